@@ -4,6 +4,16 @@
 #include "pn_core/config/identity.h"
 #include "libp2p/utils/vector.h"
 
+/***
+ * How many keys may be thrown away for an invalid peer id before giving up
+ */
+#define CORE_CONFIG_IDENTITY_TRIES 5
+
+/***
+ * The most threads that race to build an identity
+ */
+#define CORE_CONFIG_IDENTITY_MAX_WORKERS 64
+
 struct PNConfig
 {
     unsigned char *b64privkey;
@@ -15,7 +25,7 @@ struct PNConfig
 
 int core_config_is_valid_identity(struct PNIdentity *identity);
 
-int core_config_init(struct PNConfig **config, unsigned int num_bits_for_keypair, int swarm_port);
+int core_config_init(struct PNConfig **config, unsigned int num_bits_for_keypair, int swarm_port, const char *identity_path);
 
 int core_config_new(struct PNConfig **config);
 
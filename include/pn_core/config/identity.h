@@ -3,6 +3,16 @@
 
 #include "libp2p/crypto/rsa.h"
 
+/***
+ * The binary identity file: the magic, a version byte, the big endian 32 bit
+ * lengths of the private key DER, the public key DER and the peer id, then
+ * the three of them
+ */
+#define CORE_CONFIG_IDENTITY_MAGIC "PNID"
+#define CORE_CONFIG_IDENTITY_VERSION 1
+#define CORE_CONFIG_IDENTITY_HEADER_SIZE 17
+#define CORE_CONFIG_IDENTITY_FILE_MAX 8192
+
 struct PNIdentity
 {
     char *peer_id; // a pretty-printed hash of the public key
@@ -11,8 +21,14 @@ struct PNIdentity
 
 int core_config_identity_init(struct PNIdentity *identity, unsigned long num_bits_for_keypair);
 
+int core_config_identity_init_until(struct PNIdentity *identity, unsigned long num_bits_for_keypair, volatile int *stop);
+
 int core_config_identity_build_private_key(struct PNIdentity *identity, const char *base64);
 
+int core_config_identity_load(struct PNIdentity *identity, const char *path);
+
+int core_config_identity_save(struct PNIdentity *identity, const char *path);
+
 int core_config_identity_new(struct PNIdentity **identity);
 
 int core_config_identity_free(struct PNIdentity *identity);
@@ -8,7 +8,7 @@ struct PNCore
     struct PNRouting *routing;
 };
 
-int core_init(struct PNCore **core, unsigned int num_bits_for_keypair);
+int core_init(struct PNCore **core, unsigned int num_bits_for_keypair, const char *identity_path);
 
 int core_new(struct PNCore **core);
 
@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pn_core/config/config.h"
 #include "pn_core/config/identity.h"
@@ -21,39 +25,151 @@ int core_config_is_valid_identity(struct PNIdentity *identity)
 }
 
 /***
- * create a configuration based on the passed in parameters
- * @param config the configuration struct to be filled in
+ * The state shared by the threads racing to build an identity
+ */
+struct PNIdentityRace
+{
+    pthread_mutex_t lock;
+    unsigned long num_bits_for_keypair;
+    // set once an identity is found, which makes the other threads give up
+    volatile int done;
+    // keys thrown away for an invalid peer id, the race is lost at CORE_CONFIG_IDENTITY_TRIES
+    int discarded;
+    struct PNIdentity *winner;
+};
+
+/***
+ * Build identities until one is valid, or another thread finds one first
+ * @param arg the race
+ */
+static void *core_config_identity_race(void *arg)
+{
+    struct PNIdentityRace *race = (struct PNIdentityRace*)arg;
+
+    while(!race->done)
+    {
+        struct PNIdentity *identity = NULL;
+        if(!core_config_identity_new(&identity))
+            break;
+
+        int built = core_config_identity_init_until(identity, race->num_bits_for_keypair, &race->done);
+        int valid = built && core_config_is_valid_identity(identity);
+
+        pthread_mutex_lock(&race->lock);
+        if(valid && race->winner == NULL)
+        {
+            race->winner = identity;
+            identity = NULL;
+            race->done = 1;
+        }
+        else if(built && !valid && ++race->discarded >= CORE_CONFIG_IDENTITY_TRIES)
+            race->done = 1;
+        pthread_mutex_unlock(&race->lock);
+
+        core_config_identity_free(identity);
+
+        // a key that failed without being stopped will fail again
+        if(!built)
+            break;
+    }
+
+    return NULL;
+}
+
+/***
+ * Build a valid identity on as many threads as there are cores, keeping
+ * the first one found and stopping the others part way through their keys
  * @param num_bits_for_keypair number of bits for the key pair
- * @returns true(1) on success, otherwise 0
+ * @returns the identity, or NULL if none was valid
  */
-int core_config_init(struct PNConfig **config, unsigned int num_bits_for_keypair, int swarm_port)
+static struct PNIdentity *core_config_identity_generate(unsigned long num_bits_for_keypair)
 {
-    if(!core_config_identity_new(&((*config)->identity)))
+    struct PNIdentityRace race;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(workers < 1)
+        workers = 1;
+
+    if(workers > CORE_CONFIG_IDENTITY_MAX_WORKERS)
+        workers = CORE_CONFIG_IDENTITY_MAX_WORKERS;
+
+    memset(&race, 0, sizeof(struct PNIdentityRace));
+    pthread_mutex_init(&race.lock, NULL);
+    race.num_bits_for_keypair = num_bits_for_keypair;
+
+    pthread_t threads[CORE_CONFIG_IDENTITY_MAX_WORKERS];
+    long started = 0;
+
+    for(; started < workers; started++)
     {
-        printf("Failed at Core_config_identity_new\r\n");
-        return 0;
+        if(pthread_create(&threads[started], NULL, core_config_identity_race, &race) != 0)
+            break;
     }
 
-    int retval = 0, tries = 1;
+    // with no thread at all, race on this one
+    if(started == 0)
+        core_config_identity_race(&race);
+
+    for(long i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&race.lock);
+
+    return race.winner;
+}
 
-    do
+/***
+ * create a configuration based on the passed in parameters
+ * @param config the configuration struct to be filled in
+ * @param num_bits_for_keypair number of bits for the key pair
+ * @param swarm_port the port to listen on
+ * @param identity_path the identity file, built and saved if missing or damaged, or NULL to build a new one every time
+ * @returns true(1) on success, otherwise 0
+ */
+int core_config_init(struct PNConfig **config, unsigned int num_bits_for_keypair, int swarm_port, const char *identity_path)
+{
+    int retval = 0;
+
+    if(identity_path != NULL && access(identity_path, F_OK) == 0)
     {
-        if(!core_config_identity_init((*config)->identity, num_bits_for_keypair))
+        if(!core_config_identity_new(&((*config)->identity)))
         {
-            printf("Failed at Core_config_identity_init\r\n");
+            printf("Failed at Core_config_identity_new\r\n");
             return 0;
         }
 
-        if(!(retval = core_config_is_valid_identity((*config)->identity)))
+        const char *reason = NULL;
+        if(!core_config_identity_load((*config)->identity, identity_path))
+            reason = "cannot be read";
+        else if(!core_config_is_valid_identity((*config)->identity))
+            reason = "has an invalid peer id";
+
+        // a damaged file is set aside and replaced, rather than failing every boot
+        if(reason != NULL)
         {
+            char bad_path[strlen(identity_path) + 5];
+            sprintf(bad_path, "%s.bad", identity_path);
+            printf("The identity in %s %s, moving it to %s and building a new one\r\n", identity_path, reason, bad_path);
+            rename(identity_path, bad_path);
+
             core_config_identity_free((*config)->identity);
-            tries++;
-            continue;
+            (*config)->identity = NULL;
         }
-    } while(retval == 0 && tries != 5);
+    }
 
-    if(tries == 5 && retval == 0)
-        return 0;
+    if((*config)->identity == NULL)
+    {
+        (*config)->identity = core_config_identity_generate(num_bits_for_keypair);
+        if((*config)->identity == NULL)
+        {
+            printf("Failed at Core_config_identity_generate\r\n");
+            return 0;
+        }
+
+        // keep it, so the next boot is a single read, a node that cannot keep it still runs
+        if(identity_path != NULL && !core_config_identity_save((*config)->identity, identity_path))
+            printf("Unable to save the identity to %s, a new one will be built on the next boot\r\n", identity_path);
+    }
 
     struct PrivateKey *privkey = libp2p_crypto_private_key_new();
     if(privkey == NULL)
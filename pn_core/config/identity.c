@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "pn_core/config/identity.h"
 #include "pn_logger/logger.h"
@@ -10,6 +15,24 @@
 #include "libp2p/crypto/encoding/x509.h"
 #include "libp2p/crypto/peerutils.h"
 
+/***
+ * Parse the private key once for all the signatures the node makes with it
+ * @param identity the identity, with its private key
+ * @returns true(1) on success, false(0) otherwise
+ */
+static int core_config_identity_start_signer(struct PNIdentity *identity)
+{
+    libp2p_crypto_rsa_signer_free(identity->private_key.signer);
+    identity->private_key.signer = libp2p_crypto_rsa_signer_new(&identity->private_key);
+    if(identity->private_key.signer == NULL)
+    {
+        logger_msg(ERROR, "RSA Signer Init: failed");
+        return 0;
+    }
+
+    return 1;
+}
+
 int core_config_identity_generate_peerid(struct PNIdentity *identity)
 {
     struct PublicKey public_key;
@@ -24,6 +47,27 @@ int core_config_identity_generate_peerid(struct PNIdentity *identity)
     return 1;
 }
 
+/***
+ * Free the keys of an identity, leaving it empty
+ * @param identity the identity
+ */
+static void core_config_identity_clear(struct PNIdentity *identity)
+{
+    if(identity->private_key.der != NULL)
+        free(identity->private_key.der);
+
+    if(identity->private_key.public_key_der != NULL)
+        free(identity->private_key.public_key_der);
+
+    libp2p_crypto_rsa_signer_free(identity->private_key.signer);
+
+    if(identity->peer_id != NULL)
+        free(identity->peer_id);
+
+    memset(&identity->private_key, 0, sizeof(struct RsaPrivateKey));
+    identity->peer_id = NULL;
+}
+
 /* Public methods */
 /***
  * Initializes a new Identity. NOTE: This builds a new private/public keypair
@@ -32,77 +76,80 @@ int core_config_identity_generate_peerid(struct PNIdentity *identity)
  * @returns true(1) on success, false(0) otherwise
  */
 int core_config_identity_init(struct PNIdentity *identity, unsigned long num_bits_for_keypair)
+{
+    return core_config_identity_init_until(identity, num_bits_for_keypair, NULL);
+}
+
+/***
+ * Initializes a new Identity, unless asked to stop before the keypair is built
+ * @param identity the identity to fill
+ * @param num_bits_for_keypair the number of bits for the keypair
+ * @param stop keypair generation gives up once this is non-zero, may be NULL
+ * @returns true(1) on success, false(0) otherwise
+ */
+int core_config_identity_init_until(struct PNIdentity *identity, unsigned long num_bits_for_keypair, volatile int *stop)
 {
     if(num_bits_for_keypair < 1024)
         return 0;
 
-    // Generate the private and public keys
-    if(!libp2p_crypto_rsa_generate_keypair(&(identity->private_key), num_bits_for_keypair))
-    {
-        libp2p_crypto_rsa_rsa_private_key_free(&identity->private_key);
+    // Generate the private and public keys, the key is freed on failure
+    struct RsaPrivateKey *private_key = libp2p_crypto_rsa_rsa_private_key_new();
+    if(private_key == NULL)
         return 0;
-    }
+
+    if(!libp2p_crypto_rsa_generate_keypair_until(private_key, num_bits_for_keypair, stop))
+        return 0;
+
+    identity->private_key = *private_key;
+    free(private_key);
 
     if(!core_config_identity_generate_peerid(identity))
     {
-        libp2p_crypto_rsa_rsa_private_key_free(&(identity->private_key));
+        core_config_identity_clear(identity);
         return 0;
     }
 
-    return 1;
+    return core_config_identity_start_signer(identity);
 }
 
 /***
  * Build a RsaPrivateKey struct from a base64 string of the private key
  * @param identity where to put the new struct
- * @param base64 the null terminated base 64 encoded private key in DER format
+ * @param base64 the null terminated base 64 encoded private key protobuf
  * @returns true(1) on success
  */
 int core_config_identity_build_private_key(struct PNIdentity *identity, const char *base64)
 {
     int retval;
 
-    struct PrivateKey *priv_key;
+    // Decode the base64 into the protobuf
+    size_t protobuf_size = libp2p_crypto_encoding_base64_decode_size(strlen(base64));
+    unsigned char protobuf[protobuf_size];
 
-    priv_key = libp2p_crypto_private_key_new();
-    if(priv_key == NULL)
+    retval = libp2p_crypto_encoding_base64_decode((const unsigned char*)base64, strlen(base64),
+        protobuf, protobuf_size, &protobuf_size);
+    if(retval == 0)
     {
-        logger_msg(ERROR, "Crypto PrivKey Init: failed");
+        logger_msg(ERROR, "Crypto Base64 Decoding: failed");
         return 0;
     }
 
-    priv_key->data_size = identity->private_key.der_length;
-    priv_key->data = (unsigned char*)malloc(priv_key->data_size);
-    if(priv_key->data == NULL)
+    // Then the protobuf into the DER
+    struct PrivateKey *priv_key = NULL;
+
+    if(!libp2p_crypto_private_key_protobuf_decode(protobuf, protobuf_size, &priv_key))
     {
-        logger_msg(ERROR, "Crypto PrivKey Data: failed");
-        libp2p_crypto_private_key_free(priv_key);
+        logger_msg(ERROR, "Crypto PrivKey Decoding: failed");
         return 0;
     }
 
-    memcpy(priv_key->data, identity->private_key.der, priv_key->data_size);
-    priv_key->type = KEYTYPE_RSA;
-
-    size_t protobuf_size = libp2p_crypto_private_key_protobuf_encode_size(priv_key);
-    unsigned char protobuf[protobuf_size];
-
-    libp2p_crypto_private_key_protobuf_encode(priv_key, protobuf,
-        protobuf_size, &protobuf_size);
-
-    // Then base64 it
-    size_t encoded_size = libp2p_crypto_encoding_base64_encode_size(protobuf_size);
-    unsigned char encoded_buffer[encoded_size + 1];
-
-    retval = libp2p_crypto_encoding_base64_encode(protobuf, protobuf_size,
-        encoded_buffer, encoded_size, &encoded_size);
-    if(retval == 0)
+    if(priv_key->type != KEYTYPE_RSA)
     {
-        logger_msg(ERROR, "Crypto Base64 Encoding: failed");
+        logger_msg(ERROR, "Crypto PrivKey Type: not RSA");
+        libp2p_crypto_private_key_free(priv_key);
         return 0;
     }
 
-    encoded_buffer[encoded_size] = 0;
-
     // Now convert DER to RsaPrivateKey
     retval = libp2p_crypto_encoding_x509_der_to_private_key(priv_key->data,
         priv_key->data_size, &identity->private_key);
@@ -123,10 +170,163 @@ int core_config_identity_build_private_key(struct PNIdentity *identity, const ch
 
     // Now build PeerID
     retval = core_config_identity_generate_peerid(identity);
+    if(retval == 0)
+        return 0;
+
+    return core_config_identity_start_signer(identity);
+}
+
+/***
+ * Take a big endian 32 bit length off the front of a buffer
+ */
+static uint32_t core_config_identity_read_length(const unsigned char *buffer)
+{
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static void core_config_identity_write_length(unsigned char *buffer, uint32_t length)
+{
+    buffer[0] = length >> 24;
+    buffer[1] = length >> 16;
+    buffer[2] = length >> 8;
+    buffer[3] = length;
+}
+
+/***
+ * Fill an identity from the binary form written by core_config_identity_save.
+ * Nothing is derived: the DERs and the peer id are taken as stored.
+ * @param identity the identity to fill
+ * @param buffer the file
+ * @param buffer_size the size of the file
+ * @returns true(1) on success, false(0) otherwise
+ */
+static int core_config_identity_load_binary(struct PNIdentity *identity, const unsigned char *buffer, size_t buffer_size)
+{
+    if(buffer_size < CORE_CONFIG_IDENTITY_HEADER_SIZE || buffer[4] != CORE_CONFIG_IDENTITY_VERSION)
+    {
+        logger_msg(ERROR, "Identity File: unknown version");
+        return 0;
+    }
+
+    size_t der_length = core_config_identity_read_length(&buffer[5]);
+    size_t public_key_length = core_config_identity_read_length(&buffer[9]);
+    size_t peer_id_length = core_config_identity_read_length(&buffer[13]);
+
+    if(der_length == 0 || public_key_length == 0 || peer_id_length == 0
+        || der_length + public_key_length + peer_id_length != buffer_size - CORE_CONFIG_IDENTITY_HEADER_SIZE)
+    {
+        logger_msg(ERROR, "Identity File: truncated");
+        return 0;
+    }
+
+    const unsigned char *pos = &buffer[CORE_CONFIG_IDENTITY_HEADER_SIZE];
+
+    identity->private_key.der = (char*)malloc(der_length);
+    identity->private_key.public_key_der = (char*)malloc(public_key_length);
+    identity->peer_id = (char*)malloc(peer_id_length + 1);
+    if(identity->private_key.der == NULL || identity->private_key.public_key_der == NULL || identity->peer_id == NULL)
+        return 0;
+
+    memcpy(identity->private_key.der, pos, der_length);
+    identity->private_key.der_length = der_length;
+    pos += der_length;
+    memcpy(identity->private_key.public_key_der, pos, public_key_length);
+    identity->private_key.public_key_length = public_key_length;
+    pos += public_key_length;
+    memcpy(identity->peer_id, pos, peer_id_length);
+    identity->peer_id[peer_id_length] = 0;
+
+    return core_config_identity_start_signer(identity);
+}
+
+/***
+ * Load an identity from a file. The file is either the binary form written
+ * by core_config_identity_save, or the base64 private key printed at startup.
+ * @param identity the identity to fill
+ * @param path the file
+ * @returns true(1) on success, false(0) otherwise
+ */
+int core_config_identity_load(struct PNIdentity *identity, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return 0;
+
+    unsigned char buffer[CORE_CONFIG_IDENTITY_FILE_MAX];
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+
+    int retval;
+
+    if(length >= 4 && memcmp(buffer, CORE_CONFIG_IDENTITY_MAGIC, 4) == 0)
+        retval = core_config_identity_load_binary(identity, buffer, length);
+    else
+    {
+        // the key ends at the first whitespace, a trailing newline included
+        buffer[length] = 0;
+        buffer[strcspn((char*)buffer, " \t\r\n")] = 0;
+        retval = buffer[0] != 0 && core_config_identity_build_private_key(identity, (char*)buffer);
+    }
+
+    if(!retval)
+        core_config_identity_clear(identity);
 
     return retval;
 }
 
+/***
+ * Store an identity in its binary form, so that later boots read it back
+ * with core_config_identity_load. The file is replaced in one step, and
+ * only the owner may read it.
+ * @param identity the identity
+ * @param path the file
+ * @returns true(1) on success, false(0) otherwise
+ */
+int core_config_identity_save(struct PNIdentity *identity, const char *path)
+{
+    size_t der_length = identity->private_key.der_length;
+    size_t public_key_length = identity->private_key.public_key_length;
+    size_t peer_id_length = identity->peer_id == NULL ? 0 : strlen(identity->peer_id);
+    size_t buffer_size = CORE_CONFIG_IDENTITY_HEADER_SIZE + der_length + public_key_length + peer_id_length;
+
+    if(der_length == 0 || public_key_length == 0 || peer_id_length == 0 || buffer_size >= CORE_CONFIG_IDENTITY_FILE_MAX)
+        return 0;
+
+    unsigned char buffer[buffer_size];
+    unsigned char *pos = &buffer[CORE_CONFIG_IDENTITY_HEADER_SIZE];
+
+    memcpy(buffer, CORE_CONFIG_IDENTITY_MAGIC, 4);
+    buffer[4] = CORE_CONFIG_IDENTITY_VERSION;
+    core_config_identity_write_length(&buffer[5], der_length);
+    core_config_identity_write_length(&buffer[9], public_key_length);
+    core_config_identity_write_length(&buffer[13], peer_id_length);
+    memcpy(pos, identity->private_key.der, der_length);
+    pos += der_length;
+    memcpy(pos, identity->private_key.public_key_der, public_key_length);
+    pos += public_key_length;
+    memcpy(pos, identity->peer_id, peer_id_length);
+
+    char temp_path[strlen(path) + 5];
+    sprintf(temp_path, "%s.tmp", path);
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0)
+    {
+        logger_msg(ERROR, "Identity File: unable to create");
+        return 0;
+    }
+
+    int written = write(fd, buffer, buffer_size) == (ssize_t)buffer_size;
+    if(close(fd) != 0 || !written || rename(temp_path, path) != 0)
+    {
+        logger_msg(ERROR, "Identity File: unable to write");
+        unlink(temp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
 int core_config_identity_new(struct PNIdentity **identity)
 {
     *identity = (struct PNIdentity*)malloc(sizeof(struct PNIdentity));
@@ -138,6 +338,7 @@ int core_config_identity_new(struct PNIdentity **identity)
     (*identity)->peer_id = NULL;
     (*identity)->private_key.der = NULL;
     (*identity)->private_key.public_key_der = NULL;
+    (*identity)->private_key.signer = NULL;
 
     return 1;
 }
@@ -152,6 +353,8 @@ int core_config_identity_free(struct PNIdentity *identity)
         if(identity->private_key.der != NULL)
             free(identity->private_key.der);
 
+        libp2p_crypto_rsa_signer_free(identity->private_key.signer);
+
         if(identity->peer_id != NULL)
             free(identity->peer_id);
 
@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "pn_core/core.h"
 #include "pn_core/node.h"
@@ -8,7 +11,7 @@
 #include "pn_routing/routing.h"
 #include "pn_logger/logger.h"
 
-int core_init(struct PNCore **core, unsigned int num_bits_for_keypair)
+int core_init(struct PNCore **core, unsigned int num_bits_for_keypair, const char *identity_path)
 {
     if(!logger_init())
     {
@@ -22,8 +25,12 @@ int core_init(struct PNCore **core, unsigned int num_bits_for_keypair)
         return 0;
     }
 
-    printf("Generating %d-bit RSA Keypair: ", num_bits_for_keypair);
-    if(!core_config_init(&((*core)->config), num_bits_for_keypair, 4011))
+    if(identity_path != NULL && access(identity_path, F_OK) == 0)
+        printf("Loading identity from %s: ", identity_path);
+    else
+        printf("Generating %d-bit RSA Keypair: ", num_bits_for_keypair);
+
+    if(!core_config_init(&((*core)->config), num_bits_for_keypair, 4011, identity_path))
     {
         fprintf(stderr, "Unable to init config...\r\n");
         return 0;
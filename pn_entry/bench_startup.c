@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pn_core/config/config.h"
+#include "pn_core/config/identity.h"
+
+/***
+ * Compares the ways a node gets its identity at startup: building a new
+ * one, reading back the base64 private key, and reading back the binary
+ * identity file
+ */
+
+#define BENCH_KEY_BITS 2048
+#define BENCH_GENERATIONS 10
+#define BENCH_RELOADS 200
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *label, int count, double elapsed)
+{
+    printf("  %-40s %9.3f ms each (%d in %.3f s)\r\n", label, elapsed * 1000 / count, count, elapsed);
+}
+
+/***
+ * Build a new identity each time, on one thread and then racing on all cores
+ * @param config where to keep the last one, for the reloads
+ * @returns true(1) on success
+ */
+static int bench_generate(struct PNConfig **config)
+{
+    double start = bench_now();
+
+    for(int i = 0; i < BENCH_GENERATIONS; i++)
+    {
+        struct PNIdentity *identity = NULL;
+
+        if(!core_config_identity_new(&identity))
+            return 0;
+
+        int retval = core_config_identity_init(identity, BENCH_KEY_BITS);
+        core_config_identity_free(identity);
+        if(!retval)
+            return 0;
+    }
+
+    bench_report("cold generation (one thread)", BENCH_GENERATIONS, bench_now() - start);
+
+    start = bench_now();
+    for(int i = 0; i < BENCH_GENERATIONS; i++)
+    {
+        core_config_free(*config);
+        if(!core_config_new(config) || !core_config_init(config, BENCH_KEY_BITS, 0, NULL))
+            return 0;
+    }
+
+    bench_report("cold generation (racing)", BENCH_GENERATIONS, bench_now() - start);
+
+    return 1;
+}
+
+/***
+ * Load an identity file over and over
+ * @param label what to report it as
+ * @param path the file
+ * @param peer_id the peer id it should give
+ * @returns true(1) on success
+ */
+static int bench_reload(const char *label, const char *path, const char *peer_id)
+{
+    double start = bench_now();
+
+    for(int i = 0; i < BENCH_RELOADS; i++)
+    {
+        struct PNIdentity *identity = NULL;
+
+        if(!core_config_identity_new(&identity))
+            return 0;
+
+        int retval = core_config_identity_load(identity, path) && strcmp(identity->peer_id, peer_id) == 0;
+        core_config_identity_free(identity);
+        if(!retval)
+            return 0;
+    }
+
+    bench_report(label, BENCH_RELOADS, bench_now() - start);
+
+    return 1;
+}
+
+int main(void)
+{
+    int retval = 1;
+
+    struct PNConfig *config = NULL;
+    char base64_path[] = "/tmp/peerbot_bench_base64_XXXXXX";
+    char binary_path[] = "/tmp/peerbot_bench_binary_XXXXXX";
+    int base64_fd = mkstemp(base64_path);
+    int binary_fd = mkstemp(binary_path);
+
+    if(base64_fd < 0 || binary_fd < 0)
+        goto exit;
+
+    if(!core_config_new(&config) || !bench_generate(&config))
+        goto exit;
+
+    // the base64 private key, as printed at startup
+    size_t base64_length = strlen((char*)config->b64privkey);
+    if(write(base64_fd, config->b64privkey, base64_length) != (ssize_t)base64_length)
+        goto exit;
+
+    if(!core_config_identity_save(config->identity, binary_path))
+        goto exit;
+
+    if(!bench_reload("base64 reload", base64_path, config->identity->peer_id)
+        || !bench_reload("binary reload", binary_path, config->identity->peer_id))
+        goto exit;
+
+    retval = 0;
+
+exit:
+    if(retval != 0)
+        fprintf(stderr, "Startup benchmark failed\r\n");
+
+    if(base64_fd >= 0)
+    {
+        close(base64_fd);
+        unlink(base64_path);
+    }
+
+    if(binary_fd >= 0)
+    {
+        close(binary_fd);
+        unlink(binary_path);
+    }
+
+    core_config_free(config);
+
+    return retval;
+}
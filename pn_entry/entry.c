@@ -1,17 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "pn_core/core.h"
 #include "pn_core/config/config.h"
 #include "pn_core/config/identity.h"
 #include "pn_logger/logger.h"
 
-int main(void)
+/***
+ * Where the identity is kept, under the home directory
+ */
+#define ENTRY_IDENTITY_DIR ".peerbot"
+#define ENTRY_IDENTITY_FILE "identity"
+
+/***
+ * Seconds on the monotonic clock, to time the startup with
+ */
+static double entry_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***
+ * The identity file kept under the home directory, made the first time
+ * @param buffer where to put the path
+ * @param buffer_size the size of buffer
+ * @returns the path, or NULL if there is no home directory to keep it in, or it cannot be made
+ */
+static const char *entry_identity_path(char *buffer, size_t buffer_size)
+{
+    const char *home = getenv("HOME");
+
+    if(home == NULL || home[0] == 0)
+        return NULL;
+
+    if(snprintf(buffer, buffer_size, "%s/%s", home, ENTRY_IDENTITY_DIR) >= (int)buffer_size)
+        return NULL;
+
+    if(mkdir(buffer, 0700) != 0 && errno != EEXIST)
+    {
+        printf("Unable to create %s, the identity will not be kept\r\n", buffer);
+        return NULL;
+    }
+
+    if(snprintf(buffer, buffer_size, "%s/%s/%s", home, ENTRY_IDENTITY_DIR, ENTRY_IDENTITY_FILE) >= (int)buffer_size)
+        return NULL;
+
+    return buffer;
+}
+
+/***
+ * usage: peerbot [identity file]
+ * the identity file is built on the first run and read back on the next ones,
+ * it may also hold the base64 private key printed by an earlier run
+ */
+int main(int argc, char **argv)
 {
     int retval = 1;
 
     struct PNCore *core = NULL;
+    char identity_buffer[4096];
+    const char *identity_path = argc > 1 ? argv[1] : entry_identity_path(identity_buffer, sizeof(identity_buffer));
+    double started = entry_now();
 
     printf("Starting...\r\n");
 
@@ -21,12 +81,14 @@ int main(void)
         goto exit;
     }
 
-    if(!core_init(&core, 2048))
+    if(!core_init(&core, 2048, identity_path))
     {
         printf("Failed at Core_init\r\n");
         goto exit;
     }
 
+    printf("Started in %.3f seconds\r\n", entry_now() - started);
+
     printf("[PeerID]\r\n%s\r\n[Base64'd Privkey]\r\n%s\r\n",
         core->config->identity->peer_id, core->config->b64privkey);
 
@@ -87,13 +87,10 @@ struct Stream* libp2p_conn_dialer_get_stream(const struct Dialer* dialer, const
 	// this is a shortcut for now. Other protocols will soon be implemented
 	if (strcmp(protocol, "multistream") != 0)
 		return NULL;
-	char* ip;
-	int port = multiaddress_get_ip_port(multiaddress);
-	if (!multiaddress_get_ip_address(multiaddress, &ip)) {
-		free(ip);
+	char* ip = NULL;
+	if (!multiaddress_get_ip_address(multiaddress, &ip))
 		return NULL;
-	}
-	struct Stream* stream = libp2p_net_multistream_connect(ip, port);
+	struct Stream* stream = libp2p_net_multistream_connect(ip, multiaddress_get_ip_port(multiaddress));
 	free(ip);
 	return stream;
 }
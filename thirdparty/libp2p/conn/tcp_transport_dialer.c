@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
@@ -30,16 +31,25 @@ int libp2p_conn_tcp_write(const struct Connection* connection, const char* in, s
 }
 
 struct Connection* libp2p_conn_tcp_dial(const struct TransportDialer* transport_dialer, const struct MultiAddress* addr) {
+	// the address was decoded when the multiaddress was made, so there is nothing to look up
+	socklen_t sockaddr_size = 0;
+	const struct sockaddr* sockaddr = multiaddress_get_sockaddr(addr, &sockaddr_size);
+	if (sockaddr == NULL || sockaddr->sa_family != AF_INET)
+		return NULL;
 	struct Connection* conn = (struct Connection*) malloc(sizeof(struct Connection));
+	if (conn == NULL)
+		return NULL;
 	conn->socket_handle = socket_open4();
-	char* ip;
-	int port = multiaddress_get_ip_port(addr);
-	if (!multiaddress_get_ip_address(addr, &ip))
+	if (conn->socket_handle < 0) {
+		free(conn);
+		return NULL;
+	}
+	const struct sockaddr_in* in4 = (const struct sockaddr_in*)sockaddr;
+	if (socket_connect4(conn->socket_handle, in4->sin_addr.s_addr, ntohs(in4->sin_port)) != 0) {
+		close(conn->socket_handle);
+		free(conn);
 		return NULL;
-	struct hostent* host = gethostbyname(ip);
-	free(ip);
-	struct in_addr** addr_list = (struct in_addr**)host->h_addr_list;
-	socket_connect4(conn->socket_handle, (*addr_list[0]).s_addr, port);
+	}
 	conn->read = libp2p_conn_tcp_read;
 	conn->write = libp2p_conn_tcp_write;
 	return conn;
@@ -1,11 +1,30 @@
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "mbedtls/config.h"
 #include "mbedtls/ecdh.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
 #include "libp2p/crypto/ephemeral.h"
+#include "libp2p/crypto/random.h"
+
+/***
+ * The curves ephemeral keys are made on. Each group is loaded once, and
+ * its table of multiples of the generator (the fixed base comb) is worked
+ * out then and kept, rather than again for every key.
+ */
+struct EphemeralCurve {
+	const char* name;
+	mbedtls_ecp_group_id id;
+	mbedtls_ecp_group group;
+	int loaded;
+};
+
+static struct EphemeralCurve ephemeral_curves[] = {
+		{ "P-256", MBEDTLS_ECP_DP_SECP256R1 },
+		{ "P-384", MBEDTLS_ECP_DP_SECP384R1 },
+		{ "P-521", MBEDTLS_ECP_DP_SECP521R1 }
+};
+static pthread_mutex_t ephemeral_curves_lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct StretchedKey* libp2p_crypto_ephemeral_stretched_key_new() {
 	struct StretchedKey* key = (struct StretchedKey*)malloc(sizeof(struct StretchedKey));
@@ -133,6 +152,38 @@ int libp2p_crypto_ephemeral_point_unmarshal(int bit_size, unsigned char* buffer,
 	return 1;
 }
 
+/***
+ * Find a curve by name, loading its group the first time
+ * @param name the curve (P-256, P-384, or P-521). Anything else is P-521
+ * @returns the curve, or NULL on error
+ */
+static struct EphemeralCurve* libp2p_crypto_ephemeral_curve(const char* name) {
+	struct EphemeralCurve* curve = &ephemeral_curves[2];
+	for(int i = 0; i < 2; i++) {
+		if (strcmp(name, ephemeral_curves[i].name) == 0)
+			curve = &ephemeral_curves[i];
+	}
+
+	pthread_mutex_lock(&ephemeral_curves_lock);
+	if (!curve->loaded) {
+		mbedtls_ecp_point q;
+		mbedtls_mpi d;
+		mbedtls_ecp_point_init(&q);
+		mbedtls_mpi_init(&d);
+		mbedtls_ecp_group_init(&curve->group);
+		// the first multiplication by the generator fills in the comb table of the group
+		if (mbedtls_ecp_group_load(&curve->group, curve->id) == 0
+				&& mbedtls_ecp_gen_keypair(&curve->group, &d, &q, libp2p_crypto_random_f_rng, NULL) == 0)
+			curve->loaded = 1;
+		else
+			mbedtls_ecp_group_free(&curve->group);
+		mbedtls_ecp_point_free(&q);
+		mbedtls_mpi_free(&d);
+	}
+	pthread_mutex_unlock(&ephemeral_curves_lock);
+	return curve->loaded ? curve : NULL;
+}
+
 /**
  * Generate a Ephemeral keypair
  * @param curve the curve to use (P-256, P-384, or P-521)
@@ -140,52 +191,38 @@ int libp2p_crypto_ephemeral_point_unmarshal(int bit_size, unsigned char* buffer,
  * @returns true(1) on success, otherwise false(0)
  */
 int libp2p_crypto_ephemeral_keypair_generate(char* curve, struct EphemeralPrivateKey** private_key_ptr) {
-	int retVal = 0;
-	//mbedtls_ecdh_context ctx;
-	mbedtls_entropy_context entropy;
-	mbedtls_ctr_drbg_context ctr_drbg;
 	struct EphemeralPrivateKey* private_key = NULL;
 	struct EphemeralPublicKey* public_key = NULL;
-	int selected_curve = 0;
-	char* pers = "bitShares"; // data for seeding random number generator
-
-	if (strcmp(curve, "P-256") == 0)
-		selected_curve = MBEDTLS_ECP_DP_SECP256R1;
-	else if (strcmp(curve, "P-384") == 0)
-		selected_curve = MBEDTLS_ECP_DP_SECP384R1;
-	else
-		selected_curve = MBEDTLS_ECP_DP_SECP521R1;
+	struct EphemeralCurve* selected_curve = libp2p_crypto_ephemeral_curve(curve);
 
 	// allocate memory for result storage
 	*private_key_ptr = libp2p_crypto_ephemeral_key_new();
 	private_key = *private_key_ptr;
+	if (private_key == NULL)
+		return 0;
 	public_key = private_key->public_key;
 
 	mbedtls_ecdh_init(&private_key->ctx);
+	if (selected_curve == NULL)
+		return 0;
 
-	// seed random number generator
-	mbedtls_entropy_init(&entropy);
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-	if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)pers, strlen(pers)) != 0)
-		goto exit;
-
-	// Prepare to generate the public key
-	if (mbedtls_ecp_group_load(&private_key->ctx.grp, selected_curve) != 0)
-		goto exit;
+	// Prepare to generate the public key. Loading a known group only points at constants,
+	// the costly part is the comb table, and the multiplication uses the one kept with the curve
+	if (mbedtls_ecp_group_load(&private_key->ctx.grp, selected_curve->id) != 0)
+		return 0;
+	if (mbedtls_ecp_gen_keypair(&selected_curve->group, &private_key->ctx.d, &private_key->ctx.Q, libp2p_crypto_random_f_rng, NULL) != 0)
+		return 0;
 
-	// create and marshal public key
-	public_key->bytes_size = 66;
+	// marshal public key, a length byte then the uncompressed point
+	public_key->bytes_size = 2 * ((private_key->ctx.grp.pbits + 7) / 8) + 2;
 	public_key->bytes = (unsigned char*)malloc(public_key->bytes_size);
-	if (mbedtls_ecdh_make_public(&private_key->ctx, &public_key->bytes_size, (char*)public_key->bytes, public_key->bytes_size, mbedtls_ctr_drbg_random, &ctr_drbg) != 0)
-		goto exit;
-
-	// ship all this stuff back to the caller
-	retVal = 1;
-	exit:
-	mbedtls_ctr_drbg_free(&ctr_drbg);
-	mbedtls_entropy_free(&entropy);
+	if (public_key->bytes == NULL)
+		return 0;
+	if (mbedtls_ecp_tls_write_point(&private_key->ctx.grp, &private_key->ctx.Q, private_key->ctx.point_format,
+			&public_key->bytes_size, public_key->bytes, public_key->bytes_size) != 0)
+		return 0;
 
-	return retVal;
+	return 1;
 }
 
 /**
@@ -208,15 +245,6 @@ int libp2p_crypto_ephemeral_keypair_to_public_bytes(struct EphemeralPublicKey* p
  */
 int libp2p_crypto_ephemeral_generate_shared_secret(struct EphemeralPrivateKey* private_key, const unsigned char* remote_public_key, size_t remote_public_key_size) {
 	int retVal = 0;
-	mbedtls_entropy_context entropy;
-	mbedtls_ctr_drbg_context ctr_drbg;
-	char* pers = "bitShares"; // data for seeding random number generator
-
-	// seed random number generator
-	mbedtls_entropy_init(&entropy);
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-	if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)pers, strlen(pers)) != 0)
-		goto exit;
 
 	// read the remote key
 	if (mbedtls_ecdh_read_public(&private_key->ctx, remote_public_key, remote_public_key_size) < 0)
@@ -229,7 +257,7 @@ int libp2p_crypto_ephemeral_generate_shared_secret(struct EphemeralPrivateKey* p
 	private_key->public_key->shared_key = malloc(private_key->public_key->shared_key_size);
 	if (mbedtls_ecdh_calc_secret(&private_key->ctx,
 			&private_key->public_key->shared_key_size, private_key->public_key->shared_key, private_key->public_key->shared_key_size,
-			mbedtls_ctr_drbg_random, &ctr_drbg) != 0)
+			libp2p_crypto_random_f_rng, NULL) != 0)
 		goto exit;
 
 	retVal = 1;
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libp2p/crypto/ephemeral_pool.h"
+
+/***
+ * An implementation of the ephemeral key pool
+ */
+
+struct EphemeralPool {
+	const char* curve;
+	int pooled;
+	struct EphemeralPrivateKey** keys;
+	size_t count;
+	// set while a refill is under way, and when it started
+	int refilling;
+	uint64_t refill_started_ns;
+	struct EphemeralPoolStats stats;
+};
+
+static struct EphemeralPool ephemeral_pools[] = {
+		{ "P-256" },
+		{ "P-384" },
+		{ "P-521" }
+};
+#define EPHEMERAL_POOL_CURVES (sizeof(ephemeral_pools) / sizeof(ephemeral_pools[0]))
+
+static pthread_mutex_t ephemeral_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ephemeral_pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t ephemeral_pool_thread;
+static int ephemeral_pool_running = 0;
+static size_t ephemeral_pool_size = EPHEMERAL_POOL_SIZE;
+static size_t ephemeral_pool_refill_below = EPHEMERAL_POOL_REFILL_BELOW;
+
+static uint64_t libp2p_crypto_ephemeral_pool_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct EphemeralPool* libp2p_crypto_ephemeral_pool_find(const char* curve, size_t curve_len) {
+	for(size_t i = 0; i < EPHEMERAL_POOL_CURVES; i++) {
+		if (strlen(ephemeral_pools[i].curve) == curve_len && strncmp(ephemeral_pools[i].curve, curve, curve_len) == 0)
+			return &ephemeral_pools[i];
+	}
+	return NULL;
+}
+
+/***
+ * Find a pool that needs a key, starting a refill where one is due.
+ * NOTE: the lock must be held
+ * @returns the pool, or NULL if all are full enough
+ */
+static struct EphemeralPool* libp2p_crypto_ephemeral_pool_wanting() {
+	for(size_t i = 0; i < EPHEMERAL_POOL_CURVES; i++) {
+		struct EphemeralPool* pool = &ephemeral_pools[i];
+		if (!pool->pooled)
+			continue;
+		if (!pool->refilling && pool->count < ephemeral_pool_refill_below) {
+			pool->refilling = 1;
+			pool->refill_started_ns = libp2p_crypto_ephemeral_pool_now_ns();
+		}
+		if (pool->refilling)
+			return pool;
+	}
+	return NULL;
+}
+
+/***
+ * The background thread, making keys for the pools that want them
+ */
+static void* libp2p_crypto_ephemeral_pool_run(void* arg) {
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	while (ephemeral_pool_running) {
+		struct EphemeralPool* pool = libp2p_crypto_ephemeral_pool_wanting();
+		if (pool == NULL) {
+			pthread_cond_wait(&ephemeral_pool_wake, &ephemeral_pool_lock);
+			continue;
+		}
+		// make the key without holding the lock
+		struct EphemeralPrivateKey* key = NULL;
+		pthread_mutex_unlock(&ephemeral_pool_lock);
+		if (!libp2p_crypto_ephemeral_keypair_generate((char*)pool->curve, &key)) {
+			libp2p_crypto_ephemeral_key_free(key);
+			key = NULL;
+		}
+		pthread_mutex_lock(&ephemeral_pool_lock);
+		if (key == NULL)
+			continue;
+		if (!ephemeral_pool_running || pool->count >= ephemeral_pool_size) {
+			libp2p_crypto_ephemeral_key_free(key);
+			continue;
+		}
+		pool->keys[pool->count++] = key;
+		if (pool->count == ephemeral_pool_size) {
+			uint64_t elapsed = libp2p_crypto_ephemeral_pool_now_ns() - pool->refill_started_ns;
+			pool->refilling = 0;
+			pool->stats.refills++;
+			pool->stats.refill_ns_total += elapsed;
+			if (elapsed > pool->stats.refill_ns_max)
+				pool->stats.refill_ns_max = elapsed;
+		}
+	}
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+	return NULL;
+}
+
+int libp2p_crypto_ephemeral_pool_start(const char* curves, size_t size, size_t refill_below) {
+	if (size == 0 || refill_below == 0 || refill_below > size)
+		return 0;
+
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	if (ephemeral_pool_running) {
+		pthread_mutex_unlock(&ephemeral_pool_lock);
+		return 0;
+	}
+	ephemeral_pool_size = size;
+	ephemeral_pool_refill_below = refill_below;
+	while (*curves != 0) {
+		const char* comma = strchr(curves, ',');
+		size_t curve_len = comma == NULL ? strlen(curves) : (size_t)(comma - curves);
+		struct EphemeralPool* pool = libp2p_crypto_ephemeral_pool_find(curves, curve_len);
+		if (pool != NULL && !pool->pooled) {
+			pool->keys = (struct EphemeralPrivateKey**)malloc(size * sizeof(struct EphemeralPrivateKey*));
+			if (pool->keys != NULL) {
+				pool->count = 0;
+				pool->refilling = 0;
+				pool->pooled = 1;
+			}
+		}
+		curves += comma == NULL ? curve_len : curve_len + 1;
+	}
+	ephemeral_pool_running = 1;
+	if (pthread_create(&ephemeral_pool_thread, NULL, libp2p_crypto_ephemeral_pool_run, NULL) != 0) {
+		ephemeral_pool_running = 0;
+		pthread_mutex_unlock(&ephemeral_pool_lock);
+		libp2p_crypto_ephemeral_pool_stop();
+		return 0;
+	}
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+	return 1;
+}
+
+void libp2p_crypto_ephemeral_pool_stop() {
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	int was_running = ephemeral_pool_running;
+	ephemeral_pool_running = 0;
+	pthread_cond_broadcast(&ephemeral_pool_wake);
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+	if (was_running)
+		pthread_join(ephemeral_pool_thread, NULL);
+
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	for(size_t i = 0; i < EPHEMERAL_POOL_CURVES; i++) {
+		struct EphemeralPool* pool = &ephemeral_pools[i];
+		for(size_t j = 0; j < pool->count; j++)
+			libp2p_crypto_ephemeral_key_free(pool->keys[j]);
+		if (pool->keys != NULL)
+			free(pool->keys);
+		pool->keys = NULL;
+		pool->count = 0;
+		pool->refilling = 0;
+		pool->pooled = 0;
+	}
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+}
+
+int libp2p_crypto_ephemeral_pool_take(char* curve, struct EphemeralPrivateKey** private_key) {
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	struct EphemeralPool* pool = libp2p_crypto_ephemeral_pool_find(curve, strlen(curve));
+	if (pool != NULL && pool->count > 0) {
+		*private_key = pool->keys[--pool->count];
+		pool->stats.hits++;
+		if (!pool->refilling && pool->count < ephemeral_pool_refill_below)
+			pthread_cond_signal(&ephemeral_pool_wake);
+		pthread_mutex_unlock(&ephemeral_pool_lock);
+		return 1;
+	}
+	if (pool != NULL && pool->pooled)
+		pool->stats.misses++;
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+
+	if (!libp2p_crypto_ephemeral_keypair_generate(curve, private_key)) {
+		libp2p_crypto_ephemeral_key_free(*private_key);
+		*private_key = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+void libp2p_crypto_ephemeral_pool_stats(const char* curve, struct EphemeralPoolStats* stats) {
+	memset(stats, 0, sizeof(struct EphemeralPoolStats));
+	pthread_mutex_lock(&ephemeral_pool_lock);
+	struct EphemeralPool* pool = libp2p_crypto_ephemeral_pool_find(curve, strlen(curve));
+	if (pool != NULL) {
+		*stats = pool->stats;
+		stats->available = pool->count;
+	}
+	pthread_mutex_unlock(&ephemeral_pool_lock);
+}
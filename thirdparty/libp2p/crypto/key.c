@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "libp2p/crypto/key.h"
+#include "libp2p/crypto/key_cache.h"
 #include "libp2p/crypto/sha256.h"
 #include "libp2p/crypto/peerutils.h"
 #include "protobuf.h"
@@ -220,27 +221,9 @@ exit:
 int libp2p_crypto_public_key_to_peer_id(struct PublicKey* public_key, char** peer_id) {
 
 	/**
-	 * Converting to a peer id involves protobufing the struct PublicKey, SHA256 it, turn it into a MultiHash and base58 it
+	 * Converting to a peer id involves protobufing the struct PublicKey, SHA256 it, turn it into a MultiHash and base58 it.
+	 * The key cache keeps the result for keys seen lately.
 	 */
-	size_t protobuf_len = libp2p_crypto_public_key_protobuf_encode_size(public_key);
-	unsigned char protobuf[protobuf_len];
-
-	libp2p_crypto_public_key_protobuf_encode(public_key, protobuf, protobuf_len, &protobuf_len);
-
-	unsigned char hashed[32];
-	//libp2p_crypto_hashing_sha256(public_key->data, public_key->data_size, hashed);
-	libp2p_crypto_hashing_sha256(protobuf, protobuf_len, hashed);
-	size_t final_id_size = 100;
-	unsigned char final_id[final_id_size];
-	memset(final_id, 0, final_id_size);
-	// turn it into a multihash and base58 it
-	if (!PrettyID(final_id, &final_id_size, hashed, 32))
-		return 0;
-	*peer_id = (char*)malloc(final_id_size + 1);
-	if (*peer_id == NULL)
-		return 0;
-	memset(*peer_id, 0, final_id_size + 1);
-	memcpy(*peer_id, final_id, final_id_size);
-	return 1;
+	return libp2p_crypto_key_cache_peer_id(public_key, peer_id);
 }
 
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libp2p/crypto/key_cache.h"
+#include "libp2p/crypto/sha256.h"
+#include "libp2p/crypto/peerutils.h"
+
+#include "mbedtls/pk.h"
+#include "mbedtls/rsa.h"
+
+/***
+ * An implementation of the public key cache
+ */
+
+#define KEY_CACHE_BUCKETS (KEY_CACHE_SIZE * 2)
+
+struct KeyCacheEntry {
+	// SHA256 of the protobuf of the key
+	unsigned char hash[32];
+	char* peer_id;
+	// the parsed key, for RSA keys that parsed
+	mbedtls_pk_context context;
+	int parsed;
+	// verifications running on the context outside of the lock, the entry is not reused until they are done
+	int users;
+	// most recently used first
+	struct KeyCacheEntry* newer;
+	struct KeyCacheEntry* older;
+	struct KeyCacheEntry* bucket_next;
+};
+
+static pthread_mutex_t key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct KeyCacheEntry key_cache_entries[KEY_CACHE_SIZE];
+static struct KeyCacheEntry* key_cache_buckets[KEY_CACHE_BUCKETS];
+static struct KeyCacheEntry* key_cache_newest = NULL;
+static struct KeyCacheEntry* key_cache_oldest = NULL;
+static size_t key_cache_used = 0;
+static struct KeyCacheStats key_cache_counters = {0};
+
+static struct KeyCacheEntry** libp2p_crypto_key_cache_bucket(const unsigned char* hash) {
+	unsigned int index = (unsigned int)hash[0] << 24 | (unsigned int)hash[1] << 16 | (unsigned int)hash[2] << 8 | hash[3];
+	return &key_cache_buckets[index % KEY_CACHE_BUCKETS];
+}
+
+static void libp2p_crypto_key_cache_unlink(struct KeyCacheEntry* entry) {
+	if (entry->newer != NULL)
+		entry->newer->older = entry->older;
+	else
+		key_cache_newest = entry->older;
+	if (entry->older != NULL)
+		entry->older->newer = entry->newer;
+	else
+		key_cache_oldest = entry->newer;
+	entry->newer = NULL;
+	entry->older = NULL;
+}
+
+static void libp2p_crypto_key_cache_push(struct KeyCacheEntry* entry) {
+	entry->newer = NULL;
+	entry->older = key_cache_newest;
+	if (key_cache_newest != NULL)
+		key_cache_newest->newer = entry;
+	key_cache_newest = entry;
+	if (key_cache_oldest == NULL)
+		key_cache_oldest = entry;
+}
+
+/***
+ * Drop what an entry holds, and take it out of its bucket
+ * @param entry the entry
+ */
+static void libp2p_crypto_key_cache_release(struct KeyCacheEntry* entry) {
+	struct KeyCacheEntry** current = libp2p_crypto_key_cache_bucket(entry->hash);
+	while (*current != NULL && *current != entry)
+		current = &(*current)->bucket_next;
+	if (*current != NULL)
+		*current = entry->bucket_next;
+	entry->bucket_next = NULL;
+	if (entry->peer_id != NULL)
+		free(entry->peer_id);
+	entry->peer_id = NULL;
+	if (entry->parsed)
+		mbedtls_pk_free(&entry->context);
+	entry->parsed = 0;
+}
+
+/***
+ * Work out now what the RSA context would otherwise work out, and keep, on
+ * its first use, so that verifying with it only ever reads it
+ * @param rsa the context of a public key
+ * @returns true(1) on success, otherwise false(0)
+ */
+static int libp2p_crypto_key_cache_prepare(mbedtls_rsa_context* rsa) {
+	unsigned char one[rsa->len];
+	memset(one, 0, rsa->len);
+	one[rsa->len - 1] = 1;
+	return mbedtls_rsa_public(rsa, one, one) == 0;
+}
+
+/***
+ * The least recently used entry that is not being verified with
+ * @returns the entry, or NULL if every entry is in use
+ */
+static struct KeyCacheEntry* libp2p_crypto_key_cache_idle() {
+	struct KeyCacheEntry* entry = key_cache_oldest;
+	while (entry != NULL && entry->users > 0)
+		entry = entry->newer;
+	return entry;
+}
+
+/***
+ * Find a public key in the cache, adding it if it is not there.
+ * NOTE: the lock must be held
+ * @param public_key the public key
+ * @returns the entry, or NULL on error
+ */
+static struct KeyCacheEntry* libp2p_crypto_key_cache_get(const struct PublicKey* public_key) {
+	size_t protobuf_len = libp2p_crypto_public_key_protobuf_encode_size(public_key);
+	unsigned char protobuf[protobuf_len];
+	unsigned char hash[32];
+	struct KeyCacheEntry* entry;
+
+	if (!libp2p_crypto_public_key_protobuf_encode(public_key, protobuf, protobuf_len, &protobuf_len))
+		return NULL;
+	libp2p_crypto_hashing_sha256(protobuf, protobuf_len, hash);
+
+	struct KeyCacheEntry** bucket = libp2p_crypto_key_cache_bucket(hash);
+	for (entry = *bucket; entry != NULL; entry = entry->bucket_next) {
+		if (memcmp(entry->hash, hash, 32) == 0) {
+			key_cache_counters.hits++;
+			libp2p_crypto_key_cache_unlink(entry);
+			libp2p_crypto_key_cache_push(entry);
+			return entry;
+		}
+	}
+	key_cache_counters.misses++;
+
+	// turn the hash into a multihash and base58 it
+	size_t peer_id_size = 100;
+	unsigned char peer_id[peer_id_size];
+	memset(peer_id, 0, peer_id_size);
+	if (!PrettyID(peer_id, &peer_id_size, hash, 32))
+		return NULL;
+
+	if (key_cache_used < KEY_CACHE_SIZE) {
+		entry = &key_cache_entries[key_cache_used++];
+	} else {
+		// only with as many threads verifying as there are entries
+		entry = libp2p_crypto_key_cache_idle();
+		if (entry == NULL)
+			return NULL;
+		libp2p_crypto_key_cache_unlink(entry);
+		libp2p_crypto_key_cache_release(entry);
+		key_cache_counters.evictions++;
+	}
+	memcpy(entry->hash, hash, 32);
+	entry->peer_id = (char*)malloc(peer_id_size + 1);
+	if (entry->peer_id != NULL) {
+		memcpy(entry->peer_id, peer_id, peer_id_size);
+		entry->peer_id[peer_id_size] = 0;
+	}
+	if (public_key->type == KEYTYPE_RSA) {
+		mbedtls_pk_init(&entry->context);
+		entry->parsed = 1;
+		if (mbedtls_pk_parse_public_key(&entry->context, public_key->data, public_key->data_size) != 0
+				|| mbedtls_pk_get_type(&entry->context) != MBEDTLS_PK_RSA
+				|| !libp2p_crypto_key_cache_prepare(mbedtls_pk_rsa(entry->context))) {
+			mbedtls_pk_free(&entry->context);
+			entry->parsed = 0;
+		}
+	}
+	entry->bucket_next = *bucket;
+	*bucket = entry;
+	libp2p_crypto_key_cache_push(entry);
+	return entry;
+}
+
+int libp2p_crypto_key_cache_peer_id(const struct PublicKey* public_key, char** peer_id) {
+	int retVal = 0;
+
+	pthread_mutex_lock(&key_cache_lock);
+	struct KeyCacheEntry* entry = libp2p_crypto_key_cache_get(public_key);
+	if (entry != NULL && entry->peer_id != NULL) {
+		*peer_id = (char*)malloc(strlen(entry->peer_id) + 1);
+		if (*peer_id != NULL) {
+			strcpy(*peer_id, entry->peer_id);
+			retVal = 1;
+		}
+	}
+	pthread_mutex_unlock(&key_cache_lock);
+	return retVal;
+}
+
+int libp2p_crypto_key_cache_verify(const struct PublicKey* public_key, const unsigned char* message, size_t message_length, const unsigned char* signature) {
+	int retVal = 0;
+	unsigned char hash[32];
+
+	// hash outside of the lock
+	libp2p_crypto_hashing_sha256(message, message_length, hash);
+
+	pthread_mutex_lock(&key_cache_lock);
+	struct KeyCacheEntry* entry = libp2p_crypto_key_cache_get(public_key);
+	if (entry != NULL && !entry->parsed)
+		entry = NULL;
+	if (entry != NULL)
+		entry->users++;
+	pthread_mutex_unlock(&key_cache_lock);
+	if (entry == NULL)
+		return 0;
+
+	// the context was prepared when it was cached, so verifying only reads it, and needs no lock
+	retVal = mbedtls_rsa_rsassa_pkcs1_v15_verify(mbedtls_pk_rsa(entry->context),
+			NULL, NULL, // no random number generator needed for a public key
+			MBEDTLS_RSA_PUBLIC,
+			MBEDTLS_MD_SHA256,
+			32, hash, signature) == 0;
+
+	pthread_mutex_lock(&key_cache_lock);
+	entry->users--;
+	pthread_mutex_unlock(&key_cache_lock);
+	return retVal;
+}
+
+void libp2p_crypto_key_cache_stats(struct KeyCacheStats* stats) {
+	pthread_mutex_lock(&key_cache_lock);
+	*stats = key_cache_counters;
+	stats->entries = key_cache_used;
+	pthread_mutex_unlock(&key_cache_lock);
+}
+
+void libp2p_crypto_key_cache_clear() {
+	pthread_mutex_lock(&key_cache_lock);
+	for (size_t i = 0; i < key_cache_used; i++) {
+		libp2p_crypto_key_cache_release(&key_cache_entries[i]);
+		key_cache_entries[i].newer = NULL;
+		key_cache_entries[i].older = NULL;
+		key_cache_entries[i].users = 0;
+	}
+	memset(key_cache_buckets, 0, sizeof(key_cache_buckets));
+	key_cache_newest = NULL;
+	key_cache_oldest = NULL;
+	key_cache_used = 0;
+	memset(&key_cache_counters, 0, sizeof(key_cache_counters));
+	pthread_mutex_unlock(&key_cache_lock);
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libp2p/crypto/random.h"
+
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+/***
+ * An implementation of the random source, a CTR_DRBG per thread
+ */
+
+static pthread_once_t random_once = PTHREAD_ONCE_INIT;
+static pthread_key_t random_key;
+static pthread_mutex_t random_entropy_lock = PTHREAD_MUTEX_INITIALIZER;
+static mbedtls_entropy_context random_entropy;
+
+/***
+ * Free the generator of a thread that is going away
+ * @param ctr_drbg the generator
+ */
+static void libp2p_crypto_random_thread_free(void* ctr_drbg) {
+	mbedtls_ctr_drbg_free((mbedtls_ctr_drbg_context*)ctr_drbg);
+	free(ctr_drbg);
+}
+
+static void libp2p_crypto_random_init() {
+	mbedtls_entropy_init(&random_entropy);
+	pthread_key_create(&random_key, libp2p_crypto_random_thread_free);
+}
+
+/***
+ * Draw from the shared entropy pool, which is not safe for threads by itself
+ */
+static int libp2p_crypto_random_entropy(void* data, unsigned char* output, size_t length) {
+	pthread_mutex_lock(&random_entropy_lock);
+	int retVal = mbedtls_entropy_func(data, output, length);
+	pthread_mutex_unlock(&random_entropy_lock);
+	return retVal;
+}
+
+/***
+ * Get the generator of this thread, making it if need be
+ * @returns the generator, or NULL on error
+ */
+static mbedtls_ctr_drbg_context* libp2p_crypto_random_get() {
+	pthread_once(&random_once, libp2p_crypto_random_init);
+	mbedtls_ctr_drbg_context* ctr_drbg = (mbedtls_ctr_drbg_context*)pthread_getspecific(random_key);
+	if (ctr_drbg != NULL)
+		return ctr_drbg;
+
+	ctr_drbg = (mbedtls_ctr_drbg_context*)malloc(sizeof(mbedtls_ctr_drbg_context));
+	if (ctr_drbg == NULL)
+		return NULL;
+	mbedtls_ctr_drbg_init(ctr_drbg);
+	// the address of the generator tells the threads apart
+	char pers[64];
+	snprintf(pers, sizeof(pers), "libp2p random %p", (void*)ctr_drbg);
+	if (mbedtls_ctr_drbg_seed(ctr_drbg, libp2p_crypto_random_entropy, &random_entropy, (const unsigned char*)pers, strlen(pers)) != 0
+			|| pthread_setspecific(random_key, ctr_drbg) != 0) {
+		mbedtls_ctr_drbg_free(ctr_drbg);
+		free(ctr_drbg);
+		return NULL;
+	}
+	mbedtls_ctr_drbg_set_reseed_interval(ctr_drbg, RANDOM_RESEED_INTERVAL);
+	return ctr_drbg;
+}
+
+int libp2p_crypto_random_f_rng(void* p_rng, unsigned char* buffer, size_t length) {
+	mbedtls_ctr_drbg_context* ctr_drbg = libp2p_crypto_random_get();
+	if (ctr_drbg == NULL)
+		return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+	// the generator hands out at most MBEDTLS_CTR_DRBG_MAX_REQUEST bytes at a time
+	while (length > 0) {
+		size_t chunk = length > MBEDTLS_CTR_DRBG_MAX_REQUEST ? MBEDTLS_CTR_DRBG_MAX_REQUEST : length;
+		int retVal = mbedtls_ctr_drbg_random(ctr_drbg, buffer, chunk);
+		if (retVal != 0)
+			return retVal;
+		buffer += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+int libp2p_crypto_random_bytes(unsigned char* buffer, size_t length) {
+	return libp2p_crypto_random_f_rng(NULL, buffer, length) == 0;
+}
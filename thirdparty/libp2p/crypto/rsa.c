@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "libp2p/crypto/key.h"
+#include "libp2p/crypto/key_cache.h"
 #include "libp2p/crypto/rsa.h"
+#include "libp2p/crypto/random.h"
 #include "libp2p/crypto/sha256.h"
 
 // mbedtls stuff
@@ -17,6 +20,20 @@
 #include "mbedtls/oid.h"
 #include "mbedtls/pk.h"
 
+/***
+ * How many signatures a signer makes before its generator reseeds
+ */
+#define RSA_SIGNER_RESEED_INTERVAL 1000
+
+struct RsaSigner {
+	// the parsed key, CRT values included
+	mbedtls_pk_context private_context;
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ctr_drbg;
+	// the blinding values of the rsa context change with each signature
+	pthread_mutex_t lock;
+};
+
 struct PrivateKey* libp2p_crypto_rsa_to_private_key(struct RsaPrivateKey* in) {
 	struct PrivateKey* out = libp2p_crypto_private_key_new();
 	if (out != NULL) {
@@ -114,6 +131,17 @@ int libp2p_crypto_rsa_write_public_key_der( mbedtls_pk_context *key, unsigned ch
     return 1;
 }
 
+/***
+ * The random source for key generation, which fails once asked to stop,
+ * so that mbedtls gives up on the key part way through
+ * @param stop set to non-zero to stop, or NULL
+ */
+static int libp2p_crypto_rsa_generate_f_rng(void* stop, unsigned char* buffer, size_t length) {
+	if (stop != NULL && *(volatile int*)stop)
+		return MBEDTLS_ERR_RSA_RNG_FAILED;
+	return libp2p_crypto_random_f_rng(NULL, buffer, length);
+}
+
 /***
  * Generate an RSA keypair of a certain size, and place the results in the struct
  * @param private_key where to put the results
@@ -121,35 +149,23 @@ int libp2p_crypto_rsa_write_public_key_der( mbedtls_pk_context *key, unsigned ch
  * @returns true(1) on success
  */
 int libp2p_crypto_rsa_generate_keypair(struct RsaPrivateKey* private_key, unsigned long num_bits_for_keypair) {
+	return libp2p_crypto_rsa_generate_keypair_until(private_key, num_bits_for_keypair, NULL);
+}
+
+int libp2p_crypto_rsa_generate_keypair_until(struct RsaPrivateKey* private_key, unsigned long num_bits_for_keypair, volatile int* stop) {
 	
 	mbedtls_rsa_context rsa;
-	mbedtls_entropy_context entropy;
-	mbedtls_ctr_drbg_context ctr_drbg;
 	
 	int exponent = 65537;
 	int retVal = 0;
 	
-	unsigned char* buffer;
+	unsigned char* buffer = NULL;
 
-	const char *pers = "rsa_genkey";
-	
-	// initialize mbedtls structs
-	mbedtls_ctr_drbg_init( &ctr_drbg );
-	mbedtls_entropy_init( &entropy );
-	
-	// seed the routines
-	if( ( retVal = mbedtls_ctr_drbg_seed( &ctr_drbg, mbedtls_entropy_func, &entropy,
-									  (const unsigned char *) pers,
-									  strlen( pers ) ) ) != 0 )
-	{
-		goto exit;
-	}
-	
 	// initialize the rsa struct
 	mbedtls_rsa_init( &rsa, MBEDTLS_RSA_PKCS_V15, 0 );
 	
-	// finally, generate the key
-	if( mbedtls_rsa_gen_key( &rsa, mbedtls_ctr_drbg_random, &ctr_drbg, (unsigned int)num_bits_for_keypair,
+	// finally, generate the key, drawing from the generator of this thread
+	if( mbedtls_rsa_gen_key( &rsa, libp2p_crypto_rsa_generate_f_rng, (void*)stop, (unsigned int)num_bits_for_keypair,
 									   exponent ) != 0 )
 	{
 		goto exit;
@@ -170,6 +186,8 @@ int libp2p_crypto_rsa_generate_keypair(struct RsaPrivateKey* private_key, unsign
 	if (!libp2p_crypto_rsa_write_private_key_der(&rsa, buffer, &buffer_size))
 		goto exit;
 
+	// a new key has no signer yet
+	private_key->signer = NULL;
 	// allocate memory for the private key der
 	private_key->der_length = buffer_size;
 	private_key->der = malloc(sizeof(char) * buffer_size);
@@ -182,8 +200,6 @@ int libp2p_crypto_rsa_generate_keypair(struct RsaPrivateKey* private_key, unsign
 	retVal = 1;
 	exit:
 	mbedtls_rsa_free( &rsa );
-	mbedtls_ctr_drbg_free( &ctr_drbg );
-	mbedtls_entropy_free( &entropy );
 	if (buffer != NULL)
 		free(buffer);
 	if (retVal == 0) {
@@ -246,6 +262,7 @@ struct RsaPrivateKey* libp2p_crypto_rsa_rsa_private_key_new() {
 		out->public_key_length = 0;
 		out->public_key_der = NULL;
 		out->public_key_length = 0;
+		out->signer = NULL;
 	}
 	return out;
 }
@@ -261,17 +278,49 @@ int libp2p_crypto_rsa_rsa_private_key_free(struct RsaPrivateKey* private_key) {
 			free(private_key->der);
 		if (private_key->public_key_der != NULL)
 			free(private_key->public_key_der);
+		libp2p_crypto_rsa_signer_free(private_key->signer);
 		free(private_key);
 	}
 	return 1;
 }
 
+/***
+ * Sign a SHA256 hash
+ * @param ctx the rsa context of the private key
+ * @param ctr_drbg a seeded random generator, for blinding
+ * @param hash the hash
+ * @param result where to put the signature. NOTE: this memory is allocated
+ * @param result_size the size of the signature
+ * @returns true(1) on success, otherwise false(0)
+ */
+static int libp2p_crypto_rsa_sign_hash(mbedtls_rsa_context* ctx, mbedtls_ctr_drbg_context* ctr_drbg, const unsigned char hash[32], unsigned char** result, size_t* result_size) {
+	*result_size = ctx->len;
+	*result = (unsigned char*)malloc(*result_size);
+	if (*result == NULL)
+		return 0;
+	// sign
+	if (mbedtls_rsa_rsassa_pkcs1_v15_sign(ctx,
+			mbedtls_ctr_drbg_random,
+			ctr_drbg,
+			MBEDTLS_RSA_PRIVATE,
+			MBEDTLS_MD_SHA256,
+            32,
+            hash,
+            *result ) != 0) {
+		free(*result);
+		*result = NULL;
+		return 0;
+	}
+	return 1;
+}
+
 /**
  * sign a message
  * @param private_key the private key
  * @param message the message to be signed
  * @param message_length the length of message
- * @param result the resultant signature. Note: should be pre-allocated and be the size of the private key (i.e. 2048 bit key can store a sig in 256 bytes)
+ * @param result the resultant signature, the size of the private key (i.e. 2048 bit key gives a sig of 256 bytes). NOTE: this memory is allocated
+ * @param result_size the size of the signature
  * @returns true(1) on success, otherwise false(0)
  */
 int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* message, size_t message_length, unsigned char** result, size_t* result_size) {
@@ -284,6 +333,9 @@ int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* messag
 	unsigned char* der = NULL;
 	int der_allocated = 0;
 
+	if (private_key->signer != NULL)
+		return libp2p_crypto_rsa_signer_sign(private_key->signer, message, message_length, result, result_size);
+
 	// hash the incoming message
 	libp2p_crypto_hashing_sha256(message, message_length, hash);
 
@@ -296,7 +348,7 @@ int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* messag
 		memcpy(der, private_key->der, private_key->der_length);
 		der[private_key->der_length] = 0;
 	} else {
-		der = private_key->der;
+		der = (unsigned char*)private_key->der;
 	}
 	// make a pk_context from the private key
 	mbedtls_pk_init(&private_context);
@@ -313,24 +365,7 @@ int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* messag
 	if(  mbedtls_ctr_drbg_seed( &ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *) pers, strlen( pers ) )  != 0 )
 		goto exit;
 
-
-	*result_size = ctx->len;
-	*result = (unsigned char*)malloc(*result_size);
-	// sign
-	retVal = mbedtls_rsa_rsassa_pkcs1_v15_sign(ctx,
-			mbedtls_ctr_drbg_random,
-			&ctr_drbg,
-			MBEDTLS_RSA_PRIVATE,
-			MBEDTLS_MD_SHA256,
-            32,
-            hash,
-            *result );
-	//retVal = mbedtls_rsa_private(ctx, mbedtls_ctr_drbg_random, &ctr_drbg, hash, result);
-	if (retVal != 0) {
-		retVal = 0;
-		goto exit;
-	}
-	retVal = 1;
+	retVal = libp2p_crypto_rsa_sign_hash(ctx, &ctr_drbg, hash, result, result_size);
 	// cleanup
 	exit:
 	mbedtls_ctr_drbg_free(&ctr_drbg);
@@ -341,6 +376,93 @@ int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* messag
 	return retVal;
 }
 
+struct RsaSigner* libp2p_crypto_rsa_signer_new(const struct RsaPrivateKey* private_key) {
+	char* pers = "libp2p crypto rsa signer";
+	unsigned char* der = NULL;
+
+	if (private_key == NULL || private_key->der == NULL || private_key->der_length == 0)
+		return NULL;
+	struct RsaSigner* signer = (struct RsaSigner*)malloc(sizeof(struct RsaSigner));
+	if (signer == NULL)
+		return NULL;
+	mbedtls_pk_init(&signer->private_context);
+	mbedtls_entropy_init(&signer->entropy);
+	mbedtls_ctr_drbg_init(&signer->ctr_drbg);
+	if (pthread_mutex_init(&signer->lock, NULL) != 0)
+		goto error;
+
+	// mbedtls wants a null terminator on the key
+	der = (unsigned char*)malloc(private_key->der_length + 1);
+	if (der == NULL)
+		goto error_locked;
+	memcpy(der, private_key->der, private_key->der_length);
+	der[private_key->der_length] = 0;
+	if (mbedtls_pk_parse_key(&signer->private_context, der, private_key->der_length, NULL, 0) != 0
+			|| mbedtls_pk_get_type(&signer->private_context) != MBEDTLS_PK_RSA)
+		goto error_locked;
+	free(der);
+	der = NULL;
+
+	if (mbedtls_ctr_drbg_seed(&signer->ctr_drbg, mbedtls_entropy_func, &signer->entropy, (const unsigned char *) pers, strlen(pers)) != 0)
+		goto error_locked;
+	mbedtls_ctr_drbg_set_reseed_interval(&signer->ctr_drbg, RSA_SIGNER_RESEED_INTERVAL);
+	return signer;
+
+	error_locked:
+	pthread_mutex_destroy(&signer->lock);
+	error:
+	if (der != NULL)
+		free(der);
+	mbedtls_ctr_drbg_free(&signer->ctr_drbg);
+	mbedtls_entropy_free(&signer->entropy);
+	mbedtls_pk_free(&signer->private_context);
+	free(signer);
+	return NULL;
+}
+
+void libp2p_crypto_rsa_signer_free(struct RsaSigner* signer) {
+	if (signer != NULL) {
+		pthread_mutex_destroy(&signer->lock);
+		mbedtls_ctr_drbg_free(&signer->ctr_drbg);
+		mbedtls_entropy_free(&signer->entropy);
+		mbedtls_pk_free(&signer->private_context);
+		free(signer);
+	}
+}
+
+int libp2p_crypto_rsa_signer_sign(struct RsaSigner* signer, const char* message, size_t message_length, unsigned char** result, size_t* result_size) {
+	return libp2p_crypto_rsa_signer_sign_batch(signer, 1, &message, &message_length, result, result_size);
+}
+
+int libp2p_crypto_rsa_signer_sign_batch(struct RsaSigner* signer, size_t count, const char** messages, const size_t* message_lengths, unsigned char** results, size_t* result_sizes) {
+	size_t i, signed_count = 0;
+
+	// hash outside of the lock, only the signing needs it
+	unsigned char (*hashes)[32] = malloc(count * 32);
+	if (hashes == NULL)
+		return 0;
+	for (i = 0; i < count; i++)
+		libp2p_crypto_hashing_sha256(messages[i], message_lengths[i], hashes[i]);
+
+	pthread_mutex_lock(&signer->lock);
+	for (signed_count = 0; signed_count < count; signed_count++) {
+		if (!libp2p_crypto_rsa_sign_hash(mbedtls_pk_rsa(signer->private_context), &signer->ctr_drbg, hashes[signed_count],
+				&results[signed_count], &result_sizes[signed_count]))
+			break;
+	}
+	pthread_mutex_unlock(&signer->lock);
+	free(hashes);
+
+	if (signed_count != count) {
+		for (i = 0; i < signed_count; i++) {
+			free(results[i]);
+			results[i] = NULL;
+		}
+		return 0;
+	}
+	return 1;
+}
+
 /**
  * verify a signature
  *@param public_key the public key to use
@@ -350,32 +472,12 @@ int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* messag
  *@returns true(1) if the signature matches the SHA2-256 hash of message, false(0) otherwise
  */
 int libp2p_crypto_rsa_verify(struct RsaPublicKey* public_key, const unsigned char* message, size_t message_length, const unsigned char* signature) {
-
-	// hash the message
-	unsigned char output[32];
-	libp2p_crypto_hashing_sha256(message, message_length, output);
-
-	// make a pk_context from the public key
-	mbedtls_pk_context public_context;
-	mbedtls_pk_init(&public_context);
-	mbedtls_pk_parse_public_key(&public_context, (unsigned char*)public_key->der, public_key->der_length);
-
-	mbedtls_rsa_context* ctx = mbedtls_pk_rsa(public_context);
-	mbedtls_ctr_drbg_context ctr_drbg;
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-
-	int retVal = mbedtls_rsa_rsassa_pkcs1_v15_verify(ctx, // the rsa public key has to be in the context
-			NULL, // random number generator, but not needed because this is not a private key
-			NULL, //mbedtls_ctr_drbg_random, // random number generator
-			MBEDTLS_RSA_PUBLIC, // mode RSA_PUBLIC or RSA_PRIVATE
-			MBEDTLS_MD_SHA256, // type of message digest
-			32, // ignored because we know it from the parameter previous
-			output, signature); // the actual signature to compare
-
-	mbedtls_ctr_drbg_free(&ctr_drbg);
-	mbedtls_pk_free(&public_context);
-
-	return retVal == 0;
+	// the key cache keeps the parsed key, so a key seen lately is not parsed again
+	struct PublicKey key;
+	key.type = KEYTYPE_RSA;
+	key.data = (unsigned char*)public_key->der;
+	key.data_size = public_key->der_length;
+	return libp2p_crypto_key_cache_verify(&key, message, message_length, signature);
 }
 
 
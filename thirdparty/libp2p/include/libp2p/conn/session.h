@@ -10,6 +10,12 @@
 
 enum IPTrafficType { TCP, UDP };
 
+/***
+ * The cipher and mac contexts of one direction of a secio stream,
+ * see libp2p_secio_start_ciphers
+ */
+struct SecioCipher;
+
 struct SessionContext {
 	// to get the connection started
 	char* host;
@@ -48,4 +54,7 @@ struct SessionContext {
 	struct StretchedKey* remote_stretched_key;
 	unsigned char* remote_ephemeral_public_key;
 	size_t remote_ephemeral_public_key_size;
+	// keyed once the handshake stretched the keys
+	struct SecioCipher* local_cipher;
+	struct SecioCipher* remote_cipher;
 };
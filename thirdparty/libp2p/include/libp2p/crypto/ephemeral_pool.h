@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "libp2p/crypto/ephemeral.h"
+
+/***
+ * A pool of ready made ephemeral keys per curve, so that a handshake does
+ * not make one on its critical path. A background thread tops a pool back
+ * up to its size once it falls below the refill mark. Taking from an empty
+ * pool, or from a curve that is not pooled, makes a key right there.
+ */
+
+/***
+ * The default number of keys kept per curve
+ */
+#define EPHEMERAL_POOL_SIZE 8
+/***
+ * The default number of keys left in a pool that starts a refill
+ */
+#define EPHEMERAL_POOL_REFILL_BELOW 4
+
+struct EphemeralPoolStats {
+	// keys taken from the pool
+	unsigned long long hits;
+	// keys made on the spot, as the pool was empty
+	unsigned long long misses;
+	// refills done, and the time from falling below the mark to full again
+	unsigned long long refills;
+	unsigned long long refill_ns_total;
+	unsigned long long refill_ns_max;
+	// keys in the pool now
+	size_t available;
+};
+
+/***
+ * Start filling pools in the background
+ * @param curves the curves to pool, separated by commas (i.e. "P-256,P-384,P-521")
+ * @param size the number of keys to keep per curve
+ * @param refill_below refill a pool once it has fewer keys than this
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_crypto_ephemeral_pool_start(const char* curves, size_t size, size_t refill_below);
+
+/***
+ * Stop the background thread, and free the keys still pooled
+ */
+void libp2p_crypto_ephemeral_pool_stop();
+
+/***
+ * Take a key from the pool of a curve, or make one if the pool is empty
+ * @param curve the curve (P-256, P-384, or P-521)
+ * @param private_key where to put the key. Free it with libp2p_crypto_ephemeral_key_free
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_crypto_ephemeral_pool_take(char* curve, struct EphemeralPrivateKey** private_key);
+
+/***
+ * Get the counters of the pool of a curve
+ * @param curve the curve
+ * @param stats where to put them
+ */
+void libp2p_crypto_ephemeral_pool_stats(const char* curve, struct EphemeralPoolStats* stats);
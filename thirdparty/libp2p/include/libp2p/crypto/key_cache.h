@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "libp2p/crypto/key.h"
+
+/***
+ * A cache of the public keys seen lately, keyed by the SHA256 of their
+ * protobuf. An entry holds the parsed key and the peer id of the key, so
+ * a peer that comes back costs neither a DER parse nor a base58 encoding.
+ * The least recently used entry makes room for a new one when the cache is
+ * full. The cache is shared by all threads, which verify outside of its
+ * lock, so that threads verifying at once do not wait on each other.
+ */
+
+/***
+ * How many public keys are kept
+ */
+#define KEY_CACHE_SIZE 256
+
+struct KeyCacheStats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	size_t entries;
+};
+
+/***
+ * Get the peer id of a public key, from the cache if it is there
+ * @param public_key the public key
+ * @param peer_id where to put the peer id. NOTE: this memory is allocated
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_crypto_key_cache_peer_id(const struct PublicKey* public_key, char** peer_id);
+
+/***
+ * Verify a signature (SHA256, PKCS#1 v1.5) with the parsed key from the cache
+ * @param public_key the public key
+ * @param message the message that was signed
+ * @param message_length the length of the message
+ * @param signature the signature
+ * @returns true(1) if the signature matches, otherwise false(0)
+ */
+int libp2p_crypto_key_cache_verify(const struct PublicKey* public_key, const unsigned char* message, size_t message_length, const unsigned char* signature);
+
+/***
+ * Get the counters of the cache
+ * @param stats where to put them
+ */
+void libp2p_crypto_key_cache_stats(struct KeyCacheStats* stats);
+
+/***
+ * Empty the cache and zero its counters.
+ * NOTE: not while another thread may be verifying
+ */
+void libp2p_crypto_key_cache_clear();
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+/***
+ * The random source of the process. Each thread gets its own CTR_DRBG the
+ * first time it asks for random bytes, so drawing from it takes no lock.
+ * The generators are seeded, and reseed, from one entropy pool that is
+ * shared by all threads.
+ */
+
+/***
+ * How many requests a generator serves before it reseeds
+ */
+#define RANDOM_RESEED_INTERVAL 10000
+
+/***
+ * Fill a buffer with random bytes
+ * @param buffer where to put the bytes
+ * @param length the number of bytes
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_crypto_random_bytes(unsigned char* buffer, size_t length);
+
+/***
+ * The random source as an mbedtls f_rng callback, to be passed along with
+ * a NULL p_rng
+ * @param p_rng not used
+ * @param buffer where to put the bytes
+ * @param length the number of bytes
+ * @returns 0 on success, otherwise an mbedtls error code
+ */
+int libp2p_crypto_random_f_rng(void* p_rng, unsigned char* buffer, size_t length);
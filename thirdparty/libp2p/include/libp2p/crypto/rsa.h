@@ -3,6 +3,12 @@
 
 #include <stddef.h>
 
+/***
+ * A private key parsed once, with a seeded random generator, to sign with
+ * over and over. See libp2p_crypto_rsa_signer_new.
+ */
+struct RsaSigner;
+
 struct RsaPublicKey {
 	char* der;
 	size_t der_length;
@@ -25,6 +31,8 @@ struct RsaPrivateKey {
 	// public
 	char* public_key_der;
 	size_t public_key_length;
+	// if not NULL, libp2p_crypto_rsa_sign signs with this
+	struct RsaSigner* signer;
 };
 
 /**
@@ -42,6 +50,16 @@ struct PrivateKey* libp2p_crypto_rsa_to_private_key(struct RsaPrivateKey* in);
  */
 int libp2p_crypto_rsa_generate_keypair(struct RsaPrivateKey* private_key, unsigned long num_bits_for_keypair);
 
+/**
+ * generate a new private key, unless asked to stop first. Several threads
+ * may race to make a key this way, as each draws from its own generator.
+ * @param private_key the new private key
+ * @param num_bits_for_keypair the size of the key (1024 minimum)
+ * @param stop generation gives up once this is non-zero, may be NULL
+ * @returns true(1) on success, false(0) on error or when stopped
+ */
+int libp2p_crypto_rsa_generate_keypair_until(struct RsaPrivateKey* private_key, unsigned long num_bits_for_keypair, volatile int* stop);
+
 /**
  * Use the private key DER to fill in the public key DER
  * @param private_key the private key to use
@@ -67,6 +85,44 @@ struct RsaPrivateKey* libp2p_crypto_rsa_rsa_private_key_new();
  */
 int libp2p_crypto_rsa_sign(struct RsaPrivateKey* private_key, const char* message, size_t message_length, unsigned char** result, size_t* result_size);
 
+/***
+ * Parse a private key and seed a random generator for it once, so that
+ * signing does neither. The generator reseeds itself every
+ * RSA_SIGNER_RESEED_INTERVAL signatures. A signer may be shared by threads.
+ * @param private_key the private key, only its DER is used
+ * @returns the signer, or NULL on error
+ */
+struct RsaSigner* libp2p_crypto_rsa_signer_new(const struct RsaPrivateKey* private_key);
+
+/***
+ * Free a signer
+ * @param signer the signer
+ */
+void libp2p_crypto_rsa_signer_free(struct RsaSigner* signer);
+
+/***
+ * Sign a message (SHA256, PKCS#1 v1.5)
+ * @param signer the signer
+ * @param message the message to be signed
+ * @param message_length the length of message
+ * @param result where to put the signature. NOTE: this memory is allocated
+ * @param result_size the size of the signature
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_crypto_rsa_signer_sign(struct RsaSigner* signer, const char* message, size_t message_length, unsigned char** result, size_t* result_size);
+
+/***
+ * Sign several messages, taking the lock of the signer once
+ * @param signer the signer
+ * @param count the number of messages
+ * @param messages the messages to be signed
+ * @param message_lengths the lengths of the messages
+ * @param results where to put the signatures. NOTE: this memory is allocated
+ * @param result_sizes the sizes of the signatures
+ * @returns true(1) if all were signed, otherwise false(0) and none are returned
+ */
+int libp2p_crypto_rsa_signer_sign_batch(struct RsaSigner* signer, size_t count, const char** messages, const size_t* message_lengths, unsigned char** results, size_t* result_sizes);
+
 int libp2p_crypto_rsa_verify(struct RsaPublicKey* public_key, const unsigned char* message, size_t message_length, const unsigned char* signature);
 
 #endif /* rsa_h */
@@ -5,15 +5,23 @@
  *
  * Modified by Pete Warden to fix a serious performance problem, support strings as keys
  * and removed thread synchronization - http://petewarden.typepad.com
+ *
+ * Now open addressing with Robin Hood probing: keys are kept with their
+ * length and hash, and removal shifts the elements after it back, so no
+ * tombstones are left behind.
  */
 #ifndef __HASHMAP_H__
 #define __HASHMAP_H__
 
+#include <stddef.h>
+
 #define MAP_MISSING -3  /* No such element */
 #define MAP_FULL -2 	/* Hashmap is full */
 #define MAP_OMEM -1 	/* Out of Memory */
 #define MAP_OK 0 	/* OK */
 
+#define MAP_MAX_ID_SIZE 64	/* The largest id of a map made with libp2p_hashmap_new_id */
+
 /*
  * any_t is a pointer.  This allows you to put arbitrary structures in
  * the hashmap.
@@ -48,7 +56,9 @@ extern map_t libp2p_hashmap_new();
 extern int libp2p_hashmap_iterate(map_t in, PFany f, any_t item);
 
 /*
- * Add an element to the hashmap. Return MAP_OK or MAP_OMEM.
+ * Add an element to the hashmap, or replace the value of that key.
+ * The key is not copied, and must live as long as the element.
+ * Return MAP_OK or MAP_OMEM.
  */
 extern int libp2p_hashmap_put(map_t in, char* key, any_t value);
 
@@ -78,4 +88,26 @@ extern void libp2p_hashmap_free(map_t in);
  */
 extern int libp2p_hashmap_length(map_t in);
 
+/*
+ * Return an empty hashmap keyed by binary ids of key_size bytes, at most
+ * MAP_MAX_ID_SIZE, such as peer ids or content hashes. The ids are copied
+ * into the map. Use the _id functions below with it. Returns NULL on error.
+ */
+extern map_t libp2p_hashmap_new_id(size_t key_size);
+
+/*
+ * Add an element keyed by an id, or replace its value. Return MAP_OK or MAP_OMEM.
+ */
+extern int libp2p_hashmap_put_id(map_t in, const unsigned char* id, any_t value);
+
+/*
+ * Get an element by its id. Return MAP_OK or MAP_MISSING.
+ */
+extern int libp2p_hashmap_get_id(map_t in, const unsigned char* id, any_t *arg);
+
+/*
+ * Remove an element by its id. Return MAP_OK or MAP_MISSING.
+ */
+extern int libp2p_hashmap_remove_id(map_t in, const unsigned char* id);
+
 #endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 	int socket_open4();
    int socket_bind4(int s, uint32_t ip, uint16_t port);
@@ -14,6 +15,16 @@
    int socket_listen(int s, uint32_t *localip, uint16_t *localport);
    ssize_t socket_read(int s, char *buf, size_t len, int flags, int timeout_secs);
    ssize_t socket_write(int s, const char *buf, size_t len, int flags);
+   /**
+    * Write all of several buffers, i.e. a frame header and its payload, with
+    * one sendmsg when the socket takes it all, waiting with poll when it is full
+    * @param s the socket descriptor
+    * @param iov the buffers. NOTE: they are changed to track partial writes
+    * @param iovcnt the number of buffers
+    * @param num_secs the seconds to wait for the socket to be writable, 0 waits forever
+    * @returns the number of bytes written, or -1 on error or time out
+    */
+   ssize_t socket_writev(int s, struct iovec *iov, int iovcnt, int num_secs);
    /**
     * Used to send the size of the next transmission for "framed" transmissions. NOTE: This will send in big endian format
     * @param s the socket descriptor
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+
+/***
+ * A read buffer in front of a socket. It is filled by recv calls as big as
+ * the room it has, and length prefixed frames are parsed out of it, so a
+ * frame usually costs a single recv rather than one per byte of its prefix.
+ * A frame too big for the buffer is received straight into a buffer of its
+ * own, which is handed to the caller as is. Empty frames, and frames over
+ * the limit, are dropped from the stream, so the frame after them can still
+ * be read.
+ * Waiting is done with poll, and only when the socket has nothing to read.
+ */
+
+/***
+ * The default for the biggest frame a read buffer accepts. Bigger frames
+ * are refused rather than allocated.
+ */
+#define READ_BUFFER_MAX_FRAME (8 * 1024 * 1024)
+
+struct ReadBuffer {
+	int socket_descriptor;
+	unsigned char* buffer;
+	size_t buffer_size;
+	// the bytes read but not parsed yet are buffer[start] to buffer[end - 1]
+	size_t start;
+	size_t end;
+	size_t max_frame_size;
+	// a frame too big for the buffer, frame_read bytes of it received so far
+	unsigned char* frame;
+	size_t frame_size;
+	size_t frame_read;
+	// bytes of a refused frame still to be thrown away
+	size_t discard;
+};
+
+/***
+ * Create a read buffer for a socket
+ * @param socket_descriptor the socket
+ * @returns the read buffer, or NULL on error
+ */
+struct ReadBuffer* libp2p_net_read_buffer_new(int socket_descriptor);
+
+/***
+ * Free a read buffer. The socket is left open.
+ * @param read_buffer the read buffer
+ */
+void libp2p_net_read_buffer_free(struct ReadBuffer* read_buffer);
+
+/***
+ * Change the biggest frame the read buffer accepts
+ * @param read_buffer the read buffer
+ * @param max_frame_size the size in bytes
+ */
+void libp2p_net_read_buffer_set_max_frame_size(struct ReadBuffer* read_buffer, size_t max_frame_size);
+
+/***
+ * Read a frame prefixed by its length as a varint (multistream)
+ * @param read_buffer the read buffer
+ * @param results where to put the frame. NOTE: this memory is allocated
+ * @param results_size the size of the frame
+ * @param timeout_secs the seconds to wait for the whole frame
+ * @returns the size of the frame, or 0 on time out, error, an empty frame, or a frame over the limit
+ */
+int libp2p_net_read_buffer_read_varint_frame(struct ReadBuffer* read_buffer, unsigned char** results, size_t* results_size, int timeout_secs);
+
+/***
+ * Read a frame prefixed by its length as a 4 byte big endian integer (secio)
+ * @param read_buffer the read buffer
+ * @param results where to put the frame. NOTE: this memory is allocated
+ * @param results_size the size of the frame
+ * @param timeout_secs the seconds to wait for the whole frame
+ * @returns the size of the frame, or 0 on time out, error, an empty frame, or a frame over the limit
+ */
+int libp2p_net_read_buffer_read_uint32_frame(struct ReadBuffer* read_buffer, unsigned char** results, size_t* results_size, int timeout_secs);
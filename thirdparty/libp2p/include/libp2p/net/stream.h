@@ -9,6 +9,10 @@ struct Stream {
 	 */
 	void* socket_descriptor;
 	struct MultiAddress *address;
+	/**
+	 * What was read from the socket but not handed out yet
+	 */
+	struct ReadBuffer* read_buffer;
 
 	/**
 	 * Reads from the stream
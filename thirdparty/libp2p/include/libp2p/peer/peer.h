@@ -2,6 +2,7 @@
 
 #include "multiaddr/multiaddr.h"
 #include "libp2p/net/stream.h"
+#include "libp2p/utils/arena.h"
 
 enum ConnectionType {
 	// sender does not have a connection to the peer, and no extra information (default)
@@ -28,6 +29,13 @@ struct Libp2pPeer {
  */
 struct Libp2pPeer* libp2p_peer_new();
 
+/**
+ * create a new Peer struct in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns a struct or NULL if there was a problem
+ */
+struct Libp2pPeer* libp2p_peer_new_in(struct Libp2pArena* arena);
+
 /**
  * Create a new Peer based on a multiaddress
  * @param in the multiaddress
@@ -56,6 +64,14 @@ int libp2p_peer_connect(struct Libp2pPeer* peer);
  */
 struct Libp2pPeer* libp2p_peer_copy(struct Libp2pPeer* in);
 
+/**
+ * Make a copy of a peer in an arena, id and addresses included
+ * @param arena where to allocate it, or NULL to malloc it
+ * @param in what is to be copied
+ * @returns a new struct, that does not rely on the old
+ */
+struct Libp2pPeer* libp2p_peer_copy_in(struct Libp2pArena* arena, struct Libp2pPeer* in);
+
 /***
  * Determine if the passed in peer and id match
  * @param in the peer to check
@@ -72,9 +88,9 @@ int libp2p_peer_matches_id(struct Libp2pPeer* in, const unsigned char* peer_id);
 int libp2p_peer_is_connected(struct Libp2pPeer* in);
 
 /**
- * Get an estimate of the necessary size of the buffer to protobuf a particular peer
+ * Get the necessary size of the buffer to protobuf a particular peer
  * @param in the peer to examine
- * @returns an approximation of the buffer size required (erring on the side of bigger)
+ * @returns the exact buffer size required
  */
 size_t libp2p_peer_protobuf_encode_size(struct Libp2pPeer* in);
 
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "libp2p/utils/linked_list.h"
 #include "libp2p/peer/peer.h"
+#include "libp2p/utils/slot_index.h"
 
 /**
  * Structures and functions to implement a storage area for peers and
@@ -19,13 +22,18 @@ struct PeerEntry {
 };
 
 /**
- * Contains a collection of peers and their metadata
- * NOTE: this is currently a linked list. Perhaps a better algo would
- * improve performance, but will wait.
+ * The starting number of slots of a peerstore, a power of 2
+ */
+#define PEERSTORE_INITIAL_CAPACITY 64
+
+/**
+ * Contains a collection of peers and their metadata, indexed by the bytes
+ * of the peer id. The store owns one copy of each peer. Entries are
+ * allocated one by one, so pointers to them stay good as the index grows.
  */
 struct Peerstore {
-	struct Libp2pLinkedList* head_entry;
-	struct Libp2pLinkedList* last_entry;
+	// PeerEntry items by peer id
+	struct Libp2pSlotIndex index;
 };
 
 struct PeerEntry* libp2p_peer_entry_new();
@@ -46,9 +54,9 @@ struct Peerstore* libp2p_peerstore_new(const char* peer_id);
 int libp2p_peerstore_free(struct Peerstore* in);
 
 /**
- * Add a Peer to the Peerstore
+ * Add a Peer to the Peerstore, unless a peer with that id is there already
  * @param peerstore the peerstore to add the entry to
- * @param peer_entry the entry to add
+ * @param peer_entry the entry to add, which is copied
  * @returns true(1) on success, otherwise false
  */
 int libp2p_peerstore_add_peer_entry(struct Peerstore* peerstore, struct PeerEntry* peer_entry);
@@ -81,9 +89,11 @@ struct Libp2pPeer* libp2p_peerstore_get_peer(struct Peerstore* peerstore, const
 
 /**
  * Look for this peer in the peerstore. If it is found, return a reference to that object.
- * If it is not found, add it, and return a reference to the new copy
+ * If it is not found, add it, and return a reference to the new copy. Either way it is
+ * one probe of the index.
  * @param peerstore the peerstore to search
  * @param in the peer to search for
+ * @returns the peer in the peerstore, or NULL on error
  */
 struct Libp2pPeer* libp2p_peerstore_get_or_add_peer(struct Peerstore* peerstore, struct Libp2pPeer* in);
 
@@ -1,23 +1,70 @@
 #pragma once
 
+#include <stdint.h>
+#include <time.h>
+
+#include "libp2p/utils/slot_index.h"
+
 /**
- * Contains a hash and the peer id of
- * who can provide it
+ * The most providers kept for one hash. When a new one arrives for a full
+ * hash, the provider closest to expiring makes room.
  */
-struct ProviderEntry {
-	unsigned char* hash;
-	int hash_size;
+#define PROVIDERSTORE_MAX_PROVIDERS 20
+/**
+ * How long a provider record lasts, in seconds, unless announced again
+ */
+#define PROVIDERSTORE_TTL (24 * 60 * 60)
+/**
+ * The expiry wheel: slots of PROVIDERSTORE_WHEEL_TICK seconds each. Records
+ * further away than a full turn wait in their slot for later turns.
+ */
+#define PROVIDERSTORE_WHEEL_TICK 60
+#define PROVIDERSTORE_WHEEL_SLOTS 256
+/**
+ * The starting number of slots of the hash index, a power of 2
+ */
+#define PROVIDERSTORE_INITIAL_CAPACITY 64
+
+struct ProviderKey;
+
+/**
+ * A peer that can provide a hash, until it expires
+ */
+struct ProviderRecord {
 	unsigned char* peer_id;
 	int peer_id_size;
+	time_t expires;
+	struct ProviderKey* key;
+	// the slot of the expiry wheel this record is in
+	struct ProviderRecord* wheel_prev;
+	struct ProviderRecord* wheel_next;
+};
+
+/**
+ * A hash, and the providers of it
+ */
+struct ProviderKey {
+	// the hash of the hash, to find its slot again
+	uint64_t hash_code;
+	unsigned char* hash;
+	int hash_size;
+	int provider_count;
+	struct ProviderRecord* providers[PROVIDERSTORE_MAX_PROVIDERS];
 };
 
 /***
- * A structure to store providers. The implementation
- * is a vector of ProviderEntry structures, which contain
- * the hash and peer id.
+ * A structure to store providers. Hashes are indexed with open addressing,
+ * and each holds a bounded set of providers with no duplicate peer ids.
+ * Records expire through a timer wheel.
  */
 struct ProviderStore {
-	struct Libp2pVector* provider_entries;
+	// ProviderKey items by hash
+	struct Libp2pSlotIndex index;
+	// seconds a record lasts, PROVIDERSTORE_TTL unless changed
+	time_t ttl;
+	// the last tick of the wheel that has been expired
+	time_t wheel_tick;
+	struct ProviderRecord* wheel[PROVIDERSTORE_WHEEL_SLOTS];
 };
 
 /**
@@ -32,6 +79,45 @@ struct ProviderStore* libp2p_providerstore_new();
  */
 void libp2p_providerstore_free(struct ProviderStore* in);
 
+/***
+ * Record that a peer can provide a hash. A peer already recorded for the
+ * hash has its record renewed.
+ * @param store the store
+ * @param hash the hash
+ * @param hash_size the size of the hash
+ * @param peer_id the peer id
+ * @param peer_id_size the size of the peer id
+ * @returns true(1) on success, otherwise false(0)
+ */
 int libp2p_providerstore_add(struct ProviderStore* store, const unsigned char* hash, int hash_size, const unsigned char* peer_id, int peer_id_size);
 
+/***
+ * Find who can provide a hash. The records belong to the store, and are
+ * good until the store is next changed.
+ * @param store the store
+ * @param hash the hash
+ * @param hash_size the size of the hash
+ * @param providers where to put the records
+ * @param max_providers the most records to put in providers
+ * @returns the number of records found
+ */
+int libp2p_providerstore_get_providers(struct ProviderStore* store, const unsigned char* hash, int hash_size, struct ProviderRecord** providers, int max_providers);
+
+/***
+ * Find one provider of a hash
+ * @param store the store
+ * @param hash the hash
+ * @param hash_size the size of the hash
+ * @param peer_id where to put a copy of the peer id. The caller frees it
+ * @param peer_id_size where to put the size of the peer id
+ * @returns true(1) if a provider was found, otherwise false(0)
+ */
 int libp2p_providerstore_get(struct ProviderStore* store, const unsigned char* hash, int hash_size, unsigned char** peer_id, int *peer_id_size);
+
+/***
+ * Drop the records that have expired. Adding and getting do this already;
+ * it is here for a caller with its own timer.
+ * @param store the store
+ * @param now the time
+ */
+void libp2p_providerstore_expire(struct ProviderStore* store, time_t now);
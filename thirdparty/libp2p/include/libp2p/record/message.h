@@ -33,6 +33,13 @@ struct Libp2pMessage {
  */
 struct Libp2pMessage* libp2p_message_new();
 
+/**
+ * create a new Libp2pMessage struct in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns a new Libp2pMessage with default settings
+ */
+struct Libp2pMessage* libp2p_message_new_in(struct Libp2pArena* arena);
+
 /**
  * Deallocate memory from a Message struct
  * @param in the struct
@@ -40,7 +47,8 @@ struct Libp2pMessage* libp2p_message_new();
 void libp2p_message_free(struct Libp2pMessage* in);
 
 /**
- * determine the size necessary for a message struct to be protobuf'd
+ * determine the exact size necessary for a message struct to be protobuf'd,
+ * nested records and peers included
  * @param in the struct to be protobuf'd
  * @returns the size required
  */
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "libp2p/record/message.h"
+#include "libp2p/peer/peer.h"
+
+/***
+ * Views of a protobuf'd Libp2pMessage, Libp2pRecord and Libp2pPeer.
+ *
+ * Rather than copying every field out, a view points into the buffer it
+ * was decoded from, so the buffer must outlive the view. Nothing is
+ * allocated while decoding. Peers and their multiaddresses are walked
+ * only when asked for, and turned into structs only by
+ * libp2p_peer_view_to_peer.
+ */
+
+/**
+ * The repeated peer fields of a message
+ */
+#define MESSAGE_VIEW_CLOSER_PEERS 8
+#define MESSAGE_VIEW_PROVIDER_PEERS 9
+
+struct Libp2pRecordView {
+	const unsigned char* key; // protobuf field 1
+	size_t key_size;
+	const unsigned char* value; // protobuf field 2
+	size_t value_size;
+	const unsigned char* author; // protobuf field 3
+	size_t author_size;
+	const unsigned char* signature; // protobuf field 4
+	size_t signature_size;
+	const unsigned char* time_received; // protobuf field 5
+	size_t time_received_size;
+};
+
+struct Libp2pPeerView {
+	const unsigned char* id; // protobuf field 1
+	size_t id_size;
+	int address_count; // protobuf field 2, walked with libp2p_peer_view_next_address
+	enum ConnectionType connection_type; // protobuf field 3
+	// the encoded peer
+	const unsigned char* protobuf;
+	size_t protobuf_size;
+};
+
+struct Libp2pMessageView {
+	enum MessageType message_type; // protobuf field 1
+	const unsigned char* key; // protobuf field 2
+	size_t key_size;
+	int has_record; // protobuf field 3
+	struct Libp2pRecordView record;
+	int closer_peer_count; // protobuf field 8, walked with libp2p_message_view_next_peer
+	int provider_peer_count; // protobuf field 9, likewise
+	int32_t cluster_level_raw; // protobuf field 10
+	// the encoded message
+	const unsigned char* protobuf;
+	size_t protobuf_size;
+};
+
+/***
+ * Decode a record, pointing into the buffer
+ * @param in the protobuf
+ * @param in_size the size of in
+ * @param out the view to fill
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_record_view_decode(const unsigned char* in, size_t in_size, struct Libp2pRecordView* out);
+
+/***
+ * Decode a peer, pointing into the buffer. The addresses are counted and
+ * checked, but not parsed.
+ * @param in the protobuf
+ * @param in_size the size of in
+ * @param out the view to fill
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_peer_view_decode(const unsigned char* in, size_t in_size, struct Libp2pPeerView* out);
+
+/***
+ * Decode a message, pointing into the buffer. The whole message is checked,
+ * nested record and peers included, so walking it later cannot fail.
+ * @param in the protobuf
+ * @param in_size the size of in
+ * @param out the view to fill
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_message_view_decode(const unsigned char* in, size_t in_size, struct Libp2pMessageView* out);
+
+/***
+ * Get the next peer of a message
+ * @param view the message
+ * @param field_number MESSAGE_VIEW_CLOSER_PEERS or MESSAGE_VIEW_PROVIDER_PEERS
+ * @param pos where to carry on from. Start it at 0
+ * @param peer the view of the peer
+ * @returns true(1) if there was another peer, otherwise false(0)
+ */
+int libp2p_message_view_next_peer(const struct Libp2pMessageView* view, int field_number, size_t* pos, struct Libp2pPeerView* peer);
+
+/***
+ * Get the bytes of the next multiaddress of a peer
+ * @param peer the peer
+ * @param pos where to carry on from. Start it at 0
+ * @param bytes where to point at the multiaddress bytes
+ * @param bytes_size the size of the multiaddress bytes
+ * @returns true(1) if there was another address, otherwise false(0)
+ */
+int libp2p_peer_view_next_address(const struct Libp2pPeerView* peer, size_t* pos, const unsigned char** bytes, size_t* bytes_size);
+
+/***
+ * Make a Libp2pPeer of a view, parsing its multiaddresses
+ * @param peer the view
+ * @returns a new Libp2pPeer, or NULL on error
+ */
+struct Libp2pPeer* libp2p_peer_view_to_peer(const struct Libp2pPeerView* peer);
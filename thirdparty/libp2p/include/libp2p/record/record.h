@@ -2,6 +2,7 @@
 
 #include "libp2p/record/record.h"
 #include "libp2p/crypto/rsa.h"
+#include "libp2p/utils/arena.h"
 
 struct Libp2pRecord {
 	// the key that references this record
@@ -27,6 +28,13 @@ struct Libp2pRecord {
  */
 struct Libp2pRecord* libp2p_record_new();
 
+/**
+ * Create a record with default settings in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns the newly allocated record struct
+ */
+struct Libp2pRecord* libp2p_record_new_in(struct Libp2pArena* arena);
+
 /**
  * Free the resources from a record struct
  * @param in the struct to free
@@ -54,9 +62,9 @@ int libp2p_record_protobuf_encode(const struct Libp2pRecord* in, unsigned char*
 int libp2p_record_protobuf_allocate_and_encode(const struct Libp2pRecord* in, unsigned char **buffer, size_t *buffer_size);
 
 /**
- * Generates an estimate of the buffer size needed to encode the struct
+ * The exact buffer size needed to encode the struct
  * @param in the Libp2pRecord that you want to encode
- * @returns the approximate number of bytes required
+ * @returns the number of bytes required
  */
 size_t libp2p_record_protobuf_encode_size(const struct Libp2pRecord* in);
 
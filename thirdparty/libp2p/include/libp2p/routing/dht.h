@@ -20,6 +20,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#pragma once
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -59,6 +61,22 @@ int dht_ping_node(const struct sockaddr *sa, int salen);
 int dht_periodic(const void *buf, size_t buflen,
                  const struct sockaddr *from, int fromlen,
                  time_t *tosleep, dht_callback *callback, void *closure);
+/***
+ * Handle one message received from the network, without doing any of
+ * the periodic work done by dht_periodic.  This lets a caller that
+ * receives datagrams in batches process all of them and only call
+ * dht_periodic(NULL, 0, ...) when tosleep has expired.
+ * @param buf what came in from the network
+ * @param buflen the size of buf
+ * @param from where it came from
+ * @param fromlen
+ * @param callback
+ * @param closure
+ * @returns -1 on failure, 1 on success
+ */
+int dht_process(const void *buf, size_t buflen,
+                const struct sockaddr *from, int fromlen,
+                dht_callback *callback, void *closure);
 /**
  * Start a search.  If port is non-zero, perform an announce when the
  * search is complete.
@@ -77,6 +95,16 @@ int dht_nodes(int af,
 void dht_dump_tables(FILE *f);
 int dht_get_nodes(struct sockaddr_in *sin, int *num,
                   struct sockaddr_in6 *sin6, int *num6);
+/**
+ * Copy out good nodes with their ids, the nodes of our own bucket first.
+ * @param af AF_INET or AF_INET6
+ * @param ids room for *num ids of 20 bytes
+ * @param ss room for *num addresses
+ * @param num in: the room available, out: the number of nodes copied
+ * @returns the number of nodes copied
+ */
+int dht_get_node_ids(int af, unsigned char *ids, struct sockaddr_storage *ss,
+                     int *num);
 int dht_uninit(void);
 
 /* This must be provided by the user. */
@@ -86,6 +114,8 @@ void dht_hash(void *hash_return, int hash_size,
               const void *v2, int len2,
               const void *v3, int len3);
 int dht_random_bytes(void *buf, size_t size);
+int dht_sendto(int sockfd, const void *buf, int len, int flags,
+               const struct sockaddr *to, int tolen);
 
 #ifdef __cplusplus
 }
@@ -3,6 +3,8 @@
 #include "libp2p/conn/session.h"
 #include "libp2p/peer/peerstore.h"
 #include "libp2p/peer/providerstore.h"
+#include "libp2p/record/message_view.h"
+#include "libp2p/utils/arena.h"
 
 
 /***
@@ -32,3 +34,21 @@ int libp2p_routing_dht_handshake(struct SessionContext* context);
  * @returns true(1) on success, otherwise false(0)
  */
 int libp2p_routing_dht_handle_message(struct SessionContext* session, struct Peerstore* peerstore, struct ProviderStore* providerstore);
+
+/***
+ * The handlers of the requests. Each takes the request, and an arena for
+ * the reply and all it is made of. With a NULL arena everything is
+ * malloc'd, and the caller frees the results.
+ * @param session the context
+ * @param message the request
+ * @param peerstore a list of peers
+ * @param providerstore who can provide what
+ * @param arena where to allocate the reply, or NULL to malloc it
+ * @param results where to put the protobuf'd reply
+ * @param results_size the size of the reply
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_routing_dht_handle_get_providers(struct SessionContext* session, const struct Libp2pMessageView* message, struct Peerstore* peerstore,
+		struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** results, size_t* results_size);
+int libp2p_routing_dht_handle_find_node(struct SessionContext* session, const struct Libp2pMessageView* message,
+		struct Peerstore* peerstore, struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** results, size_t *results_size);
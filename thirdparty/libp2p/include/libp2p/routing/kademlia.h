@@ -7,6 +7,16 @@ int start_kademlia(int sock, int family, char* peer_id, int timeout, struct Libp
 int start_kademlia_multiaddress(struct MultiAddress* multiaddress, char* peer_id, int timeout, struct Libp2pVector* bootstrap_addresses);
 void stop_kademlia (void);
 
+/***
+ * Keep a snapshot of the good nodes of the routing table in a file. It is
+ * loaded by start_kademlia, which then only pings the bootstrap nodes if
+ * the snapshot held too few nodes, and saved every few minutes and by
+ * stop_kademlia. Call before start_kademlia.
+ * @param path the file, or NULL to stop using one
+ * @returns true(1) on success
+ */
+int kademlia_snapshot_file(const char* path);
+
 void *kademlia_thread (void *ptr);
 void *announce_thread (void *ptr);
 
@@ -20,4 +30,39 @@ int announce_kademlia (char* peer_id, uint16_t port);
  */
 struct MultiAddress** search_kademlia(char* peer_id, int timeout);
 
+/***
+ * A search in progress. Any number of them can run at once, up to what
+ * the DHT has room for, the rest wait in a queue.
+ */
+struct kademlia_search;
+
+/***
+ * Queue a search, without waiting for it
+ * @param id the 20 byte hash to search for
+ * @param port if non-zero, also announce that we serve the hash on this port
+ * @returns a handle to pass to search_kademlia_free, or NULL on error
+ */
+struct kademlia_search* search_kademlia_start(const unsigned char* id, uint16_t port);
+
+/***
+ * Wait for a search to complete
+ * @param search the search
+ * @param timeout_ms how long to wait, in milliseconds
+ * @returns 1 if the search is done, 0 on time out
+ */
+int search_kademlia_wait(struct kademlia_search* search, int timeout_ms);
+
+/***
+ * The peers found so far by a search
+ * @param search the search
+ * @returns a NULL terminated array of MultiAddress, or NULL if there are none
+ */
+struct MultiAddress** search_kademlia_results(struct kademlia_search* search);
+
+/***
+ * Release a search. It keeps running in the DHT if it has not completed.
+ * @param search the search
+ */
+void search_kademlia_free(struct kademlia_search* search);
+
 int ping_kademlia (char *ip, uint16_t port);
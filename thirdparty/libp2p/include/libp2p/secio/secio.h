@@ -18,3 +18,60 @@
  * @returns true(1) on success, false(0) otherwise
  */
 int libp2p_secio_handshake(struct SessionContext* session, struct RsaPrivateKey* private_key, int remote_requested);
+
+/***
+ * The same handshake with fewer round trips. The protocol id and the
+ * proposal are sent together, the ephemeral key is made while the remote
+ * proposal is on its way, and the nonce check is not waited for: the echo
+ * of the remote nonce goes out with the first encrypted write (or before
+ * the first encrypted read), and the echo of ours is checked on the first
+ * encrypted read. It works with a remote doing the lock-step handshake.
+ * @param session the secure session to be filled
+ * @param private_key the local private key to use
+ * @param remote_requested the other side is who asked for the upgrade
+ * @returns true(1) on success, false(0) otherwise
+ */
+int libp2p_secio_handshake_optimistic(struct SessionContext* session, struct RsaPrivateKey* private_key, int remote_requested);
+
+/***
+ * The length prefix of a secio frame
+ */
+#define SECIO_FRAME_HEADER_SIZE 4
+/***
+ * The HMAC-SHA256 that follows the encrypted bytes of a secio frame
+ */
+#define SECIO_MAC_SIZE 32
+
+/***
+ * Key the cipher and mac contexts of both directions from the stretched
+ * keys of the session. They are kept for the life of the session, so each
+ * direction is one continuous AES-CTR stream.
+ * @param session the session, with local and remote stretched keys
+ * @returns true(1) on success, false(0) otherwise
+ */
+int libp2p_secio_start_ciphers(struct SessionContext* session);
+
+/***
+ * Free the cipher and mac contexts of the session
+ * @param session the session
+ */
+void libp2p_secio_stop_ciphers(struct SessionContext* session);
+
+/***
+ * Encrypt and mac a frame in place. The frame has SECIO_FRAME_HEADER_SIZE
+ * bytes of room, then the data, then SECIO_MAC_SIZE bytes of room.
+ * @param session the session, with ciphers started
+ * @param frame the frame
+ * @param data_size the number of bytes of data in the frame
+ * @returns the number of bytes of the frame to send, or 0 on error
+ */
+size_t libp2p_secio_encrypt_frame(struct SessionContext* session, unsigned char* frame, size_t data_size);
+
+/***
+ * Check the mac of a message read from the stream, then decrypt it in place
+ * @param session the session, with ciphers started
+ * @param message the encrypted bytes followed by the mac, without the length prefix
+ * @param message_size the size of the message
+ * @returns the number of bytes of data at the start of message, or -1 on error
+ */
+int libp2p_secio_decrypt_in_place(struct SessionContext* session, unsigned char* message, size_t message_size);
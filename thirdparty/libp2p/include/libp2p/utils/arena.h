@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+
+/***
+ * A bump allocator for things that live and die together, such as
+ * everything made while answering one DHT request.
+ *
+ * Allocations are carved out of blocks in order and never freed one by
+ * one. libp2p_utils_arena_reset releases them all at once, keeping the
+ * first block for the next round. Anything made in an arena must not be
+ * passed to the matching _free function.
+ */
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_BLOCK_SIZE 4096
+
+struct Libp2pArenaBlock;
+
+struct Libp2pArena {
+	struct Libp2pArenaBlock* first;
+	struct Libp2pArenaBlock* current;
+	size_t block_size;
+	// since the last reset
+	size_t used; // bytes handed out
+	size_t allocations; // allocations handed out
+	size_t mallocs; // blocks that had to be malloc'd
+	// the most bytes ever in use between two resets
+	size_t high_water;
+};
+
+/***
+ * Prepare an arena. Nothing is allocated until it is first used.
+ * @param arena the arena
+ * @param block_size the size of the blocks to carve from
+ */
+void libp2p_utils_arena_init(struct Libp2pArena* arena, size_t block_size);
+
+/***
+ * Allocate an arena
+ * @param block_size the size of the blocks to carve from
+ * @returns the arena, or NULL on error
+ */
+struct Libp2pArena* libp2p_utils_arena_new(size_t block_size);
+
+/***
+ * Get memory from an arena. The memory is not zeroed.
+ * @param arena the arena, or NULL to malloc instead
+ * @param size the bytes needed
+ * @returns the memory, or NULL on error
+ */
+void* libp2p_utils_arena_alloc(struct Libp2pArena* arena, size_t size);
+
+/***
+ * Release everything allocated from the arena, keeping the first block
+ * @param arena the arena
+ */
+void libp2p_utils_arena_reset(struct Libp2pArena* arena);
+
+/***
+ * Release all the blocks of an arena made with libp2p_utils_arena_init
+ * @param arena the arena
+ */
+void libp2p_utils_arena_clear(struct Libp2pArena* arena);
+
+/***
+ * Free an arena made with libp2p_utils_arena_new
+ * @param arena the arena
+ */
+void libp2p_utils_arena_free(struct Libp2pArena* arena);
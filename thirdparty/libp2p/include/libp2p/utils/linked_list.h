@@ -1,5 +1,7 @@
 #pragma once
 
+#include "libp2p/utils/arena.h"
+
 struct Libp2pLinkedList {
 	void* item;
 	struct Libp2pLinkedList* next;
@@ -11,6 +13,13 @@ struct Libp2pLinkedList {
  */
 struct Libp2pLinkedList* libp2p_utils_linked_list_new();
 
+/***
+ * Create a new linked list struct in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns a new linked list struct
+ */
+struct Libp2pLinkedList* libp2p_utils_linked_list_new_in(struct Libp2pArena* arena);
+
 /**
  * Free resources from a linked list
  * NOTE: if the item is a complex object, free the item before
@@ -28,6 +28,13 @@ int libp2p_logger_initialized();
 
 int libp2p_logger_free();
 
+/***
+ * Checks to see if messages from a class are printed
+ * @param area the class name
+ * @returns true(1) if the class is watched
+ */
+int libp2p_logger_watching_class(const char* area);
+
 /**
  * Log a message to the console
  * @param area the class it is coming from
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * An index of items by a key of bytes, with open addressing and linear
+ * probing, never more than 3/4 full. It holds pointers only; the items,
+ * and the keys inside them, belong to the caller.
+ */
+
+/**
+ * A slot of the index, with the hash of the key kept beside the item so
+ * most probes never look at the item itself. An empty slot has no item.
+ */
+struct Libp2pSlot {
+	uint64_t hash;
+	void* item;
+};
+
+struct Libp2pSlotIndex {
+	struct Libp2pSlot* slots;
+	// a power of 2
+	size_t capacity;
+	size_t count;
+};
+
+/**
+ * Whether an item is the one with this key
+ */
+typedef int (*libp2p_utils_slot_index_match)(const void* item, const unsigned char* key, size_t key_size);
+
+/***
+ * FNV-1a over the bytes of a key
+ * @param key the key
+ * @param key_size the size of the key
+ * @returns the hash
+ */
+uint64_t libp2p_utils_slot_index_hash(const unsigned char* key, size_t key_size);
+
+/***
+ * Set up an empty index
+ * @param index the index
+ * @param capacity the starting number of slots, a power of 2
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_utils_slot_index_init(struct Libp2pSlotIndex* index, size_t capacity);
+
+/***
+ * Free the slots of an index, but not the items in them
+ * @param index the index
+ */
+void libp2p_utils_slot_index_release(struct Libp2pSlotIndex* index);
+
+/***
+ * Find the slot of a key, or the empty slot where it would go
+ * @param index the index
+ * @param key the key
+ * @param key_size the size of the key
+ * @param hash the hash of the key
+ * @param match tells the item with the key from others of the same hash
+ * @returns the slot
+ */
+struct Libp2pSlot* libp2p_utils_slot_index_find(struct Libp2pSlotIndex* index, const unsigned char* key, size_t key_size, uint64_t hash, libp2p_utils_slot_index_match match);
+
+/***
+ * Make room for one more item, doubling the number of slots if need be.
+ * Slots found before this may have moved.
+ * @param index the index
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_utils_slot_index_reserve(struct Libp2pSlotIndex* index);
+
+/***
+ * Put an item in the empty slot found for its key, after making room for it
+ * @param index the index
+ * @param slot the slot
+ * @param hash the hash of the key
+ * @param item the item
+ */
+void libp2p_utils_slot_index_fill(struct Libp2pSlotIndex* index, struct Libp2pSlot* slot, uint64_t hash, void* item);
+
+/***
+ * Empty a slot, shifting back the items that probed past it, so that no
+ * tombstone is left behind
+ * @param index the index
+ * @param slot the slot
+ */
+void libp2p_utils_slot_index_remove(struct Libp2pSlotIndex* index, struct Libp2pSlot* slot);
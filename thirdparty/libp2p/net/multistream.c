@@ -10,6 +10,7 @@
 #include "libp2p/secio/secio.h"
 #include "varint.h"
 #include "libp2p/net/multistream.h"
+#include "libp2p/net/read_buffer.h"
 #include "multiaddr/multiaddr.h"
 
 // NOTE: this is normally set to 5 seconds, but you may want to increase this during debugging
@@ -37,20 +38,21 @@ int libp2p_net_multistream_close(void* stream_context) {
 int libp2p_net_multistream_write(void* stream_context, const unsigned char* data, size_t data_length) {
 	struct SessionContext* session_context = (struct SessionContext*)stream_context;
 	struct Stream* stream = session_context->insecure_stream;
-	int num_bytes = 0;
-
-	if (data_length > 0) { // only do this is if there is something to send
-		// first send the size
-		unsigned char varint[12];
-		size_t varint_size = 0;
-		varint_encode(data_length, &varint[0], 12, &varint_size);
-		num_bytes = socket_write(*((int*)stream->socket_descriptor), (char*)varint, varint_size, 0);
-		if (num_bytes == 0)
-			return 0;
-		// then send the actual data
-		num_bytes += socket_write(*((int*)stream->socket_descriptor), (char*)data, data_length, 0);
-	}
 
+	if (data_length == 0) // only do this is if there is something to send
+		return 0;
+	// the size, then the actual data, in one go
+	unsigned char varint[12];
+	size_t varint_size = 0;
+	varint_encode(data_length, &varint[0], 12, &varint_size);
+	struct iovec iov[2];
+	iov[0].iov_base = varint;
+	iov[0].iov_len = varint_size;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = data_length;
+	ssize_t num_bytes = socket_writev(*((int*)stream->socket_descriptor), iov, 2, 0);
+	if (num_bytes < 0)
+		return 0;
 	return num_bytes;
 }
 
@@ -65,56 +67,13 @@ int libp2p_net_multistream_write(void* stream_context, const unsigned char* data
 int libp2p_net_multistream_read(void* stream_context, unsigned char** results, size_t* results_size, int timeout_secs) {
 	struct SessionContext* session_context = (struct SessionContext*)stream_context;
 	struct Stream* stream = session_context->insecure_stream;
-	int bytes = 0;
-	// TODO: this is arbitrary, and should be dynamic
-	size_t buffer_size = 362144;
-	char buffer[buffer_size];
-	char* pos = buffer;
-	size_t num_bytes_requested = 0, left = 0, already_read = 0;
 
-	// first read the varint
-	while(1) {
-		unsigned char c = '\0';
-		bytes = socket_read(*((int*)stream->socket_descriptor), (char*)&c, 1, 0, timeout_secs);
-		if (bytes <= 0) { // timeout
+	if (stream->read_buffer == NULL) {
+		stream->read_buffer = libp2p_net_read_buffer_new(*((int*)stream->socket_descriptor));
+		if (stream->read_buffer == NULL)
 			return 0;
-		}
-		pos[0] = c;
-		if (c >> 7 == 0) {
-			pos[1] = 0;
-			num_bytes_requested = varint_decode((unsigned char*)buffer, strlen(buffer), NULL);
-			break;
-		}
-		pos++;
 	}
-	if (num_bytes_requested <= 0)
-		return 0;
-
-	left = num_bytes_requested;
-	do {
-		bytes = socket_read(*((int*)stream->socket_descriptor), &buffer[already_read], left, 0, timeout_secs);
-		if (bytes < 0) {
-			bytes = 0;
-			if ( (errno == EAGAIN)) {
-				// do something intelligent
-			} else {
-				return 0;
-			}
-		}
-		left = left - bytes;
-		already_read += bytes;
-	} while (left > 0);
-
-	if (already_read != num_bytes_requested)
-		return 0;
-
-	// parse the results, removing the leading size indicator
-	*results = malloc(num_bytes_requested);
-	if (*results == NULL)
-		return 0;
-	memcpy(*results, buffer, num_bytes_requested);
-	*results_size = num_bytes_requested;
-	return num_bytes_requested;
+	return libp2p_net_read_buffer_read_varint_frame(stream->read_buffer, results, results_size, timeout_secs);
 }
 
 
@@ -235,6 +194,7 @@ void libp2p_net_multistream_stream_free(struct Stream* stream) {
 		}
 		if (stream->address != NULL)
 			multiaddress_free(stream->address);
+		libp2p_net_read_buffer_free(stream->read_buffer);
 		free(stream);
 	}
 }
@@ -248,6 +208,8 @@ void libp2p_net_multistream_stream_free(struct Stream* stream) {
 struct Stream* libp2p_net_multistream_stream_new(int socket_fd, const char* ip, int port) {
 	struct Stream* out = (struct Stream*)malloc(sizeof(struct Stream));
 	if (out != NULL) {
+		out->read_buffer = NULL;
+		out->address = NULL;
 		out->socket_descriptor = malloc(sizeof(int));
 		*((int*)out->socket_descriptor) = socket_fd;
 		int res = *((int*)out->socket_descriptor);
@@ -255,6 +217,11 @@ struct Stream* libp2p_net_multistream_stream_new(int socket_fd, const char* ip,
 			libp2p_net_multistream_stream_free(out);
 			return NULL;
 		}
+		out->read_buffer = libp2p_net_read_buffer_new(socket_fd);
+		if (out->read_buffer == NULL) {
+			libp2p_net_multistream_stream_free(out);
+			return NULL;
+		}
 		out->close = libp2p_net_multistream_close;
 		out->read = libp2p_net_multistream_read;
 		out->write = libp2p_net_multistream_write;
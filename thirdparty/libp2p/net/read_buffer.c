@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "libp2p/net/read_buffer.h"
+#include "varint.h"
+
+#define READ_BUFFER_INITIAL_SIZE 16384
+
+/***
+ * An implementation of a buffered reader of length prefixed frames
+ */
+
+struct ReadBuffer* libp2p_net_read_buffer_new(int socket_descriptor) {
+	struct ReadBuffer* out = (struct ReadBuffer*)malloc(sizeof(struct ReadBuffer));
+	if (out != NULL) {
+		out->socket_descriptor = socket_descriptor;
+		out->buffer = malloc(READ_BUFFER_INITIAL_SIZE);
+		if (out->buffer == NULL) {
+			free(out);
+			return NULL;
+		}
+		out->buffer_size = READ_BUFFER_INITIAL_SIZE;
+		out->start = 0;
+		out->end = 0;
+		out->max_frame_size = READ_BUFFER_MAX_FRAME;
+		out->frame = NULL;
+		out->frame_size = 0;
+		out->frame_read = 0;
+		out->discard = 0;
+	}
+	return out;
+}
+
+void libp2p_net_read_buffer_free(struct ReadBuffer* read_buffer) {
+	if (read_buffer != NULL) {
+		if (read_buffer->buffer != NULL)
+			free(read_buffer->buffer);
+		if (read_buffer->frame != NULL)
+			free(read_buffer->frame);
+		free(read_buffer);
+	}
+}
+
+static long long libp2p_net_read_buffer_now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void libp2p_net_read_buffer_set_max_frame_size(struct ReadBuffer* read_buffer, size_t max_frame_size) {
+	read_buffer->max_frame_size = max_frame_size;
+}
+
+/***
+ * Receive what the socket has, up to len bytes, waiting for it if need be
+ * @param read_buffer the read buffer
+ * @param destination where to put the bytes
+ * @param len the most bytes to receive
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns the number of bytes received, 0 on time out, error, or a closed socket
+ */
+static size_t libp2p_net_read_buffer_recv(struct ReadBuffer* read_buffer, unsigned char* destination, size_t len, long long deadline_ms) {
+	for(;;) {
+		ssize_t bytes = recv(read_buffer->socket_descriptor, destination, len, MSG_DONTWAIT);
+		if (bytes > 0)
+			return bytes;
+		if (bytes == 0) // closed by the other side
+			return 0;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return 0;
+
+		// nothing to read, wait for something
+		long long left = deadline_ms - libp2p_net_read_buffer_now_ms();
+		if (left <= 0)
+			return 0;
+		struct pollfd pfd;
+		pfd.fd = read_buffer->socket_descriptor;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int rc = poll(&pfd, 1, (int)left);
+		if (rc == 0)
+			return 0;
+		if (rc < 0 && errno != EINTR)
+			return 0;
+	}
+}
+
+/***
+ * Make sure there are at least wanted bytes buffered, reading as much as
+ * there is room for each time
+ * @param read_buffer the read buffer
+ * @param wanted the number of bytes wanted, no more than the size of the buffer
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns true(1) if the bytes are there, false(0) on time out, error, or a closed socket
+ */
+static int libp2p_net_read_buffer_fill(struct ReadBuffer* read_buffer, size_t wanted, long long deadline_ms) {
+	while (read_buffer->end - read_buffer->start < wanted) {
+		// make room for the rest of what is wanted at the end
+		if (read_buffer->start + wanted > read_buffer->buffer_size) {
+			memmove(read_buffer->buffer, &read_buffer->buffer[read_buffer->start], read_buffer->end - read_buffer->start);
+			read_buffer->end -= read_buffer->start;
+			read_buffer->start = 0;
+		}
+		size_t bytes = libp2p_net_read_buffer_recv(read_buffer, &read_buffer->buffer[read_buffer->end],
+				read_buffer->buffer_size - read_buffer->end, deadline_ms);
+		if (bytes == 0)
+			return 0;
+		read_buffer->end += bytes;
+	}
+	return 1;
+}
+
+/***
+ * Receive the rest of the frame being read straight into its own buffer,
+ * and hand that buffer out
+ * @param read_buffer the read buffer
+ * @param results where to put the frame
+ * @param results_size the size of the frame
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns the size of the frame, or 0 if it is not all there yet
+ */
+static int libp2p_net_read_buffer_finish_frame(struct ReadBuffer* read_buffer, unsigned char** results, size_t* results_size, long long deadline_ms) {
+	while (read_buffer->frame_read < read_buffer->frame_size) {
+		size_t bytes = libp2p_net_read_buffer_recv(read_buffer, &read_buffer->frame[read_buffer->frame_read],
+				read_buffer->frame_size - read_buffer->frame_read, deadline_ms);
+		if (bytes == 0) // what was read is kept for the next call
+			return 0;
+		read_buffer->frame_read += bytes;
+	}
+	*results = read_buffer->frame;
+	*results_size = read_buffer->frame_size;
+	read_buffer->frame = NULL;
+	return *results_size;
+}
+
+/***
+ * Throw away what is left of a refused frame, as it arrives
+ * @param read_buffer the read buffer
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns true(1) once it is all gone, false(0) on time out, error, or a closed socket
+ */
+static int libp2p_net_read_buffer_discard(struct ReadBuffer* read_buffer, long long deadline_ms) {
+	while (read_buffer->discard > 0) {
+		if (read_buffer->start == read_buffer->end && !libp2p_net_read_buffer_fill(read_buffer, 1, deadline_ms))
+			return 0;
+		size_t buffered = read_buffer->end - read_buffer->start;
+		size_t dropped = buffered < read_buffer->discard ? buffered : read_buffer->discard;
+		read_buffer->start += dropped;
+		read_buffer->discard -= dropped;
+		if (read_buffer->start == read_buffer->end) {
+			read_buffer->start = 0;
+			read_buffer->end = 0;
+		}
+	}
+	return 1;
+}
+
+/***
+ * Drop a frame that is not handed out: its prefix now, and its payload as
+ * it arrives, so that the next read gets the frame after it
+ * @param read_buffer the read buffer, holding at least the prefix
+ * @param prefix_size the size of the length prefix
+ * @param frame_size the size of the frame
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns 0, as there is no frame
+ */
+static int libp2p_net_read_buffer_refuse(struct ReadBuffer* read_buffer, size_t prefix_size, size_t frame_size, long long deadline_ms) {
+	read_buffer->start += prefix_size;
+	if (read_buffer->start == read_buffer->end) {
+		read_buffer->start = 0;
+		read_buffer->end = 0;
+	}
+	read_buffer->discard = frame_size;
+	libp2p_net_read_buffer_discard(read_buffer, deadline_ms);
+	return 0;
+}
+
+/***
+ * Hand out a frame, and drop it and its prefix from the buffer. A frame
+ * that does not fit in the buffer is received into a buffer of its own.
+ * @param read_buffer the read buffer, holding at least the prefix
+ * @param prefix_size the size of the length prefix
+ * @param frame_size the size of the frame
+ * @param results where to put the frame
+ * @param results_size the size of the frame
+ * @param deadline_ms when to give up, on the monotonic clock
+ * @returns the size of the frame, or 0 on error or time out
+ */
+static int libp2p_net_read_buffer_take(struct ReadBuffer* read_buffer, size_t prefix_size, size_t frame_size, unsigned char** results, size_t* results_size, long long deadline_ms) {
+	if (prefix_size + frame_size <= read_buffer->buffer_size) {
+		if (!libp2p_net_read_buffer_fill(read_buffer, prefix_size + frame_size, deadline_ms))
+			return 0;
+		*results = malloc(frame_size);
+		if (*results == NULL)
+			return 0;
+		memcpy(*results, &read_buffer->buffer[read_buffer->start + prefix_size], frame_size);
+		*results_size = frame_size;
+		read_buffer->start += prefix_size + frame_size;
+	} else {
+		size_t buffered = read_buffer->end - read_buffer->start - prefix_size;
+		read_buffer->frame = malloc(frame_size);
+		if (read_buffer->frame == NULL)
+			return 0;
+		// anything buffered is the start of this frame, as the frame is bigger than the buffer
+		memcpy(read_buffer->frame, &read_buffer->buffer[read_buffer->start + prefix_size], buffered);
+		read_buffer->frame_size = frame_size;
+		read_buffer->frame_read = buffered;
+		read_buffer->start = read_buffer->end;
+	}
+	if (read_buffer->start == read_buffer->end) {
+		read_buffer->start = 0;
+		read_buffer->end = 0;
+	}
+	if (read_buffer->frame != NULL)
+		return libp2p_net_read_buffer_finish_frame(read_buffer, results, results_size, deadline_ms);
+	return frame_size;
+}
+
+int libp2p_net_read_buffer_read_varint_frame(struct ReadBuffer* read_buffer, unsigned char** results, size_t* results_size, int timeout_secs) {
+	long long deadline_ms = libp2p_net_read_buffer_now_ms() + (long long)timeout_secs * 1000;
+	size_t prefix_size = 0;
+	unsigned long long frame_size = 0;
+
+	if (read_buffer->frame != NULL)
+		return libp2p_net_read_buffer_finish_frame(read_buffer, results, results_size, deadline_ms);
+	if (read_buffer->discard > 0 && !libp2p_net_read_buffer_discard(read_buffer, deadline_ms))
+		return 0;
+
+	// find the last byte of the varint
+	do {
+		if (prefix_size == 10) // not a length, so nothing to skip but itself
+			return libp2p_net_read_buffer_refuse(read_buffer, prefix_size, 0, deadline_ms);
+		prefix_size++;
+		if (!libp2p_net_read_buffer_fill(read_buffer, prefix_size, deadline_ms))
+			return 0;
+	} while (read_buffer->buffer[read_buffer->start + prefix_size - 1] & 0x80);
+	frame_size = varint_decode(&read_buffer->buffer[read_buffer->start], prefix_size, NULL);
+	if (frame_size == 0 || frame_size > read_buffer->max_frame_size)
+		return libp2p_net_read_buffer_refuse(read_buffer, prefix_size, frame_size, deadline_ms);
+	return libp2p_net_read_buffer_take(read_buffer, prefix_size, frame_size, results, results_size, deadline_ms);
+}
+
+int libp2p_net_read_buffer_read_uint32_frame(struct ReadBuffer* read_buffer, unsigned char** results, size_t* results_size, int timeout_secs) {
+	long long deadline_ms = libp2p_net_read_buffer_now_ms() + (long long)timeout_secs * 1000;
+	const unsigned char* prefix;
+	uint32_t frame_size;
+
+	if (read_buffer->frame != NULL)
+		return libp2p_net_read_buffer_finish_frame(read_buffer, results, results_size, deadline_ms);
+	if (read_buffer->discard > 0 && !libp2p_net_read_buffer_discard(read_buffer, deadline_ms))
+		return 0;
+
+	// a spurious \n can come before the length
+	for(;;) {
+		if (!libp2p_net_read_buffer_fill(read_buffer, 4, deadline_ms))
+			return 0;
+		if (read_buffer->buffer[read_buffer->start] != '\n')
+			break;
+		read_buffer->start++;
+	}
+	prefix = &read_buffer->buffer[read_buffer->start];
+	frame_size = (uint32_t)prefix[0] << 24 | (uint32_t)prefix[1] << 16 | (uint32_t)prefix[2] << 8 | prefix[3];
+	if (frame_size == 0 || frame_size > read_buffer->max_frame_size)
+		return libp2p_net_read_buffer_refuse(read_buffer, 4, frame_size, deadline_ms);
+	return libp2p_net_read_buffer_take(read_buffer, 4, frame_size, results, results_size, deadline_ms);
+}
@@ -6,6 +6,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 
 #include "libp2p/net/p2pnet.h"
 
@@ -143,12 +144,24 @@ int socket_listen(int s, uint32_t *localip, uint16_t *localport)
  */
 ssize_t socket_read(int s, char *buf, size_t len, int flags, int num_secs)
 {
-	struct timeval tv;
-	tv.tv_sec = num_secs;
-	tv.tv_usec = 0;
-	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(struct timeval));
-
-	return recv(s, buf, len, flags);
+	ssize_t bytes = recv(s, buf, len, flags | MSG_DONTWAIT);
+	if (bytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+		return bytes;
+
+	// nothing there yet, wait for it with poll rather than set a receive
+	// timeout on the socket for every call. 0 seconds waits forever, as
+	// SO_RCVTIMEO did.
+	struct pollfd pfd;
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int rc = poll(&pfd, 1, num_secs > 0 ? num_secs * 1000 : -1);
+	if (rc <= 0) {
+		if (rc == 0)
+			errno = EAGAIN;
+		return -1;
+	}
+	return recv(s, buf, len, flags | MSG_DONTWAIT);
 }
 
 /* Same reason as socket_read, but to send data instead of receive.
@@ -158,6 +171,55 @@ ssize_t socket_write(int s, const char *buf, size_t len, int flags)
    return send(s, buf, len, flags);
 }
 
+ssize_t socket_writev(int s, struct iovec *iov, int iovcnt, int num_secs)
+{
+	struct msghdr msg;
+	ssize_t total = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	// skip empty buffers, so a done write has none left
+	while (msg.msg_iovlen > 0 && msg.msg_iov->iov_len == 0) {
+		msg.msg_iov++;
+		msg.msg_iovlen--;
+	}
+	while (msg.msg_iovlen > 0) {
+		ssize_t bytes = sendmsg(s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			// the socket is full, wait until it drains
+			struct pollfd pfd;
+			pfd.fd = s;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			int rc = poll(&pfd, 1, num_secs > 0 ? num_secs * 1000 : -1);
+			if (rc == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			if (rc < 0 && errno != EINTR)
+				return -1;
+			continue;
+		}
+		total += bytes;
+		// move past what was written
+		while (msg.msg_iovlen > 0 && (size_t)bytes >= msg.msg_iov->iov_len) {
+			bytes -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + bytes;
+			msg.msg_iov->iov_len -= bytes;
+		}
+	}
+	return total;
+}
+
 int socket_open4() {
 	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
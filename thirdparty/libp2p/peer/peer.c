@@ -12,7 +12,16 @@
  * @returns a struct or NULL if there was a problem
  */
 struct Libp2pPeer* libp2p_peer_new() {
-	struct Libp2pPeer* out = (struct Libp2pPeer*)malloc(sizeof(struct Libp2pPeer));
+	return libp2p_peer_new_in(NULL);
+}
+
+/**
+ * create a new Peer struct in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns a struct or NULL if there was a problem
+ */
+struct Libp2pPeer* libp2p_peer_new_in(struct Libp2pArena* arena) {
+	struct Libp2pPeer* out = (struct Libp2pPeer*)libp2p_utils_arena_alloc(arena, sizeof(struct Libp2pPeer));
 	if (out != NULL) {
 		out->id = NULL;
 		out->id_size = 0;
@@ -53,17 +62,16 @@ int libp2p_peer_connect(struct Libp2pPeer* peer) {
 	struct Libp2pLinkedList* current_address = peer->addr_head;
 	while (current_address != NULL && peer->connection_type != CONNECTION_TYPE_CONNECTED) {
 		struct MultiAddress *ma = (struct MultiAddress*)current_address->item;
-		if (multiaddress_is_ip(ma)) {
-			char* ip = NULL;
-			if (!multiaddress_get_ip_address(ma, &ip))
-				continue;
-			int port = multiaddress_get_ip_port(ma);
-			peer->connection = libp2p_net_multistream_connect(ip, port);
-			if (peer->connection != NULL) {
-				peer->connection_type = CONNECTION_TYPE_CONNECTED;
-			}
-			free(ip);
-		} // is IP
+		current_address = current_address->next;
+		// the address and port were decoded when the multiaddress was made
+		char* ip = NULL;
+		if (!multiaddress_get_ip_address(ma, &ip))
+			continue;
+		peer->connection = libp2p_net_multistream_connect(ip, multiaddress_get_ip_port(ma));
+		if (peer->connection != NULL) {
+			peer->connection_type = CONNECTION_TYPE_CONNECTED;
+		}
+		free(ip);
 	} // trying to connect
 	return peer->connection_type == CONNECTION_TYPE_CONNECTED;
 }
@@ -100,10 +108,12 @@ struct Libp2pPeer* libp2p_peer_new_from_data(const char* id, size_t id_size, con
 
 void libp2p_peer_free(struct Libp2pPeer* in) {
 	if (in != NULL) {
-		if (in->addr_head != NULL && in->addr_head->item != NULL) {
-			libp2p_logger_debug("peer", "Freeing peer %s\n", ((struct MultiAddress*)in->addr_head->item)->string);
-		} else {
-			libp2p_logger_debug("peer", "Freeing peer with no multiaddress.\n");
+		// the string of the address is only built for someone to read it
+		if (libp2p_logger_watching_class("peer")) {
+			if (in->addr_head != NULL && in->addr_head->item != NULL)
+				libp2p_logger_debug("peer", "Freeing peer %s\n", multiaddress_to_string((struct MultiAddress*)in->addr_head->item));
+			else
+				libp2p_logger_debug("peer", "Freeing peer with no multiaddress.\n");
 		}
 		if (in->id != NULL)
 			free(in->id);
@@ -129,14 +139,26 @@ void libp2p_peer_free(struct Libp2pPeer* in) {
  * @returns a new struct, that does not rely on the old
  */
 struct Libp2pPeer* libp2p_peer_copy(struct Libp2pPeer* in) {
-	struct Libp2pPeer* out = libp2p_peer_new();
+	return libp2p_peer_copy_in(NULL, in);
+}
+
+static void* libp2p_peer_arena_allocate(void* arena, size_t size) {
+	return libp2p_utils_arena_alloc((struct Libp2pArena*)arena, size);
+}
+
+/**
+ * Make a copy of a peer in an arena, id and addresses included
+ * @param arena where to allocate it, or NULL to malloc it
+ * @param in what is to be copied
+ * @returns a new struct, that does not rely on the old
+ */
+struct Libp2pPeer* libp2p_peer_copy_in(struct Libp2pArena* arena, struct Libp2pPeer* in) {
+	struct Libp2pPeer* out = libp2p_peer_new_in(arena);
 	if (out != NULL) {
 		out->id_size = in->id_size;
-		out->id = malloc(in->id_size);
-		if (out->id == NULL) {
-			libp2p_peer_free(out);
-			return NULL;
-		}
+		out->id = libp2p_utils_arena_alloc(arena, in->id_size);
+		if (out->id == NULL)
+			goto fail;
 		memcpy(out->id, in->id, in->id_size);
 		out->connection_type = in->connection_type;
 		// loop through the addresses
@@ -144,19 +166,32 @@ struct Libp2pPeer* libp2p_peer_copy(struct Libp2pPeer* in) {
 		struct Libp2pLinkedList* current_out = NULL;
 		while (current_in != NULL) {
 			struct MultiAddress* addr = (struct MultiAddress*)current_in->item;
-			struct Libp2pLinkedList* copy_item = libp2p_utils_linked_list_new();
-			copy_item->item = multiaddress_copy(addr);
+			struct Libp2pLinkedList* copy_item = libp2p_utils_linked_list_new_in(arena);
+			if (copy_item == NULL)
+				goto fail;
 			if (out->addr_head == NULL) {
 				out->addr_head = copy_item;
 			} else {
 				current_out->next = copy_item;
 			}
 			current_out = copy_item;
+			if (arena == NULL)
+				copy_item->item = multiaddress_copy(addr);
+			else
+				copy_item->item = multiaddress_copy_with(addr, libp2p_peer_arena_allocate, arena);
+			if (copy_item->item == NULL)
+				goto fail;
 			current_in = current_in->next;
 		}
 		out->connection = in->connection;
 	}
 	return out;
+
+	fail:
+	// what was taken from an arena goes back when the arena is reset
+	if (arena == NULL)
+		libp2p_peer_free(out);
+	return NULL;
 }
 
 /***
@@ -188,16 +223,17 @@ int libp2p_peer_is_connected(struct Libp2pPeer* in) {
 }
 
 size_t libp2p_peer_protobuf_encode_size(struct Libp2pPeer* in) {
-	int sz = 0;
+	size_t sz = 0;
 	if (in != NULL) {
 		// id + connection_type
-		sz = 11 + in->id_size + 11;
+		sz = protobuf_encode_length_delimited_size(1, in->id_size);
+		sz += protobuf_encode_varint_size(3, in->connection_type);
 		// loop through the multiaddresses
 		struct Libp2pLinkedList* current = in->addr_head;
 		while (current != NULL) {
-			// find the length of the MultiAddress converted into bytes
+			// the length of the MultiAddress converted into bytes
 			struct MultiAddress* data = (struct MultiAddress*)current->item;
-			sz += 11 + data->bsize;
+			sz += protobuf_encode_length_delimited_size(2, data->bsize);
 			current = current->next;
 		}
 	}
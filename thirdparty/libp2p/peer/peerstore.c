@@ -31,6 +31,44 @@ struct PeerEntry* libp2p_peer_entry_copy(struct PeerEntry* in) {
 	return out;
 }
 
+/***
+ * Whether a peerstore entry is the one with this peer id
+ */
+static int libp2p_peerstore_match(const void* item, const unsigned char* peer_id, size_t peer_id_size) {
+	struct Libp2pPeer* peer = ((const struct PeerEntry*)item)->peer;
+	return peer->id_size == peer_id_size && memcmp(peer->id, peer_id, peer_id_size) == 0;
+}
+
+/***
+ * Find the entry of a peer, adding a copy of the peer if it is not there
+ * @param peerstore the peerstore
+ * @param peer the peer
+ * @returns the entry in the peerstore, or NULL on error
+ */
+static struct PeerEntry* libp2p_peerstore_get_or_add_entry(struct Peerstore* peerstore, struct Libp2pPeer* peer) {
+	if (peer == NULL || peer->id_size == 0)
+		return NULL;
+	uint64_t hash = libp2p_utils_slot_index_hash((unsigned char*)peer->id, peer->id_size);
+	struct Libp2pSlot* slot = libp2p_utils_slot_index_find(&peerstore->index, (unsigned char*)peer->id, peer->id_size, hash, libp2p_peerstore_match);
+	if (slot->item != NULL)
+		return (struct PeerEntry*)slot->item;
+
+	if (!libp2p_utils_slot_index_reserve(&peerstore->index))
+		return NULL;
+	slot = libp2p_utils_slot_index_find(&peerstore->index, (unsigned char*)peer->id, peer->id_size, hash, libp2p_peerstore_match);
+
+	struct PeerEntry* entry = libp2p_peer_entry_new();
+	if (entry == NULL)
+		return NULL;
+	entry->peer = libp2p_peer_copy(peer);
+	if (entry->peer == NULL) {
+		free(entry);
+		return NULL;
+	}
+	libp2p_utils_slot_index_fill(&peerstore->index, slot, hash, entry);
+	return entry;
+}
+
 /**
  * Creates a new empty peerstore
  * @param peer_id the peer id as a null terminated string
@@ -39,8 +77,10 @@ struct PeerEntry* libp2p_peer_entry_copy(struct PeerEntry* in) {
 struct Peerstore* libp2p_peerstore_new(const char* peer_id) {
 	struct Peerstore* out = (struct Peerstore*)malloc(sizeof(struct Peerstore));
 	if (out != NULL) {
-		out->head_entry = NULL;
-		out->last_entry = NULL;
+		if (!libp2p_utils_slot_index_init(&out->index, PEERSTORE_INITIAL_CAPACITY)) {
+			free(out);
+			return NULL;
+		}
 		// now add this peer as the first entry
 		struct Libp2pPeer* peer = libp2p_peer_new();
 		peer->connection_type = CONNECTION_TYPE_NOT_CONNECTED;
@@ -60,43 +100,24 @@ struct Peerstore* libp2p_peerstore_new(const char* peer_id) {
  */
 int libp2p_peerstore_free(struct Peerstore* in) {
 	if (in != NULL) {
-		struct Libp2pLinkedList* current = in->head_entry;
-		struct Libp2pLinkedList* next = NULL;
-		while (current != NULL) {
-			next = current->next;
-			libp2p_peer_entry_free((struct PeerEntry*)current->item);
-			current->item = NULL;
-			current = next;
+		for(size_t i = 0; i < in->index.capacity; i++) {
+			if (in->index.slots[i].item != NULL)
+				libp2p_peer_entry_free((struct PeerEntry*)in->index.slots[i].item);
 		}
-		libp2p_utils_linked_list_free(in->head_entry);
+		libp2p_utils_slot_index_release(&in->index);
 		free(in);
 	}
 	return 1;
 }
 
 /**
- * Add a Peer to the Peerstore
+ * Add a Peer to the Peerstore, unless a peer with that id is there already
  * @param peerstore the peerstore to add the entry to
- * @param peer_entry the entry to add
+ * @param peer_entry the entry to add, which is copied
  * @returns true(1) on success, otherwise false
  */
 int libp2p_peerstore_add_peer_entry(struct Peerstore* peerstore, struct PeerEntry* peer_entry) {
-	struct Libp2pLinkedList* new_item = libp2p_utils_linked_list_new();
-	if (new_item == NULL)
-		return 0;
-	new_item->item = libp2p_peer_entry_copy(peer_entry);
-	if (new_item->item == NULL) {
-		libp2p_utils_linked_list_free(new_item);
-		return 0;
-	}
-	if (peerstore->head_entry == NULL) {
-		peerstore->head_entry = new_item;
-		peerstore->last_entry = new_item;
-	} else {
-		peerstore->last_entry->next = new_item;
-		peerstore->last_entry = new_item;
-	}
-	return 1;
+	return libp2p_peerstore_get_or_add_entry(peerstore, peer_entry->peer) != NULL;
 }
 
 /***
@@ -106,38 +127,26 @@ int libp2p_peerstore_add_peer_entry(struct Peerstore* peerstore, struct PeerEntr
  * @returns true(1) on success, otherwise false
  */
 int libp2p_peerstore_add_peer(struct Peerstore* peerstore, struct Libp2pPeer* peer) {
-	int retVal = 0;
+	if (peer == NULL || peer->id_size == 0)
+		return 0;
 
-	char* ma_string = "";
-	if (peer != NULL && peer->addr_head != NULL && peer->addr_head->item != NULL) {
-		ma_string = ((struct MultiAddress*)peer->addr_head->item)->string;
-	}
-	// first check to see if it exists. If it does, return TRUE
-	if (libp2p_peerstore_get_peer_entry(peerstore, peer->id, peer->id_size) != NULL) {
-		libp2p_logger_debug("peerstore", "Attempted to add %s to peerstore, but already there.\n", ma_string);
-		return 1;
-	}
+	size_t count = peerstore->index.count;
+	if (libp2p_peerstore_get_or_add_entry(peerstore, peer) == NULL)
+		return 0;
 
-	if (peer->id_size > 0) {
-		char peer_id[peer->id_size + 1];
-		memcpy(peer_id, peer->id, peer->id_size);
-		peer_id[peer->id_size] = 0;
-		if (peer->addr_head != NULL) {
-			char* address = ((struct MultiAddress*)peer->addr_head->item)->string;
-			libp2p_logger_debug("peerstore", "Adding peer %s with address %s to peer store\n", peer_id, address);
-		}
-		struct PeerEntry* peer_entry = libp2p_peer_entry_new();
-		if (peer_entry == NULL) {
-			return 0;
-		}
-		peer_entry->peer = libp2p_peer_copy(peer);
-		if (peer_entry->peer == NULL)
-			return 0;
-		retVal = libp2p_peerstore_add_peer_entry(peerstore, peer_entry);
-		libp2p_peer_entry_free(peer_entry);
-		libp2p_logger_debug("peerstore", "Adding peer %s to peerstore was a success\n", peer_id);
-	}
-	return retVal;
+	// the strings are only built for someone to read them
+	if (!libp2p_logger_watching_class("peerstore"))
+		return 1;
+	char peer_id[peer->id_size + 1];
+	memcpy(peer_id, peer->id, peer->id_size);
+	peer_id[peer->id_size] = 0;
+	if (count == peerstore->index.count)
+		libp2p_logger_debug("peerstore", "Attempted to add %s to peerstore, but already there.\n", peer_id);
+	else if (peer->addr_head != NULL && peer->addr_head->item != NULL)
+		libp2p_logger_debug("peerstore", "Added peer %s with address %s to peer store\n", peer_id, multiaddress_to_string((struct MultiAddress*)peer->addr_head->item));
+	else
+		libp2p_logger_debug("peerstore", "Added peer %s to peer store\n", peer_id);
+	return 1;
 }
 
 /**
@@ -148,20 +157,8 @@ int libp2p_peerstore_add_peer(struct Peerstore* peerstore, struct Libp2pPeer* pe
  * @returns the PeerEntry struct if found, otherwise NULL
  */
 struct PeerEntry* libp2p_peerstore_get_peer_entry(struct Peerstore* peerstore, const unsigned char* peer_id, size_t peer_id_size) {
-	struct Libp2pLinkedList* current = peerstore->head_entry;
-	// JMJ Debugging
-	int count = 0;
-	while(current != NULL) {
-		count++;
-		struct Libp2pPeer* peer = ((struct PeerEntry*)current->item)->peer;
-		if (peer->id_size == peer_id_size) {
-			if (memcmp(peer_id, peer->id, peer->id_size) == 0) {
-				return (struct PeerEntry*)current->item;
-			}
-		}
-		current = current->next;
-	}
-	return NULL;
+	uint64_t hash = libp2p_utils_slot_index_hash(peer_id, peer_id_size);
+	return (struct PeerEntry*)libp2p_utils_slot_index_find(&peerstore->index, peer_id, peer_id_size, hash, libp2p_peerstore_match)->item;
 }
 
 /**
@@ -180,18 +177,15 @@ struct Libp2pPeer* libp2p_peerstore_get_peer(struct Peerstore* peerstore, const
 
 /**
  * Look for this peer in the peerstore. If it is found, return a reference to that object.
- * If it is not found, add it, and return a reference to the new copy
+ * If it is not found, add it, and return a reference to the new copy. Either way it is
+ * one probe of the index.
  * @param peerstore the peerstore to search
  * @param in the peer to search for
+ * @returns the peer in the peerstore, or NULL on error
  */
 struct Libp2pPeer* libp2p_peerstore_get_or_add_peer(struct Peerstore* peerstore, struct Libp2pPeer* in) {
-	struct Libp2pPeer* out = libp2p_peerstore_get_peer(peerstore, (unsigned char*)in->id, in->id_size);
-	if (out != NULL)
-		return out;
-
-	// we didn't find it. attempt to add
-	if (!libp2p_peerstore_add_peer(peerstore, in))
+	struct PeerEntry* entry = libp2p_peerstore_get_or_add_entry(peerstore, in);
+	if (entry == NULL)
 		return NULL;
-
-	return libp2p_peerstore_get_peer(peerstore, (unsigned char*)in->id, in->id_size);
+	return entry->peer;
 }
@@ -1,23 +1,82 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "libp2p/utils/vector.h"
+#include "libp2p/peer/providerstore.h"
 #include "libp2p/utils/logger.h"
 
-struct ProviderEntry {
-	unsigned char* hash;
-	int hash_size;
-	unsigned char* peer_id;
-	int peer_id_size;
-};
+/***
+ * Stores hashes, and peers where you can possibly get them
+ */
 
-struct ProviderStore {
-	struct Libp2pVector* provider_entries;
-};
+/***
+ * Whether a key of the index is the one with this hash
+ */
+static int libp2p_providerstore_match(const void* item, const unsigned char* hash, size_t hash_size) {
+	const struct ProviderKey* key = (const struct ProviderKey*)item;
+	return (size_t)key->hash_size == hash_size && memcmp(key->hash, hash, hash_size) == 0;
+}
 
 /***
- * Stores hashes, and peers where you can possibly get them
+ * Find the slot of a hash, or the empty slot where it would go
  */
+static struct Libp2pSlot* libp2p_providerstore_find_slot(struct ProviderStore* store, const unsigned char* hash, int hash_size, uint64_t hash_code) {
+	return libp2p_utils_slot_index_find(&store->index, hash, hash_size, hash_code, libp2p_providerstore_match);
+}
+
+static struct ProviderRecord** libp2p_providerstore_wheel_slot(struct ProviderStore* store, time_t expires) {
+	return &store->wheel[(expires / PROVIDERSTORE_WHEEL_TICK) % PROVIDERSTORE_WHEEL_SLOTS];
+}
+
+static void libp2p_providerstore_wheel_insert(struct ProviderStore* store, struct ProviderRecord* record) {
+	struct ProviderRecord** slot = libp2p_providerstore_wheel_slot(store, record->expires);
+	record->wheel_prev = NULL;
+	record->wheel_next = *slot;
+	if (*slot != NULL)
+		(*slot)->wheel_prev = record;
+	*slot = record;
+}
+
+static void libp2p_providerstore_wheel_unlink(struct ProviderStore* store, struct ProviderRecord* record) {
+	if (record->wheel_prev != NULL)
+		record->wheel_prev->wheel_next = record->wheel_next;
+	else
+		*libp2p_providerstore_wheel_slot(store, record->expires) = record->wheel_next;
+	if (record->wheel_next != NULL)
+		record->wheel_next->wheel_prev = record->wheel_prev;
+	record->wheel_prev = NULL;
+	record->wheel_next = NULL;
+}
+
+static void libp2p_providerstore_key_free(struct ProviderKey* key) {
+	for(int i = 0; i < key->provider_count; i++) {
+		free(key->providers[i]->peer_id);
+		free(key->providers[i]);
+	}
+	free(key->hash);
+	free(key);
+}
+
+/***
+ * Drop a record, and its hash too if it was the last provider of it
+ * @param store the store
+ * @param record the record
+ */
+static void libp2p_providerstore_record_drop(struct ProviderStore* store, struct ProviderRecord* record) {
+	struct ProviderKey* key = record->key;
+	libp2p_providerstore_wheel_unlink(store, record);
+	for(int i = 0; i < key->provider_count; i++) {
+		if (key->providers[i] == record) {
+			key->providers[i] = key->providers[--key->provider_count];
+			break;
+		}
+	}
+	free(record->peer_id);
+	free(record);
+	if (key->provider_count == 0) {
+		libp2p_utils_slot_index_remove(&store->index, libp2p_providerstore_find_slot(store, key->hash, key->hash_size, key->hash_code));
+		libp2p_providerstore_key_free(key);
+	}
+}
 
 /**
  * Create a new ProviderStore
@@ -26,23 +85,15 @@ struct ProviderStore {
 struct ProviderStore* libp2p_providerstore_new() {
 	struct ProviderStore* out = (struct ProviderStore*)malloc(sizeof(struct ProviderStore));
 	if (out != NULL) {
-		out->provider_entries = libp2p_utils_vector_new(4);
-	}
-	return out;
-}
-
-void libp2p_providerstore_entry_free(struct ProviderEntry* in) {
-	if (in != NULL) {
-		if (in->hash != NULL) {
-			free(in->hash);
-			in->hash_size = 0;
-		}
-		if (in->peer_id != NULL) {
-			free(in->peer_id);
-			in->peer_id_size = 0;
+		memset(out, 0, sizeof(struct ProviderStore));
+		if (!libp2p_utils_slot_index_init(&out->index, PROVIDERSTORE_INITIAL_CAPACITY)) {
+			free(out);
+			return NULL;
 		}
-		free(in);
+		out->ttl = PROVIDERSTORE_TTL;
+		out->wheel_tick = time(NULL) / PROVIDERSTORE_WHEEL_TICK - 1;
 	}
+	return out;
 }
 
 /***
@@ -51,45 +102,158 @@ void libp2p_providerstore_entry_free(struct ProviderEntry* in) {
  */
 void libp2p_providerstore_free(struct ProviderStore* in) {
 	if (in != NULL) {
-		for(int i = 0; i < in->provider_entries->total; i++) {
-			struct ProviderEntry* entry = libp2p_utils_vector_get(in->provider_entries, i);
-			libp2p_providerstore_entry_free(entry);
+		for(size_t i = 0; i < in->index.capacity; i++) {
+			if (in->index.slots[i].item != NULL)
+				libp2p_providerstore_key_free((struct ProviderKey*)in->index.slots[i].item);
 		}
-		libp2p_utils_vector_free(in->provider_entries);
+		libp2p_utils_slot_index_release(&in->index);
 		free(in);
-		in = NULL;
 	}
 }
 
-int libp2p_providerstore_add(struct ProviderStore* store, unsigned char* hash, int hash_size, const unsigned char* peer_id, int peer_id_size) {
-	char hash_str[hash_size + 1];
-	memcpy(hash_str, hash, hash_size);
-	hash_str[hash_size] = 0;
-	char peer_str[peer_id_size + 1];
-	memcpy(peer_str, peer_id, peer_id_size);
-	peer_str[peer_id_size] = 0;
-	libp2p_logger_debug("providerstore", "Adding hash %s to providerstore. It can be retrieved from %s\n", hash_str, peer_str);
-	struct ProviderEntry* entry = (struct ProviderEntry*)malloc(sizeof(struct ProviderEntry));
-	entry->hash = malloc(hash_size);
-	memcpy(entry->hash, hash, hash_size);
-	entry->hash_size = hash_size;
-	entry->peer_id = malloc(peer_id_size);
-	memcpy(entry->peer_id, peer_id, peer_id_size);
-	entry->peer_id_size = peer_id_size;
-	libp2p_utils_vector_add(store->provider_entries, entry);
-	return 1;
+void libp2p_providerstore_expire(struct ProviderStore* store, time_t now) {
+	// only ticks that are over hold nothing but expired records
+	time_t last_tick = now / PROVIDERSTORE_WHEEL_TICK - 1;
+	if (last_tick <= store->wheel_tick)
+		return;
+	time_t tick = store->wheel_tick + 1;
+	// one turn of the wheel visits every slot
+	if (last_tick - tick >= PROVIDERSTORE_WHEEL_SLOTS)
+		tick = last_tick - PROVIDERSTORE_WHEEL_SLOTS + 1;
+	for(; tick <= last_tick; tick++) {
+		struct ProviderRecord* record = store->wheel[tick % PROVIDERSTORE_WHEEL_SLOTS];
+		while (record != NULL) {
+			struct ProviderRecord* next = record->wheel_next;
+			// the rest are due on a later turn
+			if (record->expires <= now)
+				libp2p_providerstore_record_drop(store, record);
+			record = next;
+		}
+	}
+	store->wheel_tick = last_tick;
 }
 
-int libp2p_providerstore_get(struct ProviderStore* store, const unsigned char* hash, int hash_size, unsigned char** peer_id, int *peer_id_size) {
-	struct ProviderEntry* current = NULL;
-	for (int i = 0; i < store->provider_entries->total; i++) {
-		current = (struct ProviderEntry*)libp2p_utils_vector_get(store->provider_entries, i);
-		if (current->hash_size == hash_size && memcmp(current->hash, hash, hash_size) == 0) {
-			*peer_id = malloc(current->peer_id_size);
-			memcpy(*peer_id, current->peer_id, current->peer_id_size);
-			*peer_id_size = current->peer_id_size;
-			return 1;
+int libp2p_providerstore_add(struct ProviderStore* store, const unsigned char* hash, int hash_size, const unsigned char* peer_id, int peer_id_size) {
+	time_t now = time(NULL);
+	libp2p_providerstore_expire(store, now);
+
+	// the strings are only built for someone to read them
+	if (libp2p_logger_watching_class("providerstore")) {
+		char hash_str[hash_size + 1];
+		memcpy(hash_str, hash, hash_size);
+		hash_str[hash_size] = 0;
+		char peer_str[peer_id_size + 1];
+		memcpy(peer_str, peer_id, peer_id_size);
+		peer_str[peer_id_size] = 0;
+		libp2p_logger_debug("providerstore", "Adding hash %s to providerstore. It can be retrieved from %s\n", hash_str, peer_str);
+	}
+
+	uint64_t hash_code = libp2p_utils_slot_index_hash(hash, hash_size);
+	struct Libp2pSlot* slot = libp2p_providerstore_find_slot(store, hash, hash_size, hash_code);
+	struct ProviderKey* key = (struct ProviderKey*)slot->item;
+	if (key == NULL) {
+		if (!libp2p_utils_slot_index_reserve(&store->index))
+			return 0;
+		slot = libp2p_providerstore_find_slot(store, hash, hash_size, hash_code);
+		key = (struct ProviderKey*)malloc(sizeof(struct ProviderKey));
+		if (key == NULL)
+			return 0;
+		key->hash = malloc(hash_size);
+		if (key->hash == NULL) {
+			free(key);
+			return 0;
 		}
+		memcpy(key->hash, hash, hash_size);
+		key->hash_size = hash_size;
+		key->hash_code = hash_code;
+		key->provider_count = 0;
+		libp2p_utils_slot_index_fill(&store->index, slot, hash_code, key);
+	}
+
+	// an announce from a known provider renews it
+	struct ProviderRecord* record = NULL;
+	for(int i = 0; i < key->provider_count; i++) {
+		struct ProviderRecord* current = key->providers[i];
+		if (current->peer_id_size == peer_id_size && memcmp(current->peer_id, peer_id, peer_id_size) == 0) {
+			record = current;
+			break;
+		}
+	}
+
+	if (record == NULL && key->provider_count == PROVIDERSTORE_MAX_PROVIDERS) {
+		// full, so the provider closest to expiring makes room
+		record = key->providers[0];
+		for(int i = 1; i < key->provider_count; i++) {
+			if (key->providers[i]->expires < record->expires)
+				record = key->providers[i];
+		}
+		unsigned char* copy = malloc(peer_id_size);
+		if (copy == NULL)
+			return 0;
+		memcpy(copy, peer_id, peer_id_size);
+		free(record->peer_id);
+		record->peer_id = copy;
+		record->peer_id_size = peer_id_size;
+	}
+
+	if (record != NULL) {
+		libp2p_providerstore_wheel_unlink(store, record);
+		record->expires = now + store->ttl;
+		libp2p_providerstore_wheel_insert(store, record);
+		return 1;
+	}
+
+	record = (struct ProviderRecord*)malloc(sizeof(struct ProviderRecord));
+	if (record == NULL)
+		goto fail;
+	record->peer_id = malloc(peer_id_size);
+	if (record->peer_id == NULL) {
+		free(record);
+		goto fail;
+	}
+	memcpy(record->peer_id, peer_id, peer_id_size);
+	record->peer_id_size = peer_id_size;
+	record->expires = now + store->ttl;
+	record->key = key;
+	key->providers[key->provider_count++] = record;
+	libp2p_providerstore_wheel_insert(store, record);
+	return 1;
+
+	fail:
+	// a hash is never left with no providers
+	if (key->provider_count == 0) {
+		libp2p_utils_slot_index_remove(&store->index, slot);
+		libp2p_providerstore_key_free(key);
 	}
 	return 0;
 }
+
+int libp2p_providerstore_get_providers(struct ProviderStore* store, const unsigned char* hash, int hash_size, struct ProviderRecord** providers, int max_providers) {
+	time_t now = time(NULL);
+	libp2p_providerstore_expire(store, now);
+
+	uint64_t hash_code = libp2p_utils_slot_index_hash(hash, hash_size);
+	struct ProviderKey* key = (struct ProviderKey*)libp2p_providerstore_find_slot(store, hash, hash_size, hash_code)->item;
+	if (key == NULL)
+		return 0;
+
+	int found = 0;
+	for(int i = 0; i < key->provider_count && found < max_providers; i++) {
+		// the tick under way is not expired yet
+		if (key->providers[i]->expires > now)
+			providers[found++] = key->providers[i];
+	}
+	return found;
+}
+
+int libp2p_providerstore_get(struct ProviderStore* store, const unsigned char* hash, int hash_size, unsigned char** peer_id, int *peer_id_size) {
+	struct ProviderRecord* record = NULL;
+	if (libp2p_providerstore_get_providers(store, hash, hash_size, &record, 1) == 0)
+		return 0;
+	*peer_id = malloc(record->peer_id_size);
+	if (*peer_id == NULL)
+		return 0;
+	memcpy(*peer_id, record->peer_id, record->peer_id_size);
+	*peer_id_size = record->peer_id_size;
+	return 1;
+}
@@ -17,7 +17,16 @@
  * @returns a new, allocated Libp2pMessage struct
  */
 struct Libp2pMessage* libp2p_message_new() {
-	struct Libp2pMessage* out = (struct Libp2pMessage*)malloc(sizeof(struct Libp2pMessage));
+	return libp2p_message_new_in(NULL);
+}
+
+/**
+ * create a new Libp2pMessage struct in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns a new Libp2pMessage with default settings
+ */
+struct Libp2pMessage* libp2p_message_new_in(struct Libp2pArena* arena) {
+	struct Libp2pMessage* out = (struct Libp2pMessage*)libp2p_utils_arena_alloc(arena, sizeof(struct Libp2pMessage));
 	if (out != NULL) {
 		out->closer_peer_head = NULL;
 		out->cluster_level_raw = 0;
@@ -44,6 +53,8 @@ void libp2p_message_free(struct Libp2pMessage* in) {
 			struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
 			libp2p_peer_free(peer);
 			current->item = NULL;
+			// free just this node, the rest of the list is still walked
+			current->next = NULL;
 			libp2p_utils_linked_list_free(current);
 			current = next;
 		}
@@ -55,6 +66,7 @@ void libp2p_message_free(struct Libp2pMessage* in) {
 			struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
 			libp2p_peer_free(peer);
 			current->item = NULL;
+			current->next = NULL;
 			libp2p_utils_linked_list_free(current);
 			current = next;
 		}
@@ -63,61 +75,122 @@ void libp2p_message_free(struct Libp2pMessage* in) {
 	}
 }
 
-size_t libp2p_message_protobuf_encode_size(const struct Libp2pMessage* in) {
+/***
+ * How many nested sizes are kept between working out the size of a message
+ * and encoding it. Nested messages past these are sized again as they are
+ * encoded.
+ */
+#define MESSAGE_ENCODE_SIZES 32
+
+/***
+ * The sizes of the nested messages, worked out bottom-up before anything is
+ * written: the record, then the closer peers, then the provider peers
+ */
+struct Libp2pMessageSizes {
+	size_t nested[MESSAGE_ENCODE_SIZES];
+	int count;
+};
+
+/***
+ * Keep the size of the next nested message, if there is room
+ * @returns the size
+ */
+static size_t libp2p_message_sizes_push(struct Libp2pMessageSizes* sizes, size_t size) {
+	if (sizes != NULL) {
+		if (sizes->count < MESSAGE_ENCODE_SIZES)
+			sizes->nested[sizes->count] = size;
+		sizes->count++;
+	}
+	return size;
+}
+
+/***
+ * Find the size of the next nested message, if it was kept
+ * @param sizes the sizes, or NULL
+ * @param nested how many nested messages have been encoded so far
+ * @param size where to put the size
+ * @returns true(1) if it was kept, otherwise false(0)
+ */
+static int libp2p_message_sizes_get(const struct Libp2pMessageSizes* sizes, int nested, size_t* size) {
+	if (sizes == NULL || nested >= sizes->count || nested >= MESSAGE_ENCODE_SIZES)
+		return 0;
+	*size = sizes->nested[nested];
+	return 1;
+}
+
+static size_t libp2p_message_protobuf_encode_size_with(const struct Libp2pMessage* in, struct Libp2pMessageSizes* sizes) {
+	if (sizes != NULL)
+		sizes->count = 0;
 	// message type
-	size_t retVal = 11;
-	// clusterlevelraw
-	retVal += 11;
+	size_t retVal = protobuf_encode_varint_size(1, in->message_type);
 	// key
-	retVal += in->key_size + 11;
+	if (in->key != NULL)
+		retVal += protobuf_encode_length_delimited_size(2, in->key_size);
 	// record
-	retVal += 11 + libp2p_record_protobuf_encode_size(in->record);
+	if (in->record != NULL)
+		retVal += protobuf_encode_length_delimited_size(3, libp2p_message_sizes_push(sizes, libp2p_record_protobuf_encode_size(in->record)));
 	// closer peers
 	struct Libp2pLinkedList* current = in->closer_peer_head;
 	while (current != NULL) {
-		retVal += 11 + libp2p_peer_protobuf_encode_size((struct Libp2pPeer*)current->item);
+		retVal += protobuf_encode_length_delimited_size(8, libp2p_message_sizes_push(sizes, libp2p_peer_protobuf_encode_size((struct Libp2pPeer*)current->item)));
 		current = current->next;
 	}
 	// provider peers
 	current = in->provider_peer_head;
 	while (current != NULL) {
-		retVal += 11 + libp2p_peer_protobuf_encode_size((struct Libp2pPeer*)current->item);
+		retVal += protobuf_encode_length_delimited_size(9, libp2p_message_sizes_push(sizes, libp2p_peer_protobuf_encode_size((struct Libp2pPeer*)current->item)));
 		current = current->next;
 	}
+	// clusterlevelraw
+	retVal += protobuf_encode_varint_size(10, in->cluster_level_raw);
 	return retVal;
 }
 
-/**
- * Convert a Libp2pMessage into protobuf format,
- * allocating memory as needed
- * @param in the Libp2pMessage to convert
- * @param buffer where to store the protobuf
- * @param buffer_size the size of the buffer
+size_t libp2p_message_protobuf_encode_size(const struct Libp2pMessage* in) {
+	return libp2p_message_protobuf_encode_size_with(in, NULL);
+}
+
+/***
+ * Encode a list of peers, each straight into the buffer behind its header
+ * @param field_number the field they go in
+ * @param head the list of peers
+ * @param sizes the sizes worked out before, or NULL
+ * @param nested how many nested messages have been encoded so far
+ * @param buffer where to put them
+ * @param max_buffer_size the room left in buffer
+ * @param bytes_written the number of bytes written
  * @returns true(1) on success, otherwise false(0)
  */
-int libp2p_message_protobuf_allocate_and_encode(const struct Libp2pMessage* in, unsigned char **buffer, size_t *buffer_size) {
-	*buffer_size = libp2p_message_protobuf_encode_size(in);
-	*buffer = malloc(*buffer_size);
-	if (*buffer == NULL) {
-		*buffer_size = 0;
-		return 0;
-	}
-	int retVal = libp2p_message_protobuf_encode(in, *buffer, *buffer_size, buffer_size);
-	if (retVal == 0) {
-		free(*buffer);
-		*buffer = NULL;
-		*buffer_size = 0;
+static int libp2p_message_peers_encode(int field_number, struct Libp2pLinkedList* head, const struct Libp2pMessageSizes* sizes, int* nested,
+		unsigned char* buffer, size_t max_buffer_size, size_t* bytes_written) {
+	size_t bytes_used = 0;
+	*bytes_written = 0;
+	struct Libp2pLinkedList* current = head;
+	while (current != NULL) {
+		struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
+		size_t peer_size = 0;
+		if (!libp2p_message_sizes_get(sizes, (*nested)++, &peer_size))
+			peer_size = libp2p_peer_protobuf_encode_size(peer);
+		if (!protobuf_encode_length_delimited_header(field_number, WIRETYPE_LENGTH_DELIMITED, peer_size, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used))
+			return 0;
+		*bytes_written += bytes_used;
+		if (peer_size > max_buffer_size - *bytes_written)
+			return 0;
+		if (!libp2p_peer_protobuf_encode(peer, &buffer[*bytes_written], peer_size, &bytes_used) || bytes_used != peer_size)
+			return 0;
+		*bytes_written += bytes_used;
+		current = current->next;
 	}
-	return retVal;
+	return 1;
 }
 
-int libp2p_message_protobuf_encode(const struct Libp2pMessage* in, unsigned char* buffer, size_t max_buffer_size, size_t* bytes_written) {
+static int libp2p_message_protobuf_encode_with(const struct Libp2pMessage* in, const struct Libp2pMessageSizes* sizes,
+		unsigned char* buffer, size_t max_buffer_size, size_t* bytes_written) {
 	// data & data_size
 	size_t bytes_used = 0;
 	*bytes_written = 0;
 	int retVal = 0;
-	size_t protobuf_size = 0;
-	unsigned char* protobuf = NULL;
+	int nested = 0;
 	// field 1
 	retVal = protobuf_encode_varint(1, WIRETYPE_VARINT, in->message_type, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
 	if (retVal == 0)
@@ -130,58 +203,29 @@ int libp2p_message_protobuf_encode(const struct Libp2pMessage* in, unsigned char
 			return 0;
 		*bytes_written += bytes_used;
 	}
-	// field 3
+	// field 3, encoded in place behind its header
 	if (in->record != NULL) {
-		protobuf_size = libp2p_record_protobuf_encode_size(in->record);
-		protobuf = (unsigned char*) malloc(protobuf_size);
-		if (!libp2p_record_protobuf_encode(in->record, protobuf, protobuf_size, &protobuf_size)) {
-			free(protobuf);
-			return 0;
-		}
-		retVal = protobuf_encode_length_delimited(3, WIRETYPE_LENGTH_DELIMITED, protobuf, protobuf_size, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
-		free(protobuf);
+		size_t record_size = 0;
+		if (!libp2p_message_sizes_get(sizes, nested++, &record_size))
+			record_size = libp2p_record_protobuf_encode_size(in->record);
+		retVal = protobuf_encode_length_delimited_header(3, WIRETYPE_LENGTH_DELIMITED, record_size, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
 		if (retVal == 0)
 			return 0;
 		*bytes_written += bytes_used;
-	}
-	// field 8 (repeated)
-	struct Libp2pLinkedList* current = in->closer_peer_head;
-	while (current != NULL) {
-		struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
-		protobuf_size = libp2p_peer_protobuf_encode_size(peer);
-		unsigned char* peer_buffer = (unsigned char*)malloc(protobuf_size);
-		if (peer_buffer == NULL)
+		if (record_size > max_buffer_size - *bytes_written)
 			return 0;
-		if (!libp2p_peer_protobuf_encode(peer, peer_buffer, protobuf_size, &protobuf_size)) {
-			free(peer_buffer);
-			return 0;
-		}
-		retVal = protobuf_encode_length_delimited(8, WIRETYPE_LENGTH_DELIMITED, peer_buffer, protobuf_size, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
-		free(peer_buffer);
-		if (retVal == 0)
+		if (!libp2p_record_protobuf_encode(in->record, &buffer[*bytes_written], record_size, &bytes_used) || bytes_used != record_size)
 			return 0;
 		*bytes_written += bytes_used;
-		current = current->next;
 	}
+	// field 8 (repeated)
+	if (!libp2p_message_peers_encode(8, in->closer_peer_head, sizes, &nested, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used))
+		return 0;
+	*bytes_written += bytes_used;
 	// field 9 (repeated)
-	current = in->provider_peer_head;
-	while (current != NULL) {
-		struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
-		protobuf_size = libp2p_peer_protobuf_encode_size(peer);
-		unsigned char* peer_buffer = (unsigned char*)malloc(protobuf_size);
-		if (peer_buffer == NULL)
-			return 0;
-		if (!libp2p_peer_protobuf_encode(peer, peer_buffer, protobuf_size, &protobuf_size)) {
-			free(peer_buffer);
-			return 0;
-		}
-		retVal = protobuf_encode_length_delimited(9, WIRETYPE_LENGTH_DELIMITED, peer_buffer, protobuf_size, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
-		free(peer_buffer);
-		if (retVal == 0)
-			return 0;
-		*bytes_written += bytes_used;
-		current = current->next;
-	}
+	if (!libp2p_message_peers_encode(9, in->provider_peer_head, sizes, &nested, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used))
+		return 0;
+	*bytes_written += bytes_used;
 	// field 10
 	retVal = protobuf_encode_varint(10, WIRETYPE_VARINT, in->cluster_level_raw, &buffer[*bytes_written], max_buffer_size - *bytes_written, &bytes_used);
 	if (retVal == 0)
@@ -190,6 +234,36 @@ int libp2p_message_protobuf_encode(const struct Libp2pMessage* in, unsigned char
 	return 1;
 }
 
+int libp2p_message_protobuf_encode(const struct Libp2pMessage* in, unsigned char* buffer, size_t max_buffer_size, size_t* bytes_written) {
+	return libp2p_message_protobuf_encode_with(in, NULL, buffer, max_buffer_size, bytes_written);
+}
+
+/**
+ * Convert a Libp2pMessage into protobuf format,
+ * allocating memory as needed. The nested sizes are worked out once, and
+ * used for both the allocation and the length of each nested message.
+ * @param in the Libp2pMessage to convert
+ * @param buffer where to store the protobuf
+ * @param buffer_size the size of the buffer
+ * @returns true(1) on success, otherwise false(0)
+ */
+int libp2p_message_protobuf_allocate_and_encode(const struct Libp2pMessage* in, unsigned char **buffer, size_t *buffer_size) {
+	struct Libp2pMessageSizes sizes;
+	*buffer_size = libp2p_message_protobuf_encode_size_with(in, &sizes);
+	*buffer = malloc(*buffer_size);
+	if (*buffer == NULL) {
+		*buffer_size = 0;
+		return 0;
+	}
+	int retVal = libp2p_message_protobuf_encode_with(in, &sizes, *buffer, *buffer_size, buffer_size);
+	if (retVal == 0) {
+		free(*buffer);
+		*buffer = NULL;
+		*buffer_size = 0;
+	}
+	return retVal;
+}
+
 int libp2p_message_protobuf_decode(unsigned char* in, size_t in_size, struct Libp2pMessage** out) {
 	size_t pos = 0;
 	int retVal = 0;
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "libp2p/record/message_view.h"
+#include "libp2p/utils/linked_list.h"
+#include "protobuf.h"
+#include "multiaddr/multiaddr.h"
+
+/***
+ * Decoding of messages, records and peers into views that point into the
+ * protobuf rather than copying out of it. Every read is checked against
+ * the size of the buffer.
+ */
+
+static int libp2p_message_view_varint(const unsigned char* in, size_t in_size, size_t* pos, unsigned long long* value) {
+	unsigned long long result = 0;
+	for(int shift = 0; shift < 64; shift += 7) {
+		if (*pos >= in_size)
+			return 0;
+		unsigned char byte = in[(*pos)++];
+		result |= (unsigned long long)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			*value = result;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int libp2p_message_view_bytes(const unsigned char* in, size_t in_size, size_t* pos, const unsigned char** bytes, size_t* bytes_size) {
+	unsigned long long length = 0;
+	if (!libp2p_message_view_varint(in, in_size, pos, &length))
+		return 0;
+	if (length > in_size - *pos)
+		return 0;
+	*bytes = &in[*pos];
+	*bytes_size = length;
+	*pos += length;
+	return 1;
+}
+
+static int libp2p_message_view_field(const unsigned char* in, size_t in_size, size_t* pos, int* field_no, enum WireType* field_type) {
+	unsigned long long key = 0;
+	if (!libp2p_message_view_varint(in, in_size, pos, &key))
+		return 0;
+	*field_no = key >> 3;
+	*field_type = key & 7;
+	return *field_no > 0;
+}
+
+/***
+ * Step over a field this view has no use for
+ * @returns true(1) on success, otherwise false(0)
+ */
+static int libp2p_message_view_skip(const unsigned char* in, size_t in_size, size_t* pos, enum WireType field_type) {
+	unsigned long long value = 0;
+	const unsigned char* bytes = NULL;
+	size_t bytes_size = 0;
+	switch(field_type) {
+		case (WIRETYPE_VARINT):
+			return libp2p_message_view_varint(in, in_size, pos, &value);
+		case (WIRETYPE_LENGTH_DELIMITED):
+			return libp2p_message_view_bytes(in, in_size, pos, &bytes, &bytes_size);
+		case (WIRETYPE_64BIT):
+			bytes_size = 8;
+			break;
+		case (WIRETYPE_32BIT):
+			bytes_size = 4;
+			break;
+		default:
+			return 0;
+	}
+	if (bytes_size > in_size - *pos)
+		return 0;
+	*pos += bytes_size;
+	return 1;
+}
+
+int libp2p_record_view_decode(const unsigned char* in, size_t in_size, struct Libp2pRecordView* out) {
+	size_t pos = 0;
+	memset(out, 0, sizeof(struct Libp2pRecordView));
+	while (pos < in_size) {
+		int field_no = 0;
+		enum WireType field_type = 0;
+		if (!libp2p_message_view_field(in, in_size, &pos, &field_no, &field_type))
+			return 0;
+		if (field_no > 5) {
+			if (!libp2p_message_view_skip(in, in_size, &pos, field_type))
+				return 0;
+			continue;
+		}
+		if (field_type != WIRETYPE_LENGTH_DELIMITED)
+			return 0;
+		const unsigned char** bytes = NULL;
+		size_t* bytes_size = NULL;
+		switch(field_no) {
+			case (1): bytes = &out->key; bytes_size = &out->key_size; break;
+			case (2): bytes = &out->value; bytes_size = &out->value_size; break;
+			case (3): bytes = &out->author; bytes_size = &out->author_size; break;
+			case (4): bytes = &out->signature; bytes_size = &out->signature_size; break;
+			case (5): bytes = &out->time_received; bytes_size = &out->time_received_size; break;
+		}
+		if (!libp2p_message_view_bytes(in, in_size, &pos, bytes, bytes_size))
+			return 0;
+	}
+	return 1;
+}
+
+int libp2p_peer_view_decode(const unsigned char* in, size_t in_size, struct Libp2pPeerView* out) {
+	size_t pos = 0;
+	const unsigned char* bytes = NULL;
+	size_t bytes_size = 0;
+	unsigned long long value = 0;
+
+	memset(out, 0, sizeof(struct Libp2pPeerView));
+	out->protobuf = in;
+	out->protobuf_size = in_size;
+	while (pos < in_size) {
+		int field_no = 0;
+		enum WireType field_type = 0;
+		if (!libp2p_message_view_field(in, in_size, &pos, &field_no, &field_type))
+			return 0;
+		switch(field_no) {
+			case (1): // id
+				if (field_type != WIRETYPE_LENGTH_DELIMITED || !libp2p_message_view_bytes(in, in_size, &pos, &out->id, &out->id_size))
+					return 0;
+				break;
+			case (2): // multiaddress bytes, parsed only when asked for
+				if (field_type != WIRETYPE_LENGTH_DELIMITED || !libp2p_message_view_bytes(in, in_size, &pos, &bytes, &bytes_size))
+					return 0;
+				out->address_count++;
+				break;
+			case (3): // connection type
+				if (field_type != WIRETYPE_VARINT || !libp2p_message_view_varint(in, in_size, &pos, &value))
+					return 0;
+				out->connection_type = (enum ConnectionType)value;
+				break;
+			default:
+				if (!libp2p_message_view_skip(in, in_size, &pos, field_type))
+					return 0;
+				break;
+		}
+	}
+	return 1;
+}
+
+int libp2p_message_view_decode(const unsigned char* in, size_t in_size, struct Libp2pMessageView* out) {
+	size_t pos = 0;
+	const unsigned char* bytes = NULL;
+	size_t bytes_size = 0;
+	unsigned long long value = 0;
+	struct Libp2pPeerView peer;
+
+	memset(out, 0, sizeof(struct Libp2pMessageView));
+	out->protobuf = in;
+	out->protobuf_size = in_size;
+	while (pos < in_size) {
+		int field_no = 0;
+		enum WireType field_type = 0;
+		if (!libp2p_message_view_field(in, in_size, &pos, &field_no, &field_type))
+			return 0;
+		switch(field_no) {
+			case (1): // message type
+				if (field_type != WIRETYPE_VARINT || !libp2p_message_view_varint(in, in_size, &pos, &value))
+					return 0;
+				out->message_type = (enum MessageType)value;
+				break;
+			case (2): // key
+				if (field_type != WIRETYPE_LENGTH_DELIMITED || !libp2p_message_view_bytes(in, in_size, &pos, &out->key, &out->key_size))
+					return 0;
+				break;
+			case (3): // record
+				if (field_type != WIRETYPE_LENGTH_DELIMITED || !libp2p_message_view_bytes(in, in_size, &pos, &bytes, &bytes_size))
+					return 0;
+				if (!libp2p_record_view_decode(bytes, bytes_size, &out->record))
+					return 0;
+				out->has_record = 1;
+				break;
+			case (MESSAGE_VIEW_CLOSER_PEERS):
+			case (MESSAGE_VIEW_PROVIDER_PEERS):
+				// checked now, so that walking them later cannot fail
+				if (field_type != WIRETYPE_LENGTH_DELIMITED || !libp2p_message_view_bytes(in, in_size, &pos, &bytes, &bytes_size))
+					return 0;
+				if (!libp2p_peer_view_decode(bytes, bytes_size, &peer))
+					return 0;
+				if (field_no == MESSAGE_VIEW_CLOSER_PEERS)
+					out->closer_peer_count++;
+				else
+					out->provider_peer_count++;
+				break;
+			case (10): // cluster level raw
+				if (field_type != WIRETYPE_VARINT || !libp2p_message_view_varint(in, in_size, &pos, &value))
+					return 0;
+				out->cluster_level_raw = (int32_t)value;
+				break;
+			default:
+				if (!libp2p_message_view_skip(in, in_size, &pos, field_type))
+					return 0;
+				break;
+		}
+	}
+	return 1;
+}
+
+/***
+ * Find the next length delimited field with a given number
+ * @returns true(1) if found, otherwise false(0)
+ */
+static int libp2p_message_view_next_bytes(const unsigned char* in, size_t in_size, int wanted, size_t* pos, const unsigned char** bytes, size_t* bytes_size) {
+	while (*pos < in_size) {
+		int field_no = 0;
+		enum WireType field_type = 0;
+		if (!libp2p_message_view_field(in, in_size, pos, &field_no, &field_type))
+			return 0;
+		if (field_no == wanted && field_type == WIRETYPE_LENGTH_DELIMITED)
+			return libp2p_message_view_bytes(in, in_size, pos, bytes, bytes_size);
+		if (!libp2p_message_view_skip(in, in_size, pos, field_type))
+			return 0;
+	}
+	return 0;
+}
+
+int libp2p_message_view_next_peer(const struct Libp2pMessageView* view, int field_number, size_t* pos, struct Libp2pPeerView* peer) {
+	const unsigned char* bytes = NULL;
+	size_t bytes_size = 0;
+	if (!libp2p_message_view_next_bytes(view->protobuf, view->protobuf_size, field_number, pos, &bytes, &bytes_size))
+		return 0;
+	return libp2p_peer_view_decode(bytes, bytes_size, peer);
+}
+
+int libp2p_peer_view_next_address(const struct Libp2pPeerView* peer, size_t* pos, const unsigned char** bytes, size_t* bytes_size) {
+	return libp2p_message_view_next_bytes(peer->protobuf, peer->protobuf_size, 2, pos, bytes, bytes_size);
+}
+
+struct Libp2pPeer* libp2p_peer_view_to_peer(const struct Libp2pPeerView* view) {
+	struct Libp2pLinkedList* last = NULL;
+	const unsigned char* bytes = NULL;
+	size_t bytes_size = 0;
+	size_t pos = 0;
+
+	struct Libp2pPeer* out = libp2p_peer_new();
+	if (out == NULL)
+		return NULL;
+	out->connection_type = view->connection_type;
+	if (view->id_size > 0) {
+		out->id = malloc(view->id_size);
+		if (out->id == NULL)
+			goto fail;
+		memcpy(out->id, view->id, view->id_size);
+		out->id_size = view->id_size;
+	}
+	while (libp2p_peer_view_next_address(view, &pos, &bytes, &bytes_size)) {
+		struct Libp2pLinkedList* item = libp2p_utils_linked_list_new();
+		if (item == NULL)
+			goto fail;
+		if (last == NULL)
+			out->addr_head = item;
+		else
+			last->next = item;
+		last = item;
+		item->item = multiaddress_new_from_bytes(bytes, bytes_size);
+		if (item->item == NULL)
+			goto fail;
+	}
+	return out;
+
+	fail:
+	libp2p_peer_free(out);
+	return NULL;
+}
@@ -14,7 +14,16 @@
  * @returns the newly allocated record struct
  */
 struct Libp2pRecord* libp2p_record_new() {
-	struct Libp2pRecord* out = (struct Libp2pRecord*)malloc(sizeof(struct Libp2pRecord));
+	return libp2p_record_new_in(NULL);
+}
+
+/**
+ * Create a record with default settings in an arena
+ * @param arena where to allocate it, or NULL to malloc it
+ * @returns the newly allocated record struct
+ */
+struct Libp2pRecord* libp2p_record_new_in(struct Libp2pArena* arena) {
+	struct Libp2pRecord* out = (struct Libp2pRecord*)libp2p_utils_arena_alloc(arena, sizeof(struct Libp2pRecord));
 	if (out != NULL) {
 		out->author = NULL;
 		out->author_size = 0;
@@ -115,18 +124,18 @@ int libp2p_record_protobuf_encode(const struct Libp2pRecord* in, unsigned char*
 }
 
 /**
- * Generates an estimate of the buffer size needed to encode the struct
+ * The exact buffer size needed to encode the struct
  * @param in the Libp2pRecord that you want to encode
- * @returns the approximate number of bytes required
+ * @returns the number of bytes required
  */
 size_t libp2p_record_protobuf_encode_size(const struct Libp2pRecord* in) {
 	size_t retVal = 0;
 	if (in != NULL) {
-		retVal = 11 + in->key_size;
-		retVal += 11 + in->value_size;
-		retVal += 11 + in->author_size;
-		retVal += 11 + in->signature_size;
-		retVal += 11 + in->time_received_size;
+		retVal = protobuf_encode_length_delimited_size(1, in->key_size);
+		retVal += protobuf_encode_length_delimited_size(2, in->value_size);
+		retVal += protobuf_encode_length_delimited_size(3, in->author_size);
+		retVal += protobuf_encode_length_delimited_size(4, in->signature_size);
+		retVal += protobuf_encode_length_delimited_size(5, in->time_received_size);
 	}
 	return retVal;
 }
@@ -36,6 +36,7 @@ THE SOFTWARE.
 #include <errno.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #if !defined(_WIN32) || defined(__MINGW32__)
 #include <sys/time.h>
@@ -62,12 +63,6 @@ THE SOFTWARE.
 
 #include "libp2p/routing/dht.h"
 
-#ifndef HAVE_MEMMEM
-#ifdef __GLIBC__
-#define HAVE_MEMMEM
-#endif
-#endif
-
 #ifndef MSG_CONFIRM
 #define MSG_CONFIRM 0
 #endif
@@ -160,18 +155,29 @@ struct node {
     time_t reply_time;          /* time of last correct reply received */
     time_t pinged_time;         /* time of last request */
     int pinged;                 /* how many requests we sent since last reply */
-    struct node *next;
 };
 
+/* The number of nodes a bucket holds. */
+#define BUCKET_SIZE 8
+
 struct bucket {
     int af;
-    unsigned char first[20];
+    int depth;                  /* number of bits in common with myid */
     int count;                  /* number of nodes */
     time_t time;                /* time of last reply in this bucket */
-    struct node *nodes;
+    struct node nodes[BUCKET_SIZE];
     struct sockaddr_storage cached;  /* the address of a likely candidate */
     int cachedlen;
-    struct bucket *next;
+};
+
+/* The routing table is an array of buckets indexed by the number of
+   leading bits an id has in common with ours.  Bucket i holds the nodes
+   that share exactly i bits with myid, except for the last one, which
+   holds all the nodes at least that close and is the only one that is
+   ever split. */
+struct routing_table {
+    int numbuckets;
+    struct bucket buckets[161];
 };
 
 struct search_node {
@@ -209,6 +215,7 @@ struct peer {
     unsigned char ip[16];
     unsigned short len;
     unsigned short port;
+    int older, newer;           /* neighbours in the age list, or -1 */
 };
 
 /* The maximum number of peers we store for a given hash. */
@@ -231,11 +238,21 @@ struct peer {
 #define DHT_SEARCH_EXPIRE_TIME (62 * 60)
 #endif
 
+/* The time after which an announced peer is forgotten. */
+#define DHT_PEER_EXPIRE_TIME (32 * 60)
+
+/* Storage expiry is driven by a wheel of one-minute slots.  It must
+   cover more than DHT_PEER_EXPIRE_TIME. */
+#define STORAGE_WHEEL_SLOTS 64
+
 struct storage {
     unsigned char id[20];
     int numpeers, maxpeers;
     struct peer *peers;
-    struct storage *next;
+    int *index;                 /* open-addressed (ip, port) -> peer */
+    int indexsize;
+    int oldest, newest;         /* ends of the age list of peers */
+    struct storage *wheel_next; /* in its slot, which is emptied whole */
 };
 
 static struct storage * find_storage(const unsigned char *id);
@@ -267,9 +284,9 @@ static int send_announce_peer(const struct sockaddr *sa, int salen,
                               unsigned char *infohas, unsigned short port,
                               unsigned char *token, int token_len, int confirm);
 static int send_peer_announced(const struct sockaddr *sa, int salen,
-                               unsigned char *tid, int tid_len);
+                               const unsigned char *tid, int tid_len);
 static int send_error(const struct sockaddr *sa, int salen,
-                      unsigned char *tid, int tid_len,
+                      const unsigned char *tid, int tid_len,
                       int code, const char *message);
 
 #define ERROR 0
@@ -282,25 +299,29 @@ static int send_error(const struct sockaddr *sa, int salen,
 #define WANT4 1
 #define WANT6 2
 
+/* A parsed KRPC message.  All the pointers point into the buffer that
+   was parsed, which must outlive the message.  Missing fields point to
+   zeroes, and missing strings have length 0. */
+struct message {
+    const unsigned char *tid;
+    int tid_len;
+    const unsigned char *id, *info_hash, *target;
+    unsigned short port;
+    const unsigned char *token;
+    int token_len;
+    const unsigned char *nodes, *nodes6;
+    int nodes_len, nodes6_len;
+    const unsigned char *values;       /* contents of the values list */
+    int values_len;
+    int want;
+};
+
 static int parse_message(const unsigned char *buf, int buflen,
-                         unsigned char *tid_return, int *tid_len,
-                         unsigned char *id_return,
-                         unsigned char *info_hash_return,
-                         unsigned char *target_return,
-                         unsigned short *port_return,
-                         unsigned char *token_return, int *token_len,
-                         unsigned char *nodes_return, int *nodes_len,
-                         unsigned char *nodes6_return, int *nodes6_len,
-                         unsigned char *values_return, int *values_len,
-                         unsigned char *values6_return, int *values6_len,
-                         int *want_return);
+                         struct message *m);
+static int message_values(const struct message *m, int len,
+                          unsigned char *values_return, int max);
 
 static const unsigned char zeroes[20] = {0};
-static const unsigned char ones[20] = {
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-    0xFF, 0xFF, 0xFF, 0xFF
-};
 static const unsigned char v4prefix[16] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 0, 0, 0, 0
 };
@@ -318,10 +339,15 @@ static unsigned char my_v[9];
 static unsigned char secret[8];
 static unsigned char oldsecret[8];
 
-static struct bucket *buckets = NULL;
-static struct bucket *buckets6 = NULL;
-static struct storage *storage;
+static struct routing_table *buckets = NULL;
+static struct routing_table *buckets6 = NULL;
+/* Open-addressed hash table of storage, keyed on the info hash. */
+static struct storage **storage;
+static int storage_size;
 static int numstorage;
+static uint64_t storage_seed;
+static struct storage *storage_wheel[STORAGE_WHEEL_SLOTS];
+static time_t storage_wheel_minute;
 
 static struct search *searches = NULL;
 static int numsearches;
@@ -345,6 +371,15 @@ static int token_bucket_tokens;
 
 FILE *dht_debug = NULL;
 
+#ifdef DHT_TESTING
+/* Set to non-zero to accept nodes on the loopback interface and to stop
+   rate limiting incoming requests.  Only the tests and benchmarks, which
+   build against this source, define DHT_TESTING and may set it. */
+int dht_testing = 0;
+#else
+#define dht_testing 0
+#endif
+
 #ifdef __GNUC__
     __attribute__ ((format (printf, 1, 2)))
 #endif
@@ -387,7 +422,7 @@ is_martian(const struct sockaddr *sa)
         const unsigned char *address = (const unsigned char*)&sin->sin_addr;
         return sin->sin_port == 0 ||
             (address[0] == 0) ||
-            (address[0] == 127) ||
+            (address[0] == 127 && !dht_testing) ||
             ((address[0] & 0xE0) == 0xE0);
     }
     case AF_INET6: {
@@ -416,25 +451,53 @@ id_cmp(const unsigned char *restrict id1, const unsigned char *restrict id2)
     return memcmp(id1, id2, 20);
 }
 
-/* Find the lowest 1 bit in an id. */
-static int
-lowbit(const unsigned char *id)
+#if defined(__GNUC__)
+
+/* Ids are big-endian bit strings, load them as such so that counting
+   leading zeros of a xor counts common bits. */
+static inline uint64_t
+load_be64(const unsigned char *p)
 {
-    int i, j;
-    for(i = 19; i >= 0; i--)
-        if(id[i] != 0)
-            break;
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
 
-    if(i < 0)
-        return -1;
+static inline uint32_t
+load_be32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
 
-    for(j = 7; j >= 0; j--)
-        if((id[i] & (0x80 >> j)) != 0)
-            break;
+/* Find how many bits two ids have in common. */
+static int
+common_bits(const unsigned char *id1, const unsigned char *id2)
+{
+    uint64_t x;
+    uint32_t y;
 
-    return 8 * i + j;
+    x = load_be64(id1) ^ load_be64(id2);
+    if(x != 0)
+        return __builtin_clzll(x);
+    x = load_be64(id1 + 8) ^ load_be64(id2 + 8);
+    if(x != 0)
+        return 64 + __builtin_clzll(x);
+    y = load_be32(id1 + 16) ^ load_be32(id2 + 16);
+    if(y != 0)
+        return 128 + __builtin_clz(y);
+    return 160;
 }
 
+#else
+
 /* Find how many bits two ids have in common. */
 static int
 common_bits(const unsigned char *id1, const unsigned char *id2)
@@ -460,6 +523,8 @@ common_bits(const unsigned char *id1, const unsigned char *id2)
     return 8 * i + j;
 }
 
+#endif
+
 /* Determine whether id1 or id2 is closer to ref */
 static int
 xorcmp(const unsigned char *id1, const unsigned char *id2,
@@ -480,64 +545,62 @@ xorcmp(const unsigned char *id1, const unsigned char *id2,
     return 0;
 }
 
-/* We keep buckets in a sorted linked list.  A bucket b ranges from
-   b->first inclusive up to b->next->first exclusive. */
+static struct routing_table *
+find_table(int af)
+{
+    if(af == AF_INET)
+        return buckets;
+    else if(af == AF_INET6)
+        return buckets6;
+    else
+        return NULL;
+}
+
+/* Whether b is the deepest bucket, the one that contains myid. */
 static int
-in_bucket(const unsigned char *id, struct bucket *b)
+is_mybucket(struct bucket *b)
 {
-    return id_cmp(b->first, id) <= 0 &&
-        (b->next == NULL || id_cmp(id, b->next->first) < 0);
+    return b->depth == find_table(b->af)->numbuckets - 1;
 }
 
 static struct bucket *
 find_bucket(unsigned const char *id, int af)
 {
-    struct bucket *b = af == AF_INET ? buckets : buckets6;
+    struct routing_table *t = find_table(af);
 
-    if(b == NULL)
+    if(t == NULL)
         return NULL;
 
-    while(1) {
-        if(b->next == NULL)
-            return b;
-        if(id_cmp(id, b->next->first) < 0)
-            return b;
-        b = b->next;
-    }
+    return &t->buckets[MIN(common_bits(id, myid), t->numbuckets - 1)];
 }
 
+/* The neighbours of a bucket are the ones one bit farther from and one
+   bit closer to myid. */
 static struct bucket *
 previous_bucket(struct bucket *b)
 {
-    struct bucket *p = b->af == AF_INET ? buckets : buckets6;
-
-    if(b == p)
-        return NULL;
+    return b->depth > 0 ? b - 1 : NULL;
+}
 
-    while(1) {
-        if(p->next == NULL)
-            return NULL;
-        if(p->next == b)
-            return p;
-        p = p->next;
-    }
+static struct bucket *
+next_bucket(struct bucket *b)
+{
+    return is_mybucket(b) ? NULL : b + 1;
 }
 
-/* Every bucket contains an unordered list of nodes. */
+/* Every bucket contains an unordered array of nodes. */
 static struct node *
 find_node(const unsigned char *id, int af)
 {
     struct bucket *b = find_bucket(id, af);
-    struct node *n;
+    int i;
 
     if(b == NULL)
         return NULL;
 
-    n = b->nodes;
-    while(n) {
-        if(id_cmp(n->id, id) == 0)
-            return n;
-        n = n->next;
+    for(i = 0; i < b->count; i++) {
+        if(id_cmp(b->nodes[i].id, id) == 0)
+            return &b->nodes[i];
     }
     return NULL;
 }
@@ -546,74 +609,50 @@ find_node(const unsigned char *id, int af)
 static struct node *
 random_node(struct bucket *b)
 {
-    struct node *n;
-    int nn;
-
     if(b->count == 0)
         return NULL;
 
-    nn = random() % b->count;
-    n = b->nodes;
-    while(nn > 0 && n) {
-        n = n->next;
-        nn--;
-    }
-    return n;
+    return &b->nodes[random() % b->count];
 }
 
-/* Return the middle id of a bucket. */
-static int
-bucket_middle(struct bucket *b, unsigned char *id_return)
+/* Return the lowest id within a bucket. */
+static void
+bucket_first(struct bucket *b, unsigned char *id_return)
 {
-    int bit1 = lowbit(b->first);
-    int bit2 = b->next ? lowbit(b->next->first) : -1;
-    int bit = MAX(bit1, bit2) + 1;
+    int bit = b->depth;
 
-    if(bit >= 160)
-        return -1;
+    if(bit >= 160) {
+        memcpy(id_return, myid, 20);
+        return;
+    }
 
-    memcpy(id_return, b->first, 20);
-    id_return[bit / 8] |= (0x80 >> (bit % 8));
-    return 1;
+    memset(id_return, 0, 20);
+    memcpy(id_return, myid, bit / 8);
+    id_return[bit / 8] = myid[bit / 8] & (0xFF00 >> (bit % 8));
+    /* Outside of our own bucket, the first bit that differs from myid
+       is part of the prefix. */
+    if(!is_mybucket(b) && (myid[bit / 8] & (0x80 >> (bit % 8))) == 0)
+        id_return[bit / 8] |= 0x80 >> (bit % 8);
 }
 
 /* Return a random id within a bucket. */
 static int
 bucket_random(struct bucket *b, unsigned char *id_return)
 {
-    int bit1 = lowbit(b->first);
-    int bit2 = b->next ? lowbit(b->next->first) : -1;
-    int bit = MAX(bit1, bit2) + 1;
+    int bit = is_mybucket(b) ? b->depth : b->depth + 1;
     int i;
 
-    if(bit >= 160) {
-        memcpy(id_return, b->first, 20);
+    bucket_first(b, id_return);
+
+    if(bit >= 160)
         return 1;
-    }
 
-    memcpy(id_return, b->first, bit / 8);
-    id_return[bit / 8] = b->first[bit / 8] & (0xFF00 >> (bit % 8));
     id_return[bit / 8] |= random() & 0xFF >> (bit % 8);
     for(i = bit / 8 + 1; i < 20; i++)
         id_return[i] = random() & 0xFF;
     return 1;
 }
 
-/* Insert a new node into a bucket. */
-static struct node *
-insert_node(struct node *node)
-{
-    struct bucket *b = find_bucket(node->id, node->ss.ss_family);
-
-    if(b == NULL)
-        return NULL;
-
-    node->next = b->nodes;
-    b->nodes = node;
-    b->count++;
-    return node;
-}
-
 /* This is our definition of a known-good node. */
 static int
 node_good(struct node *node)
@@ -728,40 +767,34 @@ node_blacklisted(const struct sockaddr *sa, int salen)
     return 0;
 }
 
-/* Split a bucket into two equal parts. */
+/* Split our own bucket in two: the nodes that have more bits in common
+   with myid than its depth move to a new, deeper bucket. */
 static struct bucket *
 split_bucket(struct bucket *b)
 {
+    struct routing_table *t = find_table(b->af);
     struct bucket *new;
-    struct node *nodes;
-    int rc;
-    unsigned char new_id[20];
-
-    rc = bucket_middle(b, new_id);
-    if(rc < 0)
-        return NULL;
+    int i;
 
-    new = calloc(1, sizeof(struct bucket));
-    if(new == NULL)
+    if(!is_mybucket(b) || b->depth >= 160)
         return NULL;
 
-    new->af = b->af;
-
     send_cached_ping(b);
 
-    memcpy(new->first, new_id, 20);
+    new = &t->buckets[t->numbuckets++];
+    memset(new, 0, sizeof(struct bucket));
+    new->af = b->af;
+    new->depth = b->depth + 1;
     new->time = b->time;
 
-    nodes = b->nodes;
-    b->nodes = NULL;
-    b->count = 0;
-    new->next = b->next;
-    b->next = new;
-    while(nodes) {
-        struct node *n;
-        n = nodes;
-        nodes = nodes->next;
-        insert_node(n);
+    i = 0;
+    while(i < b->count) {
+        if(common_bits(b->nodes[i].id, myid) > b->depth) {
+            new->nodes[new->count++] = b->nodes[i];
+            b->nodes[i] = b->nodes[--b->count];
+        } else {
+            i++;
+        }
     }
     return b;
 }
@@ -774,7 +807,7 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
 {
     struct bucket *b = find_bucket(id, sa->sa_family);
     struct node *n;
-    int mybucket, split;
+    int i, mybucket, split;
 
     if(b == NULL)
         return NULL;
@@ -785,13 +818,13 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
     if(is_martian(sa) || node_blacklisted(sa, salen))
         return NULL;
 
-    mybucket = in_bucket(myid, b);
+    mybucket = is_mybucket(b);
 
     if(confirm == 2)
         b->time = now.tv_sec;
 
-    n = b->nodes;
-    while(n) {
+    for(i = 0; i < b->count; i++) {
+        n = &b->nodes[i];
         if(id_cmp(n->id, id) == 0) {
             if(confirm || n->time < now.tv_sec - 15 * 60) {
                 /* Known node.  Update stuff. */
@@ -806,7 +839,6 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
             }
             return n;
         }
-        n = n->next;
     }
 
     /* New node. */
@@ -819,25 +851,25 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
     }
 
     /* First, try to get rid of a known-bad node. */
-    n = b->nodes;
-    while(n) {
+    for(i = 0; i < b->count; i++) {
+        n = &b->nodes[i];
         if(n->pinged >= 3 && n->pinged_time < now.tv_sec - 15) {
             memcpy(n->id, id, 20);
             memcpy((struct sockaddr*)&n->ss, sa, salen);
+            n->sslen = salen;
             n->time = confirm ? now.tv_sec : 0;
             n->reply_time = confirm >= 2 ? now.tv_sec : 0;
             n->pinged_time = 0;
             n->pinged = 0;
             return n;
         }
-        n = n->next;
     }
 
-    if(b->count >= 8) {
+    if(b->count >= BUCKET_SIZE) {
         /* Bucket full.  Ping a dubious node */
         int dubious = 0;
-        n = b->nodes;
-        while(n) {
+        for(i = 0; i < b->count; i++) {
+            n = &b->nodes[i];
             /* Pick the first dubious node that we haven't pinged in the
                last 15 seconds.  This gives nodes the time to reply, but
                tends to concentrate on the same nodes, so that we get rid
@@ -855,7 +887,6 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
                     break;
                 }
             }
-            n = n->next;
         }
 
         split = 0;
@@ -864,16 +895,14 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
                 split = 1;
             /* If there's only one bucket, split eagerly.  This is
                incorrect unless there's more than 8 nodes in the DHT. */
-            else if(b->af == AF_INET && buckets->next == NULL)
-                split = 1;
-            else if(b->af == AF_INET6 && buckets6->next == NULL)
+            else if(find_table(b->af)->numbuckets == 1)
                 split = 1;
         }
 
         if(split) {
             debugf("Splitting.\n");
-            b = split_bucket(b);
-            return new_node(id, sa, salen, confirm);
+            if(split_bucket(b) != NULL)
+                return new_node(id, sa, salen, confirm);
         }
 
         /* No space for this node.  Cache it away for later. */
@@ -886,17 +915,13 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
     }
 
     /* Create a new node. */
-    n = calloc(1, sizeof(struct node));
-    if(n == NULL)
-        return NULL;
+    n = &b->nodes[b->count++];
+    memset(n, 0, sizeof(struct node));
     memcpy(n->id, id, 20);
     memcpy(&n->ss, sa, salen);
     n->sslen = salen;
     n->time = confirm ? now.tv_sec : 0;
     n->reply_time = confirm >= 2 ? now.tv_sec : 0;
-    n->next = b->nodes;
-    b->nodes = n;
-    b->count++;
     return n;
 }
 
@@ -904,36 +929,26 @@ new_node(const unsigned char *id, const struct sockaddr *sa, int salen,
    conservative here: broken nodes in the table don't do much harm, we'll
    recover as soon as we find better ones. */
 static int
-expire_buckets(struct bucket *b)
+expire_buckets(struct routing_table *t)
 {
-    while(b) {
-        struct node *n, *p;
-        int changed = 0;
+    int i, j;
 
-        while(b->nodes && b->nodes->pinged >= 4) {
-            n = b->nodes;
-            b->nodes = n->next;
-            b->count--;
-            changed = 1;
-            free(n);
-        }
+    for(i = 0; t && i < t->numbuckets; i++) {
+        struct bucket *b = &t->buckets[i];
+        int changed = 0;
 
-        p = b->nodes;
-        while(p) {
-            while(p->next && p->next->pinged >= 4) {
-                n = p->next;
-                p->next = n->next;
-                b->count--;
+        j = 0;
+        while(j < b->count) {
+            if(b->nodes[j].pinged >= 4) {
+                b->nodes[j] = b->nodes[--b->count];
                 changed = 1;
-                free(n);
+            } else {
+                j++;
             }
-            p = p->next;
         }
 
         if(changed)
             send_cached_ping(b);
-
-        b = b->next;
     }
     expire_stuff_time = now.tv_sec + 120 + random() % 240;
     return 1;
@@ -961,10 +976,10 @@ find_search(unsigned short tid, int af)
    discard it. */
 
 static int
-insert_search_node(unsigned char *id,
+insert_search_node(const unsigned char *id,
                    const struct sockaddr *sa, int salen,
                    struct search *sr, int replied,
-                   unsigned char *token, int token_len)
+                   const unsigned char *token, int token_len)
 {
     struct search_node *n;
     int i, j;
@@ -1204,12 +1219,11 @@ new_search(void)
 static void
 insert_search_bucket(struct bucket *b, struct search *sr)
 {
-    struct node *n;
-    n = b->nodes;
-    while(n) {
+    int i;
+    for(i = 0; i < b->count; i++) {
+        struct node *n = &b->nodes[i];
         insert_search_node(n->id, (struct sockaddr*)&n->ss, n->sslen,
                            sr, 0, NULL, 0);
-        n = n->next;
     }
 }
 
@@ -1311,8 +1325,9 @@ int dht_search(const unsigned char *id, int port, int af,
 
     if(sr->numnodes < SEARCH_NODES) {
         struct bucket *p = previous_bucket(b);
-        if(b->next)
-            insert_search_bucket(b->next, sr);
+        struct bucket *q = next_bucket(b);
+        if(q)
+            insert_search_bucket(q, sr);
         if(p)
             insert_search_bucket(p, sr);
     }
@@ -1325,19 +1340,201 @@ int dht_search(const unsigned char *id, int port, int af,
 }
 
 /* A struct storage stores all the stored peer addresses for a given info
-   hash. */
+   hash.  Storage lives in a linear-probing hash table keyed on the info
+   hash, and every storage indexes its peers by (ip, port) in a second
+   one, so that neither lookups nor announces depend on the amount of
+   data we hold.  Peers are kept in a list ordered by the time they were
+   last announced, and every storage sits in the slot of the expiry wheel
+   of its oldest peer. */
+
+static inline unsigned
+storage_hash(const unsigned char *id)
+{
+    uint64_t h;
+    memcpy(&h, id, 8);
+    h ^= storage_seed;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (unsigned)(h >> 32);
+}
+
+static inline unsigned
+peer_hash(const unsigned char *ip, int len, unsigned short port)
+{
+    uint64_t h = storage_seed ^ 0xCBF29CE484222325ULL;
+    int i;
+    for(i = 0; i < len; i++) {
+        h ^= ip[i];
+        h *= 0x100000001B3ULL;
+    }
+    h ^= port;
+    h *= 0x100000001B3ULL;
+    return (unsigned)(h ^ (h >> 32));
+}
+
+static int
+storage_slot(const unsigned char *id)
+{
+    unsigned mask = storage_size - 1;
+    unsigned i = storage_hash(id) & mask;
+
+    while(storage[i] != NULL) {
+        if(id_cmp(id, storage[i]->id) == 0)
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
 
 static struct storage *
 find_storage(const unsigned char *id)
 {
-    struct storage *st = storage;
+    if(storage_size == 0)
+        return NULL;
+    return storage[storage_slot(id)];
+}
+
+static int
+storage_grow(void)
+{
+    struct storage **old = storage;
+    int oldsize = storage_size, i;
+
+    storage = calloc(oldsize == 0 ? 64 : 2 * oldsize, sizeof(struct storage*));
+    if(storage == NULL) {
+        storage = old;
+        return -1;
+    }
+    storage_size = oldsize == 0 ? 64 : 2 * oldsize;
+
+    for(i = 0; i < oldsize; i++) {
+        if(old[i] != NULL)
+            storage[storage_slot(old[i]->id)] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+/* Removal from a linear-probing table: entries of the same probe
+   sequence that follow the hole are shifted back into it, unless their
+   home slot lies between the hole and where they are. */
+static int
+probe_movable(unsigned hole, unsigned j, unsigned home, unsigned mask)
+{
+    return ((j - home) & mask) >= ((j - hole) & mask);
+}
 
-    while(st) {
-        if(id_cmp(id, st->id) == 0)
+static void
+storage_delete(struct storage *st)
+{
+    unsigned mask = storage_size - 1;
+    unsigned hole = storage_slot(st->id), j;
+
+    storage[hole] = NULL;
+    for(j = (hole + 1) & mask; storage[j] != NULL; j = (j + 1) & mask) {
+        if(probe_movable(hole, j, storage_hash(storage[j]->id) & mask, mask)) {
+            storage[hole] = storage[j];
+            storage[j] = NULL;
+            hole = j;
+        }
+    }
+    numstorage--;
+}
+
+/* Find the slot of a peer in the index of st. */
+static unsigned
+peer_slot(struct storage *st, const unsigned char *ip, int len,
+          unsigned short port)
+{
+    unsigned mask = st->indexsize - 1;
+    unsigned i = peer_hash(ip, len, port) & mask;
+
+    while(st->index[i] >= 0) {
+        struct peer *p = &st->peers[st->index[i]];
+        if(p->port == port && p->len == len && memcmp(p->ip, ip, len) == 0)
             break;
-        st = st->next;
+        i = (i + 1) & mask;
     }
-    return st;
+    return i;
+}
+
+static void
+peer_unlink(struct storage *st, int i)
+{
+    struct peer *p = &st->peers[i];
+    if(p->older >= 0)
+        st->peers[p->older].newer = p->newer;
+    else
+        st->oldest = p->newer;
+    if(p->newer >= 0)
+        st->peers[p->newer].older = p->older;
+    else
+        st->newest = p->older;
+}
+
+static void
+peer_link_newest(struct storage *st, int i)
+{
+    struct peer *p = &st->peers[i];
+    p->older = st->newest;
+    p->newer = -1;
+    if(st->newest >= 0)
+        st->peers[st->newest].newer = i;
+    else
+        st->oldest = i;
+    st->newest = i;
+}
+
+/* Remove peer i from st, moving the last peer into its place. */
+static void
+peer_delete(struct storage *st, int i)
+{
+    struct peer *p = &st->peers[i];
+    unsigned slot = peer_slot(st, p->ip, p->len, p->port);
+    unsigned mask = st->indexsize - 1, j;
+    int last = st->numpeers - 1;
+
+    st->index[slot] = -1;
+    for(j = (slot + 1) & mask; st->index[j] >= 0; j = (j + 1) & mask) {
+        struct peer *q = &st->peers[st->index[j]];
+        if(probe_movable(slot, j, peer_hash(q->ip, q->len, q->port) & mask,
+                         mask)) {
+            st->index[slot] = st->index[j];
+            st->index[j] = -1;
+            slot = j;
+        }
+    }
+    peer_unlink(st, i);
+
+    if(i != last) {
+        struct peer *q = &st->peers[last];
+        st->index[peer_slot(st, q->ip, q->len, q->port)] = i;
+        if(q->older >= 0)
+            st->peers[q->older].newer = i;
+        else
+            st->oldest = i;
+        if(q->newer >= 0)
+            st->peers[q->newer].older = i;
+        else
+            st->newest = i;
+        *p = *q;
+    }
+    st->numpeers--;
+}
+
+static void
+storage_wheel_insert(struct storage *st, time_t expires)
+{
+    int slot = (expires / 60) % STORAGE_WHEEL_SLOTS;
+    st->wheel_next = storage_wheel[slot];
+    storage_wheel[slot] = st;
+}
+
+static void
+storage_free(struct storage *st)
+{
+    free(st->peers);
+    free(st->index);
+    free(st);
 }
 
 static int
@@ -1345,8 +1542,10 @@ storage_store(const unsigned char *id,
               const struct sockaddr *sa, unsigned short port)
 {
     int i, len;
+    unsigned slot;
     struct storage *st;
     unsigned char *ip;
+    struct peer *p;
 
     if(sa->sa_family == AF_INET) {
         struct sockaddr_in *sin = (struct sockaddr_in*)sa;
@@ -1365,86 +1564,108 @@ storage_store(const unsigned char *id,
     if(st == NULL) {
         if(numstorage >= DHT_MAX_HASHES)
             return -1;
+        if(2 * (numstorage + 1) > storage_size && storage_grow() < 0)
+            return -1;
         st = calloc(1, sizeof(struct storage));
         if(st == NULL) return -1;
         memcpy(st->id, id, 20);
-        st->next = storage;
-        storage = st;
+        st->oldest = st->newest = -1;
+        storage[storage_slot(id)] = st;
         numstorage++;
+        storage_wheel_insert(st, now.tv_sec + DHT_PEER_EXPIRE_TIME);
+    }
+
+    if(st->indexsize > 0) {
+        slot = peer_slot(st, ip, len, port);
+        if(st->index[slot] >= 0) {
+            /* Already there, only need to refresh */
+            i = st->index[slot];
+            st->peers[i].time = now.tv_sec;
+            peer_unlink(st, i);
+            peer_link_newest(st, i);
+            return 0;
+        }
     }
 
-    for(i = 0; i < st->numpeers; i++) {
-        if(st->peers[i].port == port && st->peers[i].len == len &&
-           memcmp(st->peers[i].ip, ip, len) == 0)
-            break;
-    }
-
-    if(i < st->numpeers) {
-        /* Already there, only need to refresh */
-        st->peers[i].time = now.tv_sec;
-        return 0;
-    } else {
-        struct peer *p;
-        if(i >= st->maxpeers) {
-            /* Need to expand the array. */
-            struct peer *new_peers;
-            int n;
-            if(st->maxpeers >= DHT_MAX_PEERS)
-                return 0;
-            n = st->maxpeers == 0 ? 2 : 2 * st->maxpeers;
-            n = MIN(n, DHT_MAX_PEERS);
-            new_peers = realloc(st->peers, n * sizeof(struct peer));
-            if(new_peers == NULL)
-                return -1;
-            st->peers = new_peers;
-            st->maxpeers = n;
+    if(st->numpeers >= st->maxpeers) {
+        /* Need to expand the array, and rebuild the index to match. */
+        struct peer *new_peers;
+        int *new_index;
+        int n, size;
+        if(st->maxpeers >= DHT_MAX_PEERS)
+            return 0;
+        n = st->maxpeers == 0 ? 2 : 2 * st->maxpeers;
+        n = MIN(n, DHT_MAX_PEERS);
+        for(size = 4; size < 2 * n; size *= 2)
+            ;
+        new_index = malloc(size * sizeof(int));
+        if(new_index == NULL)
+            return -1;
+        new_peers = realloc(st->peers, n * sizeof(struct peer));
+        if(new_peers == NULL) {
+            free(new_index);
+            return -1;
+        }
+        st->peers = new_peers;
+        st->maxpeers = n;
+        free(st->index);
+        st->index = new_index;
+        st->indexsize = size;
+        memset(st->index, 0xFF, size * sizeof(int));
+        for(i = 0; i < st->numpeers; i++) {
+            p = &st->peers[i];
+            st->index[peer_slot(st, p->ip, p->len, p->port)] = i;
         }
-        p = &st->peers[st->numpeers++];
-        p->time = now.tv_sec;
-        p->len = len;
-        memcpy(p->ip, ip, len);
-        p->port = port;
-        return 1;
     }
+
+    i = st->numpeers++;
+    p = &st->peers[i];
+    p->time = now.tv_sec;
+    p->len = len;
+    memcpy(p->ip, ip, len);
+    p->port = port;
+    st->index[peer_slot(st, ip, len, port)] = i;
+    peer_link_newest(st, i);
+    return 1;
 }
 
+/* Expire the peers of the storage in the wheel slots that came due since
+   we last ran.  A storage is only looked at when its oldest peer may
+   have expired, and then only its expired peers are touched. */
 static int
 expire_storage(void)
 {
-    struct storage *st = storage, *previous = NULL;
-    while(st) {
-        int i = 0;
-        while(i < st->numpeers) {
-            if(st->peers[i].time < now.tv_sec - 32 * 60) {
-                if(i != st->numpeers - 1)
-                    st->peers[i] = st->peers[st->numpeers - 1];
-                st->numpeers--;
-            } else {
-                i++;
-            }
-        }
+    time_t minute = now.tv_sec / 60;
+    time_t m;
 
-        if(st->numpeers == 0) {
-            free(st->peers);
-            if(previous)
-                previous->next = st->next;
-            else
-                storage = st->next;
-            free(st);
-            if(previous)
-                st = previous->next;
-            else
-                st = storage;
-            numstorage--;
-            if(numstorage < 0) {
-                debugf("Eek... numstorage became negative.\n");
-                numstorage = 0;
+    if(storage_wheel_minute == 0 ||
+       minute - storage_wheel_minute >= STORAGE_WHEEL_SLOTS)
+        storage_wheel_minute = minute - STORAGE_WHEEL_SLOTS + 1;
+
+    for(m = storage_wheel_minute; m <= minute; m++) {
+        int slot = m % STORAGE_WHEEL_SLOTS;
+        struct storage *st = storage_wheel[slot];
+        storage_wheel[slot] = NULL;
+
+        while(st) {
+            struct storage *next = st->wheel_next;
+
+            while(st->oldest >= 0 &&
+                  st->peers[st->oldest].time <
+                  now.tv_sec - DHT_PEER_EXPIRE_TIME)
+                peer_delete(st, st->oldest);
+
+            if(st->numpeers == 0) {
+                storage_delete(st);
+                storage_free(st);
+            } else {
+                storage_wheel_insert(st, st->peers[st->oldest].time +
+                                     DHT_PEER_EXPIRE_TIME + 1);
             }
-        } else {
-            previous = st;
-            st = st->next;
+            st = next;
         }
     }
+    storage_wheel_minute = minute;
     return 1;
 }
 
@@ -1514,11 +1735,13 @@ dht_nodes(int af, int *good_return, int *dubious_return, int *cached_return,
           int *incoming_return)
 {
     int good = 0, dubious = 0, cached = 0, incoming = 0;
-    struct bucket *b = af == AF_INET ? buckets : buckets6;
+    struct routing_table *t = find_table(af);
+    int i, j;
 
-    while(b) {
-        struct node *n = b->nodes;
-        while(n) {
+    for(i = 0; t && i < t->numbuckets; i++) {
+        struct bucket *b = &t->buckets[i];
+        for(j = 0; j < b->count; j++) {
+            struct node *n = &b->nodes[j];
             if(node_good(n)) {
                 good++;
                 if(n->time > n->reply_time)
@@ -1526,11 +1749,9 @@ dht_nodes(int af, int *good_return, int *dubious_return, int *cached_return,
             } else {
                 dubious++;
             }
-            n = n->next;
         }
         if(b->cached.ss_family > 0)
             cached++;
-        b = b->next;
     }
     if(good_return)
         *good_return = good;
@@ -1546,14 +1767,18 @@ dht_nodes(int af, int *good_return, int *dubious_return, int *cached_return,
 static void
 dump_bucket(FILE *f, struct bucket *b)
 {
-    struct node *n = b->nodes;
+    unsigned char first[20];
+    int i;
+
+    bucket_first(b, first);
     fprintf(f, "Bucket ");
-    print_hex(f, b->first, 20);
+    print_hex(f, first, 20);
     fprintf(f, " count %d age %d%s%s:\n",
             b->count, (int)(now.tv_sec - b->time),
-            in_bucket(myid, b) ? " (mine)" : "",
+            is_mybucket(b) ? " (mine)" : "",
             b->cached.ss_family ? " (cached)" : "");
-    while(n) {
+    for(i = 0; i < b->count; i++) {
+        struct node *n = &b->nodes[i];
         char buf[512];
         unsigned short port;
         fprintf(f, "    Node ");
@@ -1586,36 +1811,47 @@ dump_bucket(FILE *f, struct bucket *b)
         if(node_good(n))
             fprintf(f, " (good)");
         fprintf(f, "\n");
-        n = n->next;
     }
 
 }
 
+/* Dump the buckets of a table sorted by their first id. */
+static void
+dump_table(FILE *f, struct routing_table *t)
+{
+    unsigned char first[161][20];
+    int order[161];
+    int i, j;
+
+    if(t == NULL)
+        return;
+
+    for(i = 0; i < t->numbuckets; i++) {
+        bucket_first(&t->buckets[i], first[i]);
+        for(j = i; j > 0 && id_cmp(first[order[j - 1]], first[i]) > 0; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for(i = 0; i < t->numbuckets; i++)
+        dump_bucket(f, &t->buckets[order[i]]);
+}
+
 void
 dht_dump_tables(FILE *f)
 {
-    int i;
-    struct bucket *b;
-    struct storage *st = storage;
+    int i, j;
     struct search *sr = searches;
 
     fprintf(f, "My id ");
     print_hex(f, myid, 20);
     fprintf(f, "\n");
 
-    b = buckets;
-    while(b) {
-        dump_bucket(f, b);
-        b = b->next;
-    }
+    dump_table(f, buckets);
 
     fprintf(f, "\n");
 
-    b = buckets6;
-    while(b) {
-        dump_bucket(f, b);
-        b = b->next;
-    }
+    dump_table(f, buckets6);
 
     while(sr) {
         fprintf(f, "\nSearch%s id ", sr->af == AF_INET6 ? " (IPv6)" : "");
@@ -1639,7 +1875,10 @@ dht_dump_tables(FILE *f)
         sr = sr->next;
     }
 
-    while(st) {
+    for(j = 0; j < storage_size; j++) {
+        struct storage *st = storage[j];
+        if(st == NULL)
+            continue;
         fprintf(f, "\nStorage ");
         print_hex(f, st->id, 20);
         fprintf(f, " %d/%d nodes:", st->numpeers, st->maxpeers);
@@ -1658,7 +1897,6 @@ dht_dump_tables(FILE *f)
                     buf, st->peers[i].port,
                     (long)(now.tv_sec - st->peers[i].time));
         }
-        st = st->next;
     }
 
     fprintf(f, "\n\n");
@@ -1679,13 +1917,18 @@ dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
     numsearches = 0;
 
     storage = NULL;
+    storage_size = 0;
     numstorage = 0;
+    storage_seed = ((uint64_t)random() << 32) ^ random();
+    memset(storage_wheel, 0, sizeof(storage_wheel));
+    storage_wheel_minute = 0;
 
     if(s >= 0) {
-        buckets = calloc(sizeof(struct bucket), 1);
+        buckets = calloc(sizeof(struct routing_table), 1);
         if(buckets == NULL)
             return -1;
-        buckets->af = AF_INET;
+        buckets->numbuckets = 1;
+        buckets->buckets[0].af = AF_INET;
 
         rc = set_nonblocking(s, 1);
         if(rc < 0)
@@ -1693,10 +1936,11 @@ dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
     }
 
     if(s6 >= 0) {
-        buckets6 = calloc(sizeof(struct bucket), 1);
+        buckets6 = calloc(sizeof(struct routing_table), 1);
         if(buckets6 == NULL)
             return -1;
-        buckets6->af = AF_INET6;
+        buckets6->numbuckets = 1;
+        buckets6->buckets[0].af = AF_INET6;
 
         rc = set_nonblocking(s6, 1);
         if(rc < 0)
@@ -1750,6 +1994,8 @@ dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
 int
 dht_uninit()
 {
+    int i;
+
     if(dht_socket < 0 && dht_socket6 < 0) {
         errno = EINVAL;
         return -1;
@@ -1758,34 +2004,20 @@ dht_uninit()
     dht_socket = -1;
     dht_socket6 = -1;
 
-    while(buckets) {
-        struct bucket *b = buckets;
-        buckets = b->next;
-        while(b->nodes) {
-            struct node *n = b->nodes;
-            b->nodes = n->next;
-            free(n);
-        }
-        free(b);
-    }
+    free(buckets);
+    buckets = NULL;
 
-    while(buckets6) {
-        struct bucket *b = buckets6;
-        buckets6 = b->next;
-        while(b->nodes) {
-            struct node *n = b->nodes;
-            b->nodes = n->next;
-            free(n);
-        }
-        free(b);
-    }
+    free(buckets6);
+    buckets6 = NULL;
 
-    while(storage) {
-        struct storage *st = storage;
-        storage = storage->next;
-        free(st->peers);
-        free(st);
+    for(i = 0; i < storage_size; i++) {
+        if(storage[i] != NULL)
+            storage_free(storage[i]);
     }
+    free(storage);
+    storage = NULL;
+    storage_size = 0;
+    numstorage = 0;
 
     while(searches) {
         struct search *sr = searches;
@@ -1801,6 +2033,9 @@ dht_uninit()
 static int
 token_bucket(void)
 {
+    if(dht_testing)
+        return 1;
+
     if(token_bucket_tokens == 0) {
         token_bucket_tokens = MIN(MAX_TOKEN_BUCKET_TOKENS,
                                   100 * (now.tv_sec - token_bucket_time));
@@ -1828,8 +2063,8 @@ neighbourhood_maintenance(int af)
     memcpy(id, myid, 20);
     id[19] = random() & 0xFF;
     q = b;
-    if(q->next && (q->count == 0 || (random() & 7) == 0))
-        q = b->next;
+    if(next_bucket(q) && (q->count == 0 || (random() & 7) == 0))
+        q = next_bucket(b);
     if(q->count == 0 || (random() & 7) == 0) {
         struct bucket *r;
         r = previous_bucket(b);
@@ -1860,11 +2095,11 @@ neighbourhood_maintenance(int af)
 static int
 bucket_maintenance(int af)
 {
-    struct bucket *b;
-
-    b = af == AF_INET ? buckets : buckets6;
+    struct routing_table *t = find_table(af);
+    int i;
 
-    while(b) {
+    for(i = 0; t && i < t->numbuckets; i++) {
+        struct bucket *b = &t->buckets[i];
         struct bucket *q;
         if(b->time < now.tv_sec - 600) {
             /* This bucket hasn't seen any positive confirmation for a long
@@ -1876,14 +2111,14 @@ bucket_maintenance(int af)
 
             rc = bucket_random(b, id);
             if(rc < 0)
-                memcpy(id, b->first, 20);
+                bucket_first(b, id);
 
             q = b;
             /* If the bucket is empty, we try to fill it from a neighbour.
                We also sometimes do it gratuitiously to recover from
                buckets full of broken nodes. */
-            if(q->next && (q->count == 0 || (random() & 7) == 0))
-                q = b->next;
+            if(next_bucket(q) && (q->count == 0 || (random() & 7) == 0))
+                q = next_bucket(b);
             if(q->count == 0 || (random() & 7) == 0) {
                 struct bucket *r;
                 r = previous_bucket(b);
@@ -1901,7 +2136,7 @@ bucket_maintenance(int af)
                         struct bucket *otherbucket;
                         otherbucket =
                             find_bucket(id, af == AF_INET ? AF_INET6 : AF_INET);
-                        if(otherbucket && otherbucket->count < 8)
+                        if(otherbucket && otherbucket->count < BUCKET_SIZE)
                             /* The corresponding bucket in the other family
                                is emptyish -- querying both is useful. */
                             want = WANT4 | WANT6;
@@ -1926,282 +2161,287 @@ bucket_maintenance(int af)
                 }
             }
         }
-        b = b->next;
     }
     return 0;
 }
 
-/***
- * Called when something is received from the network or
- * the network times out (things that should be done
- * periodically)
- * @param buf what came in from the network
- * @param buflen the size of buf
- * @param from where it came from
- * @param fromlen
- * @param tosleep
- * @param callback
- * @param closure
- * @returns ??
- */
-int dht_periodic(const void *buf, size_t buflen, const struct sockaddr *from, int fromlen,
-             time_t *tosleep, dht_callback *callback, void *closure)
-{
-    dht_gettimeofday(&now, NULL);
-
-    if(buflen > 0) {
-        int message;
-        unsigned char tid[16], id[20], info_hash[20], target[20];
-        unsigned char nodes[26*16], nodes6[38*16], token[128];
-        int tid_len = 16, token_len = 128;
-        int nodes_len = 26*16, nodes6_len = 38*16;
-        unsigned short port;
-        unsigned char values[2048], values6[2048];
-        int values_len = 2048, values6_len = 2048;
-        int want;
-        unsigned short ttid;
-
-        if(is_martian(from))
-            goto dontread;
-
-        if(node_blacklisted(from, fromlen)) {
-            debugf("Received packet from blacklisted node.\n");
+/* Handle a single message received from the network.  The buffer need
+   not be NUL-terminated. */
+static int
+handle_message(const void *buf, size_t buflen,
+               const struct sockaddr *from, int fromlen,
+               dht_callback *callback, void *closure)
+{
+    int message;
+    struct message m;
+    const unsigned char *tid, *id, *info_hash, *target, *token;
+    const unsigned char *nodes, *nodes6;
+    int tid_len, token_len, nodes_len, nodes6_len;
+    unsigned short port;
+    int want;
+    unsigned short ttid;
+
+    if(is_martian(from))
+        goto dontread;
+
+    if(node_blacklisted(from, fromlen)) {
+        debugf("Received packet from blacklisted node.\n");
+        goto dontread;
+    }
+
+    message = parse_message(buf, buflen, &m);
+    tid = m.tid;
+    tid_len = m.tid_len;
+    id = m.id;
+    info_hash = m.info_hash;
+    target = m.target;
+    port = m.port;
+    token = m.token;
+    token_len = m.token_len;
+    nodes = m.nodes;
+    nodes_len = m.nodes_len;
+    nodes6 = m.nodes6;
+    nodes6_len = m.nodes6_len;
+    want = m.want;
+
+    if(message < 0 || message == ERROR || id_cmp(id, zeroes) == 0) {
+        debugf("Unparseable message: ");
+        debug_printable(buf, buflen);
+        debugf("\n");
+        goto dontread;
+    }
+
+    if(id_cmp(id, myid) == 0) {
+        debugf("Received message from self.\n");
+        goto dontread;
+    }
+
+    if(message > REPLY) {
+        /* Rate limit requests. */
+        if(!token_bucket()) {
+            debugf("Dropping request due to rate limiting.\n");
             goto dontread;
         }
+    }
 
-        if(((char*)buf)[buflen] != '\0') {
-            debugf("Unterminated message.\n");
-            errno = EINVAL;
-            return -1;
-        }
-
-        message = parse_message(buf, buflen, tid, &tid_len, id, info_hash,
-                                target, &port, token, &token_len,
-                                nodes, &nodes_len, nodes6, &nodes6_len,
-                                values, &values_len, values6, &values6_len,
-                                &want);
-
-        if(message < 0 || message == ERROR || id_cmp(id, zeroes) == 0) {
-            debugf("Unparseable message: ");
+    switch(message) {
+    case REPLY:
+        if(tid_len != 4) {
+            debugf("Broken node truncates transaction ids: ");
             debug_printable(buf, buflen);
             debugf("\n");
+            /* This is really annoying, as it means that we will
+               time-out all our searches that go through this node.
+               Kill it. */
+            blacklist_node(id, from, fromlen);
             goto dontread;
         }
-
-        if(id_cmp(id, myid) == 0) {
-            debugf("Received message from self.\n");
-            goto dontread;
-        }
-
-        if(message > REPLY) {
-            /* Rate limit requests. */
-            if(!token_bucket()) {
-                debugf("Dropping request due to rate limiting.\n");
-                goto dontread;
+        if(tid_match(tid, "pn", NULL)) {
+            debugf("Pong!\n");
+            new_node(id, from, fromlen, 2);
+        } else if(tid_match(tid, "fn", NULL) ||
+                  tid_match(tid, "gp", NULL)) {
+            int gp = 0;
+            struct search *sr = NULL;
+            if(tid_match(tid, "gp", &ttid)) {
+                gp = 1;
+                sr = find_search(ttid, from->sa_family);
             }
-        }
-
-        switch(message) {
-        case REPLY:
-            if(tid_len != 4) {
-                debugf("Broken node truncates transaction ids: ");
-                debug_printable(buf, buflen);
-                debugf("\n");
-                /* This is really annoying, as it means that we will
-                   time-out all our searches that go through this node.
-                   Kill it. */
+            debugf("Nodes found (%d+%d)%s!\n", nodes_len/26, nodes6_len/38,
+                   gp ? " for get_peers" : "");
+            if(nodes_len % 26 != 0 || nodes6_len % 38 != 0) {
+                debugf("Unexpected length for node info!\n");
                 blacklist_node(id, from, fromlen);
-                goto dontread;
-            }
-            if(tid_match(tid, "pn", NULL)) {
-                debugf("Pong!\n");
+            } else if(gp && sr == NULL) {
+                debugf("Unknown search!\n");
+                new_node(id, from, fromlen, 1);
+            } else {
+                int i;
                 new_node(id, from, fromlen, 2);
-            } else if(tid_match(tid, "fn", NULL) ||
-                      tid_match(tid, "gp", NULL)) {
-                int gp = 0;
-                struct search *sr = NULL;
-                if(tid_match(tid, "gp", &ttid)) {
-                    gp = 1;
-                    sr = find_search(ttid, from->sa_family);
-                }
-                debugf("Nodes found (%d+%d)%s!\n", nodes_len/26, nodes6_len/38,
-                       gp ? " for get_peers" : "");
-                if(nodes_len % 26 != 0 || nodes6_len % 38 != 0) {
-                    debugf("Unexpected length for node info!\n");
-                    blacklist_node(id, from, fromlen);
-                } else if(gp && sr == NULL) {
-                    debugf("Unknown search!\n");
-                    new_node(id, from, fromlen, 1);
-                } else {
-                    int i;
-                    new_node(id, from, fromlen, 2);
-                    for(i = 0; i < nodes_len / 26; i++) {
-                        unsigned char *ni = nodes + i * 26;
-                        struct sockaddr_in sin;
-                        if(id_cmp(ni, myid) == 0)
-                            continue;
-                        memset(&sin, 0, sizeof(sin));
-                        sin.sin_family = AF_INET;
-                        memcpy(&sin.sin_addr, ni + 20, 4);
-                        memcpy(&sin.sin_port, ni + 24, 2);
-                        new_node(ni, (struct sockaddr*)&sin, sizeof(sin), 0);
-                        if(sr && sr->af == AF_INET) {
-                            insert_search_node(ni,
-                                               (struct sockaddr*)&sin,
-                                               sizeof(sin),
-                                               sr, 0, NULL, 0);
-                        }
-                    }
-                    for(i = 0; i < nodes6_len / 38; i++) {
-                        unsigned char *ni = nodes6 + i * 38;
-                        struct sockaddr_in6 sin6;
-                        if(id_cmp(ni, myid) == 0)
-                            continue;
-                        memset(&sin6, 0, sizeof(sin6));
-                        sin6.sin6_family = AF_INET6;
-                        memcpy(&sin6.sin6_addr, ni + 20, 16);
-                        memcpy(&sin6.sin6_port, ni + 36, 2);
-                        new_node(ni, (struct sockaddr*)&sin6, sizeof(sin6), 0);
-                        if(sr && sr->af == AF_INET6) {
-                            insert_search_node(ni,
-                                               (struct sockaddr*)&sin6,
-                                               sizeof(sin6),
-                                               sr, 0, NULL, 0);
-                        }
+                for(i = 0; i < nodes_len / 26; i++) {
+                    const unsigned char *ni = nodes + i * 26;
+                    struct sockaddr_in sin;
+                    if(id_cmp(ni, myid) == 0)
+                        continue;
+                    memset(&sin, 0, sizeof(sin));
+                    sin.sin_family = AF_INET;
+                    memcpy(&sin.sin_addr, ni + 20, 4);
+                    memcpy(&sin.sin_port, ni + 24, 2);
+                    new_node(ni, (struct sockaddr*)&sin, sizeof(sin), 0);
+                    if(sr && sr->af == AF_INET) {
+                        insert_search_node(ni,
+                                           (struct sockaddr*)&sin,
+                                           sizeof(sin),
+                                           sr, 0, NULL, 0);
                     }
-                    if(sr)
-                        /* Since we received a reply, the number of
-                           requests in flight has decreased.  Let's push
-                           another request. */
-                        search_send_get_peers(sr, NULL);
                 }
-                if(sr) {
-                    insert_search_node(id, from, fromlen, sr,
-                                       1, token, token_len);
-                    if(values_len > 0 || values6_len > 0) {
-                        debugf("Got values (%d+%d)!\n",
-                               values_len / 6, values6_len / 18);
-                        if(callback) {
-                            if(values_len > 0)
-                                (*callback)(closure, DHT_EVENT_VALUES, sr->id,
-                                            (void*)values, values_len);
-
-                            if(values6_len > 0)
-                                (*callback)(closure, DHT_EVENT_VALUES6, sr->id,
-                                            (void*)values6, values6_len);
-                        }
+                for(i = 0; i < nodes6_len / 38; i++) {
+                    const unsigned char *ni = nodes6 + i * 38;
+                    struct sockaddr_in6 sin6;
+                    if(id_cmp(ni, myid) == 0)
+                        continue;
+                    memset(&sin6, 0, sizeof(sin6));
+                    sin6.sin6_family = AF_INET6;
+                    memcpy(&sin6.sin6_addr, ni + 20, 16);
+                    memcpy(&sin6.sin6_port, ni + 36, 2);
+                    new_node(ni, (struct sockaddr*)&sin6, sizeof(sin6), 0);
+                    if(sr && sr->af == AF_INET6) {
+                        insert_search_node(ni,
+                                           (struct sockaddr*)&sin6,
+                                           sizeof(sin6),
+                                           sr, 0, NULL, 0);
                     }
                 }
-            } else if(tid_match(tid, "ap", &ttid)) {
-                struct search *sr;
-                debugf("Got reply to announce_peer.\n");
-                sr = find_search(ttid, from->sa_family);
-                if(!sr) {
-                    debugf("Unknown search!\n");
-                    new_node(id, from, fromlen, 1);
-                } else {
-                    int i;
-                    new_node(id, from, fromlen, 2);
-                    for(i = 0; i < sr->numnodes; i++)
-                        if(id_cmp(sr->nodes[i].id, id) == 0) {
-                            sr->nodes[i].request_time = 0;
-                            sr->nodes[i].reply_time = now.tv_sec;
-                            sr->nodes[i].acked = 1;
-                            sr->nodes[i].pinged = 0;
-                            break;
-                        }
-                    /* See comment for gp above. */
+                if(sr)
+                    /* Since we received a reply, the number of
+                       requests in flight has decreased.  Let's push
+                       another request. */
                     search_send_get_peers(sr, NULL);
+            }
+            if(sr) {
+                unsigned char values[2048], values6[2048];
+                int values_len, values6_len;
+                insert_search_node(id, from, fromlen, sr,
+                                   1, token, token_len);
+                values_len = message_values(&m, 4, values, 2048);
+                values6_len = message_values(&m, 16, values6, 2048);
+                if(values_len > 0 || values6_len > 0) {
+                    debugf("Got values (%d+%d)!\n",
+                           values_len / 6, values6_len / 18);
+                    if(callback) {
+                        if(values_len > 0)
+                            (*callback)(closure, DHT_EVENT_VALUES, sr->id,
+                                        (void*)values, values_len);
+
+                        if(values6_len > 0)
+                            (*callback)(closure, DHT_EVENT_VALUES6, sr->id,
+                                        (void*)values6, values6_len);
+                    }
                 }
+                /* A pure lookup may be complete now; don't make whoever
+                   waits for it sit through the next periodic step. */
+                if(!sr->done && sr->port == 0)
+                    search_step(sr, callback, closure);
+            }
+        } else if(tid_match(tid, "ap", &ttid)) {
+            struct search *sr;
+            debugf("Got reply to announce_peer.\n");
+            sr = find_search(ttid, from->sa_family);
+            if(!sr) {
+                debugf("Unknown search!\n");
+                new_node(id, from, fromlen, 1);
             } else {
-                debugf("Unexpected reply: ");
-                debug_printable(buf, buflen);
-                debugf("\n");
+                int i;
+                new_node(id, from, fromlen, 2);
+                for(i = 0; i < sr->numnodes; i++)
+                    if(id_cmp(sr->nodes[i].id, id) == 0) {
+                        sr->nodes[i].request_time = 0;
+                        sr->nodes[i].reply_time = now.tv_sec;
+                        sr->nodes[i].acked = 1;
+                        sr->nodes[i].pinged = 0;
+                        break;
+                    }
+                /* See comment for gp above. */
+                search_send_get_peers(sr, NULL);
             }
+        } else {
+            debugf("Unexpected reply: ");
+            debug_printable(buf, buflen);
+            debugf("\n");
+        }
+        break;
+    case PING:
+        debugf("Ping (%d)!\n", tid_len);
+        new_node(id, from, fromlen, 1);
+        debugf("Sending pong.\n");
+        send_pong(from, fromlen, tid, tid_len);
+        break;
+    case FIND_NODE:
+        debugf("Find node!\n");
+        new_node(id, from, fromlen, 1);
+        debugf("Sending closest nodes (%d).\n", want);
+        send_closest_nodes(from, fromlen,
+                           tid, tid_len, target, want,
+                           0, NULL, NULL, 0);
+        break;
+    case GET_PEERS:
+        debugf("Get_peers!\n");
+        new_node(id, from, fromlen, 1);
+        if(id_cmp(info_hash, zeroes) == 0) {
+            debugf("Eek!  Got get_peers with no info_hash.\n");
+            send_error(from, fromlen, tid, tid_len,
+                       203, "Get_peers with no info_hash");
             break;
-        case PING:
-            debugf("Ping (%d)!\n", tid_len);
-            new_node(id, from, fromlen, 1);
-            debugf("Sending pong.\n");
-            send_pong(from, fromlen, tid, tid_len);
-            break;
-        case FIND_NODE:
-            debugf("Find node!\n");
-            new_node(id, from, fromlen, 1);
-            debugf("Sending closest nodes (%d).\n", want);
-            send_closest_nodes(from, fromlen,
-                               tid, tid_len, target, want,
-                               0, NULL, NULL, 0);
-            break;
-        case GET_PEERS:
-            debugf("Get_peers!\n");
-            new_node(id, from, fromlen, 1);
-            if(id_cmp(info_hash, zeroes) == 0) {
-                debugf("Eek!  Got get_peers with no info_hash.\n");
-                send_error(from, fromlen, tid, tid_len,
-                           203, "Get_peers with no info_hash");
-                break;
+        } else {
+            struct storage *st = find_storage(info_hash);
+            unsigned char token[TOKEN_SIZE];
+            make_token(from, 0, token);
+            if(st && st->numpeers > 0) {
+                 debugf("Sending found%s peers.\n",
+                        from->sa_family == AF_INET6 ? " IPv6" : "");
+                 send_closest_nodes(from, fromlen,
+                                    tid, tid_len,
+                                    info_hash, want,
+                                    from->sa_family, st,
+                                    token, TOKEN_SIZE);
             } else {
-                struct storage *st = find_storage(info_hash);
-                unsigned char token[TOKEN_SIZE];
-                make_token(from, 0, token);
-                if(st && st->numpeers > 0) {
-                     debugf("Sending found%s peers.\n",
-                            from->sa_family == AF_INET6 ? " IPv6" : "");
-                     send_closest_nodes(from, fromlen,
-                                        tid, tid_len,
-                                        info_hash, want,
-                                        from->sa_family, st,
-                                        token, TOKEN_SIZE);
-                } else {
-                    debugf("Sending nodes for get_peers.\n");
-                    send_closest_nodes(from, fromlen,
-                                       tid, tid_len, info_hash, want,
-                                       0, NULL, token, TOKEN_SIZE);
-                }
+                debugf("Sending nodes for get_peers.\n");
+                send_closest_nodes(from, fromlen,
+                                   tid, tid_len, info_hash, want,
+                                   0, NULL, token, TOKEN_SIZE);
             }
+        }
+        break;
+    case ANNOUNCE_PEER:
+        debugf("Announce peer!\n");
+        new_node(id, from, fromlen, 1);
+        if(id_cmp(info_hash, zeroes) == 0) {
+            debugf("Announce_peer with no info_hash.\n");
+            send_error(from, fromlen, tid, tid_len,
+                       203, "Announce_peer with no info_hash");
+            break;
+        }
+        if(!token_match(token, token_len, from)) {
+            debugf("Incorrect token for announce_peer.\n");
+            send_error(from, fromlen, tid, tid_len,
+                       203, "Announce_peer with wrong token");
             break;
-        case ANNOUNCE_PEER:
-            debugf("Announce peer!\n");
-            new_node(id, from, fromlen, 1);
-            if(id_cmp(info_hash, zeroes) == 0) {
-                debugf("Announce_peer with no info_hash.\n");
-                send_error(from, fromlen, tid, tid_len,
-                           203, "Announce_peer with no info_hash");
-                break;
-            }
-            if(!token_match(token, token_len, from)) {
-                debugf("Incorrect token for announce_peer.\n");
-                send_error(from, fromlen, tid, tid_len,
-                           203, "Announce_peer with wrong token");
-                break;
-            }
-            if(port == 0) {
-                debugf("Announce_peer with forbidden port %d.\n", port);
-                send_error(from, fromlen, tid, tid_len,
-                           203, "Announce_peer with forbidden port number");
-                break;
-            }
-            storage_store(info_hash, from, port);
-            /* Note that if storage_store failed, we lie to the requestor.
-               This is to prevent them from backtracking, and hence
-               polluting the DHT. */
-            debugf("Sending peer announced.\n");
-            send_peer_announced(from, fromlen, tid, tid_len);
         }
+        if(port == 0) {
+            debugf("Announce_peer with forbidden port %d.\n", port);
+            send_error(from, fromlen, tid, tid_len,
+                       203, "Announce_peer with forbidden port number");
+            break;
+        }
+        storage_store(info_hash, from, port);
+        /* Note that if storage_store failed, we lie to the requestor.
+           This is to prevent them from backtracking, and hence
+           polluting the DHT. */
+        debugf("Sending peer announced.\n");
+        send_peer_announced(from, fromlen, tid, tid_len);
     }
 
  dontread:
+    return 1;
+}
+
+/* Everything that needs to be done periodically, independently of
+   incoming traffic. */
+static void
+periodic_maintenance(time_t *tosleep, dht_callback *callback, void *closure)
+{
     if(now.tv_sec >= rotate_secrets_time)
         rotate_secrets();
 
     if(now.tv_sec >= expire_stuff_time) {
         expire_buckets(buckets);
         expire_buckets(buckets6);
-        expire_storage();
         expire_searches();
     }
 
+    if(now.tv_sec / 60 != storage_wheel_minute)
+        expire_storage();
+
     if(search_time > 0 && now.tv_sec >= search_time) {
         struct search *sr;
         sr = searches;
@@ -2259,15 +2499,61 @@ int dht_periodic(const void *buf, size_t buflen, const struct sockaddr *from, in
         else if(*tosleep > search_time - now.tv_sec)
             *tosleep = search_time - now.tv_sec;
     }
+}
 
+/***
+ * Called when something is received from the network or
+ * the network times out (things that should be done
+ * periodically)
+ * @param buf what came in from the network
+ * @param buflen the size of buf
+ * @param from where it came from
+ * @param fromlen
+ * @param tosleep
+ * @param callback
+ * @param closure
+ * @returns ??
+ */
+int dht_periodic(const void *buf, size_t buflen, const struct sockaddr *from, int fromlen,
+             time_t *tosleep, dht_callback *callback, void *closure)
+{
+    dht_gettimeofday(&now, NULL);
+
+    if(buflen > 0) {
+        if(handle_message(buf, buflen, from, fromlen, callback, closure) < 0)
+            return -1;
+    }
+
+    periodic_maintenance(tosleep, callback, closure);
     return 1;
 }
 
+/***
+ * Handle one message received from the network, without doing any of
+ * the periodic work done by dht_periodic.  This lets a caller that
+ * receives datagrams in batches process all of them and only call
+ * dht_periodic(NULL, 0, ...) when tosleep has expired.
+ * @param buf what came in from the network, NUL-terminated
+ * @param buflen the size of buf
+ * @param from where it came from
+ * @param fromlen
+ * @param callback
+ * @param closure
+ * @returns -1 on failure, 1 on success
+ */
+int dht_process(const void *buf, size_t buflen,
+                const struct sockaddr *from, int fromlen,
+                dht_callback *callback, void *closure)
+{
+    dht_gettimeofday(&now, NULL);
+    return handle_message(buf, buflen, from, fromlen, callback, closure);
+}
+
 int
 dht_get_nodes(struct sockaddr_in *sin, int *num,
               struct sockaddr_in6 *sin6, int *num6)
 {
-    int i, j;
+    int i, j, k, l;
     struct bucket *b;
     struct node *n;
 
@@ -2279,28 +2565,25 @@ dht_get_nodes(struct sockaddr_in *sin, int *num,
     if(b == NULL)
         goto no_ipv4;
 
-    n = b->nodes;
-    while(n && i < *num) {
+    for(k = 0; k < b->count && i < *num; k++) {
+        n = &b->nodes[k];
         if(node_good(n)) {
             sin[i] = *(struct sockaddr_in*)&n->ss;
             i++;
         }
-        n = n->next;
     }
 
-    b = buckets;
-    while(b && i < *num) {
-        if(!in_bucket(myid, b)) {
-            n = b->nodes;
-            while(n && i < *num) {
+    for(l = 0; l < buckets->numbuckets && i < *num; l++) {
+        b = &buckets->buckets[l];
+        if(!is_mybucket(b)) {
+            for(k = 0; k < b->count && i < *num; k++) {
+                n = &b->nodes[k];
                 if(node_good(n)) {
                     sin[i] = *(struct sockaddr_in*)&n->ss;
                     i++;
                 }
-                n = n->next;
             }
         }
-        b = b->next;
     }
 
  no_ipv4:
@@ -2311,28 +2594,25 @@ dht_get_nodes(struct sockaddr_in *sin, int *num,
     if(b == NULL)
         goto no_ipv6;
 
-    n = b->nodes;
-    while(n && j < *num6) {
+    for(k = 0; k < b->count && j < *num6; k++) {
+        n = &b->nodes[k];
         if(node_good(n)) {
             sin6[j] = *(struct sockaddr_in6*)&n->ss;
             j++;
         }
-        n = n->next;
     }
 
-    b = buckets6;
-    while(b && j < *num6) {
-        if(!in_bucket(myid, b)) {
-            n = b->nodes;
-            while(n && j < *num6) {
+    for(l = 0; l < buckets6->numbuckets && j < *num6; l++) {
+        b = &buckets6->buckets[l];
+        if(!is_mybucket(b)) {
+            for(k = 0; k < b->count && j < *num6; k++) {
+                n = &b->nodes[k];
                 if(node_good(n)) {
                     sin6[j] = *(struct sockaddr_in6*)&n->ss;
                     j++;
                 }
-                n = n->next;
             }
         }
-        b = b->next;
     }
 
  no_ipv6:
@@ -2342,12 +2622,45 @@ dht_get_nodes(struct sockaddr_in *sin, int *num,
     return i + j;
 }
 
+/* Like dht_get_nodes, but with the ids of the nodes, which is what it
+   takes to restore them with dht_insert_node rather than by pinging. */
+int
+dht_get_node_ids(int af, unsigned char *ids, struct sockaddr_storage *ss,
+                 int *num)
+{
+    struct routing_table *t = find_table(af);
+    struct bucket *mine;
+    int i, k, n = 0;
+
+    if(t == NULL) {
+        *num = 0;
+        return 0;
+    }
+
+    mine = find_bucket(myid, af);
+    for(i = -1; i < t->numbuckets && n < *num; i++) {
+        struct bucket *b = i < 0 ? mine : &t->buckets[i];
+        if(i >= 0 && b == mine)
+            continue;
+        for(k = 0; k < b->count && n < *num; k++) {
+            if(node_good(&b->nodes[k])) {
+                memcpy(ids + 20 * n, b->nodes[k].id, 20);
+                memcpy(&ss[n], &b->nodes[k].ss, b->nodes[k].sslen);
+                n++;
+            }
+        }
+    }
+
+    *num = n;
+    return n;
+}
+
 int
 dht_insert_node(const unsigned char *id, struct sockaddr *sa, int salen)
 {
     struct node *n;
 
-    if(sa->sa_family != AF_INET) {
+    if(sa->sa_family != AF_INET && sa->sa_family != AF_INET6) {
         errno = EAFNOSUPPORT;
         return -1;
     }
@@ -2422,7 +2735,7 @@ dht_send(const void *buf, size_t len, int flags,
         return -1;
     }
 
-    return sendto(s, buf, len, flags, sa, salen);
+    return dht_sendto(s, buf, len, flags, sa, salen);
 }
 
 int
@@ -2611,11 +2924,11 @@ static int
 buffer_closest_nodes(unsigned char *nodes, int numnodes,
                      const unsigned char *id, struct bucket *b)
 {
-    struct node *n = b->nodes;
-    while(n) {
-        if(node_good(n))
-            numnodes = insert_closest_node(nodes, numnodes, id, n);
-        n = n->next;
+    int i;
+    for(i = 0; i < b->count; i++) {
+        if(node_good(&b->nodes[i]))
+            numnodes = insert_closest_node(nodes, numnodes, id,
+                                           &b->nodes[i]);
     }
     return numnodes;
 }
@@ -2639,8 +2952,9 @@ send_closest_nodes(const struct sockaddr *sa, int salen,
         b = find_bucket(id, AF_INET);
         if(b) {
             numnodes = buffer_closest_nodes(nodes, numnodes, id, b);
-            if(b->next)
-                numnodes = buffer_closest_nodes(nodes, numnodes, id, b->next);
+            if(next_bucket(b))
+                numnodes = buffer_closest_nodes(nodes, numnodes, id,
+                                                next_bucket(b));
             b = previous_bucket(b);
             if(b)
                 numnodes = buffer_closest_nodes(nodes, numnodes, id, b);
@@ -2651,9 +2965,9 @@ send_closest_nodes(const struct sockaddr *sa, int salen,
         b = find_bucket(id, AF_INET6);
         if(b) {
             numnodes6 = buffer_closest_nodes(nodes6, numnodes6, id, b);
-            if(b->next)
+            if(next_bucket(b))
                 numnodes6 =
-                    buffer_closest_nodes(nodes6, numnodes6, id, b->next);
+                    buffer_closest_nodes(nodes6, numnodes6, id, next_bucket(b));
             b = previous_bucket(b);
             if(b)
                 numnodes6 = buffer_closest_nodes(nodes6, numnodes6, id, b);
@@ -2748,7 +3062,7 @@ int send_announce_peer(const struct sockaddr *sa, int salen,
  */
 static int
 send_peer_announced(const struct sockaddr *sa, int salen,
-                    unsigned char *tid, int tid_len)
+                    const unsigned char *tid, int tid_len)
 {
     char buf[512];
     int i = 0, rc;
@@ -2769,7 +3083,7 @@ send_peer_announced(const struct sockaddr *sa, int salen,
 
 static int
 send_error(const struct sockaddr *sa, int salen,
-           unsigned char *tid, int tid_len,
+           const unsigned char *tid, int tid_len,
            int code, const char *message)
 {
     char buf[512];
@@ -2795,248 +3109,290 @@ send_error(const struct sockaddr *sa, int salen,
 #undef COPY
 #undef ADD_V
 
-#ifdef HAVE_MEMMEM
+/* Bencode scanning.  Every scanner takes the current position and the
+   end of the buffer, and returns the position just after what it scanned,
+   or NULL if the input is malformed or truncated.  Nothing is copied and
+   the buffer need not be NUL-terminated. */
+
+/* The maximum nesting of lists and dictionaries we are willing to skip. */
+#define BENCODE_MAX_DEPTH 8
 
-static void *
-dht_memmem(const void *haystack, size_t haystacklen,
-           const void *needle, size_t needlelen)
+static const unsigned char *
+bencode_string(const unsigned char *p, const unsigned char *end,
+               const unsigned char **str_return, int *len_return)
 {
-    return memmem(haystack, haystacklen, needle, needlelen);
+    long l = 0;
+
+    if(p >= end || *p < '0' || *p > '9')
+        return NULL;
+    while(p < end && *p >= '0' && *p <= '9') {
+        l = l * 10 + (*p - '0');
+        if(l > end - p)
+            return NULL;
+        p++;
+    }
+    if(p >= end || *p != ':')
+        return NULL;
+    p++;
+    if(l > end - p)
+        return NULL;
+    *str_return = p;
+    *len_return = l;
+    return p + l;
 }
 
-#else
+static const unsigned char *
+bencode_integer(const unsigned char *p, const unsigned char *end,
+                long *value_return)
+{
+    long v = 0;
+    int negative = 0, digits = 0;
 
-static void *
-dht_memmem(const void *haystack, size_t haystacklen,
-           const void *needle, size_t needlelen)
+    if(p >= end || *p != 'i')
+        return NULL;
+    p++;
+    if(p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    while(p < end && *p >= '0' && *p <= '9') {
+        if(v > 0x7FFFFFFF)
+            return NULL;
+        v = v * 10 + (*p - '0');
+        digits++;
+        p++;
+    }
+    if(digits == 0 || p >= end || *p != 'e')
+        return NULL;
+    *value_return = negative ? -v : v;
+    return p + 1;
+}
+
+static const unsigned char *
+bencode_skip(const unsigned char *p, const unsigned char *end, int depth)
 {
-    const char *h = haystack;
-    const char *n = needle;
-    size_t i;
+    const unsigned char *str;
+    int len;
+    long v;
 
-    /* size_t is unsigned */
-    if(needlelen > haystacklen)
+    if(p >= end)
         return NULL;
 
-    for(i = 0; i <= haystacklen - needlelen; i++) {
-        if(memcmp(h + i, n, needlelen) == 0)
-            return (void*)(h + i);
+    switch(*p) {
+    case 'i':
+        return bencode_integer(p, end, &v);
+    case 'l':
+    case 'd':
+        if(depth >= BENCODE_MAX_DEPTH)
+            return NULL;
+        p++;
+        while(p != NULL && p < end && *p != 'e')
+            p = bencode_skip(p, end, depth + 1);
+        if(p == NULL || p >= end)
+            return NULL;
+        return p + 1;
+    default:
+        return bencode_string(p, end, &str, &len);
     }
-    return NULL;
 }
 
-#endif
-
 static int
-parse_message(const unsigned char *buf, int buflen,
-              unsigned char *tid_return, int *tid_len,
-              unsigned char *id_return, unsigned char *info_hash_return,
-              unsigned char *target_return, unsigned short *port_return,
-              unsigned char *token_return, int *token_len,
-              unsigned char *nodes_return, int *nodes_len,
-              unsigned char *nodes6_return, int *nodes6_len,
-              unsigned char *values_return, int *values_len,
-              unsigned char *values6_return, int *values6_len,
-              int *want_return)
-{
-    const unsigned char *p;
-
-    /* This code will happily crash if the buffer is not NUL-terminated. */
-    if(buf[buflen] != '\0') {
-        debugf("Eek!  parse_message with unterminated buffer.\n");
-        return -1;
-    }
+key_is(const unsigned char *key, int key_len, const char *name)
+{
+    return key_len == (int)strlen(name) && memcmp(key, name, key_len) == 0;
+}
 
-#define CHECK(ptr, len)                                                 \
-    if(((unsigned char*)ptr) + (len) > (buf) + (buflen)) goto overflow;
-
-    if(tid_return) {
-        p = dht_memmem(buf, buflen, "1:t", 3);
-        if(p) {
-            long l;
-            char *q;
-            l = strtol((char*)p + 3, &q, 10);
-            if(q && *q == ':' && l > 0 && l < *tid_len) {
-                CHECK(q + 1, l);
-                memcpy(tid_return, q + 1, l);
-                *tid_len = l;
-            } else
-                *tid_len = 0;
-        }
-    }
-    if(id_return) {
-        p = dht_memmem(buf, buflen, "2:id20:", 7);
-        if(p) {
-            CHECK(p + 7, 20);
-            memcpy(id_return, p + 7, 20);
-        } else {
-            memset(id_return, 0, 20);
-        }
-    }
-    if(info_hash_return) {
-        p = dht_memmem(buf, buflen, "9:info_hash20:", 14);
-        if(p) {
-            CHECK(p + 14, 20);
-            memcpy(info_hash_return, p + 14, 20);
-        } else {
-            memset(info_hash_return, 0, 20);
-        }
-    }
-    if(port_return) {
-        p = dht_memmem(buf, buflen, "porti", 5);
-        if(p) {
-            long l;
-            char *q;
-            l = strtol((char*)p + 5, &q, 10);
-            if(q && *q == 'e' && l > 0 && l < 0x10000)
-                *port_return = l;
-            else
-                *port_return = 0;
-        } else
-            *port_return = 0;
-    }
-    if(target_return) {
-        p = dht_memmem(buf, buflen, "6:target20:", 11);
-        if(p) {
-            CHECK(p + 11, 20);
-            memcpy(target_return, p + 11, 20);
-        } else {
-            memset(target_return, 0, 20);
-        }
-    }
-    if(token_return) {
-        p = dht_memmem(buf, buflen, "5:token", 7);
-        if(p) {
-            long l;
-            char *q;
-            l = strtol((char*)p + 7, &q, 10);
-            if(q && *q == ':' && l > 0 && l < *token_len) {
-                CHECK(q + 1, l);
-                memcpy(token_return, q + 1, l);
-                *token_len = l;
-            } else
-                *token_len = 0;
-        } else
-            *token_len = 0;
-    }
-
-    if(nodes_len) {
-        p = dht_memmem(buf, buflen, "5:nodes", 7);
-        if(p) {
-            long l;
-            char *q;
-            l = strtol((char*)p + 7, &q, 10);
-            if(q && *q == ':' && l > 0 && l <= *nodes_len) {
-                CHECK(q + 1, l);
-                memcpy(nodes_return, q + 1, l);
-                *nodes_len = l;
-            } else
-                *nodes_len = 0;
-        } else
-            *nodes_len = 0;
-    }
-
-    if(nodes6_len) {
-        p = dht_memmem(buf, buflen, "6:nodes6", 8);
-        if(p) {
-            long l;
-            char *q;
-            l = strtol((char*)p + 8, &q, 10);
-            if(q && *q == ':' && l > 0 && l <= *nodes6_len) {
-                CHECK(q + 1, l);
-                memcpy(nodes6_return, q + 1, l);
-                *nodes6_len = l;
-            } else
-                *nodes6_len = 0;
-        } else
-            *nodes6_len = 0;
-    }
-
-    if(values_len || values6_len) {
-        p = dht_memmem(buf, buflen, "6:valuesl", 9);
-        if(p) {
-            int i = p - buf + 9;
-            int j = 0, j6 = 0;
-            while(1) {
-                long l;
-                char *q;
-                l = strtol((char*)buf + i, &q, 10);
-                if(q && *q == ':' && l > 0) {
-                    CHECK(q + 1, l);
-                    i = q + 1 + l - (char*)buf;
-                    if(l == 6) {
-                        if(j + l > *values_len)
-                            continue;
-                        memcpy((char*)values_return + j, q + 1, l);
-                        j += l;
-                    } else if(l == 18) {
-                        if(j6 + l > *values6_len)
-                            continue;
-                        memcpy((char*)values6_return + j6, q + 1, l);
-                        j6 += l;
-                    } else {
-                        debugf("Received weird value -- %d bytes.\n", (int)l);
-                    }
-                } else {
-                    break;
+/* Parse the arguments ("a") or return values ("r") of a message. */
+static const unsigned char *
+parse_arguments(const unsigned char *p, const unsigned char *end,
+                struct message *m)
+{
+    const unsigned char *key, *str;
+    int key_len, len;
+    long v;
+
+    if(p >= end || *p != 'd')
+        return NULL;
+    p++;
+
+    while(p < end && *p != 'e') {
+        p = bencode_string(p, end, &key, &key_len);
+        if(p == NULL || p >= end)
+            return NULL;
+
+        if(*p >= '0' && *p <= '9') {
+            p = bencode_string(p, end, &str, &len);
+            if(p == NULL)
+                return NULL;
+            if(key_is(key, key_len, "id")) {
+                if(len == 20)
+                    m->id = str;
+            } else if(key_is(key, key_len, "info_hash")) {
+                if(len == 20)
+                    m->info_hash = str;
+            } else if(key_is(key, key_len, "target")) {
+                if(len == 20)
+                    m->target = str;
+            } else if(key_is(key, key_len, "token")) {
+                if(len > 0 && len < 128) {
+                    m->token = str;
+                    m->token_len = len;
+                }
+            } else if(key_is(key, key_len, "nodes")) {
+                if(len > 0 && len <= 26 * 16) {
+                    m->nodes = str;
+                    m->nodes_len = len;
+                }
+            } else if(key_is(key, key_len, "nodes6")) {
+                if(len > 0 && len <= 38 * 16) {
+                    m->nodes6 = str;
+                    m->nodes6_len = len;
                 }
             }
-            if(i >= buflen || buf[i] != 'e')
-                debugf("eek... unexpected end for values.\n");
-            if(values_len)
-                *values_len = j;
-            if(values6_len)
-                *values6_len = j6;
+        } else if(*p == 'i' && key_is(key, key_len, "port")) {
+            p = bencode_integer(p, end, &v);
+            if(p == NULL)
+                return NULL;
+            if(v > 0 && v < 0x10000)
+                m->port = v;
+        } else if(*p == 'l' && key_is(key, key_len, "values")) {
+            const unsigned char *start = ++p;
+            while(p < end && *p != 'e') {
+                p = bencode_string(p, end, &str, &len);
+                if(p == NULL)
+                    return NULL;
+            }
+            if(p >= end)
+                return NULL;
+            m->values = start;
+            m->values_len = p - start;
+            p++;
+        } else if(*p == 'l' && key_is(key, key_len, "want")) {
+            p++;
+            m->want = 0;
+            while(p < end && *p != 'e') {
+                p = bencode_string(p, end, &str, &len);
+                if(p == NULL)
+                    return NULL;
+                if(len == 2 && memcmp(str, "n4", 2) == 0)
+                    m->want |= WANT4;
+                else if(len == 2 && memcmp(str, "n6", 2) == 0)
+                    m->want |= WANT6;
+                else
+                    debugf("eek... unexpected want flag.\n");
+            }
+            if(p >= end)
+                return NULL;
+            p++;
         } else {
-            if(values_len)
-                *values_len = 0;
-            if(values6_len)
-                *values6_len = 0;
+            p = bencode_skip(p, end, 1);
+            if(p == NULL)
+                return NULL;
         }
     }
 
-    if(want_return) {
-        p = dht_memmem(buf, buflen, "4:wantl", 7);
-        if(p) {
-            int i = p - buf + 7;
-            *want_return = 0;
-            while(buf[i] > '0' && buf[i] <= '9' && buf[i + 1] == ':' &&
-                  i + 2 + buf[i] - '0' < buflen) {
-                CHECK(buf + i + 2, buf[i] - '0');
-                if(buf[i] == '2' && memcmp(buf + i + 2, "n4", 2) == 0)
-                    *want_return |= WANT4;
-                else if(buf[i] == '2' && memcmp(buf + i + 2, "n6", 2) == 0)
-                    *want_return |= WANT6;
-                else
-                    debugf("eek... unexpected want flag (%c)\n", buf[i]);
-                i += 2 + buf[i] - '0';
+    if(p >= end)
+        return NULL;
+    return p + 1;
+}
+
+/* Parse a KRPC message in a single pass over buf, filling m with views
+   into buf.  Returns the message type, or -1 if the message is malformed
+   or of a kind we don't understand. */
+static int
+parse_message(const unsigned char *buf, int buflen, struct message *m)
+{
+    const unsigned char *p = buf, *end = buf + buflen;
+    const unsigned char *key, *str, *y = NULL, *q = NULL;
+    int key_len, len, q_len = 0;
+
+    memset(m, 0, sizeof(struct message));
+    m->tid = m->id = m->info_hash = m->target = zeroes;
+    m->token = m->nodes = m->nodes6 = m->values = zeroes;
+    m->want = -1;
+
+    if(p >= end || *p != 'd')
+        goto fail;
+    p++;
+
+    while(p < end && *p != 'e') {
+        p = bencode_string(p, end, &key, &key_len);
+        if(p == NULL || p >= end)
+            goto fail;
+
+        if(key_is(key, key_len, "a") || key_is(key, key_len, "r")) {
+            p = parse_arguments(p, end, m);
+        } else if(*p >= '0' && *p <= '9') {
+            p = bencode_string(p, end, &str, &len);
+            if(p == NULL)
+                goto fail;
+            if(key_is(key, key_len, "t")) {
+                if(len > 0 && len < 16) {
+                    m->tid = str;
+                    m->tid_len = len;
+                }
+            } else if(key_is(key, key_len, "y")) {
+                if(len == 1)
+                    y = str;
+            } else if(key_is(key, key_len, "q")) {
+                q = str;
+                q_len = len;
             }
-            if(i >= buflen || buf[i] != 'e')
-                debugf("eek... unexpected end for want.\n");
         } else {
-            *want_return = -1;
+            p = bencode_skip(p, end, 1);
         }
+        if(p == NULL)
+            goto fail;
     }
 
-#undef CHECK
+    if(p >= end)
+        goto fail;
 
-    if(dht_memmem(buf, buflen, "1:y1:r", 6))
+    if(y == NULL)
+        return -1;
+    if(*y == 'r')
         return REPLY;
-    if(dht_memmem(buf, buflen, "1:y1:e", 6))
+    if(*y == 'e')
         return ERROR;
-    if(!dht_memmem(buf, buflen, "1:y1:q", 6))
+    if(*y != 'q' || q == NULL)
         return -1;
-    if(dht_memmem(buf, buflen, "1:q4:ping", 9))
+    if(key_is(q, q_len, "ping"))
         return PING;
-    if(dht_memmem(buf, buflen, "1:q9:find_node", 14))
-       return FIND_NODE;
-    if(dht_memmem(buf, buflen, "1:q9:get_peers", 14))
+    if(key_is(q, q_len, "find_node"))
+        return FIND_NODE;
+    if(key_is(q, q_len, "get_peers"))
         return GET_PEERS;
-    if(dht_memmem(buf, buflen, "1:q13:announce_peer", 19))
-       return ANNOUNCE_PEER;
+    if(key_is(q, q_len, "announce_peer"))
+        return ANNOUNCE_PEER;
     return -1;
 
- overflow:
-    debugf("Truncated message.\n");
+ fail:
+    debugf("Truncated or malformed message.\n");
     return -1;
 }
+
+/* Gather the values of length len + 2 (compact peer info) carried by m
+   into values_return, which has room for max octets. */
+static int
+message_values(const struct message *m, int len,
+               unsigned char *values_return, int max)
+{
+    const unsigned char *p = m->values, *end = m->values + m->values_len;
+    const unsigned char *str;
+    int l, j = 0;
+
+    while(p != NULL && p < end) {
+        p = bencode_string(p, end, &str, &l);
+        if(p == NULL)
+            break;
+        if(l == len + 2) {
+            if(j + l > max)
+                break;
+            memcpy(values_return + j, str, l);
+            j += l;
+        } else if(l != 6 && l != 18) {
+            debugf("Received weird value -- %d bytes.\n", l);
+        }
+    }
+    return j;
+}
@@ -4,6 +4,8 @@
 #include "libp2p/net/stream.h"
 #include "libp2p/routing/dht_protocol.h"
 #include "libp2p/record/message.h"
+#include "libp2p/record/message_view.h"
+#include "libp2p/utils/arena.h"
 #include "libp2p/utils/logger.h"
 #include "libp2p/conn/session.h"
 
@@ -12,6 +14,14 @@
  * This is where kademlia and dht talk to the outside world
  */
 
+/***
+ * What is made while answering a request comes from one arena, so a
+ * typical reply costs a single malloc, and is released in one go. The
+ * exception is the provider of an ADD_PROVIDER, which is parsed with malloc
+ * along with its addresses, as the peerstore takes a copy of it and its
+ * addresses may be asked for their string, which is always malloced.
+ */
+#define DHT_ARENA_BLOCK_SIZE 8192
 
 /***
  * Helper method to protobuf a message
@@ -21,16 +31,68 @@
  * @returns true(1) on success, false(0) otherwise
  */
 int libp2p_routing_dht_protobuf_message(struct Libp2pMessage* message, unsigned char** buffer, size_t *buffer_size) {
-	*buffer_size = libp2p_message_protobuf_encode_size(message);
-	*buffer = malloc(*buffer_size);
-	if (!libp2p_message_protobuf_encode(message, *buffer, *buffer_size, buffer_size)) {
-		free(*buffer);
+	return libp2p_message_protobuf_allocate_and_encode(message, buffer, buffer_size);
+}
+
+/***
+ * Protobuf a reply into memory from an arena
+ * @param arena where to allocate the results, or NULL to malloc them
+ * @param message the message
+ * @param buffer where to put the results
+ * @param buffer_size the size of the results
+ * @returns true(1) on success, false(0) otherwise
+ */
+static int libp2p_routing_dht_protobuf_reply(struct Libp2pArena* arena, struct Libp2pMessage* message, unsigned char** buffer, size_t *buffer_size) {
+	if (arena == NULL)
+		return libp2p_routing_dht_protobuf_message(message, buffer, buffer_size);
+	size_t size = libp2p_message_protobuf_encode_size(message);
+	*buffer = libp2p_utils_arena_alloc(arena, size);
+	if (*buffer == NULL || !libp2p_message_protobuf_encode(message, *buffer, size, buffer_size)) {
+		*buffer = NULL;
 		*buffer_size = 0;
 		return 0;
 	}
 	return 1;
 }
 
+/***
+ * Start the reply to a request, with its type, key and cluster level. The
+ * key points into the request, so the reply is cleaned up with
+ * libp2p_routing_dht_reply_clear rather than libp2p_message_free.
+ * @param request the request
+ * @param reply the reply
+ */
+static void libp2p_routing_dht_reply_init(const struct Libp2pMessageView* request, struct Libp2pMessage* reply) {
+	memset(reply, 0, sizeof(struct Libp2pMessage));
+	reply->message_type = request->message_type;
+	reply->key = (char*)request->key;
+	reply->key_size = request->key_size;
+	reply->cluster_level_raw = request->cluster_level_raw;
+}
+
+static void libp2p_routing_dht_reply_free_peers(struct Libp2pLinkedList* head) {
+	while (head != NULL) {
+		struct Libp2pLinkedList* next = head->next;
+		libp2p_peer_free((struct Libp2pPeer*)head->item);
+		free(head);
+		head = next;
+	}
+}
+
+/***
+ * Free what the handlers added to a reply
+ * @param arena the arena it was added from, whose reset frees it, or NULL
+ * @param reply the reply
+ */
+static void libp2p_routing_dht_reply_clear(struct Libp2pArena* arena, struct Libp2pMessage* reply) {
+	if (arena == NULL) {
+		libp2p_routing_dht_reply_free_peers(reply->closer_peer_head);
+		libp2p_routing_dht_reply_free_peers(reply->provider_peer_head);
+		libp2p_record_free(reply->record);
+	}
+	memset(reply, 0, sizeof(struct Libp2pMessage));
+}
+
 /**
  * Take existing stream and upgrade to the Kademlia / DHT protocol/codec
  * @param context the context
@@ -75,9 +137,14 @@ int libp2p_routing_dht_handshake(struct SessionContext* context) {
  * @param buffer_size the length of the results
  * @returns true(1) on success, false(0) otherwise
  */
-int libp2p_routing_dht_handle_ping(struct Libp2pMessage* message, unsigned char** buffer, size_t *buffer_size) {
-	// just turn message back into a protobuf and send it back...
-	return libp2p_routing_dht_protobuf_message(message, buffer, buffer_size);
+int libp2p_routing_dht_handle_ping(const struct Libp2pMessageView* message, struct Libp2pArena* arena, unsigned char** buffer, size_t *buffer_size) {
+	// just send the message back as it came
+	*buffer = libp2p_utils_arena_alloc(arena, message->protobuf_size);
+	if (*buffer == NULL)
+		return 0;
+	memcpy(*buffer, message->protobuf, message->protobuf_size);
+	*buffer_size = message->protobuf_size;
+	return 1;
 }
 
 /**
@@ -86,45 +153,66 @@ int libp2p_routing_dht_handle_ping(struct Libp2pMessage* message, unsigned char*
  * @param message the message from the caller, contains a key
  * @param peerstore the list of peers
  * @param providerstore the list of peers that can provide things
+ * @param arena where to allocate the reply, or NULL to malloc it
+ * @param results where to put the reply
+ * @param results_size the size of the reply
  * @returns true(1) on success, false(0) otherwise
  */
-int libp2p_routing_dht_handle_get_providers(struct SessionContext* session, struct Libp2pMessage* message, struct Peerstore* peerstore,
-		struct ProviderStore* providerstore, unsigned char** results, size_t* results_size) {
-	unsigned char* peer_id = NULL;
-	int peer_id_size = 0;
+int libp2p_routing_dht_handle_get_providers(struct SessionContext* session, const struct Libp2pMessageView* message, struct Peerstore* peerstore,
+		struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** results, size_t* results_size) {
+	struct ProviderRecord* providers[PROVIDERSTORE_MAX_PROVIDERS];
+	struct Libp2pLinkedList* last = NULL;
+	struct Libp2pMessage reply;
+	int retVal = 1;
 
-	// This shouldn't be needed, but just in case:
-	message->provider_peer_head = NULL;
+	libp2p_routing_dht_reply_init(message, &reply);
 
 	// Can I provide it?
-	if (libp2p_providerstore_get(providerstore, message->key, message->key_size, &peer_id, &peer_id_size)) {
-		libp2p_logger_debug("dht_protocol", "I can provide a provider for this key.\n");
-		// we have a peer id, convert it to a peer object
-		struct Libp2pPeer* peer = libp2p_peerstore_get_peer(peerstore, peer_id, peer_id_size);
-		if (peer != NULL) {
-			message->provider_peer_head = libp2p_utils_linked_list_new();
-			message->provider_peer_head->item = libp2p_peer_copy(peer);
+	int provider_count = libp2p_providerstore_get_providers(providerstore, message->key, message->key_size, providers, PROVIDERSTORE_MAX_PROVIDERS);
+	if (provider_count > 0) {
+		libp2p_logger_debug("dht_protocol", "I can provide %d providers for this key.\n", provider_count);
+		// convert the peer ids we know of to peer objects
+		for(int i = 0; i < provider_count; i++) {
+			struct Libp2pPeer* peer = libp2p_peerstore_get_peer(peerstore, providers[i]->peer_id, providers[i]->peer_id_size);
+			if (peer == NULL)
+				continue;
+			struct Libp2pLinkedList* item = libp2p_utils_linked_list_new_in(arena);
+			if (item == NULL) {
+				retVal = 0;
+				break;
+			}
+			// linked before it is filled, so clearing the reply frees it either way
+			if (last == NULL)
+				reply.provider_peer_head = item;
+			else
+				last->next = item;
+			last = item;
+			item->item = libp2p_peer_copy_in(arena, peer);
+			if (item->item == NULL) {
+				retVal = 0;
+				break;
+			}
 		}
 	} else {
 		libp2p_logger_debug("dht_protocol", "I cannot provide a provider for this key.\n");
 	}
-	free(peer_id);
 	// TODO: find closer peers
 	/*
-	if (message->provider_peer_head == NULL) {
+	if (reply.provider_peer_head == NULL) {
 		// Who else can provide it?
 		//while ()
 	}
 	*/
-	if (message->provider_peer_head != NULL) {
+	if (retVal && reply.provider_peer_head != NULL) {
 		libp2p_logger_debug("dht_protocol", "GetProviders: We have a peer. Sending it back\n");
 		// protobuf it and send it back
-		if (!libp2p_routing_dht_protobuf_message(message, results, results_size)) {
+		if (!libp2p_routing_dht_protobuf_reply(arena, &reply, results, results_size)) {
 			libp2p_logger_error("dht_protocol", "GetProviders: Error protobufing results\n");
-			return 0;
+			retVal = 0;
 		}
 	}
-	return 1;
+	libp2p_routing_dht_reply_clear(arena, &reply);
+	return retVal;
 }
 
 /***
@@ -138,7 +226,8 @@ struct MultiAddress* libp2p_routing_dht_find_peer_ip_multiaddress(struct Libp2pL
 	while (current != NULL) {
 		out = (struct MultiAddress*)current->item;
 		if (multiaddress_is_ip(out)) {
-			libp2p_logger_debug("dht_protocol", "Found MultiAddress %s\n", out->string);
+			if (libp2p_logger_watching_class("dht_protocol"))
+				libp2p_logger_debug("dht_protocol", "Found MultiAddress %s\n", multiaddress_to_string(out));
 			break;
 		}
 		current = current->next;
@@ -154,67 +243,77 @@ struct MultiAddress* libp2p_routing_dht_find_peer_ip_multiaddress(struct Libp2pL
  * @param message the message
  * @param peerstore the peerstore
  * @param providerstore the providerstore
+ * @param arena where to allocate the reply, or NULL to malloc it
  * @param result_buffer where to put the result
  * @param result_buffer_size the size of the result buffer
  * @returns true(1) on success, otherwise false(0)
  */
-int libp2p_routing_dht_handle_add_provider(struct SessionContext* session, struct Libp2pMessage* message,
-			struct Peerstore* peerstore, struct ProviderStore* providerstore, unsigned char** result_buffer, size_t* result_buffer_size) {
+int libp2p_routing_dht_handle_add_provider(struct SessionContext* session, const struct Libp2pMessageView* message,
+			struct Peerstore* peerstore, struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** result_buffer, size_t* result_buffer_size) {
 	int retVal = 0;
 	struct Libp2pPeer *peer = NULL;
-	
+	struct Libp2pPeerView peer_view;
+	struct Libp2pMessage reply;
+	size_t pos = 0;
+
+	libp2p_routing_dht_reply_init(message, &reply);
+
 	//TODO: verify peer signature
 	/*
-	if (message->record != NULL && message->record->author != NULL && message->record->author_size > 0
+	if (message->has_record && message->record.author != NULL && message->record.author_size > 0
 			&& message->key != NULL && message->key_size > 0)
 	*/
 
-	struct Libp2pLinkedList* current = message->provider_peer_head;
-	if (current == NULL) {
+	// there should only be 1 when adding a provider
+	if (!libp2p_message_view_next_peer(message, MESSAGE_VIEW_PROVIDER_PEERS, &pos, &peer_view)) {
 		libp2p_logger_error("dht_protocol", "Provider has no peer.\n");
 		goto exit;
 	}
-	// there should only be 1 when adding a provider
-	if (current != NULL) {
-		peer = current->item;
-		if (peer == NULL) {
-			libp2p_logger_error("dht_protocol", "Message add_provider has no peer\n");
-			goto exit;
-		}
-		struct MultiAddress *peer_ma = libp2p_routing_dht_find_peer_ip_multiaddress(peer->addr_head);
-		if (peer_ma == NULL) {
-			libp2p_logger_error("dht_protocol", "Peer has no IP MultiAddress.\n");
-			goto exit;
-		}
-		// add what we know to be the ip for this peer
-		char *ip;
-		char new_string[255];
-		multiaddress_get_ip_address(session->default_stream->address, &ip);
-		int port = multiaddress_get_ip_port(peer_ma);
-		char* peer_id = multiaddress_get_peer_id(peer_ma);
-		sprintf(new_string, "/ip4/%s/tcp/%d/ipfs/%s", ip, port, peer_id);
-		free(ip);
-		free(peer_id);
-		struct MultiAddress* new_ma = multiaddress_new_from_string(new_string);
-		if (new_ma == NULL)
-			goto exit;
-		libp2p_logger_debug("dht_protocol", "New MultiAddress made with %s.\n", new_string);
-		// TODO: See if the sender is who he says he is
-		// set it as the first in the list
-		struct Libp2pLinkedList* new_head = libp2p_utils_linked_list_new();
-		new_head->item = new_ma;
-		new_head->next = peer->addr_head;
-		peer->addr_head = new_head;
-		// now add the peer to the peerstore
-		libp2p_logger_debug("dht_protocol", "About to add peer %s to peerstore\n", peer_ma->string);
-		if (!libp2p_peerstore_add_peer(peerstore, peer))
-			goto exit;
-		libp2p_logger_debug("dht_protocol", "About to add key to providerstore\n");
-		if (!libp2p_providerstore_add(providerstore, message->key, message->key_size, peer->id, peer->id_size))
-			goto exit;
+	// this is the only peer of the message that is parsed
+	peer = libp2p_peer_view_to_peer(&peer_view);
+	if (peer == NULL) {
+		libp2p_logger_error("dht_protocol", "Message add_provider has no peer\n");
+		goto exit;
 	}
+	reply.provider_peer_head = libp2p_utils_linked_list_new_in(arena);
+	if (reply.provider_peer_head == NULL)
+		goto exit;
+	reply.provider_peer_head->item = peer;
 
-	if (!libp2p_routing_dht_protobuf_message(message, result_buffer, result_buffer_size)) {
+	struct MultiAddress *peer_ma = libp2p_routing_dht_find_peer_ip_multiaddress(peer->addr_head);
+	if (peer_ma == NULL) {
+		libp2p_logger_error("dht_protocol", "Peer has no IP MultiAddress.\n");
+		goto exit;
+	}
+	// add what we know to be the ip for this peer
+	char *ip;
+	char new_string[255];
+	multiaddress_get_ip_address(session->default_stream->address, &ip);
+	int port = multiaddress_get_ip_port(peer_ma);
+	char* peer_id = multiaddress_get_peer_id(peer_ma);
+	sprintf(new_string, "/ip4/%s/tcp/%d/ipfs/%s", ip, port, peer_id);
+	free(ip);
+	free(peer_id);
+	struct MultiAddress* new_ma = multiaddress_new_from_string(new_string);
+	if (new_ma == NULL)
+		goto exit;
+	libp2p_logger_debug("dht_protocol", "New MultiAddress made with %s.\n", new_string);
+	// TODO: See if the sender is who he says he is
+	// set it as the first in the list
+	struct Libp2pLinkedList* new_head = libp2p_utils_linked_list_new();
+	new_head->item = new_ma;
+	new_head->next = peer->addr_head;
+	peer->addr_head = new_head;
+	// now add the peer to the peerstore
+	if (libp2p_logger_watching_class("dht_protocol"))
+		libp2p_logger_debug("dht_protocol", "About to add peer %s to peerstore\n", multiaddress_to_string(peer_ma));
+	if (!libp2p_peerstore_add_peer(peerstore, peer))
+		goto exit;
+	libp2p_logger_debug("dht_protocol", "About to add key to providerstore\n");
+	if (!libp2p_providerstore_add(providerstore, message->key, message->key_size, (unsigned char*)peer->id, peer->id_size))
+		goto exit;
+
+	if (!libp2p_routing_dht_protobuf_reply(arena, &reply, result_buffer, result_buffer_size)) {
 		goto exit;
 	}
 
@@ -222,16 +321,17 @@ int libp2p_routing_dht_handle_add_provider(struct SessionContext* session, struc
 	exit:
 	if (retVal != 1) {
 		if (*result_buffer != NULL) {
-			free(*result_buffer);
+			if (arena == NULL)
+				free(*result_buffer);
 			*result_buffer_size = 0;
 			*result_buffer = NULL;
 		}
 		libp2p_logger_error("dht_protocol", "add_provider returning false\n");
 	}
-	/*
-	if (peer != NULL)
+	// the peer was parsed with malloc, so the arena does not free it
+	if (arena != NULL || reply.provider_peer_head == NULL)
 		libp2p_peer_free(peer);
-	*/
+	libp2p_routing_dht_reply_clear(arena, &reply);
 	return retVal;
 }
 
@@ -241,17 +341,20 @@ int libp2p_routing_dht_handle_add_provider(struct SessionContext* session, struc
  * @param message the message
  * @param peerstore the peerstore
  * @param providerstore the providerstore
+ * @param arena where to allocate the reply, or NULL to malloc it
  * @param result_buffer the results
  * @param result_buffer_size the size of the results
  * @returns true(1) on success, otherwise false(0)
  */
-int libp2p_routing_dht_handle_get_value(struct SessionContext* session, struct Libp2pMessage* message,
-		struct Peerstore* peerstore, struct ProviderStore* providerstore, unsigned char** result_buffer, size_t *result_buffer_size) {
+int libp2p_routing_dht_handle_get_value(struct SessionContext* session, const struct Libp2pMessageView* message,
+		struct Peerstore* peerstore, struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** result_buffer, size_t *result_buffer_size) {
 
 	struct Datastore* datastore = session->datastore;
 	struct Filestore* filestore = session->filestore;
 	size_t data_size = 0;
 	unsigned char* data = NULL;
+	struct Libp2pMessage reply;
+	int retVal = 1;
 
 	// We need to get the data from the disk
 	if(!filestore->node_get(message->key, message->key_size, (void**)&data, &data_size, filestore)) {
@@ -260,23 +363,31 @@ int libp2p_routing_dht_handle_get_value(struct SessionContext* session, struct L
 
 	libp2p_logger_debug("dht_protocol", "handle_get_value: value retrieved from the datastore\n");
 
-	struct Libp2pRecord *record = libp2p_record_new();
+	libp2p_routing_dht_reply_init(message, &reply);
+	struct Libp2pRecord *record = libp2p_record_new_in(arena);
+	reply.record = record;
+	if (record == NULL) {
+		free(data);
+		libp2p_routing_dht_reply_clear(arena, &reply);
+		return 0;
+	}
 	record->key_size = message->key_size;
-	record->key = malloc(record->key_size);
-	memcpy(record->key, message->key, record->key_size);
+	record->key = libp2p_utils_arena_alloc(arena, record->key_size);
 	record->value_size = data_size;
-	record->value = malloc(record->value_size);
-	memcpy(record->value, data, record->value_size);
-	message->record = record;
+	record->value = libp2p_utils_arena_alloc(arena, record->value_size);
+	if (record->key == NULL || record->value == NULL)
+		retVal = 0;
+	else {
+		memcpy(record->key, message->key, record->key_size);
+		memcpy(record->value, data, record->value_size);
+	}
 	free(data);
 
-	if (!libp2p_routing_dht_protobuf_message(message, result_buffer, result_buffer_size)) {
-		libp2p_record_free(record);
-		message->record = NULL;
-		return 0;
-	}
+	if (retVal && !libp2p_routing_dht_protobuf_reply(arena, &reply, result_buffer, result_buffer_size))
+		retVal = 0;
 
-	return 1;
+	libp2p_routing_dht_reply_clear(arena, &reply);
+	return retVal;
 }
 
 /**
@@ -285,12 +396,13 @@ int libp2p_routing_dht_handle_get_value(struct SessionContext* session, struct L
  * @param message the message
  * @param peerstore the peerstore
  * @param providerstore the providerstore
+ * @param arena where to allocate the reply, or NULL to malloc it
  * @param result_buffer the results
  * @param result_buffer_size the size of the results
  * @returns true(1) on success, otherwise false(0)
  */
-int libp2p_routing_dht_handle_put_value(struct SessionContext* session, struct Libp2pMessage* message,
-		struct Peerstore* peerstore, struct ProviderStore* providerstore, unsigned char** result_buffer, size_t *result_buffer_size) {
+int libp2p_routing_dht_handle_put_value(struct SessionContext* session, const struct Libp2pMessageView* message,
+		struct Peerstore* peerstore, struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** result_buffer, size_t *result_buffer_size) {
 	//TODO: implement this
 	return 0;
 }
@@ -301,23 +413,28 @@ int libp2p_routing_dht_handle_put_value(struct SessionContext* session, struct L
  * @param message the message
  * @param peerstore the peerstore
  * @param providerstore the providerstore
+ * @param arena where to allocate the reply, or NULL to malloc it
  * @param result_buffer the results
  * @param result_buffer_size the size of the results
  * @returns true(1) on success, otherwise false(0)
  */
-int libp2p_routing_dht_handle_find_node(struct SessionContext* session, struct Libp2pMessage* message,
-		struct Peerstore* peerstore, struct ProviderStore* providerstore, unsigned char** result_buffer, size_t *result_buffer_size) {
+int libp2p_routing_dht_handle_find_node(struct SessionContext* session, const struct Libp2pMessageView* message,
+		struct Peerstore* peerstore, struct ProviderStore* providerstore, struct Libp2pArena* arena, unsigned char** result_buffer, size_t *result_buffer_size) {
+	struct Libp2pMessage reply;
+	int retVal = 0;
 	// look through peer store
 	struct Libp2pPeer* peer = libp2p_peerstore_get_peer(peerstore, message->key, message->key_size);
 	if (peer != NULL) {
-		message->provider_peer_head = libp2p_utils_linked_list_new();
-		message->provider_peer_head->item = libp2p_peer_copy(peer);
-		if (!libp2p_routing_dht_protobuf_message(message, result_buffer, result_buffer_size)) {
-			return 0;
+		libp2p_routing_dht_reply_init(message, &reply);
+		reply.provider_peer_head = libp2p_utils_linked_list_new_in(arena);
+		if (reply.provider_peer_head != NULL) {
+			reply.provider_peer_head->item = libp2p_peer_copy_in(arena, peer);
+			if (reply.provider_peer_head->item != NULL)
+				retVal = libp2p_routing_dht_protobuf_reply(arena, &reply, result_buffer, result_buffer_size);
 		}
-		return 1;
+		libp2p_routing_dht_reply_clear(arena, &reply);
 	}
-	return 0;
+	return retVal;
 }
 
 /***
@@ -332,34 +449,38 @@ int libp2p_routing_dht_handle_message(struct SessionContext* session, struct Pee
 	unsigned char* buffer = NULL, *result_buffer = NULL;
 	size_t buffer_size = 0, result_buffer_size = 0;
 	int retVal = 0;
-	struct Libp2pMessage* message = NULL;
+	struct Libp2pMessageView message_view;
+	struct Libp2pMessageView* message = &message_view;
+	struct Libp2pArena arena;
+
+	libp2p_utils_arena_init(&arena, DHT_ARENA_BLOCK_SIZE);
 
 	// read from stream
 	if (!session->default_stream->read(session, &buffer, &buffer_size, 5))
 		goto exit;
-	// unprotobuf
-	if (!libp2p_message_protobuf_decode(buffer, buffer_size, &message))
+	// unprotobuf, pointing into the buffer rather than copying out of it
+	if (!libp2p_message_view_decode(buffer, buffer_size, message))
 		goto exit;
 
 	// handle message
 	switch(message->message_type) {
 		case(MESSAGE_TYPE_PUT_VALUE): // store a value in local storage
-				libp2p_routing_dht_handle_put_value(session, message, peerstore, providerstore, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_put_value(session, message, peerstore, providerstore, &arena, &result_buffer, &result_buffer_size);
 				break;
 		case(MESSAGE_TYPE_GET_VALUE): // get a value from local storage
-				libp2p_routing_dht_handle_get_value(session, message, peerstore, providerstore, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_get_value(session, message, peerstore, providerstore, &arena, &result_buffer, &result_buffer_size);
 				break;
 		case(MESSAGE_TYPE_ADD_PROVIDER): // client wants us to know he can provide something
-				libp2p_routing_dht_handle_add_provider(session, message, peerstore, providerstore, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_add_provider(session, message, peerstore, providerstore, &arena, &result_buffer, &result_buffer_size);
 				break;
 		case(MESSAGE_TYPE_GET_PROVIDERS): // see if we can help, and send closer peers
-				libp2p_routing_dht_handle_get_providers(session, message, peerstore, providerstore, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_get_providers(session, message, peerstore, providerstore, &arena, &result_buffer, &result_buffer_size);
 				break;
 		case(MESSAGE_TYPE_FIND_NODE): // find peers
-				libp2p_routing_dht_handle_find_node(session, message, peerstore, providerstore, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_find_node(session, message, peerstore, providerstore, &arena, &result_buffer, &result_buffer_size);
 				break;
 		case(MESSAGE_TYPE_PING):
-				libp2p_routing_dht_handle_ping(message, &result_buffer, &result_buffer_size);
+				libp2p_routing_dht_handle_ping(message, &arena, &result_buffer, &result_buffer_size);
 				break;
 	}
 	// if we have something to send, send it.
@@ -374,9 +495,9 @@ int libp2p_routing_dht_handle_message(struct SessionContext* session, struct Pee
 	exit:
 	if (buffer != NULL)
 		free(buffer);
-	if (result_buffer != NULL)
-		free(result_buffer);
-	if (message != NULL)
-		libp2p_message_free(message);
+	libp2p_logger_debug("dht_protocol", "Request used %lu bytes in %lu allocations and %lu mallocs.\n",
+			(unsigned long)arena.high_water, (unsigned long)arena.allocations, (unsigned long)arena.mallocs);
+	// the reply and everything made for it
+	libp2p_utils_arena_clear(&arena);
 	return retVal;
 }
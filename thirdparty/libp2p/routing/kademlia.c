@@ -13,8 +13,12 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include <libp2p/crypto/sha256.h>
+#include <libp2p/crypto/random.h>
 #include <libp2p/routing/kademlia.h>
 #include <libp2p/routing/dht.h>
 #include <multiaddr/multiaddr.h>
@@ -34,21 +38,61 @@ struct bs_struct {
 pthread_t pth_kademlia, pth_announce;
 time_t tosleep = 0;
 int kfd = -1;
+int kwakefd = -1; // eventfd used to wake kademlia_thread up.
 int net_family = 0;
-volatile int8_t searching = 0; // search lock, -1 to busy, 0 to free, 1 to running.
-volatile char hash[20];     // hash to be search or announce.
-volatile uint16_t announce_port = 0;
 volatile int8_t closing = 0;
 
+#define HASH_SIZE 20
+
 #define ANNOUNCE_WAIT_TIME		(28 * 60) // Wait 28 minutes.
 #define ANNOUNCE_WAIT_TOLERANCE		60
 struct announce_struct {
-    unsigned char hash[sizeof hash];
+    unsigned char hash[HASH_SIZE];
     uint16_t port;
     unsigned int time;
     struct announce_struct *next;
 } *announce_list = NULL;
 
+/* The routing table snapshot is a magic string followed by records of a
+   node id, an IPv6 (or v4-mapped) address and a port in network order,
+   and ends with the SHA-256 of all that. */
+#define SNAPSHOT_MAGIC			"PNDHTv2\n"
+#define SNAPSHOT_RECORD			(HASH_SIZE + 16 + 2)
+#define SNAPSHOT_CHECKSUM		32
+#define SNAPSHOT_MAX_NODES		1024
+#define SNAPSHOT_MAX_SIZE		(sizeof SNAPSHOT_MAGIC - 1 + SNAPSHOT_MAX_NODES * SNAPSHOT_RECORD + SNAPSHOT_CHECKSUM)
+#define SNAPSHOT_INTERVAL		(5 * 60) // Save every 5 minutes.
+/* A snapshot with fewer nodes than this is not trusted to replace the
+   bootstrap nodes. */
+#define SNAPSHOT_MIN_NODES		8
+static char *snapshot_path = NULL;
+/* Nodes that dht_insert_node had no room for.  Unconfirmed nodes never
+   split a bucket, so they are pinged once the loaded ones had the time to
+   answer and the buckets can split. */
+#define SNAPSHOT_RETRY_DELAY	500 // ms
+static struct sockaddr_storage *snapshot_retry = NULL;
+static int snapshot_retry_count = 0;
+
+/* How many datagrams are moved per recvmmsg/sendmmsg call. */
+#define KADEMLIA_BATCH			64
+/* Big enough for anything dht.c sends or is willing to parse. */
+#define KADEMLIA_MAX_DATAGRAM	4096
+
+struct kademlia_batch {
+    int count;
+    struct mmsghdr msgs[KADEMLIA_BATCH];
+    struct iovec iov[KADEMLIA_BATCH];
+    struct sockaddr_storage addr[KADEMLIA_BATCH];
+    char buf[KADEMLIA_BATCH][KADEMLIA_MAX_DATAGRAM];
+};
+
+/* Only kademlia_thread touches these. */
+static struct kademlia_batch inbox, outbox;
+/* Set while kademlia_thread is handling a batch, so that dht_sendto queues
+   replies in the outbox instead of sending them one at a time.  Other
+   threads calling into the DHT still send directly. */
+static __thread int batching = 0;
+
 #define DHT_MAX_IPV4	50
 #define DHT_MAX_IPV6	10
 
@@ -62,14 +106,65 @@ struct ipv6_struct {
     uint16_t port;
 };
 
-struct search_struct {
-    unsigned char hash[sizeof hash];
+/* A search moves from the pending queue, filled by any thread, to the
+   running list once kademlia_thread has handed it to the DHT.  Results
+   are collected as they arrive and waiters are woken when the DHT reports
+   the search done.  Everything here is protected by search_mutex. */
+struct kademlia_search {
+    unsigned char hash[HASH_SIZE];
+    uint16_t port;
+    int done;
+    int refs;                   // the caller and kademlia_thread.
     uint8_t ipv4_count;
     uint8_t ipv6_count;
     struct ipv4_struct ipv4[DHT_MAX_IPV4];
     struct ipv6_struct ipv6[DHT_MAX_IPV6];
-    struct search_struct *next;
-} *search_result = NULL;
+    struct kademlia_search *next;
+};
+
+static pthread_mutex_t search_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t search_cond;
+static pthread_once_t search_cond_once = PTHREAD_ONCE_INIT;
+static struct kademlia_search *search_pending = NULL, **search_pending_tail = &search_pending;
+static struct kademlia_search *search_running = NULL;
+
+/* Waits are measured against CLOCK_MONOTONIC, so that they don't care
+   about the wall clock being set. */
+static void search_cond_init(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&search_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Drop a reference to a search, with search_mutex held. */
+static void search_unref(struct kademlia_search *s)
+{
+    if (--s->refs == 0) {
+        free(s);
+    }
+}
+
+/* Mark every running search for hash done and wake up their waiters,
+   with search_mutex held. */
+static void search_complete(const unsigned char *hash)
+{
+    struct kademlia_search **sp = &search_running, *s;
+
+    while ((s = *sp) != NULL) {
+        if (hash == NULL || memcmp(s->hash, hash, HASH_SIZE) == 0) {
+            *sp = s->next;
+            s->done = 1;
+            search_unref(s);
+        } else {
+            sp = &s->next;
+        }
+    }
+    pthread_cond_broadcast(&search_cond);
+}
 
 /***
  * The call-back function is called by the DHT whenever something
@@ -82,7 +177,9 @@ struct search_struct {
  * @param data_len the length of the data
  */
 static void callback(void *closure, int event, const unsigned char *info_hash, const void *data, size_t data_len) {
-    struct search_struct *sp, *rp = NULL; // struct pointer and result pointer
+    struct kademlia_search *rp; // result pointer
+    size_t n;
+    int i;
 
     switch (event) {
         case DHT_EVENT_VALUES:
@@ -90,81 +187,274 @@ static void callback(void *closure, int event, const unsigned char *info_hash, c
             if (dht_debug) {
                 fprintf(dht_debug, "Received %d values.\n", (int)(data_len / 6));
             }
-            // Find the item in the list.
-            for (rp = search_result ; rp ; rp = rp->next) {
-                if (memcmp(rp->hash, info_hash, sizeof hash) == 0) { // Found.
-                    int i;
-                    if (event == DHT_EVENT_VALUES) { // IPv4
+            pthread_mutex_lock(&search_mutex);
+            // Every running search for this hash gets the values.
+            for (rp = search_running ; rp ; rp = rp->next) {
+                if (memcmp(rp->hash, info_hash, HASH_SIZE) != 0) {
+                    continue;
+                }
+                if (event == DHT_EVENT_VALUES) { // IPv4
+                    for (n = 0 ; n + 6 <= data_len ; n += 6) {
                         struct ipv4_struct ipv4;
                         if (rp->ipv4_count == DHT_MAX_IPV4) { // Full
-                            return;
+                            break;
                         }
                         // Make sure the data is in struct format.
-                        memcpy(&ipv4.ip, data, 4);
-                        memcpy(&ipv4.port, data+4, 2);
+                        memset(&ipv4, 0, sizeof ipv4);
+                        memcpy(&ipv4.ip, (const char*)data + n, 4);
+                        memcpy(&ipv4.port, (const char*)data + n + 4, 2);
                         ipv4.port = ntohs(ipv4.port);
                         for (i = 0 ; i < rp->ipv4_count ; i++) {
                             if (memcmp(&rp->ipv4[i], &ipv4, sizeof ipv4) == 0) {
-                                return; // Alread in the list.
+                                break; // Already in the list.
                             }
                         }
-                        // Not in the list, then add.
-                        memcpy(&rp->ipv4[rp->ipv4_count], &ipv4, sizeof ipv4);
-                        rp->ipv4_count++;
-                    } else { // IPv6
+                        if (i == rp->ipv4_count) {
+                            memcpy(&rp->ipv4[rp->ipv4_count], &ipv4, sizeof ipv4);
+                            rp->ipv4_count++;
+                        }
+                    }
+                } else { // IPv6
+                    for (n = 0 ; n + 18 <= data_len ; n += 18) {
                         struct ipv6_struct ipv6;
                         if (rp->ipv6_count == DHT_MAX_IPV6) { // Full
-                            return;
+                            break;
                         }
                         // Make sure the data is in struct format.
-                        memcpy(&ipv6.ip, data, 16);
-                        memcpy(&ipv6.port, data+16, 2);
+                        memset(&ipv6, 0, sizeof ipv6);
+                        memcpy(&ipv6.ip, (const char*)data + n, 16);
+                        memcpy(&ipv6.port, (const char*)data + n + 16, 2);
+                        ipv6.port = ntohs(ipv6.port);
                         for (i = 0 ; i < rp->ipv6_count ; i++) {
                             if (memcmp(&rp->ipv6[i], &ipv6, sizeof ipv6) == 0) {
-                                return; // Alread in the list.
+                                break; // Already in the list.
                             }
                         }
-                        // Not in the list, then add.
-                        memcpy(&rp->ipv6[rp->ipv6_count], &ipv6, sizeof ipv6);
-                        rp->ipv6_count++;
+                        if (i == rp->ipv6_count) {
+                            memcpy(&rp->ipv6[rp->ipv6_count], &ipv6, sizeof ipv6);
+                            rp->ipv6_count++;
+                        }
                     }
-                    return;
                 }
             }
-            break; // Not found, how can EVENT_VALUE may occur before SEARCH_DONE?
+            pthread_mutex_unlock(&search_mutex);
+            break;
         case DHT_EVENT_SEARCH_DONE:
         case DHT_EVENT_SEARCH_DONE6:
             if (dht_debug) {
                 fprintf(dht_debug, "Search done.\n");
             }
-            if (search_result) {
-                // Try to find the item in the list.
-                for (sp = search_result ; sp->next ; sp = sp->next) {
-                    if (memcmp(sp->hash, info_hash, sizeof hash) == 0) { // Found.
-                        rp = sp;
-                        break;
-                    }
-                }
-                if (!rp) {
-                    rp = malloc(sizeof(struct search_struct));
-                    if (!rp) return; // Abort, out of memory.
-                    memset(rp, 0, sizeof(struct search_struct));
-                    memcpy(rp->hash, info_hash, sizeof hash);
-                    sp->next = rp; // Insert in the list.
-                }
-            } else {
-                rp = malloc(sizeof(struct search_struct));
-                if (!rp) return; // Abort, out of memory.
-                memset(rp, 0, sizeof(struct search_struct));
-                memcpy(rp->hash, info_hash, sizeof hash);
-                search_result = rp; // Insert first item in the list.
-            }
+            pthread_mutex_lock(&search_mutex);
+            search_complete(info_hash);
+            pthread_mutex_unlock(&search_mutex);
             break;
         default:
             break;
     }
 }
 
+/***
+ * Interrupt the epoll_wait of kademlia_thread, so it notices a new search
+ * or a close request right away instead of at its next timeout.
+ */
+static void kademlia_wakeup(void)
+{
+    uint64_t one = 1;
+
+    if (kwakefd != -1 && write(kwakefd, &one, sizeof one) < 0 && errno != EAGAIN) {
+        perror("kademlia_wakeup");
+    }
+}
+
+int kademlia_snapshot_file(const char* path)
+{
+    free(snapshot_path);
+    snapshot_path = NULL;
+    if (path) {
+        snapshot_path = strdup(path);
+        if (!snapshot_path) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/***
+ * Whether buf holds a whole snapshot: the magic string, whole records and
+ * a matching checksum.  A truncated or damaged file is not loaded at all.
+ * @param buf the content of the file
+ * @param len its length
+ * @returns true(1) if it can be loaded
+ */
+static int kademlia_snapshot_valid(const unsigned char *buf, size_t len)
+{
+    unsigned char sum[SNAPSHOT_CHECKSUM];
+    size_t magic = sizeof SNAPSHOT_MAGIC - 1;
+
+    if (len < magic + SNAPSHOT_CHECKSUM || len > SNAPSHOT_MAX_SIZE ||
+        (len - magic - SNAPSHOT_CHECKSUM) % SNAPSHOT_RECORD != 0 ||
+        memcmp(buf, SNAPSHOT_MAGIC, magic) != 0) {
+        return 0;
+    }
+    libp2p_crypto_hashing_sha256((const char*)buf, len - SNAPSHOT_CHECKSUM, sum);
+    return memcmp(sum, buf + len - SNAPSHOT_CHECKSUM, SNAPSHOT_CHECKSUM) == 0;
+}
+
+/***
+ * Bulk load the nodes of the snapshot with dht_insert_node, and ping them
+ * so that those still alive are confirmed right away instead of at the
+ * next bucket maintenance.
+ * @param family the address family of the DHT
+ * @returns the number of nodes loaded
+ */
+static int kademlia_load_snapshot(int family)
+{
+    static const unsigned char v4prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+    unsigned char *buf;
+    FILE *f;
+    size_t len, pos;
+    int loaded = 0;
+
+    if (!snapshot_path || (f = fopen(snapshot_path, "rb")) == NULL) {
+        return 0;
+    }
+    // one byte more than a snapshot can hold, to notice a file too long
+    buf = malloc(SNAPSHOT_MAX_SIZE + 1);
+    if (!buf) {
+        fclose(f);
+        return 0;
+    }
+    len = fread(buf, 1, SNAPSHOT_MAX_SIZE + 1, f);
+    fclose(f);
+
+    if (!kademlia_snapshot_valid(buf, len)) {
+        if (dht_debug) {
+            fprintf(dht_debug, "Ignoring the damaged snapshot %s.\n", snapshot_path);
+        }
+        free(buf);
+        return 0;
+    }
+    len -= SNAPSHOT_CHECKSUM;
+
+    for (pos = sizeof SNAPSHOT_MAGIC - 1 ; pos + SNAPSHOT_RECORD <= len ; pos += SNAPSHOT_RECORD) {
+        const unsigned char *r = buf + pos;
+        struct sockaddr_storage ss;
+        int sslen;
+
+        memset(&ss, 0, sizeof ss);
+        if (memcmp(r + HASH_SIZE, v4prefix, sizeof v4prefix) == 0) {
+            struct sockaddr_in *sin = (struct sockaddr_in*)&ss;
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, r + HASH_SIZE + 12, 4);
+            memcpy(&sin->sin_port, r + HASH_SIZE + 16, 2);
+            sslen = sizeof(struct sockaddr_in);
+        } else {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&ss;
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_addr, r + HASH_SIZE, 16);
+            memcpy(&sin6->sin6_port, r + HASH_SIZE + 16, 2);
+            sslen = sizeof(struct sockaddr_in6);
+        }
+        if (ss.ss_family != family) {
+            continue;
+        }
+        if (dht_insert_node(r, (struct sockaddr*)&ss, sslen) > 0) {
+            dht_ping_node((struct sockaddr*)&ss, sslen);
+            loaded++;
+        } else {
+            if (!snapshot_retry) {
+                snapshot_retry = malloc(SNAPSHOT_MAX_NODES * sizeof(struct sockaddr_storage));
+            }
+            if (snapshot_retry) {
+                memcpy(&snapshot_retry[snapshot_retry_count++], &ss, sizeof ss);
+            }
+        }
+    }
+    free(buf);
+
+    if (dht_debug) {
+        fprintf(dht_debug, "Loaded %d nodes from %s.\n", loaded, snapshot_path);
+    }
+    return loaded;
+}
+
+/***
+ * Write the good nodes of the routing table to the snapshot file.  The
+ * file is replaced atomically, so a crash never leaves half a snapshot.
+ * Only kademlia_thread may call this, the DHT is not thread safe.
+ * @returns the number of nodes saved, or -1 on error
+ */
+static int kademlia_save_snapshot(void)
+{
+    unsigned char *ids = NULL, *buf = NULL;
+    struct sockaddr_storage *ss = NULL;
+    char *tmp = NULL;
+    FILE *f = NULL;
+    int i, num = SNAPSHOT_MAX_NODES, retVal = -1;
+    size_t len = sizeof SNAPSHOT_MAGIC - 1;
+
+    if (!snapshot_path) {
+        return 0;
+    }
+
+    ids = malloc(SNAPSHOT_MAX_NODES * HASH_SIZE);
+    ss = malloc(SNAPSHOT_MAX_NODES * sizeof(struct sockaddr_storage));
+    buf = malloc(SNAPSHOT_MAX_SIZE);
+    tmp = malloc(strlen(snapshot_path) + 5);
+    if (!ids || !ss || !buf || !tmp) {
+        goto exit;
+    }
+
+    dht_get_node_ids(net_family, ids, ss, &num);
+    if (num == 0) {
+        retVal = 0; // Keep the last snapshot rather than an empty one.
+        goto exit;
+    }
+
+    memcpy(buf, SNAPSHOT_MAGIC, len);
+    for (i = 0 ; i < num ; i++) {
+        unsigned char *r = buf + len;
+        memcpy(r, ids + i * HASH_SIZE, HASH_SIZE);
+        if (ss[i].ss_family == AF_INET) {
+            struct sockaddr_in *sin = (struct sockaddr_in*)&ss[i];
+            memset(r + HASH_SIZE, 0, 10);
+            memset(r + HASH_SIZE + 10, 0xFF, 2);
+            memcpy(r + HASH_SIZE + 12, &sin->sin_addr, 4);
+            memcpy(r + HASH_SIZE + 16, &sin->sin_port, 2);
+        } else {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&ss[i];
+            memcpy(r + HASH_SIZE, &sin6->sin6_addr, 16);
+            memcpy(r + HASH_SIZE + 16, &sin6->sin6_port, 2);
+        }
+        len += SNAPSHOT_RECORD;
+    }
+    libp2p_crypto_hashing_sha256((const char*)buf, len, buf + len);
+    len += SNAPSHOT_CHECKSUM;
+
+    sprintf(tmp, "%s.tmp", snapshot_path);
+    f = fopen(tmp, "wb");
+    if (!f) {
+        goto exit;
+    }
+    if (fwrite(buf, 1, len, f) != len) {
+        fclose(f);
+        unlink(tmp);
+        goto exit;
+    }
+    if (fclose(f) != 0 || rename(tmp, snapshot_path) != 0) {
+        unlink(tmp);
+        goto exit;
+    }
+    retVal = num;
+
+exit:
+    free(ids);
+    free(ss);
+    free(buf);
+    free(tmp);
+    return retVal;
+}
+
 int start_kademlia_multiaddress(struct MultiAddress* address, char* peer_id, int timeout, struct Libp2pVector* bootstrap_addresses) {
 	int port = multiaddress_get_ip_port(address);
 	int family = multiaddress_get_ip_family(address);
@@ -190,11 +480,13 @@ int start_kademlia_multiaddress(struct MultiAddress* address, char* peer_id, int
 int start_kademlia(int net_fd, int family, char* peer_id, int timeout, struct Libp2pVector* bootstrap_addresses)
 {
     int rc, i, len;
-    unsigned char id[sizeof hash];
+    unsigned char id[HASH_SIZE];
     struct sockaddr_in sa;
 
     dht_debug = stderr;
 
+    pthread_once(&search_cond_once, search_cond_init);
+
     len = bootstrap_addresses->total;
 
     if (len > MAX_BOOTSTRAP_NODES) {
@@ -251,20 +543,26 @@ int start_kademlia(int net_fd, int family, char* peer_id, int timeout, struct Li
        a massive number of nodes (for example because you're restoring from
        a dump) and you already know their ids, it's better to use
        dht_insert_node.  If the ids are incorrect, the DHT will recover. */
-    for(i = 0; i < num_bootstrap_nodes; i++) {
-    	// for debugging
-    	int retVal =
-        dht_ping_node((struct sockaddr*)&bootstrap_nodes[i],
-                      sizeof (bootstrap_nodes[i]));
-    	fprintf(stderr, "ping returned %d\n", retVal);
-        usleep(random() % 100000);
+    if (kademlia_load_snapshot(family) < SNAPSHOT_MIN_NODES) {
+        for(i = 0; i < num_bootstrap_nodes; i++) {
+            // for debugging
+            int retVal =
+            dht_ping_node((struct sockaddr*)&bootstrap_nodes[i],
+                          sizeof (bootstrap_nodes[i]));
+            fprintf(stderr, "ping returned %d\n", retVal);
+            usleep(random() % 100000);
+        }
     }
 
-    // TODO: Read cache nodes from file and load using dht_insert_node.
-
     kfd = net_fd;
     net_family = family;
     tosleep = timeout;
+    closing = 0;
+
+    kwakefd = eventfd(0, EFD_NONBLOCK);
+    if (kwakefd < 0) {
+        return -1;
+    }
 
     rc = pthread_create(&pth_kademlia, NULL, kademlia_thread, NULL);
     if (rc) {
@@ -278,124 +576,380 @@ void stop_kademlia (void)
 {
     if (kfd != -1) {
         closing = 1;
+        kademlia_wakeup();
 
         pthread_cancel(pth_announce);
 
         // Wait kademlia_thread finish.
         pthread_join(pth_kademlia, NULL);
 
+        // Nobody will run the searches left, release whoever waits for them.
+        pthread_mutex_lock(&search_mutex);
+        while (search_pending) {
+            struct kademlia_search *s = search_pending;
+            search_pending = s->next;
+            s->done = 1;
+            search_unref(s);
+        }
+        search_pending_tail = &search_pending;
+        search_complete(NULL);
+        pthread_mutex_unlock(&search_mutex);
+
         dht_uninit();
 
         close (kfd);
         kfd = -1;
+        close (kwakefd);
+        kwakefd = -1;
+    }
+}
+
+/***
+ * Hand the pending searches to the DHT.  If port is non-zero, the search
+ * also performs an announce.  Searches the DHT has no room for stay queued
+ * until one finishes.
+ * @returns the number of searches started
+ */
+static int kademlia_start_searches(void)
+{
+    struct kademlia_search *s;
+    int started = 0;
+
+    pthread_mutex_lock(&search_mutex);
+    while ((s = search_pending) != NULL) {
+        // On the running list first, dht_search may report local values.
+        search_pending = s->next;
+        if (search_pending == NULL) {
+            search_pending_tail = &search_pending;
+        }
+        s->next = search_running;
+        search_running = s;
+        pthread_mutex_unlock(&search_mutex);
+
+        if (dht_search(s->hash, s->port, net_family, callback, NULL) < 0) {
+            pthread_mutex_lock(&search_mutex);
+            if (errno != ENOSPC) {
+                perror("dht_search");
+                search_complete(s->hash);
+                continue;
+            }
+            // The DHT is full, retry once something completes.
+            search_running = s->next;
+            s->next = search_pending;
+            search_pending = s;
+            if (s->next == NULL) {
+                search_pending_tail = &s->next;
+            }
+            break;
+        }
+        started++;
+        pthread_mutex_lock(&search_mutex);
+    }
+    pthread_mutex_unlock(&search_mutex);
+    return started;
+}
+
+/***
+ * Send everything queued in the outbox with as few sendmmsg calls as
+ * possible.  Datagrams the kernel refuses are dropped, as they would have
+ * been by sendto.
+ */
+static void kademlia_flush_outbox(void)
+{
+    int sent = 0, rc;
+
+    while (sent < outbox.count) {
+        rc = sendmmsg(kfd, &outbox.msgs[sent], outbox.count - sent, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (dht_debug) {
+                fprintf(dht_debug, "kademlia_flush_outbox:sendmmsg failed with %d\n", errno);
+            }
+            sent++; // skip the datagram that failed.
+            continue;
+        }
+        sent += rc;
     }
+    outbox.count = 0;
 }
 
+/***
+ * Read every pending datagram from the socket, KADEMLIA_BATCH at a time,
+ * hand each of them to the DHT and send all the replies in one go.
+ * @returns the number of datagrams processed
+ */
+static int kademlia_receive_batch(void)
+{
+    int i, rc, total = 0;
+
+    do {
+        for (i = 0 ; i < KADEMLIA_BATCH ; i++) {
+            inbox.iov[i].iov_base = inbox.buf[i];
+            inbox.iov[i].iov_len = sizeof(inbox.buf[i]);
+            inbox.msgs[i].msg_hdr.msg_name = &inbox.addr[i];
+            inbox.msgs[i].msg_hdr.msg_namelen = sizeof(inbox.addr[i]);
+            inbox.msgs[i].msg_hdr.msg_iov = &inbox.iov[i];
+            inbox.msgs[i].msg_hdr.msg_iovlen = 1;
+            inbox.msgs[i].msg_hdr.msg_control = NULL;
+            inbox.msgs[i].msg_hdr.msg_controllen = 0;
+            inbox.msgs[i].msg_hdr.msg_flags = 0;
+        }
+        rc = recvmmsg(kfd, inbox.msgs, KADEMLIA_BATCH, MSG_DONTWAIT, NULL);
+        if (rc < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "kademlia_thread:recvmmsg failed with %d\n", errno);
+            }
+            break;
+        }
+        inbox.count = rc;
+
+        batching = 1;
+        for (i = 0 ; i < inbox.count ; i++) {
+            if (dht_process(inbox.buf[i], inbox.msgs[i].msg_len,
+                            (struct sockaddr*)&inbox.addr[i],
+                            inbox.msgs[i].msg_hdr.msg_namelen,
+                            callback, NULL) < 0) {
+                perror("dht_process");
+            }
+        }
+        batching = 0;
+        kademlia_flush_outbox();
+        total += inbox.count;
+    } while (inbox.count == KADEMLIA_BATCH && !closing);
+
+    return total;
+}
+
+/***
+ * Milliseconds on the monotonic clock
+ */
+static long long kademlia_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/***
+ * The event loop of the DHT. The socket is watched with epoll, and every
+ * wakeup drains all pending datagrams in batches. The periodic work of
+ * the DHT only runs when the timeout requested by dht_periodic expires,
+ * not once per packet.
+ */
 void *kademlia_thread (void *ptr)
 {
-    int rc;
-    struct timeval tv;
-    fd_set readfds;
-    char buf[4096];
-    struct sockaddr from;
-    socklen_t fromlen;
+    int rc, i, epfd;
+    long long deadline, now_ms, wakeup, retry_at = 0;
+    time_t next_snapshot = time(NULL) + SNAPSHOT_INTERVAL;
+    struct epoll_event ev[2];
+    struct epoll_event add;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return (void*)1;
+    }
+    memset(&add, 0, sizeof add);
+    add.events = EPOLLIN;
+    add.data.fd = kfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, kfd, &add) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
+        return (void*)1;
+    }
+    add.data.fd = kwakefd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, kwakefd, &add) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
+        return (void*)1;
+    }
 
-    for(;;) {
-        tv.tv_sec = tosleep;
-        tv.tv_usec = random() % 1000000;
+    deadline = kademlia_now_ms();
+    if (snapshot_retry_count > 0) {
+        retry_at = deadline + SNAPSHOT_RETRY_DELAY;
+    }
 
-        FD_ZERO(&readfds);
-        FD_SET(kfd, &readfds);
-        rc = select(kfd + 1, &readfds, NULL, NULL, &tv);
+    for(;;) {
+        now_ms = kademlia_now_ms();
+        wakeup = retry_at > 0 && retry_at < deadline ? retry_at : deadline;
+        rc = epoll_wait(epfd, ev, 2, wakeup > now_ms ? (int)(wakeup - now_ms) : 0);
         if(rc < 0) {
             if(errno != EINTR) {
-                perror("select");
+                perror("epoll_wait");
                 sleep(1);
             }
         }
 
-        if(rc > 0 && FD_ISSET(kfd, &readfds)) {
-            fromlen = sizeof(from);
-            rc = recvfrom(kfd, buf, sizeof(buf) - 1, 0,
-                          (struct sockaddr*)&from, &fromlen);
-            if (rc < 0) {
-            	if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            		continue;
-            	} else {
-            		fprintf(stderr, "kademlia_thread:recvfrom failed with %d\n", errno);
-            		continue;
-            	}
+        for (i = 0 ; i < rc ; i++) {
+            if (ev[i].data.fd == kwakefd) {
+                uint64_t count;
+                if (read(kwakefd, &count, sizeof count) < 0 && errno != EAGAIN) {
+                    perror("kademlia_thread:read");
+                }
+            } else if (ev[i].events & EPOLLIN) {
+                kademlia_receive_batch();
             }
-            buf[rc] = '\0';
-            rc = dht_periodic(buf, rc, (struct sockaddr*)&from, fromlen,
-                              &tosleep, callback, NULL);
-        } else {
-            rc = dht_periodic(NULL, 0, NULL, 0, &tosleep, callback, NULL);
         }
-        if(rc < 0) {
-            if(errno == EINTR) {
-                continue;
-            } else {
+
+        if (kademlia_now_ms() >= deadline) {
+            rc = dht_periodic(NULL, 0, NULL, 0, &tosleep, callback, NULL);
+            if(rc < 0 && errno != EINTR) {
                 perror("dht_periodic");
-                if(rc == EINVAL || rc == EFAULT)
-                    abort();
                 tosleep = 1;
             }
+            deadline = kademlia_now_ms() + tosleep * 1000 + random() % 1000;
         }
 
-        /* This is how you trigger a search for a torrent hash.  If port
-           (the second argument) is non-zero, it also performs an announce.
-           Since peers expire announced data after 30 minutes, it's a good
-           idea to reannounce every 28 minutes or so. */
-        if(searching > 0) {
-            unsigned char h[sizeof hash];
-            int i;
-            for (i = 0 ; i < sizeof hash ; i++) {
-                h[i] = hash[i]; // Copy hash array to new array so can call
-                                // dht_search without volatile variable.
+        if (retry_at > 0 && kademlia_now_ms() >= retry_at) {
+            for (i = 0 ; i < snapshot_retry_count ; i++) {
+                dht_ping_node((struct sockaddr*)&snapshot_retry[i],
+                              snapshot_retry[i].ss_family == AF_INET ?
+                              sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
             }
-            dht_search(h, announce_port, net_family, callback, NULL);
-            searching = 0;
+            free(snapshot_retry);
+            snapshot_retry = NULL;
+            snapshot_retry_count = 0;
+            retry_at = 0;
+        }
+
+        if (snapshot_path && time(NULL) >= next_snapshot) {
+            if (kademlia_save_snapshot() < 0) {
+                perror("kademlia_save_snapshot");
+            }
+            next_snapshot = time(NULL) + SNAPSHOT_INTERVAL;
+        }
+
+        if (kademlia_start_searches() > 0) {
+            // Let the DHT send the first requests of the new searches now.
+            deadline = kademlia_now_ms();
         }
         if(closing) {
-            // TODO: Create a routine to save the cache nodes in the file sometimes and before closing.
+            if (kademlia_save_snapshot() < 0) {
+                perror("kademlia_save_snapshot");
+            }
+            close(epfd);
             return 0; // end thread.
         }
     }
     return (void*)1;
 }
 
-/**
- * Search for a hash
- * @param id the hash to look for
- * @param port the port if it is available
- * @param to the time out
- * @returns the time left
- */
-int search_kademlia_internal (unsigned char* id, int port, int to)
+struct kademlia_search* search_kademlia_start (const unsigned char* id, uint16_t port)
 {
-    int i;
+    struct kademlia_search *s;
+
+    if (kfd == -1) {
+        return NULL; // start thread first.
+    }
+
+    s = calloc(1, sizeof(struct kademlia_search));
+    if (!s) {
+        return NULL;
+    }
+    memcpy(s->hash, id, HASH_SIZE);
+    s->port = port;
+    s->refs = 2;
+
+    pthread_mutex_lock(&search_mutex);
+    *search_pending_tail = s;
+    search_pending_tail = &s->next;
+    pthread_mutex_unlock(&search_mutex);
+
+    kademlia_wakeup();
+
+    return s;
+}
+
+int search_kademlia_wait (struct kademlia_search* search, int timeout_ms)
+{
+    struct timespec until;
+    int done;
+
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
 
-    while (searching != 0) {
-        i = random() % 100000;
-        if (i > to) {
-            return 0; // timeout waiting a chance
+    pthread_mutex_lock(&search_mutex);
+    while (!search->done) {
+        if (pthread_cond_timedwait(&search_cond, &search_mutex, &until) == ETIMEDOUT) {
+            break;
         }
-        usleep(i);
-        to -= i;
     }
+    done = search->done;
+    pthread_mutex_unlock(&search_mutex);
+
+    return done;
+}
+
+struct MultiAddress** search_kademlia_results (struct kademlia_search* search)
+{
+    char ipstr[INET6_ADDRSTRLEN + 1];
+    char str[sizeof ipstr + 16];
+    struct MultiAddress **ret;
+    int i, c = 0;
 
-    searching = -1; // lock.
+    pthread_mutex_lock(&search_mutex);
 
-    for (i = 0 ; i < sizeof hash ; i++) {
-        hash[i] = id[i];
+    if (search->ipv4_count == 0 && search->ipv6_count == 0) {
+        pthread_mutex_unlock(&search_mutex);
+        return NULL; // no result.
     }
 
-    announce_port = port;
+    ret = calloc(search->ipv4_count + search->ipv6_count + 1, // IPv4 + IPv6 itens and a NULL terminator.
+                 sizeof (struct MultiAddress*)); // array of pointer.
+    if (!ret) {
+        pthread_mutex_unlock(&search_mutex);
+        return NULL;
+    }
 
-    searching = 1; // search.
+    for (i = 0 ; i < search->ipv4_count ; i++) {
+        if (inet_ntop(AF_INET, &search->ipv4[i].ip, ipstr, sizeof ipstr)) {
+            snprintf (str, sizeof str, "/ip4/%s/tcp/%d", ipstr, search->ipv4[i].port);
+            ret[c] = multiaddress_new_from_string (str);
+            if (ret[c]) { // Sucess.
+                c++;
+            }
+        }
+    }
+    for (i = 0 ; i < search->ipv6_count ; i++) {
+        if (inet_ntop(AF_INET6, search->ipv6[i].ip, ipstr, sizeof ipstr)) {
+            snprintf (str, sizeof str, "/ip6/%s/tcp/%d", ipstr, search->ipv6[i].port);
+            ret[c] = multiaddress_new_from_string (str);
+            if (ret[c]) { // Sucess.
+                c++;
+            }
+        }
+    }
+    ret[c] = NULL; // NULL terminator.
 
-    return to;
+    pthread_mutex_unlock(&search_mutex);
+    return ret;
+}
+
+void search_kademlia_free (struct kademlia_search* search)
+{
+    if (search) {
+        pthread_mutex_lock(&search_mutex);
+        search_unref(search);
+        pthread_mutex_unlock(&search_mutex);
+    }
+}
+
+/**
+ * Start a search, or an announce if port is non-zero, without waiting
+ * for it.
+ * @param id the hash to look for
+ * @param port the port if it is available
+ */
+static void search_kademlia_internal (unsigned char* id, int port)
+{
+    search_kademlia_free(search_kademlia_start(id, port));
 }
 
 void *announce_thread (void *ptr)
@@ -422,7 +976,7 @@ void *announce_thread (void *ptr)
                     sleep (wait);
                 } else {
                     if (p) {
-                        search_kademlia_internal (p->hash, p->port, ANNOUNCE_WAIT_TOLERANCE * 1000000);
+                        search_kademlia_internal (p->hash, p->port);
                         p->time = time(NULL);
                     }
                 }
@@ -437,7 +991,7 @@ void *announce_thread (void *ptr)
 
 int announce_kademlia (char* peer_id, uint16_t port)
 {
-    unsigned char id[sizeof hash];
+    unsigned char id[HASH_SIZE];
     struct announce_struct *n, *p;
 
     dht_hash (id, sizeof(id), peer_id, strlen(peer_id), NULL, 0, NULL, 0);
@@ -456,7 +1010,7 @@ int announce_kademlia (char* peer_id, uint16_t port)
         return 0; // Fail to alloc.
     }
 
-    search_kademlia_internal (id, port, ANNOUNCE_WAIT_TOLERANCE * 1000000);
+    search_kademlia_internal (id, port);
 
     memcpy(p->hash, id, sizeof id);
     p->port = port;
@@ -474,85 +1028,28 @@ int announce_kademlia (char* peer_id, uint16_t port)
 
 struct MultiAddress** search_kademlia(char* peer_id, int timeout)
 {
-    unsigned char id[sizeof hash];
-    int i, to = timeout * 1000000;
-    struct search_struct *rp; // result pointer
+    unsigned char id[HASH_SIZE];
+    struct kademlia_search *s;
     struct MultiAddress **ret;
 
-    if (kfd == -1) {
-        return NULL; // start thread first.
-    }
-
     dht_hash (id, sizeof(id), peer_id, strlen(peer_id), NULL, 0, NULL, 0);
 
-    //TODO: Is this the right place to ask the net?
-    dht_search(peer_id, 0, AF_INET, NULL, NULL);
-    to = search_kademlia_internal (id, 0, to);
-    if (to == 0) return NULL; // time out.
-
-    // Wait for search completion.
-    for(;;) {
-        i = random() % 100000;
-        if (i > to) {
-            return NULL; // timeout.
-        }
-        usleep(i);
-        for (rp = search_result ; rp ; rp = rp->next) {
-            if (memcmp(rp->hash, id, sizeof hash) == 0) { // Found.
-                char ipstr[INET6_ADDRSTRLEN + 1];
-                char str[sizeof ipstr + 16];
-                int c = 0;
-
-                // Wait for result or time out.
-                while (to > 0 &&
-                       search_result->ipv4_count == 0 &&
-                       search_result->ipv6_count == 0) {
-                         to = search_kademlia_internal (id, 0, to); // Repeat search to collect result.
-                         usleep(2000000); // Wait a few seconds for the result.
-                         to -= 2000000;
-                }
-
-                if (search_result->ipv4_count == 0 ||
-                    search_result->ipv6_count == 0) return NULL; // no result.
-
-                ret = calloc(search_result->ipv4_count + search_result->ipv6_count + 1, // IPv4 + IPv6 itens and a NULL terminator.
-                             sizeof (struct MultiAddress*)); // array of pointer.
-                if (!ret) {
-                    return NULL;
-                }
+    s = search_kademlia_start(id, 0);
+    if (!s) {
+        return NULL;
+    }
 
-                for (i = 0 ; i < search_result->ipv4_count ; i++) {
-                    if (inet_ntop(AF_INET, &search_result->ipv4[i].ip, ipstr, sizeof ipstr)) {
-                        snprintf (str, sizeof str, "/ip4/%s/tcp/%d", ipstr, search_result->ipv4[i].port);
-                        if (dht_debug) {
-                            fprintf(dht_debug, "SEARCH %s (%d) = %s\n", peer_id, c, str);
-                        }
-                        ret[c] = multiaddress_new_from_string (str);
-                        if (ret[c] > 0) { // Sucess.
-                            c++;
-                        }
-                    }
-                }
-                for (i = 0 ; i < search_result->ipv6_count ; i++) {
-                    if (inet_ntop(AF_INET6, search_result->ipv6[i].ip, ipstr, sizeof ipstr)) {
-                        snprintf (str, sizeof str, "/ip6/%s/tcp/%d", ipstr, search_result->ipv6[i].port);
-                        if (dht_debug) {
-                            fprintf(dht_debug, "SEARCH %s (%d) = %s\n", peer_id, c, str);
-                        }
-                        ret[c] = multiaddress_new_from_string (str);
-                        if (ret[c] > 0) { // Sucess.
-                            c++;
-                        }
-                    }
-                }
-                ret[c] = NULL; // NULL terminator.
-                return ret;
-            }
+    search_kademlia_wait(s, timeout * 1000);
+    ret = search_kademlia_results(s);
+    if (ret && dht_debug) {
+        int c;
+        for (c = 0 ; ret[c] ; c++) {
+            fprintf(dht_debug, "SEARCH %s (%d) = %s\n", peer_id, c, multiaddress_to_string(ret[c]));
         }
-        to -= i;
     }
+    search_kademlia_free(s);
 
-    return NULL;
+    return ret;
 }
 
 int ping_kademlia (char *ip, uint16_t port)
@@ -613,38 +1110,47 @@ void dht_hash (void *hash_return, int hash_size,
     }
 }
 
-int dht_random_bytes (void *buf, size_t size)
+/***
+ * Called by the DHT for every datagram it sends. While kademlia_thread is
+ * working through a batch, the datagram is queued and sent with the rest
+ * of the batch by kademlia_flush_outbox.
+ */
+int dht_sendto (int sockfd, const void *buf, int len, int flags,
+                const struct sockaddr *to, int tolen)
 {
-    int fd, rc = 0, save;
-    size_t len = 0;
+    struct mmsghdr *msg;
 
-    fd = open("/dev/urandom", O_RDONLY);
-    if (fd < 0) {
-        return fd;
+    if (!batching || sockfd != kfd || len > KADEMLIA_MAX_DATAGRAM ||
+        tolen > sizeof(struct sockaddr_storage)) {
+        return sendto(sockfd, buf, len, flags, to, tolen);
     }
 
-    while (len < size) {
-        rc = read (fd, buf + len, size - len);
-        if (rc < 0) {
-            if (errno == EINTR || errno == EAGAIN) {
-                continue; // not fatal, try again.
-            }
-            if (errno == EWOULDBLOCK && len > 0) {
-                rc = len;
-            }
-
-            break; // fail.
-        }
-        len += rc;
-    }
-
-    if (len > 0 && rc >= 0) {
-        rc = len;
+    if (outbox.count == KADEMLIA_BATCH) {
+        kademlia_flush_outbox();
     }
 
-    save = errno;
-    close(fd);
-    errno = save;
+    // per datagram flags (MSG_CONFIRM) are lost, they are only hints.
+    memcpy(outbox.buf[outbox.count], buf, len);
+    memcpy(&outbox.addr[outbox.count], to, tolen);
+    outbox.iov[outbox.count].iov_base = outbox.buf[outbox.count];
+    outbox.iov[outbox.count].iov_len = len;
+    msg = &outbox.msgs[outbox.count];
+    memset(msg, 0, sizeof(struct mmsghdr));
+    msg->msg_hdr.msg_name = &outbox.addr[outbox.count];
+    msg->msg_hdr.msg_namelen = tolen;
+    msg->msg_hdr.msg_iov = &outbox.iov[outbox.count];
+    msg->msg_hdr.msg_iovlen = 1;
+    outbox.count++;
+
+    return len;
+}
 
-    return rc;
+int dht_random_bytes (void *buf, size_t size)
+{
+    // drawn from the generator of this thread rather than /dev/urandom
+    if (!libp2p_crypto_random_bytes(buf, size)) {
+        errno = EIO;
+        return -1;
+    }
+    return size;
 }
@@ -12,21 +12,43 @@
 #include "libp2p/secio/exchange.h"
 #include "libp2p/net/multistream.h"
 #include "libp2p/net/p2pnet.h"
+#include "libp2p/net/read_buffer.h"
 #include "libp2p/crypto/ephemeral.h"
+#include "libp2p/crypto/ephemeral_pool.h"
+#include "libp2p/crypto/random.h"
 #include "libp2p/crypto/sha1.h"
 #include "libp2p/crypto/sha256.h"
 #include "libp2p/crypto/sha512.h"
 #include "libp2p/utils/string_list.h"
 #include "libp2p/utils/vector.h"
 #include "libp2p/utils/logger.h"
+#include "varint.h"
 #include "mbedtls/md.h"
-#include "mbedtls/cipher.h"
+#include "mbedtls/aes.h"
 #include "mbedtls/md_internal.h"
 
 const char* SupportedExchanges = "P-256,P-384,P-521";
 const char* SupportedCiphers = "AES-256,AES-128,Blowfish";
 const char* SupportedHashes = "SHA256,SHA512";
 
+struct SecioCipher {
+	// AES-CTR through the aes module, as mbedtls_cipher_update refuses to
+	// work in place on lengths that are not a multiple of the block size
+	mbedtls_aes_context aes;
+	unsigned char nonce_counter[16];
+	unsigned char stream_block[16];
+	size_t nc_off;
+	mbedtls_md_context_t mac;
+	// the frame buffer reused by libp2p_secio_encrypted_write
+	unsigned char* frame;
+	size_t frame_size;
+	// after an optimistic handshake, the local side holds the echo of the remote
+	// nonce until the first write, and the remote side expects our nonce first
+	unsigned char* pending;
+	size_t pending_size;
+	int expect_nonce;
+};
+
 /***
  * Create a new SecureSession struct
  * @returns a pointer to a new SecureSession object
@@ -37,6 +59,8 @@ struct SessionContext* libp2p_secio_secure_session_new() {
 		return NULL;
 	ss->insecure_stream = NULL;
 	ss->secure_stream = NULL;
+	ss->local_cipher = NULL;
+	ss->remote_cipher = NULL;
 	return ss;
 }
 
@@ -46,6 +70,7 @@ struct SessionContext* libp2p_secio_secure_session_new() {
  */
 void libp2p_secio_secure_session_free(struct SessionContext* in) {
 	//TODO:  should we close the socket?
+	libp2p_secio_stop_ciphers(in);
 	free(in);
 }
 
@@ -56,10 +81,7 @@ void libp2p_secio_secure_session_free(struct SessionContext* in) {
  * @returns true(1) on success, otherwise false(0)
  */
 int libp2p_secio_generate_nonce(char* results, int length) {
-	FILE* fd = fopen("/dev/urandom", "r");
-	fread(results, 1, length, fd);
-	fclose(fd);
-	return 1;
+	return libp2p_crypto_random_bytes((unsigned char*)results, length);
 }
 
 /**
@@ -402,7 +424,7 @@ int libp2p_secio_make_mac_and_cipher(struct SessionContext* session, struct Stre
 		return 0;
 	}
 
-	//TODO: set up the encrypted streams
+	// the encrypted streams are keyed by libp2p_secio_start_ciphers
 	return 1;
 }
 
@@ -414,47 +436,18 @@ int libp2p_secio_make_mac_and_cipher(struct SessionContext* session, struct Stre
  * @returns the number of bytes written
  */
 int libp2p_secio_unencrypted_write(struct SessionContext* session, unsigned char* bytes, size_t data_length) {
-	int num_bytes = 0;
-
-	if (data_length > 0) { // only do this is if there is something to send
-		// first send the size
-		uint32_t size = htonl(data_length);
-		char* size_as_char = (char*)&size;
-		int left = 4;
-		int written = 0;
-		int written_this_time = 0;
-		do {
-			written_this_time = socket_write(*((int*)session->insecure_stream->socket_descriptor), &size_as_char[written], left, 0);
-			if (written_this_time < 0) {
-				written_this_time = 0;
-				if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-					// TODO: use epoll or select to wait for socket to be writable
-				} else {
-					return 0;
-				}
-			}
-			left = left - written_this_time;
-		} while (left > 0);
-		// then send the actual data
-		left = data_length;
-		written = 0;
-		do {
-			written_this_time = socket_write(*((int*)session->insecure_stream->socket_descriptor), (char*)&bytes[written], left, 0);
-			if (written_this_time < 0) {
-				written_this_time = 0;
-				if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-					// TODO: use epoll or select to wait for socket to be writable
-				} else {
-					return 0;
-				}
-			}
-			left = left - written_this_time;
-			written += written_this_time;
-		} while (left > 0);
-		num_bytes = written;
-	} // there was something to send
-
-	return num_bytes;
+	if (data_length == 0) // only do this is if there is something to send
+		return 0;
+	// the size, then the actual data, in one go
+	uint32_t size = htonl(data_length);
+	struct iovec iov[2];
+	iov[0].iov_base = &size;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = bytes;
+	iov[1].iov_len = data_length;
+	if (socket_writev(*((int*)session->insecure_stream->socket_descriptor), iov, 2, 0) < 0)
+		return 0;
+	return data_length;
 }
 
 /***
@@ -465,57 +458,118 @@ int libp2p_secio_unencrypted_write(struct SessionContext* session, unsigned char
  * @returns the number of bytes read
  */
 int libp2p_secio_unencrypted_read(struct SessionContext* session, unsigned char** results, size_t* results_size, int timeout_secs) {
-	uint32_t buffer_size;
-
-	// first read the 4 byte integer
-	char* size = (char*)&buffer_size;
-	int left = 4;
-	int read = 0;
-	int read_this_time = 0;
-	do {
-		read_this_time = socket_read(*((int*)session->insecure_stream->socket_descriptor), &size[read], 1, 0, timeout_secs);
-		if (read_this_time < 0) {
-			read_this_time = 0;
-			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-				// TODO: use epoll or select to wait for socket to be writable
-			} else {
-				fprintf(stderr, "Error in libp2p_secio_unencrypted_read: %s\n", strerror(errno));
-				return 0;
-			}
-		}
-		if (read == 0 && size[0] == 10) {
-			// a spurious \n
-			// write over this value by not adding it
-		} else {
-			left = left - read_this_time;
-			read += read_this_time;
-		}
-	} while (left > 0);
-	buffer_size = ntohl(buffer_size);
-	if (buffer_size == 0)
+	struct Stream* stream = session->insecure_stream;
+
+	if (stream->read_buffer == NULL) {
+		stream->read_buffer = libp2p_net_read_buffer_new(*((int*)stream->socket_descriptor));
+		if (stream->read_buffer == NULL)
+			return 0;
+	}
+	return libp2p_net_read_buffer_read_uint32_frame(stream->read_buffer, results, results_size, timeout_secs);
+}
+
+/***
+ * Key the cipher and mac of one direction
+ * @param key the stretched key of that direction
+ * @returns the contexts, or NULL on error
+ */
+static struct SecioCipher* libp2p_secio_cipher_new(const struct StretchedKey* key) {
+	struct SecioCipher* cipher = (struct SecioCipher*) malloc(sizeof(struct SecioCipher));
+	if (cipher == NULL)
+		return NULL;
+	cipher->frame = NULL;
+	cipher->frame_size = 0;
+	cipher->pending = NULL;
+	cipher->pending_size = 0;
+	cipher->expect_nonce = 0;
+	cipher->nc_off = 0;
+	mbedtls_aes_init(&cipher->aes);
+	mbedtls_md_init(&cipher->mac);
+	//TODO switch between ciphers
+	//TODO make this more generic to use more than SHA256
+	// CTR mode only ever runs the block cipher forwards, to decrypt as well
+	if (key->iv_size != sizeof(cipher->nonce_counter)
+			|| mbedtls_aes_setkey_enc(&cipher->aes, key->cipher_key, key->cipher_size * 8) != 0
+			|| mbedtls_md_setup(&cipher->mac, &mbedtls_sha256_info, 1) != 0
+			|| mbedtls_md_hmac_starts(&cipher->mac, key->mac_key, key->mac_size) != 0) {
+		mbedtls_aes_free(&cipher->aes);
+		mbedtls_md_free(&cipher->mac);
+		free(cipher);
+		return NULL;
+	}
+	memcpy(cipher->nonce_counter, key->iv, sizeof(cipher->nonce_counter));
+	return cipher;
+}
+
+static void libp2p_secio_cipher_free(struct SecioCipher* cipher) {
+	if (cipher != NULL) {
+		mbedtls_aes_free(&cipher->aes);
+		mbedtls_md_free(&cipher->mac);
+		if (cipher->frame != NULL)
+			free(cipher->frame);
+		if (cipher->pending != NULL)
+			free(cipher->pending);
+		free(cipher);
+	}
+}
+
+int libp2p_secio_start_ciphers(struct SessionContext* session) {
+	session->local_cipher = libp2p_secio_cipher_new(session->local_stretched_key);
+	session->remote_cipher = libp2p_secio_cipher_new(session->remote_stretched_key);
+	if (session->local_cipher == NULL || session->remote_cipher == NULL) {
+		libp2p_secio_stop_ciphers(session);
 		return 0;
+	}
+	return 1;
+}
 
-	// now read the number of bytes we've found, minus the 4 that we just read
-	left = buffer_size;
-	read = 0;
-	read_this_time = 0;
-	*results = malloc(left);
-	unsigned char* ptr = *results;
-	do {
-		read_this_time = socket_read(*((int*)session->insecure_stream->socket_descriptor), (char*)&ptr[read], left, 0, timeout_secs);
-		if (read_this_time < 0) {
-			read_this_time = 0;
-			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-				// TODO: use epoll or select to wait for socket to be writable
-			} else {
-				return 0;
-			}
-		}
-		left = left - read_this_time;
-	} while (left > 0);
+void libp2p_secio_stop_ciphers(struct SessionContext* session) {
+	libp2p_secio_cipher_free(session->local_cipher);
+	session->local_cipher = NULL;
+	libp2p_secio_cipher_free(session->remote_cipher);
+	session->remote_cipher = NULL;
+}
+
+size_t libp2p_secio_encrypt_frame(struct SessionContext* session, unsigned char* frame, size_t data_size) {
+	struct SecioCipher* cipher = session->local_cipher;
+	unsigned char* data = &frame[SECIO_FRAME_HEADER_SIZE];
+
+	if (cipher == NULL || data_size + SECIO_MAC_SIZE > UINT32_MAX)
+		return 0;
+	// CTR is a stream cipher, so the data can be encrypted where it is
+	if (mbedtls_aes_crypt_ctr(&cipher->aes, data_size, &cipher->nc_off, cipher->nonce_counter, cipher->stream_block, data, data) != 0)
+		return 0;
+	// mac the data, and tack the mac onto the end of the frame
+	if (mbedtls_md_hmac_update(&cipher->mac, data, data_size) != 0
+			|| mbedtls_md_hmac_finish(&cipher->mac, &data[data_size]) != 0
+			|| mbedtls_md_hmac_reset(&cipher->mac) != 0)
+		return 0;
+	uint32_t size = htonl(data_size + SECIO_MAC_SIZE);
+	memcpy(frame, &size, SECIO_FRAME_HEADER_SIZE);
+	return SECIO_FRAME_HEADER_SIZE + data_size + SECIO_MAC_SIZE;
+}
 
-	*results_size = buffer_size;
-	return buffer_size;
+int libp2p_secio_decrypt_in_place(struct SessionContext* session, unsigned char* message, size_t message_size) {
+	struct SecioCipher* cipher = session->remote_cipher;
+	unsigned char generated_mac[SECIO_MAC_SIZE];
+	size_t data_size;
+
+	if (cipher == NULL || message_size < SECIO_MAC_SIZE || message_size - SECIO_MAC_SIZE > INT32_MAX)
+		return -1;
+	data_size = message_size - SECIO_MAC_SIZE;
+
+	// verify MAC before touching the stream, so a bad message does not
+	// throw the cipher out of step
+	if (mbedtls_md_hmac_update(&cipher->mac, message, data_size) != 0
+			|| mbedtls_md_hmac_finish(&cipher->mac, generated_mac) != 0
+			|| mbedtls_md_hmac_reset(&cipher->mac) != 0)
+		return -1;
+	if (memcmp(&message[data_size], generated_mac, SECIO_MAC_SIZE) != 0)
+		return -1;
+
+	if (mbedtls_aes_crypt_ctr(&cipher->aes, data_size, &cipher->nc_off, cipher->nonce_counter, cipher->stream_block, message, message) != 0)
+		return -1;
+	return data_size;
 }
 
 /**
@@ -528,40 +582,18 @@ int libp2p_secio_unencrypted_read(struct SessionContext* session, unsigned char*
  * @returns true(1) on success, otherwise false(0)
  */
 int libp2p_secio_encrypt(const struct SessionContext* session, const unsigned char* incoming, size_t incoming_size, unsigned char** outgoing, size_t* outgoing_size) {
-	unsigned char* buffer = NULL;
-	size_t buffer_size = 0, original_buffer_size = 0;
-
-	//TODO switch between ciphers
-	mbedtls_cipher_context_t cipher_ctx;
-	mbedtls_cipher_init(&cipher_ctx);
-	mbedtls_cipher_setup(&cipher_ctx, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_256_CTR));
-	mbedtls_cipher_setkey(&cipher_ctx, session->local_stretched_key->cipher_key, session->local_stretched_key->cipher_size * 8, MBEDTLS_ENCRYPT);
-	original_buffer_size = incoming_size;
-	original_buffer_size += 32;
-	buffer_size = original_buffer_size;
-	buffer = malloc(original_buffer_size);
-	memset(buffer, 0, original_buffer_size);
-	mbedtls_cipher_crypt(&cipher_ctx, session->local_stretched_key->iv, session->local_stretched_key->iv_size, incoming, incoming_size, buffer, &buffer_size);
-	// Now, buffer size may be set differently than original_buffer_size
-	// The "incoming" is now encrypted, and is in the first part of the buffer
-	mbedtls_cipher_free(&cipher_ctx);
-
-	// mac the data
-	mbedtls_md_context_t ctx;
-	mbedtls_md_setup(&ctx, &mbedtls_sha256_info, 1);
-	mbedtls_md_hmac_starts(&ctx, session->local_stretched_key->mac_key, session->local_stretched_key->mac_size);
-	mbedtls_md_hmac_update(&ctx, buffer, buffer_size);
-	// this will tack the mac onto the end of the buffer
-	mbedtls_md_hmac_finish(&ctx, &buffer[buffer_size]);
-	mbedtls_md_free(&ctx);
-
-	// put it all in outgoing
-	*outgoing_size = original_buffer_size;
-	*outgoing = malloc(*outgoing_size);
-	memset(*outgoing, 0, *outgoing_size);
-	memcpy(*outgoing, buffer, original_buffer_size);
-
-	free(buffer);
+	unsigned char* frame = malloc(SECIO_FRAME_HEADER_SIZE + incoming_size + SECIO_MAC_SIZE);
+	if (frame == NULL)
+		return 0;
+	memcpy(&frame[SECIO_FRAME_HEADER_SIZE], incoming, incoming_size);
+	if (libp2p_secio_encrypt_frame((struct SessionContext*)session, frame, incoming_size) == 0) {
+		free(frame);
+		return 0;
+	}
+	// hand back the message without its length prefix
+	memmove(frame, &frame[SECIO_FRAME_HEADER_SIZE], incoming_size + SECIO_MAC_SIZE);
+	*outgoing = frame;
+	*outgoing_size = incoming_size + SECIO_MAC_SIZE;
 	return 1;
 }
 
@@ -575,13 +607,58 @@ int libp2p_secio_encrypt(const struct SessionContext* session, const unsigned ch
 int libp2p_secio_encrypted_write(void* stream_context, const unsigned char* bytes, size_t num_bytes) {
 	struct SessionContext* session = (struct SessionContext*) stream_context;
 	// writer uses the local cipher and mac
-	unsigned char* buffer = NULL;
-	size_t buffer_size = 0;
-	if (!libp2p_secio_encrypt(session, bytes, num_bytes, &buffer, &buffer_size))
+	struct SecioCipher* cipher = session->local_cipher;
+	size_t frame_size = SECIO_FRAME_HEADER_SIZE + num_bytes + SECIO_MAC_SIZE;
+
+	if (cipher == NULL || num_bytes == 0)
 		return 0;
-	int retVal = libp2p_secio_unencrypted_write(session, buffer, buffer_size);
-	free(buffer);
-	return retVal;
+	if (cipher->frame_size < frame_size) {
+		unsigned char* frame = realloc(cipher->frame, frame_size);
+		if (frame == NULL)
+			return 0;
+		cipher->frame = frame;
+		cipher->frame_size = frame_size;
+	}
+	memcpy(&cipher->frame[SECIO_FRAME_HEADER_SIZE], bytes, num_bytes);
+	frame_size = libp2p_secio_encrypt_frame(session, cipher->frame, num_bytes);
+	if (frame_size == 0)
+		return 0;
+	// the length prefix, data and mac go out in one write, behind a pending nonce frame if there is one
+	struct iovec iov[2];
+	int iovcnt = 0;
+	if (cipher->pending != NULL) {
+		iov[iovcnt].iov_base = cipher->pending;
+		iov[iovcnt++].iov_len = cipher->pending_size;
+	}
+	iov[iovcnt].iov_base = cipher->frame;
+	iov[iovcnt++].iov_len = frame_size;
+	if (socket_writev(*((int*)session->insecure_stream->socket_descriptor), iov, iovcnt, 0) < 0)
+		return 0;
+	if (cipher->pending != NULL) {
+		free(cipher->pending);
+		cipher->pending = NULL;
+	}
+	return frame_size - SECIO_FRAME_HEADER_SIZE;
+}
+
+/***
+ * Send the pending nonce frame of an optimistic handshake, if it was not
+ * sent along with a write yet
+ * @param session the session
+ * @returns true(1) on success, false(0) otherwise
+ */
+static int libp2p_secio_flush_pending(struct SessionContext* session) {
+	struct SecioCipher* cipher = session->local_cipher;
+	if (cipher == NULL || cipher->pending == NULL)
+		return 1;
+	struct iovec iov;
+	iov.iov_base = cipher->pending;
+	iov.iov_len = cipher->pending_size;
+	if (socket_writev(*((int*)session->insecure_stream->socket_descriptor), &iov, 1, 0) < 0)
+		return 0;
+	free(cipher->pending);
+	cipher->pending = NULL;
+	return 1;
 }
 
 /**
@@ -594,39 +671,18 @@ int libp2p_secio_encrypted_write(void* stream_context, const unsigned char* byte
  * @returns number of unencrypted bytes
  */
 int libp2p_secio_decrypt(const struct SessionContext* session, const unsigned char* incoming, size_t incoming_size, unsigned char** outgoing, size_t* outgoing_size) {
-	size_t data_section_size = incoming_size - 32;
 	*outgoing_size = 0;
-	unsigned char* buffer;
-	size_t buffer_size;
-
-	// verify MAC
-	//TODO make this more generic to use more than SHA256
-	mbedtls_md_context_t ctx;
-	mbedtls_md_setup(&ctx, &mbedtls_sha256_info, 1);
-	mbedtls_md_hmac_starts(&ctx, session->remote_stretched_key->mac_key, session->remote_stretched_key->mac_size);
-	mbedtls_md_hmac_update(&ctx, incoming, data_section_size);
-	unsigned char generated_mac[32];
-	mbedtls_md_hmac_finish(&ctx, generated_mac);
-	mbedtls_md_free(&ctx);
-	// 2. check the mac to see if it is the same
-	int retVal = memcmp(&incoming[data_section_size], generated_mac, 32);
-	// TODO: This MAC verification is failing.
-	if (retVal != 0)
+	unsigned char* buffer = malloc(incoming_size > 0 ? incoming_size : 1);
+	if (buffer == NULL)
 		return 0;
-
-	mbedtls_cipher_context_t cipher_ctx;
-	mbedtls_cipher_init(&cipher_ctx);
-	mbedtls_cipher_setup(&cipher_ctx, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_256_CTR));
-	mbedtls_cipher_setkey(&cipher_ctx, session->remote_stretched_key->cipher_key, session->remote_stretched_key->cipher_size * 8, MBEDTLS_DECRYPT);
-	mbedtls_cipher_set_iv(&cipher_ctx, session->remote_stretched_key->iv, session->remote_stretched_key->iv_size);
-	buffer_size = data_section_size + mbedtls_cipher_get_block_size(&cipher_ctx);
-	buffer = malloc(buffer_size);
-	mbedtls_cipher_update(&cipher_ctx, incoming, data_section_size, buffer, &buffer_size);
-	mbedtls_cipher_free(&cipher_ctx);
-	*outgoing = malloc(buffer_size);
-	*outgoing_size = buffer_size;
-	memcpy(*outgoing, buffer, buffer_size);
-	free(buffer);
+	memcpy(buffer, incoming, incoming_size);
+	int data_size = libp2p_secio_decrypt_in_place((struct SessionContext*)session, buffer, incoming_size);
+	if (data_size < 0) {
+		free(buffer);
+		return 0;
+	}
+	*outgoing = buffer;
+	*outgoing_size = data_size;
 	return *outgoing_size;
 }
 
@@ -644,15 +700,66 @@ int libp2p_secio_encrypted_read(void* stream_context, unsigned char** bytes, siz
 	// read the data
 	unsigned char* incoming = NULL;
 	size_t incoming_size = 0;
+	// the remote may be waiting for the echo of its nonce before it says anything
+	if (!libp2p_secio_flush_pending(session))
+		goto exit;
+	if (session->remote_cipher != NULL && session->remote_cipher->expect_nonce) {
+		// after an optimistic handshake the first frame is our nonce, sent back
+		if (libp2p_secio_unencrypted_read(session, &incoming, &incoming_size, timeout_secs) <= 0)
+			goto exit;
+		if (libp2p_secio_decrypt_in_place(session, incoming, incoming_size) != 16
+				|| libp2p_secio_bytes_compare((char*)incoming, session->local_nonce, 16) != 0) {
+			libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Bytes of nonce did not match");
+			goto exit;
+		}
+		session->remote_cipher->expect_nonce = 0;
+		free(incoming);
+		incoming = NULL;
+	}
 	if (libp2p_secio_unencrypted_read(session, &incoming, &incoming_size, timeout_secs) <= 0)
 		goto exit;
-	retVal = libp2p_secio_decrypt(session, incoming, incoming_size, bytes, num_bytes);
+	// decrypt where it was read, and hand that buffer to the caller
+	retVal = libp2p_secio_decrypt_in_place(session, incoming, incoming_size);
+	if (retVal <= 0) {
+		retVal = 0;
+		goto exit;
+	}
+	*bytes = incoming;
+	*num_bytes = retVal;
+	incoming = NULL;
 	exit:
 	if (incoming != NULL)
 		free(incoming);
 	return retVal;
 }
 
+/***
+ * Write the multistream protocol id and the first secio frame with one call
+ * @param session the session
+ * @param protocol the protocol id
+ * @param protocol_len the length of the protocol id
+ * @param bytes the bytes of the secio frame
+ * @param bytes_length the number of bytes
+ * @returns true(1) on success, false(0) otherwise
+ */
+static int libp2p_secio_write_protocol_and_frame(struct SessionContext* session, const unsigned char* protocol, size_t protocol_len, unsigned char* bytes, size_t bytes_length) {
+	unsigned char varint[12];
+	size_t varint_size = 0;
+	uint32_t size = htonl(bytes_length);
+	struct iovec iov[4];
+
+	varint_encode(protocol_len, &varint[0], 12, &varint_size);
+	iov[0].iov_base = varint;
+	iov[0].iov_len = varint_size;
+	iov[1].iov_base = (void*)protocol;
+	iov[1].iov_len = protocol_len;
+	iov[2].iov_base = &size;
+	iov[2].iov_len = 4;
+	iov[3].iov_base = bytes;
+	iov[3].iov_len = bytes_length;
+	return socket_writev(*((int*)session->insecure_stream->socket_descriptor), iov, 4, 0) >= 0;
+}
+
 /***
  * performs initial communication over an insecure channel to share
  * keys, IDs, and initiate connection. This is a framed messaging system
@@ -660,9 +767,10 @@ int libp2p_secio_encrypted_read(void* stream_context, unsigned char** bytes, siz
  * @param local_session the secure session to be filled
  * @param private_key our private key to use
  * @param remote_requested it is the other side that requested the upgrade to secio
+ * @param optimistic true(1) to cut round trips, see libp2p_secio_handshake_optimistic
  * @returns true(1) on success, false(0) otherwise
  */
-int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPrivateKey* private_key, int remote_requested) {
+static int libp2p_secio_handshake_run(struct SessionContext* local_session, struct RsaPrivateKey* private_key, int remote_requested, int optimistic) {
 	int retVal = 0;
 	size_t results_size = 0, bytes_written = 0;
 	unsigned char* propose_in_bytes = NULL; // the remote protobuf
@@ -683,36 +791,14 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	char* char_buffer = NULL;
 	size_t char_buffer_length = 0;
 	struct StretchedKey* k1 = NULL, *k2 = NULL;
-	struct PrivateKey* priv = NULL;
 	struct PublicKey pub_key = {0};
 	char* remote_peer_id = NULL;
+	char early_curve[16] = {0};
 
 	//TODO: make sure we're not talking to ourself
 
-	// prepare the multistream send of the protocol ID
 	const unsigned char* protocol = (unsigned char*)"/secio/1.0.0\n";
 	int protocol_len = strlen((char*)protocol);
-	unsigned char* total = malloc(protocol_len + propose_out_size);
-	memcpy(total, protocol, protocol_len);
-	memcpy(&total[protocol_len], propose_out_bytes, propose_out_size);
-
-	libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Writing protocol");
-	bytes_written = libp2p_net_multistream_write(local_session, total, protocol_len + propose_out_size);
-	free(total);
-	if (bytes_written <= 0)
-		goto exit;
-
-	if (!remote_requested) {
-		// we should get back the secio confirmation
-		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Reading protocol response");
-		bytes_written = libp2p_net_multistream_read(local_session, &results, &results_size, 20);
-		if (bytes_written < 5 || strstr((char*)results, "secio") == NULL)
-			goto exit;
-
-		free(results);
-		results = NULL;
-		results_size = 0;
-	}
 
 	// generate 16 byte nonce
 	if (!libp2p_secio_generate_nonce(&local_session->local_nonce[0], 16)) {
@@ -759,11 +845,43 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	if (libp2p_secio_propose_protobuf_encode(propose_out, propose_out_bytes, propose_out_size, &propose_out_size) == 0)
 		goto exit;
 
+	if (optimistic) {
+		// the protocol ID and the proposal go out together, the proposal waits in the remote buffer
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Writing protocol and propose_out");
+		if (!libp2p_secio_write_protocol_and_frame(local_session, protocol, protocol_len, propose_out_bytes, propose_out_size))
+			goto exit;
+		// while the remote proposal is on its way, make an ephemeral key on the curve
+		// we list first, which is the one picked whenever the remote lists it too
+		const char* comma = strchr(SupportedExchanges, ',');
+		size_t curve_len = comma == NULL ? strlen(SupportedExchanges) : (size_t)(comma - SupportedExchanges);
+		if (curve_len < sizeof(early_curve)) {
+			memcpy(early_curve, SupportedExchanges, curve_len);
+			libp2p_crypto_ephemeral_pool_take(early_curve, &local_session->ephemeral_private_key);
+		}
+	} else {
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Writing protocol");
+		if (libp2p_net_multistream_write(local_session, protocol, protocol_len) <= 0)
+			goto exit;
+	}
 
-	libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Writing propose_out");
-	bytes_written = libp2p_secio_unencrypted_write(local_session, propose_out_bytes, propose_out_size);
-	if (bytes_written < propose_out_size)
-		goto exit;
+	if (!remote_requested) {
+		// we should get back the secio confirmation
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Reading protocol response");
+		bytes_written = libp2p_net_multistream_read(local_session, &results, &results_size, 20);
+		if (bytes_written < 5 || strstr((char*)results, "secio") == NULL)
+			goto exit;
+
+		free(results);
+		results = NULL;
+		results_size = 0;
+	}
+
+	if (!optimistic) {
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Writing propose_out");
+		bytes_written = libp2p_secio_unencrypted_write(local_session, propose_out_bytes, propose_out_size);
+		if (bytes_written < propose_out_size)
+			goto exit;
+	}
 
 	// now receive the proposal from the new connection
 	libp2p_logger_log("secio", LOGLEVEL_DEBUG, "receiving propose_in");
@@ -799,8 +917,13 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	if (libp2p_secio_select_best(order, propose_out->hashes, propose_out->hashes_size, propose_in->hashes, propose_in->hashes_size, &local_session->chosen_hash) == 0)
 		goto exit;
 
-	// generate EphemeralPubKey
-	if (libp2p_crypto_ephemeral_keypair_generate(local_session->chosen_curve, &local_session->ephemeral_private_key) == 0)
+	// take an EphemeralPubKey from the pool, unless the one taken early is on the chosen curve
+	if (local_session->ephemeral_private_key != NULL && strcmp(early_curve, local_session->chosen_curve) != 0) {
+		libp2p_crypto_ephemeral_key_free(local_session->ephemeral_private_key);
+		local_session->ephemeral_private_key = NULL;
+	}
+	if (local_session->ephemeral_private_key == NULL
+			&& libp2p_crypto_ephemeral_pool_take(local_session->chosen_curve, &local_session->ephemeral_private_key) == 0)
 		goto exit;
 
 	// build buffer to sign
@@ -823,15 +946,10 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	memcpy(exchange_out->epubkey, &local_session->ephemeral_private_key->public_key->bytes[1], local_session->ephemeral_private_key->public_key->bytes_size - 1);
 	exchange_out->epubkey_size = local_session->ephemeral_private_key->public_key->bytes_size - 1;
 
-	priv = libp2p_crypto_private_key_new();
-	priv->type = KEYTYPE_RSA;
-	priv->data = (unsigned char*)private_key->der;
-	priv->data_size = private_key->der_length;
-	libp2p_secio_sign(priv, char_buffer, char_buffer_length, &exchange_out->signature, &exchange_out->signature_size);
+	// sign with the key itself, so its signer is used if it has one
+	libp2p_crypto_rsa_sign(private_key, char_buffer, char_buffer_length, &exchange_out->signature, &exchange_out->signature_size);
 	free(char_buffer);
 	char_buffer = NULL;
-	// yes, this is an improper disposal, but it gets the job done without fuss
-	free(priv);
 
 	exchange_out_protobuf_size = libp2p_secio_exchange_protobuf_encode_size(exchange_out);
 	exchange_out_protobuf = (unsigned char*)malloc(exchange_out_protobuf_size);
@@ -889,7 +1007,7 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	if (!libp2p_secio_stretch_keys(local_session->chosen_cipher, local_session->chosen_hash, local_session->shared_key, local_session->shared_key_size, &k1, &k2))
 		goto exit;
 
-	if (order > 1) {
+	if (order > 0) {
 		local_session->local_stretched_key = k1;
 		local_session->remote_stretched_key = k2;
 	} else {
@@ -910,26 +1028,42 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 
 	libp2p_secio_make_mac_and_cipher(local_session, local_session->local_stretched_key);
 	libp2p_secio_make_mac_and_cipher(local_session, local_session->remote_stretched_key);
-
-	// send expected message (their nonce) to verify encryption works
-	libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Sending their nonce");
-	if (libp2p_secio_encrypted_write(local_session, (unsigned char*)local_session->remote_nonce, 16) <= 0)
+	if (!libp2p_secio_start_ciphers(local_session))
 		goto exit;
 
-	// receive our nonce to verify encryption works
-	libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Receiving our nonce");
-	int bytes_read = libp2p_secio_encrypted_read(local_session, &results, &results_size, 10);
-	if (bytes_read <= 0) {
-		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Encrypted read returned %d", bytes_read);
-		goto exit;
-	}
-	if (results_size != 16) {
-		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Results_size should be 16 but was %d", results_size);
-		goto exit;
-	}
-	if (libp2p_secio_bytes_compare((char*)results, local_session->local_nonce, 16) != 0) {
-		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Bytes of nonce did not match");
-		goto exit;
+	if (optimistic) {
+		// the echo of their nonce goes out in front of our first frame, and the echo of
+		// ours is checked when their first frame comes in, rather than waiting for it here
+		struct SecioCipher* cipher = local_session->local_cipher;
+		cipher->pending = (unsigned char*)malloc(SECIO_FRAME_HEADER_SIZE + 16 + SECIO_MAC_SIZE);
+		if (cipher->pending == NULL)
+			goto exit;
+		memcpy(&cipher->pending[SECIO_FRAME_HEADER_SIZE], local_session->remote_nonce, 16);
+		cipher->pending_size = libp2p_secio_encrypt_frame(local_session, cipher->pending, 16);
+		if (cipher->pending_size == 0)
+			goto exit;
+		local_session->remote_cipher->expect_nonce = 1;
+	} else {
+		// send expected message (their nonce) to verify encryption works
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Sending their nonce");
+		if (libp2p_secio_encrypted_write(local_session, (unsigned char*)local_session->remote_nonce, 16) <= 0)
+			goto exit;
+
+		// receive our nonce to verify encryption works
+		libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Receiving our nonce");
+		int bytes_read = libp2p_secio_encrypted_read(local_session, &results, &results_size, 10);
+		if (bytes_read <= 0) {
+			libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Encrypted read returned %d", bytes_read);
+			goto exit;
+		}
+		if (results_size != 16) {
+			libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Results_size should be 16 but was %d", results_size);
+			goto exit;
+		}
+		if (libp2p_secio_bytes_compare((char*)results, local_session->local_nonce, 16) != 0) {
+			libp2p_logger_log("secio", LOGLEVEL_DEBUG, "Bytes of nonce did not match");
+			goto exit;
+		}
 	}
 
 	// set up the secure stream in the struct
@@ -973,3 +1107,11 @@ int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPriva
 	}
 	return retVal;
 }
+
+int libp2p_secio_handshake(struct SessionContext* local_session, struct RsaPrivateKey* private_key, int remote_requested) {
+	return libp2p_secio_handshake_run(local_session, private_key, remote_requested, 0);
+}
+
+int libp2p_secio_handshake_optimistic(struct SessionContext* local_session, struct RsaPrivateKey* private_key, int remote_requested) {
+	return libp2p_secio_handshake_run(local_session, private_key, remote_requested, 1);
+}
@@ -0,0 +1,546 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/***
+ * The routing table and storage of the DHT are internal to dht.c, so the
+ * benchmarks build against the source itself. dht.o from libp2p.a is then
+ * never pulled in by the linker, and DHT_TESTING gives them dht_testing.
+ */
+#define DHT_TESTING
+#include "../routing/dht.c"
+#include "bench_helper.h"
+
+#define BENCH_DHT_IDS 100000
+
+/***
+ * Start a DHT whose socket can not reach anything, so that pings sent
+ * while filling the table fail locally instead of leaving the machine.
+ * @returns the socket, or -1 on error
+ */
+int bench_dht_start() {
+	unsigned char id[20];
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	if (dht_init(fd, -1, id, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void bench_dht_stop(int fd) {
+	dht_uninit();
+	close(fd);
+}
+
+/***
+ * Insert BENCH_DHT_IDS random ids into the routing table with new_node,
+ * then look every one of them up with find_node.
+ */
+int bench_dht_routing_table() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char* ids = NULL;
+	struct sockaddr_in* addrs = NULL;
+	int good = 0, dubious = 0, found = 0;
+
+	ids = malloc(BENCH_DHT_IDS * 20);
+	addrs = malloc(BENCH_DHT_IDS * sizeof(struct sockaddr_in));
+	if (ids == NULL || addrs == NULL)
+		goto exit;
+	for(int i = 0; i < BENCH_DHT_IDS; i++) {
+		for(int j = 0; j < 20; j++)
+			ids[i * 20 + j] = random() & 0xFF;
+		memset(&addrs[i], 0, sizeof(struct sockaddr_in));
+		addrs[i].sin_family = AF_INET;
+		addrs[i].sin_addr.s_addr = htonl(0x0A000000 | (i + 1));
+		addrs[i].sin_port = htons(1024 + i % 60000);
+	}
+
+	fd = bench_dht_start();
+	if (fd < 0)
+		goto exit;
+
+	uint64_t start = bench_now_ns();
+	for(int round = 0; round < 10; round++)
+		for(int i = 0; i < BENCH_DHT_IDS; i++)
+			new_node(&ids[i * 20], (struct sockaddr*)&addrs[i], sizeof(struct sockaddr_in), 2);
+	bench_report_rate("new_node", 10 * BENCH_DHT_IDS, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int round = 0; round < 10; round++)
+		for(int i = 0; i < BENCH_DHT_IDS; i++)
+			if (find_node(&ids[i * 20], AF_INET) != NULL)
+				found++;
+	bench_report_rate("find_node", 10 * BENCH_DHT_IDS, bench_now_ns() - start);
+
+	dht_nodes(AF_INET, &good, &dubious, NULL, NULL);
+	printf("  %-40s %12d good, %d dubious, %d found\n", "routing table", good, dubious, found / 10);
+
+	/* every node in the table, and only those, is found in every round */
+	retVal = good > 0 && found == 10 * (good + dubious);
+	exit:
+	if (fd >= 0)
+		bench_dht_stop(fd);
+	if (ids != NULL)
+		free(ids);
+	if (addrs != NULL)
+		free(addrs);
+	return retVal;
+}
+
+#define BENCH_DHT_HASHES 16000
+#define BENCH_DHT_ANNOUNCES 1000000
+
+/***
+ * Announce random peers for BENCH_DHT_HASHES info hashes with storage_store, look them up with find_storage, then let all of them
+ * expire with expire_storage.
+ */
+int bench_dht_storage() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char* hashes = NULL;
+	struct sockaddr_in addr;
+	int found = 0;
+
+	hashes = malloc(BENCH_DHT_HASHES * 20);
+	if (hashes == NULL)
+		goto exit;
+	for(int i = 0; i < BENCH_DHT_HASHES * 20; i++)
+		hashes[i] = random() & 0xFF;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	fd = bench_dht_start();
+	if (fd < 0)
+		goto exit;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_ANNOUNCES; i++) {
+		/* a third of the announces refresh a peer that is already known */
+		int peer = random() % (BENCH_DHT_ANNOUNCES / 48);
+		addr.sin_addr.s_addr = htonl(0x0A000000 | peer);
+		storage_store(&hashes[(i % BENCH_DHT_HASHES) * 20], (struct sockaddr*)&addr, 6881);
+	}
+	bench_report_rate("storage_store", BENCH_DHT_ANNOUNCES, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_ANNOUNCES; i++)
+		if (find_storage(&hashes[(i % BENCH_DHT_HASHES) * 20]) != NULL)
+			found++;
+	bench_report_rate("find_storage", BENCH_DHT_ANNOUNCES, bench_now_ns() - start);
+
+	int stored = numstorage;
+	now.tv_sec += 33 * 60;
+	start = bench_now_ns();
+	expire_storage();
+	bench_report_rate("expire_storage (hashes)", stored, bench_now_ns() - start);
+	printf("  %-40s %12d stored, %d left\n", "storage hashes", stored, numstorage);
+
+	retVal = found == BENCH_DHT_ANNOUNCES && numstorage == 0;
+	exit:
+	if (fd >= 0)
+		bench_dht_stop(fd);
+	if (hashes != NULL)
+		free(hashes);
+	return retVal;
+}
+
+/***
+ * The memmem-based parser dht.c used before the single-pass one, kept
+ * here so the benchmark has something to compare against.
+ */
+static int
+legacy_parse_message(const unsigned char *buf, int buflen,
+                     unsigned char *tid_return, int *tid_len,
+                     unsigned char *id_return, unsigned char *info_hash_return,
+                     unsigned char *target_return, unsigned short *port_return,
+                     unsigned char *token_return, int *token_len,
+                     unsigned char *nodes_return, int *nodes_len,
+                     unsigned char *nodes6_return, int *nodes6_len,
+                     unsigned char *values_return, int *values_len,
+                     unsigned char *values6_return, int *values6_len,
+                     int *want_return)
+{
+    const unsigned char *p;
+
+    /* This code will happily crash if the buffer is not NUL-terminated. */
+    if(buf[buflen] != '\0') {
+        debugf("Eek!  parse_message with unterminated buffer.\n");
+        return -1;
+    }
+
+#define CHECK(ptr, len)                                                 \
+    if(((unsigned char*)ptr) + (len) > (buf) + (buflen)) goto overflow;
+
+    if(tid_return) {
+        p = memmem(buf, buflen, "1:t", 3);
+        if(p) {
+            long l;
+            char *q;
+            l = strtol((char*)p + 3, &q, 10);
+            if(q && *q == ':' && l > 0 && l < *tid_len) {
+                CHECK(q + 1, l);
+                memcpy(tid_return, q + 1, l);
+                *tid_len = l;
+            } else
+                *tid_len = 0;
+        }
+    }
+    if(id_return) {
+        p = memmem(buf, buflen, "2:id20:", 7);
+        if(p) {
+            CHECK(p + 7, 20);
+            memcpy(id_return, p + 7, 20);
+        } else {
+            memset(id_return, 0, 20);
+        }
+    }
+    if(info_hash_return) {
+        p = memmem(buf, buflen, "9:info_hash20:", 14);
+        if(p) {
+            CHECK(p + 14, 20);
+            memcpy(info_hash_return, p + 14, 20);
+        } else {
+            memset(info_hash_return, 0, 20);
+        }
+    }
+    if(port_return) {
+        p = memmem(buf, buflen, "porti", 5);
+        if(p) {
+            long l;
+            char *q;
+            l = strtol((char*)p + 5, &q, 10);
+            if(q && *q == 'e' && l > 0 && l < 0x10000)
+                *port_return = l;
+            else
+                *port_return = 0;
+        } else
+            *port_return = 0;
+    }
+    if(target_return) {
+        p = memmem(buf, buflen, "6:target20:", 11);
+        if(p) {
+            CHECK(p + 11, 20);
+            memcpy(target_return, p + 11, 20);
+        } else {
+            memset(target_return, 0, 20);
+        }
+    }
+    if(token_return) {
+        p = memmem(buf, buflen, "5:token", 7);
+        if(p) {
+            long l;
+            char *q;
+            l = strtol((char*)p + 7, &q, 10);
+            if(q && *q == ':' && l > 0 && l < *token_len) {
+                CHECK(q + 1, l);
+                memcpy(token_return, q + 1, l);
+                *token_len = l;
+            } else
+                *token_len = 0;
+        } else
+            *token_len = 0;
+    }
+
+    if(nodes_len) {
+        p = memmem(buf, buflen, "5:nodes", 7);
+        if(p) {
+            long l;
+            char *q;
+            l = strtol((char*)p + 7, &q, 10);
+            if(q && *q == ':' && l > 0 && l <= *nodes_len) {
+                CHECK(q + 1, l);
+                memcpy(nodes_return, q + 1, l);
+                *nodes_len = l;
+            } else
+                *nodes_len = 0;
+        } else
+            *nodes_len = 0;
+    }
+
+    if(nodes6_len) {
+        p = memmem(buf, buflen, "6:nodes6", 8);
+        if(p) {
+            long l;
+            char *q;
+            l = strtol((char*)p + 8, &q, 10);
+            if(q && *q == ':' && l > 0 && l <= *nodes6_len) {
+                CHECK(q + 1, l);
+                memcpy(nodes6_return, q + 1, l);
+                *nodes6_len = l;
+            } else
+                *nodes6_len = 0;
+        } else
+            *nodes6_len = 0;
+    }
+
+    if(values_len || values6_len) {
+        p = memmem(buf, buflen, "6:valuesl", 9);
+        if(p) {
+            int i = p - buf + 9;
+            int j = 0, j6 = 0;
+            while(1) {
+                long l;
+                char *q;
+                l = strtol((char*)buf + i, &q, 10);
+                if(q && *q == ':' && l > 0) {
+                    CHECK(q + 1, l);
+                    i = q + 1 + l - (char*)buf;
+                    if(l == 6) {
+                        if(j + l > *values_len)
+                            continue;
+                        memcpy((char*)values_return + j, q + 1, l);
+                        j += l;
+                    } else if(l == 18) {
+                        if(j6 + l > *values6_len)
+                            continue;
+                        memcpy((char*)values6_return + j6, q + 1, l);
+                        j6 += l;
+                    } else {
+                        debugf("Received weird value -- %d bytes.\n", (int)l);
+                    }
+                } else {
+                    break;
+                }
+            }
+            if(i >= buflen || buf[i] != 'e')
+                debugf("eek... unexpected end for values.\n");
+            if(values_len)
+                *values_len = j;
+            if(values6_len)
+                *values6_len = j6;
+        } else {
+            if(values_len)
+                *values_len = 0;
+            if(values6_len)
+                *values6_len = 0;
+        }
+    }
+
+    if(want_return) {
+        p = memmem(buf, buflen, "4:wantl", 7);
+        if(p) {
+            int i = p - buf + 7;
+            *want_return = 0;
+            while(buf[i] > '0' && buf[i] <= '9' && buf[i + 1] == ':' &&
+                  i + 2 + buf[i] - '0' < buflen) {
+                CHECK(buf + i + 2, buf[i] - '0');
+                if(buf[i] == '2' && memcmp(buf + i + 2, "n4", 2) == 0)
+                    *want_return |= WANT4;
+                else if(buf[i] == '2' && memcmp(buf + i + 2, "n6", 2) == 0)
+                    *want_return |= WANT6;
+                else
+                    debugf("eek... unexpected want flag (%c)\n", buf[i]);
+                i += 2 + buf[i] - '0';
+            }
+            if(i >= buflen || buf[i] != 'e')
+                debugf("eek... unexpected end for want.\n");
+        } else {
+            *want_return = -1;
+        }
+    }
+
+#undef CHECK
+
+    if(memmem(buf, buflen, "1:y1:r", 6))
+        return REPLY;
+    if(memmem(buf, buflen, "1:y1:e", 6))
+        return ERROR;
+    if(!memmem(buf, buflen, "1:y1:q", 6))
+        return -1;
+    if(memmem(buf, buflen, "1:q4:ping", 9))
+        return PING;
+    if(memmem(buf, buflen, "1:q9:find_node", 14))
+       return FIND_NODE;
+    if(memmem(buf, buflen, "1:q9:get_peers", 14))
+        return GET_PEERS;
+    if(memmem(buf, buflen, "1:q13:announce_peer", 19))
+       return ANNOUNCE_PEER;
+    return -1;
+
+ overflow:
+    debugf("Truncated message.\n");
+    return -1;
+}
+
+
+#define BENCH_DHT_MESSAGES 7
+#define BENCH_DHT_MESSAGE_SIZE 1024
+#define BENCH_DHT_PARSES 2000000
+
+static int bench_dht_append(unsigned char* buf, int pos, const void* data, int len) {
+	memcpy(&buf[pos], data, len);
+	return pos + len;
+}
+
+#define BENCH_DHT_APPEND(buf, pos, literal) bench_dht_append(buf, pos, literal, sizeof(literal) - 1)
+
+static int bench_dht_append_random(unsigned char* buf, int pos, int len) {
+	for(int i = 0; i < len; i++)
+		buf[pos + i] = random() & 0xFF;
+	return pos + len;
+}
+
+/***
+ * Build the KRPC messages a busy node sees: ping, find_node, get_peers and
+ * announce_peer queries, and ping, find_node and get_peers replies. Every
+ * message is NUL-terminated, which the legacy parser requires.
+ * @param bufs where to build them
+ * @param lens the length of each message
+ */
+void bench_dht_messages(unsigned char bufs[][BENCH_DHT_MESSAGE_SIZE], int* lens) {
+	unsigned char* b;
+	int i;
+
+	b = bufs[0]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:ad2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "e1:q4:ping1:t4:pn\0\0011:y1:qe");
+	lens[0] = i;
+
+	b = bufs[1]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:ad2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "6:target20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "4:wantl2:n42:n6ee1:q9:find_node1:t4:fn\0\0021:y1:qe");
+	lens[1] = i;
+
+	b = bufs[2]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:ad2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "9:info_hash20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "e1:q9:get_peers1:t4:gp\0\0031:y1:qe");
+	lens[2] = i;
+
+	b = bufs[3]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:ad2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "9:info_hash20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "4:porti6881e5:token8:");
+	i = bench_dht_append_random(b, i, 8);
+	i = BENCH_DHT_APPEND(b, i, "e1:q13:announce_peer1:t4:ap\0\0041:y1:qe");
+	lens[3] = i;
+
+	b = bufs[4]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:rd2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "e1:t4:pn\0\0051:y1:re");
+	lens[4] = i;
+
+	b = bufs[5]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:rd2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "5:nodes208:");
+	i = bench_dht_append_random(b, i, 208);
+	i = BENCH_DHT_APPEND(b, i, "e1:t4:fn\0\0061:v4:LT\001\0021:y1:re");
+	lens[5] = i;
+
+	b = bufs[6]; i = 0;
+	i = BENCH_DHT_APPEND(b, i, "d1:rd2:id20:");
+	i = bench_dht_append_random(b, i, 20);
+	i = BENCH_DHT_APPEND(b, i, "5:token8:");
+	i = bench_dht_append_random(b, i, 8);
+	i = BENCH_DHT_APPEND(b, i, "6:valuesl");
+	for(int j = 0; j < 20; j++) {
+		i = BENCH_DHT_APPEND(b, i, "6:");
+		i = bench_dht_append_random(b, i, 6);
+	}
+	i = BENCH_DHT_APPEND(b, i, "ee1:t4:gp\0\0071:y1:re");
+	lens[6] = i;
+
+	for(int j = 0; j < BENCH_DHT_MESSAGES; j++)
+		bufs[j][lens[j]] = '\0';
+}
+
+/***
+ * Check that the single-pass parser and the legacy one agree on a message.
+ */
+int bench_dht_parse_agrees(const unsigned char* buf, int len) {
+	struct message m;
+	unsigned char tid[16], id[20], info_hash[20], target[20];
+	unsigned char nodes[26*16], nodes6[38*16], token[128];
+	int tid_len = 16, token_len = 128;
+	int nodes_len = 26*16, nodes6_len = 38*16;
+	unsigned short port;
+	unsigned char values[2048], values6[2048], gathered[2048];
+	int values_len = 2048, values6_len = 2048;
+	int want;
+
+	int type = legacy_parse_message(buf, len, tid, &tid_len, id, info_hash,
+			target, &port, token, &token_len, nodes, &nodes_len, nodes6, &nodes6_len,
+			values, &values_len, values6, &values6_len, &want);
+	if (type != parse_message(buf, len, &m))
+		return 0;
+	if (tid_len != m.tid_len || memcmp(tid, m.tid, tid_len) != 0)
+		return 0;
+	if (memcmp(id, m.id, 20) != 0 || port != m.port || want != m.want)
+		return 0;
+	if (token_len != m.token_len || memcmp(token, m.token, token_len) != 0)
+		return 0;
+	if (nodes_len != m.nodes_len || memcmp(nodes, m.nodes, nodes_len) != 0)
+		return 0;
+	if (values_len != message_values(&m, 4, gathered, 2048) || memcmp(values, gathered, values_len) != 0)
+		return 0;
+	return 1;
+}
+
+/***
+ * Parse a realistic mix of KRPC messages with the single-pass parser and
+ * with the legacy one.
+ */
+int bench_dht_parse_message() {
+	unsigned char bufs[BENCH_DHT_MESSAGES][BENCH_DHT_MESSAGE_SIZE];
+	int lens[BENCH_DHT_MESSAGES];
+	size_t bytes = 0;
+	int agree = 0;
+	struct message m;
+
+	bench_dht_messages(bufs, lens);
+	for(int i = 0; i < BENCH_DHT_MESSAGES; i++) {
+		bytes += lens[i];
+		agree += bench_dht_parse_agrees(bufs[i], lens[i]);
+	}
+	bytes *= BENCH_DHT_PARSES / BENCH_DHT_MESSAGES;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_PARSES; i++) {
+		int k = i % BENCH_DHT_MESSAGES;
+		parse_message(bufs[k], lens[k], &m);
+	}
+	uint64_t elapsed = bench_now_ns() - start;
+	bench_report_rate("parse_message", BENCH_DHT_PARSES, elapsed);
+	printf("  %-40s %12.1f MB/s\n", "parse_message", bytes * 1000.0 / elapsed);
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_PARSES; i++) {
+		int k = i % BENCH_DHT_MESSAGES;
+		unsigned char tid[16], id[20], info_hash[20], target[20];
+		unsigned char nodes[26*16], nodes6[38*16], token[128];
+		int tid_len = 16, token_len = 128;
+		int nodes_len = 26*16, nodes6_len = 38*16;
+		unsigned short port;
+		unsigned char values[2048], values6[2048];
+		int values_len = 2048, values6_len = 2048;
+		int want;
+		legacy_parse_message(bufs[k], lens[k], tid, &tid_len, id, info_hash,
+				target, &port, token, &token_len, nodes, &nodes_len, nodes6, &nodes6_len,
+				values, &values_len, values6, &values6_len, &want);
+	}
+	elapsed = bench_now_ns() - start;
+	bench_report_rate("legacy parse_message", BENCH_DHT_PARSES, elapsed);
+	printf("  %-40s %12.1f MB/s\n", "legacy parse_message", bytes * 1000.0 / elapsed);
+	printf("  %-40s %12d of %d\n", "parsers agree", agree, BENCH_DHT_MESSAGES);
+
+	return agree == BENCH_DHT_MESSAGES;
+}
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_helper.h"
+#include "libp2p/peer/peerstore.h"
+#include "libp2p/peer/providerstore.h"
+#include "libp2p/record/message.h"
+#include "libp2p/record/message_view.h"
+#include "libp2p/routing/dht_protocol.h"
+#include "libp2p/utils/arena.h"
+#include "libp2p/utils/linked_list.h"
+#include "multiaddr/multiaddr.h"
+
+#define BENCH_DHT_PROTOCOL_PEERS 1000
+#define BENCH_DHT_PROTOCOL_KEYS 50
+#define BENCH_DHT_PROTOCOL_REQUESTS 20000
+// as libp2p_routing_dht_handle_message has, so that one block holds a reply
+#define BENCH_DHT_PROTOCOL_BLOCK_SIZE 8192
+
+struct BenchDhtProtocolRequests {
+	unsigned char* buffers[BENCH_DHT_PROTOCOL_KEYS];
+	size_t sizes[BENCH_DHT_PROTOCOL_KEYS];
+	struct Libp2pMessageView views[BENCH_DHT_PROTOCOL_KEYS];
+};
+
+static void bench_dht_protocol_id(char* id, int i) {
+	sprintf(id, "QmYjtig7VJQ6XsnUjqqJvj7QaMcCAwtrgNdahSiFofr%03d", i);
+}
+
+/***
+ * Protobuf a request for each key, and view it as the handler would
+ */
+static int bench_dht_protocol_requests(struct BenchDhtProtocolRequests* requests, enum MessageType type) {
+	char key[64];
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_KEYS; i++) {
+		struct Libp2pMessage* message = libp2p_message_new();
+		if (message == NULL)
+			return 0;
+		message->message_type = type;
+		if (type == MESSAGE_TYPE_FIND_NODE)
+			bench_dht_protocol_id(key, i * (BENCH_DHT_PROTOCOL_PEERS / BENCH_DHT_PROTOCOL_KEYS));
+		else
+			sprintf(key, "QmW8CYQuoJhgfxTeNVFWktGFnTRzdUAimerSsHaE4rU%03d", i);
+		message->key_size = strlen(key);
+		message->key = malloc(message->key_size);
+		memcpy(message->key, key, message->key_size);
+		int ok = libp2p_message_protobuf_allocate_and_encode(message, &requests->buffers[i], &requests->sizes[i]);
+		libp2p_message_free(message);
+		if (!ok || !libp2p_message_view_decode(requests->buffers[i], requests->sizes[i], &requests->views[i]))
+			return 0;
+	}
+	return 1;
+}
+
+static void bench_dht_protocol_requests_free(struct BenchDhtProtocolRequests* requests) {
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_KEYS; i++)
+		free(requests->buffers[i]);
+}
+
+/***
+ * Answer requests with everything malloc'd, then from an arena reset after each request
+ */
+static int bench_dht_protocol_run(const char* name, struct BenchDhtProtocolRequests* requests,
+		int (*handler)(struct SessionContext*, const struct Libp2pMessageView*, struct Peerstore*, struct ProviderStore*, struct Libp2pArena*, unsigned char**, size_t*),
+		struct Peerstore* peerstore, struct ProviderStore* providerstore) {
+	struct Libp2pArena arena;
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+	size_t allocations = 0, mallocs = 0;
+	char label[64];
+	int answered = 0;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_REQUESTS; i++) {
+		results = NULL;
+		if (handler(NULL, &requests->views[i % BENCH_DHT_PROTOCOL_KEYS], peerstore, providerstore, NULL, &results, &results_size))
+			answered++;
+		free(results);
+	}
+	sprintf(label, "%s malloc", name);
+	bench_report_rate(label, BENCH_DHT_PROTOCOL_REQUESTS, bench_now_ns() - start);
+
+	libp2p_utils_arena_init(&arena, BENCH_DHT_PROTOCOL_BLOCK_SIZE);
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_REQUESTS; i++) {
+		results = NULL;
+		if (handler(NULL, &requests->views[i % BENCH_DHT_PROTOCOL_KEYS], peerstore, providerstore, &arena, &results, &results_size))
+			answered++;
+		allocations += arena.allocations;
+		mallocs += arena.mallocs;
+		libp2p_utils_arena_reset(&arena);
+	}
+	sprintf(label, "%s arena", name);
+	bench_report_rate(label, BENCH_DHT_PROTOCOL_REQUESTS, bench_now_ns() - start);
+	printf("  %-40s %12.1f allocations, %.3f mallocs per request, %lu bytes high water\n", label,
+			(double)allocations / BENCH_DHT_PROTOCOL_REQUESTS, (double)mallocs / BENCH_DHT_PROTOCOL_REQUESTS, (unsigned long)arena.high_water);
+	libp2p_utils_arena_clear(&arena);
+
+	return answered == 2 * BENCH_DHT_PROTOCOL_REQUESTS;
+}
+
+/***
+ * GET_PROVIDERS and FIND_NODE, answered from a peerstore of 1000 peers
+ * with 2 addresses each, and 20 providers for each key
+ */
+int bench_dht_protocol_handlers() {
+	struct Peerstore* peerstore = libp2p_peerstore_new("QmLocal");
+	struct ProviderStore* providerstore = libp2p_providerstore_new();
+	struct BenchDhtProtocolRequests get_providers = {0}, find_node = {0};
+	char str[128];
+	int retVal = 0;
+
+	if (peerstore == NULL || providerstore == NULL)
+		goto exit;
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_PEERS; i++) {
+		struct Libp2pPeer* peer = libp2p_peer_new();
+		bench_dht_protocol_id(str, i);
+		peer->id_size = strlen(str);
+		peer->id = malloc(peer->id_size);
+		memcpy(peer->id, str, peer->id_size);
+		peer->addr_head = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/10.0.%d.%d/tcp/4001", i / 256, i % 256);
+		peer->addr_head->item = multiaddress_new_from_string(str);
+		peer->addr_head->next = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/127.0.0.1/tcp/%d", 5000 + i);
+		peer->addr_head->next->item = multiaddress_new_from_string(str);
+		libp2p_peerstore_add_peer(peerstore, peer);
+		libp2p_peer_free(peer);
+	}
+	if (!bench_dht_protocol_requests(&get_providers, MESSAGE_TYPE_GET_PROVIDERS)
+			|| !bench_dht_protocol_requests(&find_node, MESSAGE_TYPE_FIND_NODE))
+		goto exit;
+	for(int i = 0; i < BENCH_DHT_PROTOCOL_KEYS; i++) {
+		for(int j = 0; j < PROVIDERSTORE_MAX_PROVIDERS; j++) {
+			bench_dht_protocol_id(str, (i * 7 + j * 31) % BENCH_DHT_PROTOCOL_PEERS);
+			libp2p_providerstore_add(providerstore, get_providers.views[i].key, get_providers.views[i].key_size,
+					(unsigned char*)str, strlen(str));
+		}
+	}
+
+	retVal = bench_dht_protocol_run("get_providers", &get_providers, libp2p_routing_dht_handle_get_providers, peerstore, providerstore)
+			&& bench_dht_protocol_run("find_node", &find_node, libp2p_routing_dht_handle_find_node, peerstore, providerstore);
+
+	exit:
+	bench_dht_protocol_requests_free(&get_providers);
+	bench_dht_protocol_requests_free(&find_node);
+	libp2p_providerstore_free(providerstore);
+	libp2p_peerstore_free(peerstore);
+	return retVal;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_helper.h"
+#include "bench_hashmap_legacy.h"
+#include "libp2p/hashmap/hashmap.h"
+
+#define BENCH_HASHMAP_MAX_ENTRIES 1000000
+#define BENCH_HASHMAP_KEY_SIZE 48
+#define BENCH_HASHMAP_ID_SIZE 32
+
+/***
+ * The functions of one of the maps being compared
+ */
+struct BenchHashmapOps {
+	const char* name;
+	map_t (*new)();
+	int (*put)(map_t, char*, any_t);
+	int (*get)(map_t, char*, any_t*);
+	int (*remove)(map_t, char*);
+	void (*free)(map_t);
+};
+
+/***
+ * Time put, get, a missed get and remove of count keys
+ * @returns true(1) if every key was found, otherwise false(0)
+ */
+int bench_hashmap_run(struct BenchHashmapOps* ops, char (*keys)[BENCH_HASHMAP_KEY_SIZE], char (*misses)[BENCH_HASHMAP_KEY_SIZE], int count) {
+	char label[64];
+	any_t value = NULL;
+	int found = 0;
+	map_t map = ops->new();
+	if (map == NULL)
+		return 0;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		ops->put(map, keys[i], keys[i]);
+	snprintf(label, sizeof(label), "%s put (%d)", ops->name, count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		found += ops->get(map, keys[i], &value) == MAP_OK;
+	snprintf(label, sizeof(label), "%s get (%d)", ops->name, count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		found -= ops->get(map, misses[i], &value) == MAP_OK;
+	snprintf(label, sizeof(label), "%s miss (%d)", ops->name, count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		ops->remove(map, keys[i]);
+	snprintf(label, sizeof(label), "%s remove (%d)", ops->name, count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	ops->free(map);
+	return found == count;
+}
+
+/***
+ * The id map, keyed by binary ids the size of a sha256
+ */
+int bench_hashmap_id_run(unsigned char (*ids)[BENCH_HASHMAP_ID_SIZE], int count) {
+	char label[64];
+	any_t value = NULL;
+	int found = 0;
+	map_t map = libp2p_hashmap_new_id(BENCH_HASHMAP_ID_SIZE);
+	if (map == NULL)
+		return 0;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		libp2p_hashmap_put_id(map, ids[i], ids[i]);
+	snprintf(label, sizeof(label), "id put (%d)", count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		found += libp2p_hashmap_get_id(map, ids[i], &value) == MAP_OK;
+	snprintf(label, sizeof(label), "id get (%d)", count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++)
+		libp2p_hashmap_remove_id(map, ids[i]);
+	snprintf(label, sizeof(label), "id remove (%d)", count);
+	bench_report_rate(label, count, bench_now_ns() - start);
+
+	libp2p_hashmap_free(map);
+	return found == count;
+}
+
+/***
+ * Compare the open addressing hashmap with the one it replaced, at 1k,
+ * 100k and 1M keys the length of base58 peer ids, and time the id map at
+ * as many sha256 sized ids
+ */
+int bench_hashmap() {
+	struct BenchHashmapOps maps[] = {
+			{ "legacy", legacy_hashmap_new, legacy_hashmap_put, legacy_hashmap_get, legacy_hashmap_remove, legacy_hashmap_free },
+			{ "hashmap", libp2p_hashmap_new, libp2p_hashmap_put, libp2p_hashmap_get, libp2p_hashmap_remove, libp2p_hashmap_free }
+	};
+	int sizes[] = { 1000, 100000, BENCH_HASHMAP_MAX_ENTRIES };
+	char (*keys)[BENCH_HASHMAP_KEY_SIZE] = malloc(BENCH_HASHMAP_MAX_ENTRIES * sizeof(*keys));
+	char (*misses)[BENCH_HASHMAP_KEY_SIZE] = malloc(BENCH_HASHMAP_MAX_ENTRIES * sizeof(*misses));
+	unsigned char (*ids)[BENCH_HASHMAP_ID_SIZE] = malloc(BENCH_HASHMAP_MAX_ENTRIES * sizeof(*ids));
+	int retVal = 0;
+
+	if (keys == NULL || misses == NULL || ids == NULL)
+		goto exit;
+	for(int i = 0; i < BENCH_HASHMAP_MAX_ENTRIES; i++) {
+		keys[i][0] = 'Q';
+		keys[i][1] = 'm';
+		misses[i][0] = 'Z';
+		misses[i][1] = 'x';
+		for(int j = 2; j < 46; j++) {
+			keys[i][j] = 'A' + random() % 26;
+			misses[i][j] = 'A' + random() % 26;
+		}
+		keys[i][46] = 0;
+		misses[i][46] = 0;
+		for(int j = 0; j < BENCH_HASHMAP_ID_SIZE; j++)
+			ids[i][j] = random() & 0xff;
+	}
+
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for(size_t m = 0; m < sizeof(maps) / sizeof(maps[0]); m++) {
+			if (!bench_hashmap_run(&maps[m], keys, misses, sizes[s]))
+				goto exit;
+		}
+		if (!bench_hashmap_id_run(ids, sizes[s]))
+			goto exit;
+	}
+
+	retVal = 1;
+	exit:
+	free(keys);
+	free(misses);
+	free(ids);
+	return retVal;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/***
+ * Nanoseconds on the monotonic clock
+ */
+static inline uint64_t bench_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_compare_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/***
+ * Find a percentile in a set of samples. The samples are sorted in place.
+ * @param samples the samples
+ * @param count the number of samples
+ * @param percentile 0 to 100
+ * @returns the value at that percentile, or 0 if there are no samples
+ */
+uint64_t bench_percentile(uint64_t* samples, size_t count, double percentile) {
+	if (count == 0)
+		return 0;
+	qsort(samples, count, sizeof(uint64_t), bench_compare_u64);
+	size_t pos = (size_t)(percentile / 100.0 * (count - 1) + 0.5);
+	return samples[pos];
+}
+
+/***
+ * Print a rate in a uniform way
+ * @param label what was measured
+ * @param count how many operations were done
+ * @param elapsed_ns how long it took
+ */
+void bench_report_rate(const char* label, uint64_t count, uint64_t elapsed_ns) {
+	double secs = elapsed_ns / 1e9;
+	printf("  %-40s %12.0f ops/sec (%llu ops in %.3f s)\n", label,
+			secs > 0 ? count / secs : 0.0, (unsigned long long)count, secs);
+}
+
+/***
+ * Print a throughput in a uniform way
+ * @param label what was measured
+ * @param count how many messages were handled
+ * @param bytes how many bytes they held
+ * @param elapsed_ns how long it took
+ */
+void bench_report_throughput(const char* label, uint64_t count, uint64_t bytes, uint64_t elapsed_ns) {
+	double secs = elapsed_ns / 1e9;
+	printf("  %-40s %9.1f MB/sec %12.0f msgs/sec\n", label,
+			secs > 0 ? bytes / secs / 1e6 : 0.0, secs > 0 ? count / secs : 0.0);
+}
@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// for dht_testing, which only a build of dht.c with DHT_TESTING has
+#include "bench_dht.h"
+#include "libp2p/routing/kademlia.h"
+#include "libp2p/utils/vector.h"
+#include "bench_helper.h"
+
+#define BENCH_KADEMLIA_PACKETS 200000
+#define BENCH_KADEMLIA_WINDOW 64
+
+/***
+ * Build a KRPC request of the kind picked by seq (ping, find_node or get_peers)
+ * @param buf where to build it
+ * @param id the id of the sender
+ * @param seq the sequence number, also used as the transaction id
+ * @returns the length of the request
+ */
+int bench_kademlia_build_request(unsigned char* buf, const unsigned char* id, uint16_t seq) {
+	unsigned char target[20];
+	int pos = 0;
+	for(int i = 0; i < 20; i++)
+		target[i] = random() & 0xFF;
+	memcpy(&buf[pos], "d1:ad2:id20:", 12); pos += 12;
+	memcpy(&buf[pos], id, 20); pos += 20;
+	switch (seq % 3) {
+		case 0:
+			memcpy(&buf[pos], "e1:q4:ping", 10); pos += 10;
+			break;
+		case 1:
+			memcpy(&buf[pos], "6:target20:", 11); pos += 11;
+			memcpy(&buf[pos], target, 20); pos += 20;
+			memcpy(&buf[pos], "e1:q9:find_node", 15); pos += 15;
+			break;
+		default:
+			memcpy(&buf[pos], "9:info_hash20:", 14); pos += 14;
+			memcpy(&buf[pos], target, 20); pos += 20;
+			memcpy(&buf[pos], "e1:q9:get_peers", 15); pos += 15;
+			break;
+	}
+	memcpy(&buf[pos], "1:t4:bk", 7); pos += 7;
+	memcpy(&buf[pos], &seq, 2); pos += 2;
+	memcpy(&buf[pos], "1:y1:qe", 7); pos += 7;
+	return pos;
+}
+
+/***
+ * Replay a mix of ping, find_node and get_peers requests against a
+ * kademlia node over loopback, keeping BENCH_KADEMLIA_WINDOW requests
+ * in flight, and report the packet rate and the response latency.
+ */
+int bench_kademlia_krpc_mix() {
+	int retVal = 0;
+	int server = -1, client = -1;
+	int started = 0;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct Libp2pVector* bootstrap = NULL;
+	uint64_t* latencies = NULL;
+	uint64_t sent_at[65536];
+	unsigned char id[20];
+	unsigned char buf[4096];
+	size_t answered = 0, lost = 0;
+
+	latencies = malloc(sizeof(uint64_t) * BENCH_KADEMLIA_PACKETS);
+	bootstrap = libp2p_utils_vector_new(1);
+	if (latencies == NULL || bootstrap == NULL)
+		goto exit;
+
+	dht_testing = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server = socket(AF_INET, SOCK_DGRAM, 0);
+	if (server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto exit;
+	if (getsockname(server, (struct sockaddr*)&addr, &addr_len) != 0)
+		goto exit;
+
+	if (start_kademlia(server, AF_INET, "QmBenchKademliaServerNode", 1, bootstrap) != 0)
+		goto exit;
+	started = 1;
+	dht_debug = NULL;
+
+	client = socket(AF_INET, SOCK_DGRAM, 0);
+	if (client < 0 || connect(client, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto exit;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = (random() & 0xFF) | 1;
+
+	uint64_t start = bench_now_ns();
+	size_t next = 0;
+	while (next < BENCH_KADEMLIA_PACKETS) {
+		size_t window_start = next;
+		int outstanding = 0;
+		for(; next < BENCH_KADEMLIA_PACKETS && next - window_start < BENCH_KADEMLIA_WINDOW; next++) {
+			uint16_t seq = (uint16_t)next;
+			int len = bench_kademlia_build_request(buf, id, seq);
+			sent_at[seq] = bench_now_ns();
+			if (send(client, buf, len, 0) == len)
+				outstanding++;
+		}
+		while (outstanding > 0) {
+			struct pollfd pfd = { client, POLLIN, 0 };
+			if (poll(&pfd, 1, 200) <= 0)
+				break;
+			int rc = recv(client, buf, sizeof(buf) - 1, 0);
+			if (rc <= 0)
+				continue;
+			uint64_t now = bench_now_ns();
+			buf[rc] = 0;
+			unsigned char* tid = memmem(buf, rc, "1:t4:bk", 7);
+			if (tid == NULL || tid + 9 > buf + rc)
+				continue;
+			uint16_t seq;
+			memcpy(&seq, tid + 7, 2);
+			latencies[answered++] = now - sent_at[seq];
+			outstanding--;
+		}
+		lost += outstanding;
+	}
+	uint64_t elapsed = bench_now_ns() - start;
+
+	bench_report_rate("requests answered", answered, elapsed);
+	printf("  %-40s %12zu\n", "requests lost", lost);
+	printf("  %-40s %12.1f us\n", "p50 response latency", bench_percentile(latencies, answered, 50) / 1000.0);
+	printf("  %-40s %12.1f us\n", "p99 response latency", bench_percentile(latencies, answered, 99) / 1000.0);
+
+	retVal = answered > 0;
+	exit:
+	if (client >= 0)
+		close(client);
+	if (started)
+		stop_kademlia();
+	else if (server >= 0)
+		close(server);
+	dht_testing = 0;
+	if (bootstrap != NULL)
+		libp2p_utils_vector_free(bootstrap);
+	if (latencies != NULL)
+		free(latencies);
+	return retVal;
+}
+
+#define BENCH_KADEMLIA_SEARCHES 256
+
+/***
+ * Answer a KRPC query received by a fake peer: pings get a pong, and
+ * get_peers gets one value derived from the info hash.
+ * @param fd the socket of the fake peer
+ * @param id the id of the fake peer
+ * @returns the number of queries answered
+ */
+int bench_kademlia_answer(int fd, const unsigned char* id) {
+	unsigned char buf[4096], reply[512];
+	struct sockaddr_storage from;
+	socklen_t from_len = sizeof(from);
+	int answered = 0;
+	int rc;
+
+	while ((rc = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len)) > 0) {
+		unsigned char* tid = memmem(buf, rc, "1:t4:", 5);
+		unsigned char* hash = memmem(buf, rc, "9:info_hash20:", 14);
+		int pos = 0;
+		if (tid == NULL || tid + 9 > buf + rc)
+			continue;
+		memcpy(&reply[pos], "d1:rd2:id20:", 12); pos += 12;
+		memcpy(&reply[pos], id, 20); pos += 20;
+		if (hash != NULL && hash + 34 <= buf + rc) {
+			memcpy(&reply[pos], "5:token4:bkbk6:valuesl6:", 24); pos += 24;
+			reply[pos++] = 10;
+			memcpy(&reply[pos], hash + 14, 3); pos += 3;
+			reply[pos++] = 0x0F;
+			reply[pos++] = 0xA1;
+			reply[pos++] = 'e';
+		}
+		memcpy(&reply[pos], "e1:t4:", 6); pos += 6;
+		memcpy(&reply[pos], tid + 5, 4); pos += 4;
+		memcpy(&reply[pos], "1:y1:re", 7); pos += 7;
+		sendto(fd, reply, pos, 0, (struct sockaddr*)&from, from_len);
+		answered++;
+		from_len = sizeof(from);
+	}
+	return answered;
+}
+
+/***
+ * Start BENCH_KADEMLIA_SEARCHES lookups at once against a kademlia node
+ * whose routing table holds one fake peer that knows every hash, and
+ * report how long each takes to complete.
+ */
+int bench_kademlia_concurrent_search() {
+	int retVal = 0;
+	int server = -1, peer = -1;
+	int started = 0;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct Libp2pVector* bootstrap = NULL;
+	struct kademlia_search* searches[BENCH_KADEMLIA_SEARCHES];
+	uint64_t latencies[BENCH_KADEMLIA_SEARCHES];
+	int finished[BENCH_KADEMLIA_SEARCHES];
+	unsigned char id[20], hash[20];
+	char ip[INET_ADDRSTRLEN];
+	int done = 0, found = 0;
+
+	memset(searches, 0, sizeof(searches));
+	bootstrap = libp2p_utils_vector_new(1);
+	if (bootstrap == NULL)
+		goto exit;
+
+	dht_testing = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server = socket(AF_INET, SOCK_DGRAM, 0);
+	if (server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto exit;
+	if (start_kademlia(server, AF_INET, "QmBenchKademliaSearchNode", 1, bootstrap) != 0)
+		goto exit;
+	started = 1;
+	dht_debug = NULL;
+
+	peer = socket(AF_INET, SOCK_DGRAM, 0);
+	addr.sin_port = 0;
+	if (peer < 0 || bind(peer, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		goto exit;
+	if (getsockname(peer, (struct sockaddr*)&addr, &addr_len) != 0)
+		goto exit;
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+
+	// get the fake peer into the routing table
+	inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+	ping_kademlia(ip, ntohs(addr.sin_port));
+	for(int i = 0; i < 10 && bench_kademlia_answer(peer, id) == 0; i++)
+		usleep(10000);
+	usleep(100000);
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < BENCH_KADEMLIA_SEARCHES; i++) {
+		for(int j = 0; j < 20; j++)
+			hash[j] = random() & 0xFF;
+		searches[i] = search_kademlia_start(hash, 0);
+		finished[i] = 0;
+	}
+
+	while (done < BENCH_KADEMLIA_SEARCHES && bench_now_ns() - start < 10000000000ULL) {
+		struct pollfd pfd = { peer, POLLIN, 0 };
+		poll(&pfd, 1, 1);
+		bench_kademlia_answer(peer, id);
+		for(int i = 0; i < BENCH_KADEMLIA_SEARCHES; i++) {
+			if (searches[i] != NULL && !finished[i] && search_kademlia_wait(searches[i], 0)) {
+				finished[i] = 1;
+				latencies[done++] = bench_now_ns() - start;
+			}
+		}
+	}
+	uint64_t elapsed = bench_now_ns() - start;
+
+	for(int i = 0; i < BENCH_KADEMLIA_SEARCHES; i++) {
+		struct MultiAddress** results = searches[i] == NULL ? NULL : search_kademlia_results(searches[i]);
+		if (results != NULL) {
+			found++;
+			for(int j = 0; results[j] != NULL; j++)
+				multiaddress_free(results[j]);
+			free(results);
+		}
+	}
+
+	bench_report_rate("searches completed", done, elapsed);
+	printf("  %-40s %12d of %d\n", "searches with results", found, BENCH_KADEMLIA_SEARCHES);
+	printf("  %-40s %12.1f ms\n", "p50 search latency", bench_percentile(latencies, done, 50) / 1000000.0);
+	printf("  %-40s %12.1f ms\n", "p99 search latency", bench_percentile(latencies, done, 99) / 1000000.0);
+
+	retVal = done == BENCH_KADEMLIA_SEARCHES && found == BENCH_KADEMLIA_SEARCHES;
+	exit:
+	for(int i = 0; i < BENCH_KADEMLIA_SEARCHES; i++)
+		search_kademlia_free(searches[i]);
+	if (peer >= 0)
+		close(peer);
+	if (started)
+		stop_kademlia();
+	else if (server >= 0)
+		close(server);
+	dht_testing = 0;
+	if (bootstrap != NULL)
+		libp2p_utils_vector_free(bootstrap);
+	return retVal;
+}
+
+#define BENCH_KADEMLIA_SWARM 256
+#define BENCH_KADEMLIA_GOOD 32
+#define BENCH_KADEMLIA_BOOT_LIMIT 30
+
+struct bench_kademlia_swarm {
+	int fds[BENCH_KADEMLIA_SWARM];
+	unsigned char ids[BENCH_KADEMLIA_SWARM][20];
+	struct sockaddr_in addrs[BENCH_KADEMLIA_SWARM];
+};
+
+/***
+ * Open the sockets of a swarm of fake DHT nodes on the loopback interface
+ * @param swarm the swarm
+ * @returns true(1) on success
+ */
+int bench_kademlia_swarm_open(struct bench_kademlia_swarm* swarm) {
+	for(int i = 0; i < BENCH_KADEMLIA_SWARM; i++)
+		swarm->fds[i] = -1;
+	for(int i = 0; i < BENCH_KADEMLIA_SWARM; i++) {
+		socklen_t len = sizeof(struct sockaddr_in);
+		memset(&swarm->addrs[i], 0, sizeof(struct sockaddr_in));
+		swarm->addrs[i].sin_family = AF_INET;
+		swarm->addrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		swarm->fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (swarm->fds[i] < 0 || bind(swarm->fds[i], (struct sockaddr*)&swarm->addrs[i], len) != 0)
+			return 0;
+		if (getsockname(swarm->fds[i], (struct sockaddr*)&swarm->addrs[i], &len) != 0)
+			return 0;
+		for(int j = 0; j < 20; j++)
+			swarm->ids[i][j] = random() & 0xFF;
+	}
+	return 1;
+}
+
+void bench_kademlia_swarm_close(struct bench_kademlia_swarm* swarm) {
+	for(int i = 0; i < BENCH_KADEMLIA_SWARM; i++)
+		if (swarm->fds[i] >= 0)
+			close(swarm->fds[i]);
+}
+
+/***
+ * Answer whatever the swarm received: pings get a pong, everything else
+ * gets eight random members of the swarm as nodes.
+ * @param swarm the swarm
+ */
+void bench_kademlia_swarm_answer(struct bench_kademlia_swarm* swarm) {
+	struct pollfd pfds[BENCH_KADEMLIA_SWARM];
+	unsigned char buf[4096], reply[512];
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	int rc;
+
+	for(int i = 0; i < BENCH_KADEMLIA_SWARM; i++) {
+		pfds[i].fd = swarm->fds[i];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	if (poll(pfds, BENCH_KADEMLIA_SWARM, 1) <= 0)
+		return;
+
+	for(int i = 0; i < BENCH_KADEMLIA_SWARM; i++) {
+		if (!(pfds[i].revents & POLLIN))
+			continue;
+		from_len = sizeof(from);
+		while ((rc = recvfrom(swarm->fds[i], buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len)) > 0) {
+			unsigned char* tid = memmem(buf, rc, "1:t4:", 5);
+			int pos = 0;
+			from_len = sizeof(from);
+			if (tid == NULL || tid + 9 > buf + rc || memmem(buf, rc, "1:y1:q", 6) == NULL)
+				continue;
+			memcpy(&reply[pos], "d1:rd2:id20:", 12); pos += 12;
+			memcpy(&reply[pos], swarm->ids[i], 20); pos += 20;
+			if (memmem(buf, rc, "1:q4:ping", 9) == NULL) {
+				memcpy(&reply[pos], "5:nodes208:", 11); pos += 11;
+				for(int j = 0; j < 8; j++) {
+					int k = random() % BENCH_KADEMLIA_SWARM;
+					memcpy(&reply[pos], swarm->ids[k], 20); pos += 20;
+					memcpy(&reply[pos], &swarm->addrs[k].sin_addr, 4); pos += 4;
+					memcpy(&reply[pos], &swarm->addrs[k].sin_port, 2); pos += 2;
+				}
+			}
+			memcpy(&reply[pos], "e1:t4:", 6); pos += 6;
+			memcpy(&reply[pos], tid + 5, 4); pos += 4;
+			memcpy(&reply[pos], "1:y1:re", 7); pos += 7;
+			sendto(swarm->fds[i], reply, pos, 0, (struct sockaddr*)&from, sizeof(struct sockaddr_in));
+		}
+	}
+}
+
+/***
+ * Start a kademlia node against the swarm and measure how long it takes
+ * to have BENCH_KADEMLIA_GOOD good nodes, looking up random hashes once
+ * a first node answered the way a joining node fills its routing table
+ * @param swarm the swarm to answer for
+ * @param bootstrap the bootstrap addresses
+ * @returns the time it took in nanoseconds, 0 on time out or error
+ */
+uint64_t bench_kademlia_time_to_good(struct bench_kademlia_swarm* swarm, struct Libp2pVector* bootstrap) {
+	struct sockaddr_in addr;
+	struct kademlia_search* search = NULL;
+	unsigned char hash[20];
+	int good = 0, server;
+	uint64_t start, elapsed = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server = socket(AF_INET, SOCK_DGRAM, 0);
+	if (server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		if (server >= 0)
+			close(server);
+		return 0;
+	}
+
+	start = bench_now_ns();
+	if (start_kademlia(server, AF_INET, "QmBenchKademliaWarmStartNode", 1, bootstrap) != 0) {
+		close(server);
+		return 0;
+	}
+	dht_debug = NULL;
+	while (bench_now_ns() - start < BENCH_KADEMLIA_BOOT_LIMIT * 1000000000ULL) {
+		bench_kademlia_swarm_answer(swarm);
+		// read without a lock, only good enough for a benchmark
+		dht_nodes(AF_INET, &good, NULL, NULL, NULL);
+		if (good >= BENCH_KADEMLIA_GOOD) {
+			elapsed = bench_now_ns() - start;
+			break;
+		}
+		if (good > 0 && (search == NULL || search_kademlia_wait(search, 0))) {
+			search_kademlia_free(search);
+			for(int i = 0; i < 20; i++)
+				hash[i] = random() & 0xFF;
+			search = search_kademlia_start(hash, 0);
+		}
+	}
+	search_kademlia_free(search);
+	stop_kademlia();
+	return elapsed;
+}
+
+/***
+ * Measure how long a node takes to be routable, with BENCH_KADEMLIA_GOOD
+ * good nodes, when bootstrapping from a single node of a simulated swarm,
+ * then again when warm-started from the snapshot the first run saved.
+ */
+int bench_kademlia_warm_start() {
+	int retVal = 0;
+	struct bench_kademlia_swarm swarm;
+	struct Libp2pVector* bootstrap = NULL;
+	struct MultiAddress* ma = NULL;
+	char path[64], str[64];
+
+	snprintf(path, sizeof(path), "/tmp/bench_kademlia_%d.snapshot", (int)getpid());
+	unlink(path);
+
+	if (!bench_kademlia_swarm_open(&swarm))
+		goto exit;
+	bootstrap = libp2p_utils_vector_new(1);
+	snprintf(str, sizeof(str), "/ip4/127.0.0.1/udp/%d", ntohs(swarm.addrs[0].sin_port));
+	ma = multiaddress_new_from_string(str);
+	if (bootstrap == NULL || ma == NULL)
+		goto exit;
+	libp2p_utils_vector_add(bootstrap, ma);
+
+	dht_testing = 1;
+	kademlia_snapshot_file(path);
+
+	uint64_t cold = bench_kademlia_time_to_good(&swarm, bootstrap);
+	uint64_t warm = bench_kademlia_time_to_good(&swarm, bootstrap);
+
+	if (cold)
+		printf("  %-40s %12.1f ms\n", "bootstrap from one node", cold / 1000000.0);
+	else
+		printf("  %-40s %12s\n", "bootstrap from one node", "> limit");
+	if (warm)
+		printf("  %-40s %12.1f ms\n", "warm start from snapshot", warm / 1000000.0);
+	else
+		printf("  %-40s %12s\n", "warm start from snapshot", "> limit");
+
+	retVal = warm > 0;
+	exit:
+	kademlia_snapshot_file(NULL);
+	unlink(path);
+	dht_testing = 0;
+	bench_kademlia_swarm_close(&swarm);
+	if (bootstrap != NULL)
+		libp2p_utils_vector_free(bootstrap);
+	if (ma != NULL)
+		multiaddress_free(ma);
+	return retVal;
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_helper.h"
+#include "libp2p/record/message.h"
+#include "libp2p/record/message_view.h"
+#include "libp2p/utils/linked_list.h"
+#include "multiaddr/multiaddr.h"
+
+#define BENCH_MESSAGE_PEERS 20
+#define BENCH_MESSAGE_DECODES 100000
+
+/***
+ * A FIND_NODE reply as a node sends it: a key and 20 closer peers, each
+ * with 2 addresses
+ * @param buffer where to put the protobuf
+ * @param buffer_size the size of the protobuf
+ * @returns true(1) on success, otherwise false(0)
+ */
+int bench_message_find_node(unsigned char** buffer, size_t* buffer_size) {
+	struct Libp2pMessage* message = libp2p_message_new();
+	struct Libp2pLinkedList* last = NULL;
+	char str[128];
+
+	if (message == NULL)
+		return 0;
+	message->message_type = MESSAGE_TYPE_FIND_NODE;
+	message->key = strdup("QmW8CYQuoJhgfxTeNVFWktGFnTRzdUAimerSsHaE4rUXk8");
+	message->key_size = strlen(message->key);
+	for(int i = 0; i < BENCH_MESSAGE_PEERS; i++) {
+		struct Libp2pPeer* peer = libp2p_peer_new();
+		sprintf(str, "QmYjtig7VJQ6XsnUjqqJvj7QaMcCAwtrgNdahSiFofrE%02d", i);
+		peer->id = strdup(str);
+		peer->id_size = strlen(str);
+		peer->connection_type = CONNECTION_TYPE_CAN_CONNECT;
+		peer->addr_head = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/10.0.0.%d/tcp/4001", i);
+		peer->addr_head->item = multiaddress_new_from_string(str);
+		peer->addr_head->next = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/127.0.0.1/tcp/%d", 4001 + i);
+		peer->addr_head->next->item = multiaddress_new_from_string(str);
+		struct Libp2pLinkedList* item = libp2p_utils_linked_list_new();
+		item->item = peer;
+		if (last == NULL)
+			message->closer_peer_head = item;
+		else
+			last->next = item;
+		last = item;
+	}
+	int retVal = libp2p_message_protobuf_allocate_and_encode(message, buffer, buffer_size);
+	libp2p_message_free(message);
+	return retVal;
+}
+
+/***
+ * Decode a FIND_NODE reply into structs, and into a view
+ */
+int bench_message_decode() {
+	unsigned char* buffer = NULL;
+	size_t buffer_size = 0;
+	struct Libp2pMessage* message = NULL;
+	struct Libp2pMessageView view;
+	struct Libp2pPeerView peer_view;
+	int peers = 0;
+
+	if (!bench_message_find_node(&buffer, &buffer_size))
+		return 0;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < BENCH_MESSAGE_DECODES; i++) {
+		if (!libp2p_message_protobuf_decode(buffer, buffer_size, &message))
+			goto exit;
+		libp2p_message_free(message);
+	}
+	bench_report_throughput("protobuf_decode", BENCH_MESSAGE_DECODES, (uint64_t)BENCH_MESSAGE_DECODES * buffer_size, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_MESSAGE_DECODES; i++) {
+		if (!libp2p_message_view_decode(buffer, buffer_size, &view))
+			goto exit;
+	}
+	bench_report_throughput("view_decode", BENCH_MESSAGE_DECODES, (uint64_t)BENCH_MESSAGE_DECODES * buffer_size, bench_now_ns() - start);
+
+	// what a handler does that needs every peer id, but no address
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_MESSAGE_DECODES; i++) {
+		size_t pos = 0;
+		if (!libp2p_message_view_decode(buffer, buffer_size, &view))
+			goto exit;
+		while (libp2p_message_view_next_peer(&view, MESSAGE_VIEW_CLOSER_PEERS, &pos, &peer_view))
+			peers++;
+	}
+	bench_report_throughput("view_decode and walk peers", BENCH_MESSAGE_DECODES, (uint64_t)BENCH_MESSAGE_DECODES * buffer_size, bench_now_ns() - start);
+	printf("  %-40s %12lu bytes, %d peers\n", "message", (unsigned long)buffer_size, view.closer_peer_count);
+
+	exit:
+	free(buffer);
+	return peers == BENCH_MESSAGE_DECODES * BENCH_MESSAGE_PEERS;
+}
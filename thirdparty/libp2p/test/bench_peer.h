@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_helper.h"
+#include "libp2p/peer/peer.h"
+#include "libp2p/peer/peerstore.h"
+#include "libp2p/utils/linked_list.h"
+
+#define BENCH_PEERSTORE_PEERS 100000
+#define BENCH_PEERSTORE_LIST_PEERS 10000
+#define BENCH_PEERSTORE_ID_SIZE 46
+
+/***
+ * Make peers with random ids of the length of a base58 peer id
+ * @param count how many
+ * @returns the peers, or NULL on error
+ */
+struct Libp2pPeer** bench_peerstore_peers(int count) {
+	struct Libp2pPeer** peers = (struct Libp2pPeer**)calloc(count, sizeof(struct Libp2pPeer*));
+	if (peers == NULL)
+		return NULL;
+	for(int i = 0; i < count; i++) {
+		peers[i] = libp2p_peer_new();
+		peers[i]->id_size = BENCH_PEERSTORE_ID_SIZE;
+		peers[i]->id = malloc(BENCH_PEERSTORE_ID_SIZE);
+		memcpy(peers[i]->id, "Qm", 2);
+		for(int j = 2; j < BENCH_PEERSTORE_ID_SIZE; j++)
+			peers[i]->id[j] = 'A' + random() % 26;
+	}
+	return peers;
+}
+
+void bench_peerstore_peers_free(struct Libp2pPeer** peers, int count) {
+	if (peers == NULL)
+		return;
+	for(int i = 0; i < count; i++)
+		libp2p_peer_free(peers[i]);
+	free(peers);
+}
+
+/***
+ * The peerstore as it was: a list that is walked for every add and lookup
+ */
+int bench_peerstore_list(struct Libp2pPeer** peers, int count) {
+	struct Libp2pLinkedList* head = NULL;
+	struct Libp2pLinkedList* last = NULL;
+	int found = 0;
+
+	uint64_t start = bench_now_ns();
+	for(int i = 0; i < count; i++) {
+		struct Libp2pLinkedList* current = head;
+		while (current != NULL) {
+			struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
+			if (peer->id_size == peers[i]->id_size && memcmp(peer->id, peers[i]->id, peer->id_size) == 0)
+				break;
+			current = current->next;
+		}
+		if (current != NULL)
+			continue;
+		struct Libp2pLinkedList* item = libp2p_utils_linked_list_new();
+		item->item = libp2p_peer_copy(peers[i]);
+		if (head == NULL)
+			head = item;
+		else
+			last->next = item;
+		last = item;
+	}
+	bench_report_rate("list add", count, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < count; i++) {
+		struct Libp2pLinkedList* current = head;
+		while (current != NULL) {
+			struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
+			if (peer->id_size == peers[i]->id_size && memcmp(peer->id, peers[i]->id, peer->id_size) == 0) {
+				found++;
+				break;
+			}
+			current = current->next;
+		}
+	}
+	bench_report_rate("list lookup", count, bench_now_ns() - start);
+
+	while (head != NULL) {
+		struct Libp2pLinkedList* next = head->next;
+		libp2p_peer_free((struct Libp2pPeer*)head->item);
+		head->item = NULL;
+		head->next = NULL;
+		libp2p_utils_linked_list_free(head);
+		head = next;
+	}
+	return found == count;
+}
+
+/***
+ * Add BENCH_PEERSTORE_PEERS peers to a peerstore, then look each one up,
+ * then add them all again. The old list is run with fewer peers, as it
+ * is quadratic.
+ */
+int bench_peerstore_add_lookup() {
+	int retVal = 0;
+	struct Peerstore* peerstore = NULL;
+	struct Libp2pPeer** peers = bench_peerstore_peers(BENCH_PEERSTORE_PEERS);
+	int found = 0;
+	uint64_t start;
+
+	if (peers == NULL)
+		goto exit;
+
+	for(int count = BENCH_PEERSTORE_LIST_PEERS; count <= BENCH_PEERSTORE_PEERS; count *= 10) {
+		char label[64];
+		peerstore = libp2p_peerstore_new("QmLocal");
+		if (peerstore == NULL)
+			goto exit;
+
+		start = bench_now_ns();
+		for(int i = 0; i < count; i++) {
+			if (!libp2p_peerstore_add_peer(peerstore, peers[i]))
+				goto exit;
+		}
+		snprintf(label, sizeof(label), "peerstore add (%d peers)", count);
+		bench_report_rate(label, count, bench_now_ns() - start);
+
+		found = 0;
+		start = bench_now_ns();
+		for(int i = 0; i < count; i++)
+			found += libp2p_peerstore_get_peer(peerstore, (unsigned char*)peers[i]->id, peers[i]->id_size) != NULL;
+		snprintf(label, sizeof(label), "peerstore lookup (%d peers)", count);
+		bench_report_rate(label, count, bench_now_ns() - start);
+		if (found != count)
+			goto exit;
+
+		start = bench_now_ns();
+		for(int i = 0; i < count; i++) {
+			if (libp2p_peerstore_get_or_add_peer(peerstore, peers[i]) == NULL)
+				goto exit;
+		}
+		snprintf(label, sizeof(label), "peerstore get_or_add (%d known)", count);
+		bench_report_rate(label, count, bench_now_ns() - start);
+
+		libp2p_peerstore_free(peerstore);
+		peerstore = NULL;
+	}
+
+	if (!bench_peerstore_list(peers, BENCH_PEERSTORE_LIST_PEERS))
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_peerstore_free(peerstore);
+	bench_peerstore_peers_free(peers, BENCH_PEERSTORE_PEERS);
+	return retVal;
+}
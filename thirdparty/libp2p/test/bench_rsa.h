@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "bench_helper.h"
+#include "libp2p/crypto/rsa.h"
+
+#define BENCH_RSA_SIGNATURES 100
+#define BENCH_RSA_BATCH 10
+
+/***
+ * Sign with a 2048 bit key by parsing its DER and seeding a generator for
+ * each signature, then through a signer, one by one and in batches
+ */
+int bench_crypto_rsa_sign() {
+	int retVal = 0;
+	struct RsaPrivateKey* private_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct RsaSigner* signer = NULL;
+	unsigned char* results[BENCH_RSA_BATCH];
+	size_t result_sizes[BENCH_RSA_BATCH];
+	const char* messages[BENCH_RSA_BATCH];
+	size_t message_lengths[BENCH_RSA_BATCH];
+	const char* message = "a put record of a reasonable size to be signed by the node";
+	uint64_t start;
+
+	if (private_key == NULL || !libp2p_crypto_rsa_generate_keypair(private_key, 2048))
+		goto exit;
+	signer = libp2p_crypto_rsa_signer_new(private_key);
+	if (signer == NULL)
+		goto exit;
+	for(int i = 0; i < BENCH_RSA_BATCH; i++) {
+		messages[i] = message;
+		message_lengths[i] = strlen(message);
+	}
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_RSA_SIGNATURES; i++) {
+		if (!libp2p_crypto_rsa_sign(private_key, message, message_lengths[0], &results[0], &result_sizes[0]))
+			goto exit;
+		free(results[0]);
+	}
+	bench_report_rate("sign, parsing the key each time", BENCH_RSA_SIGNATURES, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_RSA_SIGNATURES; i++) {
+		if (!libp2p_crypto_rsa_signer_sign(signer, message, message_lengths[0], &results[0], &result_sizes[0]))
+			goto exit;
+		free(results[0]);
+	}
+	bench_report_rate("sign with a signer", BENCH_RSA_SIGNATURES, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_RSA_SIGNATURES; i += BENCH_RSA_BATCH) {
+		if (!libp2p_crypto_rsa_signer_sign_batch(signer, BENCH_RSA_BATCH, messages, message_lengths, results, result_sizes))
+			goto exit;
+		for(int j = 0; j < BENCH_RSA_BATCH; j++)
+			free(results[j]);
+	}
+	bench_report_rate("sign with a signer, in batches", BENCH_RSA_SIGNATURES, bench_now_ns() - start);
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_rsa_signer_free(signer);
+	libp2p_crypto_rsa_rsa_private_key_free(private_key);
+	return retVal;
+}
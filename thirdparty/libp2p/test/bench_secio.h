@@ -0,0 +1,539 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "bench_helper.h"
+#include "secio_helper.h"
+#include "libp2p/secio/secio.h"
+#include "libp2p/crypto/ephemeral.h"
+#include "libp2p/crypto/ephemeral_pool.h"
+#include "libp2p/crypto/rsa.h"
+#include "libp2p/net/multistream.h"
+#include "libp2p/net/p2pnet.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/cipher.h"
+#include "mbedtls/md.h"
+#include "mbedtls/md_internal.h"
+
+#define BENCH_SECIO_BYTES (64 * 1024 * 1024)
+
+/***
+ * The way libp2p_secio_encrypt used to work, keying a cipher and a mac and
+ * allocating twice for every message, to compare against
+ */
+int bench_secio_legacy_encrypt(const struct StretchedKey* key, const unsigned char* incoming, size_t incoming_size, unsigned char** outgoing, size_t* outgoing_size) {
+	unsigned char* buffer = NULL;
+	size_t buffer_size = incoming_size + 32;
+
+	mbedtls_cipher_context_t cipher_ctx;
+	mbedtls_cipher_init(&cipher_ctx);
+	mbedtls_cipher_setup(&cipher_ctx, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_256_CTR));
+	mbedtls_cipher_setkey(&cipher_ctx, key->cipher_key, key->cipher_size * 8, MBEDTLS_ENCRYPT);
+	buffer = malloc(buffer_size);
+	memset(buffer, 0, buffer_size);
+	mbedtls_cipher_crypt(&cipher_ctx, key->iv, key->iv_size, incoming, incoming_size, buffer, &buffer_size);
+	mbedtls_cipher_free(&cipher_ctx);
+
+	mbedtls_md_context_t ctx;
+	mbedtls_md_init(&ctx);
+	mbedtls_md_setup(&ctx, &mbedtls_sha256_info, 1);
+	mbedtls_md_hmac_starts(&ctx, key->mac_key, key->mac_size);
+	mbedtls_md_hmac_update(&ctx, buffer, buffer_size);
+	mbedtls_md_hmac_finish(&ctx, &buffer[buffer_size]);
+	mbedtls_md_free(&ctx);
+
+	*outgoing_size = incoming_size + 32;
+	*outgoing = malloc(*outgoing_size);
+	memset(*outgoing, 0, *outgoing_size);
+	memcpy(*outgoing, buffer, *outgoing_size);
+	free(buffer);
+	return 1;
+}
+
+/***
+ * Encrypt then decrypt messages of 64 bytes up to 1MB through the kept
+ * cipher contexts of a session, and through the old per message setup
+ */
+int bench_secio_throughput() {
+	static const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024 };
+	int retVal = 0;
+	struct SessionContext session = {0};
+	struct StretchedKey key;
+	unsigned char* frame = NULL;
+	unsigned char* plain = NULL;
+	char label[64];
+
+	key.cipher_key = (unsigned char*)"abcdefghijklmnopqrstuvwxyzabcdef";
+	key.cipher_size = 32;
+	key.mac_key = (unsigned char*)"abcdefghijklmnopqrstuvwxyzabcdef";
+	key.mac_size = 32;
+	key.iv = (unsigned char*)"abcdefghijklmnop";
+	key.iv_size = 16;
+	session.local_stretched_key = &key;
+	session.remote_stretched_key = &key;
+	if (!libp2p_secio_start_ciphers(&session))
+		goto exit;
+
+	frame = malloc(SECIO_FRAME_HEADER_SIZE + sizes[4] + SECIO_MAC_SIZE);
+	plain = malloc(sizes[4]);
+	if (frame == NULL || plain == NULL)
+		goto exit;
+	for(size_t i = 0; i < sizes[4]; i++)
+		plain[i] = random() & 0xFF;
+
+	for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t size = sizes[s];
+		uint64_t count = BENCH_SECIO_BYTES / size;
+		uint64_t encrypt_ns = 0, decrypt_ns = 0, legacy_ns = 0, start;
+
+		for(uint64_t i = 0; i < count; i++) {
+			memcpy(&frame[SECIO_FRAME_HEADER_SIZE], plain, size);
+			start = bench_now_ns();
+			size_t frame_size = libp2p_secio_encrypt_frame(&session, frame, size);
+			encrypt_ns += bench_now_ns() - start;
+			if (frame_size != SECIO_FRAME_HEADER_SIZE + size + SECIO_MAC_SIZE)
+				goto exit;
+			start = bench_now_ns();
+			int data_size = libp2p_secio_decrypt_in_place(&session, &frame[SECIO_FRAME_HEADER_SIZE], size + SECIO_MAC_SIZE);
+			decrypt_ns += bench_now_ns() - start;
+			if (data_size != size || memcmp(&frame[SECIO_FRAME_HEADER_SIZE], plain, size) != 0)
+				goto exit;
+		}
+
+		start = bench_now_ns();
+		for(uint64_t i = 0; i < count; i++) {
+			unsigned char* out = NULL;
+			size_t out_size = 0;
+			bench_secio_legacy_encrypt(&key, plain, size, &out, &out_size);
+			free(out);
+		}
+		legacy_ns = bench_now_ns() - start;
+
+		snprintf(label, sizeof(label), "encrypt %zu bytes", size);
+		bench_report_throughput(label, count, count * size, encrypt_ns);
+		snprintf(label, sizeof(label), "decrypt %zu bytes", size);
+		bench_report_throughput(label, count, count * size, decrypt_ns);
+		snprintf(label, sizeof(label), "encrypt %zu bytes (per message setup)", size);
+		bench_report_throughput(label, count, count * size, legacy_ns);
+	}
+
+	retVal = 1;
+	exit:
+	libp2p_secio_stop_ciphers(&session);
+	if (frame != NULL)
+		free(frame);
+	if (plain != NULL)
+		free(plain);
+	return retVal;
+}
+
+#define BENCH_SECIO_HANDSHAKES 50
+#define BENCH_SECIO_KEYPAIRS 200
+
+/***
+ * The way libp2p_crypto_ephemeral_keypair_generate used to work, seeding a
+ * generator and loading the group (so working out its comb table) every time
+ */
+int bench_secio_legacy_keypair(mbedtls_ecp_group_id id) {
+	int retVal = 0;
+	mbedtls_ecdh_context ctx;
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ctr_drbg;
+	unsigned char bytes[66];
+	size_t bytes_size = sizeof(bytes);
+	char* pers = "bitShares";
+
+	mbedtls_ecdh_init(&ctx);
+	mbedtls_entropy_init(&entropy);
+	mbedtls_ctr_drbg_init(&ctr_drbg);
+	if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)pers, strlen(pers)) == 0
+			&& mbedtls_ecp_group_load(&ctx.grp, id) == 0
+			&& mbedtls_ecdh_make_public(&ctx, &bytes_size, bytes, bytes_size, mbedtls_ctr_drbg_random, &ctr_drbg) == 0)
+		retVal = 1;
+	mbedtls_ctr_drbg_free(&ctr_drbg);
+	mbedtls_entropy_free(&entropy);
+	mbedtls_ecdh_free(&ctx);
+	return retVal;
+}
+
+struct BenchSecioListener {
+	int socket_fd;
+	struct RsaPrivateKey* private_key;
+	int optimistic;
+	int connections;
+	int handshakes;
+};
+
+/***
+ * Handshake on a connection, then have the listener say hello and the
+ * dialer answer, so that each side reads what the other wrote before the
+ * connection is closed
+ * @param session the session, with its insecure stream
+ * @param private_key the local key
+ * @param remote_requested true(1) on the listener side
+ * @param optimistic true(1) for libp2p_secio_handshake_optimistic
+ * @param first_byte_ns if not NULL, when the dialer had the hello
+ * @returns true(1) on success, false(0) otherwise
+ */
+int bench_secio_converse(struct SessionContext* session, struct RsaPrivateKey* private_key, int remote_requested, int optimistic, uint64_t* first_byte_ns) {
+	int retVal = 0;
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+
+	if (optimistic) {
+		if (!libp2p_secio_handshake_optimistic(session, private_key, remote_requested))
+			return 0;
+	} else if (!libp2p_secio_handshake(session, private_key, remote_requested)) {
+		return 0;
+	}
+	if (remote_requested) {
+		if (session->default_stream->write(session, (unsigned char*)"hello", 5) <= 0
+				|| session->default_stream->read(session, &results, &results_size, 5) != 4)
+			goto exit;
+	} else {
+		if (session->default_stream->read(session, &results, &results_size, 5) != 5)
+			goto exit;
+		if (first_byte_ns != NULL)
+			*first_byte_ns = bench_now_ns();
+		if (session->default_stream->write(session, (unsigned char*)"ping", 4) <= 0)
+			goto exit;
+	}
+	retVal = 1;
+	exit:
+	if (results != NULL)
+		free(results);
+	return retVal;
+}
+
+/***
+ * Accept connections and answer their handshakes, as a node does when
+ * asked for /secio/1.0.0
+ */
+void* bench_secio_handshake_listener(void* arg) {
+	struct BenchSecioListener* listener = (struct BenchSecioListener*)arg;
+	uint32_t ip;
+	uint16_t port;
+
+	for(int i = 0; i < listener->connections; i++) {
+		struct SessionContext session = {0};
+		unsigned char* results = NULL;
+		size_t results_size = 0;
+		int fd = socket_accept4(listener->socket_fd, &ip, &port);
+		if (fd < 0)
+			break;
+		session.insecure_stream = libp2p_net_multistream_stream_new(fd, "127.0.0.1", port);
+		if (session.insecure_stream == NULL) {
+			close(fd);
+			break;
+		}
+		if (libp2p_net_multistream_read(&session, &results, &results_size, 5) > 0
+				&& bench_secio_converse(&session, listener->private_key, 1, listener->optimistic, NULL))
+			listener->handshakes++;
+		if (results != NULL)
+			free(results);
+		secio_helper_session_clear(&session);
+	}
+	return NULL;
+}
+
+/***
+ * Start a listener on loopback
+ * @param listener the listener, with its key, mode and number of connections
+ * @param ip where to put the address
+ * @param port where to put the port
+ * @param thread where to put the thread
+ * @returns true(1) on success, false(0) otherwise
+ */
+int bench_secio_listener_start(struct BenchSecioListener* listener, uint32_t* ip, uint16_t* port, pthread_t* thread) {
+	*ip = htonl(INADDR_LOOPBACK);
+	*port = 0;
+	listener->handshakes = 0;
+	listener->socket_fd = socket_listen(socket_tcp4(), ip, port);
+	if (listener->socket_fd < 0)
+		return 0;
+	if (pthread_create(thread, NULL, bench_secio_handshake_listener, listener) != 0) {
+		close(listener->socket_fd);
+		listener->socket_fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+void bench_secio_listener_stop(struct BenchSecioListener* listener, pthread_t thread) {
+	shutdown(listener->socket_fd, SHUT_RDWR);
+	pthread_join(thread, NULL);
+	close(listener->socket_fd);
+	listener->socket_fd = -1;
+}
+
+/***
+ * Connect to a listener and converse with it
+ * @param ip the address
+ * @param port the port
+ * @param private_key the local key
+ * @param optimistic true(1) for libp2p_secio_handshake_optimistic
+ * @param elapsed_ns if not NULL, the time from connecting to having the first encrypted bytes
+ * @returns true(1) on success, false(0) otherwise
+ */
+int bench_secio_dial(uint32_t ip, uint16_t port, struct RsaPrivateKey* private_key, int optimistic, uint64_t* elapsed_ns) {
+	struct SessionContext session = {0};
+	uint64_t start = bench_now_ns(), first_byte = 0;
+	int fd = socket_tcp4();
+
+	if (fd < 0)
+		return 0;
+	if (socket_connect4(fd, ip, port) != 0) {
+		close(fd);
+		return 0;
+	}
+	session.insecure_stream = libp2p_net_multistream_stream_new(fd, "127.0.0.1", port);
+	if (session.insecure_stream == NULL) {
+		close(fd);
+		return 0;
+	}
+	int retVal = bench_secio_converse(&session, private_key, 0, optimistic, &first_byte);
+	secio_helper_session_clear(&session);
+	if (elapsed_ns != NULL)
+		*elapsed_ns = first_byte - start;
+	return retVal;
+}
+
+/***
+ * Make ephemeral keys with the kept curve groups and the way it used to be
+ * done, then do whole secio handshakes with a listener over loopback TCP,
+ * lock-step and optimistic
+ */
+int bench_secio_handshake() {
+	int retVal = 0;
+	struct RsaPrivateKey* listener_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct RsaPrivateKey* dialer_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct BenchSecioListener listener = { -1, listener_key, 0, BENCH_SECIO_HANDSHAKES, 0 };
+	uint32_t ip;
+	uint16_t port;
+	pthread_t thread;
+	uint64_t start;
+
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_SECIO_KEYPAIRS; i++) {
+		struct EphemeralPrivateKey* key = NULL;
+		int ok = libp2p_crypto_ephemeral_keypair_generate("P-256", &key);
+		libp2p_crypto_ephemeral_key_free(key);
+		if (!ok)
+			goto exit;
+	}
+	bench_report_rate("ephemeral P-256 keypairs", BENCH_SECIO_KEYPAIRS, bench_now_ns() - start);
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_SECIO_KEYPAIRS; i++) {
+		if (!bench_secio_legacy_keypair(MBEDTLS_ECP_DP_SECP256R1))
+			goto exit;
+	}
+	bench_report_rate("ephemeral P-256 keypairs (per call setup)", BENCH_SECIO_KEYPAIRS, bench_now_ns() - start);
+
+	if (listener_key == NULL || dialer_key == NULL
+			|| !libp2p_crypto_rsa_generate_keypair(listener_key, 2048)
+			|| !libp2p_crypto_rsa_generate_keypair(dialer_key, 2048))
+		goto exit;
+
+	for(int optimistic = 0; optimistic < 2; optimistic++) {
+		int handshakes = 0;
+		listener.optimistic = optimistic;
+		if (!bench_secio_listener_start(&listener, &ip, &port, &thread))
+			goto exit;
+		start = bench_now_ns();
+		for(int i = 0; i < BENCH_SECIO_HANDSHAKES; i++)
+			handshakes += bench_secio_dial(ip, port, dialer_key, optimistic, NULL);
+		uint64_t elapsed = bench_now_ns() - start;
+		bench_secio_listener_stop(&listener, thread);
+		bench_report_rate(optimistic ? "secio handshakes (optimistic)" : "secio handshakes",
+				handshakes, elapsed);
+		if (handshakes != BENCH_SECIO_HANDSHAKES || listener.handshakes != BENCH_SECIO_HANDSHAKES)
+			goto exit;
+	}
+
+	// again, with the ephemeral keys made ahead of time in the background
+	if (!libp2p_crypto_ephemeral_pool_start("P-256,P-384,P-521", EPHEMERAL_POOL_SIZE, EPHEMERAL_POOL_REFILL_BELOW))
+		goto exit;
+	struct EphemeralPoolStats stats;
+	do {
+		usleep(1000);
+		libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+	} while (stats.available < EPHEMERAL_POOL_SIZE);
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_SECIO_KEYPAIRS; i++) {
+		struct EphemeralPrivateKey* key = NULL;
+		int ok = libp2p_crypto_ephemeral_pool_take("P-256", &key);
+		libp2p_crypto_ephemeral_key_free(key);
+		if (!ok) {
+			libp2p_crypto_ephemeral_pool_stop();
+			goto exit;
+		}
+	}
+	bench_report_rate("ephemeral P-256 keypairs (pool, drained)", BENCH_SECIO_KEYPAIRS, bench_now_ns() - start);
+	do {
+		usleep(1000);
+		libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+	} while (stats.available < EPHEMERAL_POOL_SIZE);
+	struct EphemeralPoolStats before = stats;
+	listener.optimistic = 1;
+	if (!bench_secio_listener_start(&listener, &ip, &port, &thread)) {
+		libp2p_crypto_ephemeral_pool_stop();
+		goto exit;
+	}
+	int handshakes = 0;
+	start = bench_now_ns();
+	for(int i = 0; i < BENCH_SECIO_HANDSHAKES; i++)
+		handshakes += bench_secio_dial(ip, port, dialer_key, 1, NULL);
+	uint64_t elapsed = bench_now_ns() - start;
+	bench_secio_listener_stop(&listener, thread);
+	libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+	libp2p_crypto_ephemeral_pool_stop();
+	bench_report_rate("secio handshakes (optimistic, key pool)", handshakes, elapsed);
+	printf("  %-40s %9llu hits %6llu misses %6llu refills %9.1f us mean refill %9.1f us max\n",
+			"P-256 key pool", stats.hits - before.hits, stats.misses - before.misses, stats.refills - before.refills,
+			stats.refills == before.refills ? 0.0 : (stats.refill_ns_total - before.refill_ns_total) / 1000.0 / (stats.refills - before.refills),
+			stats.refill_ns_max / 1000.0);
+	if (handshakes != BENCH_SECIO_HANDSHAKES || listener.handshakes != BENCH_SECIO_HANDSHAKES)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_rsa_rsa_private_key_free(listener_key);
+	libp2p_crypto_rsa_rsa_private_key_free(dialer_key);
+	return retVal;
+}
+
+#define BENCH_SECIO_SETUPS 10
+#define BENCH_SECIO_ONE_WAY_MS 5
+
+struct BenchSecioRelay {
+	int from;
+	int to;
+};
+
+/***
+ * Copy what one side of a connection sends to the other, each read
+ * BENCH_SECIO_ONE_WAY_MS late
+ */
+void* bench_secio_relay(void* arg) {
+	struct BenchSecioRelay* relay = (struct BenchSecioRelay*)arg;
+	unsigned char buffer[65536];
+
+	for(;;) {
+		ssize_t bytes = read(relay->from, buffer, sizeof(buffer));
+		if (bytes <= 0)
+			break;
+		struct timespec delay = { 0, BENCH_SECIO_ONE_WAY_MS * 1000000L };
+		nanosleep(&delay, NULL);
+		for(ssize_t written = 0; written < bytes; ) {
+			ssize_t rc = write(relay->to, &buffer[written], bytes - written);
+			if (rc <= 0)
+				goto done;
+			written += rc;
+		}
+	}
+	done:
+	shutdown(relay->to, SHUT_WR);
+	return NULL;
+}
+
+struct BenchSecioProxy {
+	int socket_fd;
+	uint32_t ip;
+	uint16_t port;
+	int connections;
+};
+
+/***
+ * Accept connections and relay each to the listener, with a delay both ways
+ */
+void* bench_secio_proxy(void* arg) {
+	struct BenchSecioProxy* proxy = (struct BenchSecioProxy*)arg;
+	uint32_t ip;
+	uint16_t port;
+
+	for(int i = 0; i < proxy->connections; i++) {
+		int dialer_fd = socket_accept4(proxy->socket_fd, &ip, &port);
+		if (dialer_fd < 0)
+			break;
+		int listener_fd = socket_tcp4();
+		if (listener_fd < 0 || socket_connect4(listener_fd, proxy->ip, proxy->port) != 0) {
+			close(dialer_fd);
+			if (listener_fd >= 0)
+				close(listener_fd);
+			break;
+		}
+		struct BenchSecioRelay there = { dialer_fd, listener_fd };
+		struct BenchSecioRelay back = { listener_fd, dialer_fd };
+		pthread_t threads[2];
+		pthread_create(&threads[0], NULL, bench_secio_relay, &there);
+		pthread_create(&threads[1], NULL, bench_secio_relay, &back);
+		pthread_join(threads[0], NULL);
+		pthread_join(threads[1], NULL);
+		close(dialer_fd);
+		close(listener_fd);
+	}
+	return NULL;
+}
+
+/***
+ * Time from connecting to having the first encrypted bytes of the listener,
+ * through a proxy that adds a round trip time of 2 * BENCH_SECIO_ONE_WAY_MS,
+ * for the lock-step and the optimistic handshake
+ */
+int bench_secio_connection_setup() {
+	int retVal = 0;
+	struct RsaPrivateKey* listener_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct RsaPrivateKey* dialer_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct BenchSecioListener listener = { -1, listener_key, 0, BENCH_SECIO_SETUPS, 0 };
+	struct BenchSecioProxy proxy = { -1, 0, 0, BENCH_SECIO_SETUPS };
+	uint64_t samples[BENCH_SECIO_SETUPS];
+	pthread_t listener_thread, proxy_thread;
+	uint32_t ip;
+	uint16_t port;
+
+	if (listener_key == NULL || dialer_key == NULL
+			|| !libp2p_crypto_rsa_generate_keypair(listener_key, 2048)
+			|| !libp2p_crypto_rsa_generate_keypair(dialer_key, 2048))
+		goto exit;
+
+	for(int optimistic = 0; optimistic < 2; optimistic++) {
+		int setups = 0;
+		uint64_t total = 0;
+		listener.optimistic = optimistic;
+		if (!bench_secio_listener_start(&listener, &proxy.ip, &proxy.port, &listener_thread))
+			goto exit;
+		ip = htonl(INADDR_LOOPBACK);
+		port = 0;
+		proxy.socket_fd = socket_listen(socket_tcp4(), &ip, &port);
+		if (proxy.socket_fd < 0 || pthread_create(&proxy_thread, NULL, bench_secio_proxy, &proxy) != 0) {
+			bench_secio_listener_stop(&listener, listener_thread);
+			goto exit;
+		}
+		for(int i = 0; i < BENCH_SECIO_SETUPS; i++) {
+			if (!bench_secio_dial(ip, port, dialer_key, optimistic, &samples[setups]))
+				break;
+			total += samples[setups++];
+		}
+		shutdown(proxy.socket_fd, SHUT_RDWR);
+		pthread_join(proxy_thread, NULL);
+		close(proxy.socket_fd);
+		bench_secio_listener_stop(&listener, listener_thread);
+		if (setups != BENCH_SECIO_SETUPS)
+			goto exit;
+		printf("  %-40s %9.1f ms mean %9.1f ms p50 (rtt %d ms)\n",
+				optimistic ? "first encrypted byte (optimistic)" : "first encrypted byte",
+				total / 1e6 / setups, bench_percentile(samples, setups, 50) / 1e6, 2 * BENCH_SECIO_ONE_WAY_MS);
+	}
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_rsa_rsa_private_key_free(listener_key);
+	libp2p_crypto_rsa_rsa_private_key_free(dialer_key);
+	return retVal;
+}
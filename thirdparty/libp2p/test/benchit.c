@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_kademlia.h"
+#include "bench_dht.h"
+#include "bench_secio.h"
+#include "bench_rsa.h"
+#include "bench_peer.h"
+#include "bench_hashmap.h"
+#include "bench_message.h"
+#include "bench_dht_protocol.h"
+#include "libp2p/utils/logger.h"
+
+/***
+ * Benchmarks are kept out of testit, as they take a while and their
+ * output is numbers rather than pass/fail. Run them all, or just one
+ * by passing its name.
+ */
+
+const char* names[] = {
+		"bench_kademlia_krpc_mix",
+		"bench_kademlia_concurrent_search",
+		"bench_kademlia_warm_start",
+		"bench_dht_routing_table",
+		"bench_dht_storage",
+		"bench_dht_parse_message",
+		"bench_secio_throughput",
+		"bench_secio_handshake",
+		"bench_secio_connection_setup",
+		"bench_crypto_rsa_sign",
+		"bench_peerstore_add_lookup",
+		"bench_hashmap",
+		"bench_message_decode",
+		"bench_dht_protocol_handlers"
+};
+
+int (*funcs[])(void) = {
+		bench_kademlia_krpc_mix,
+		bench_kademlia_concurrent_search,
+		bench_kademlia_warm_start,
+		bench_dht_routing_table,
+		bench_dht_storage,
+		bench_dht_parse_message,
+		bench_secio_throughput,
+		bench_secio_handshake,
+		bench_secio_connection_setup,
+		bench_crypto_rsa_sign,
+		bench_peerstore_add_lookup,
+		bench_hashmap,
+		bench_message_decode,
+		bench_dht_protocol_handlers
+};
+
+int benchit(const char* name, int (*func)(void)) {
+	printf("Running %s...\n", name);
+	int retVal = func();
+	if (!retVal)
+		printf("** Uh oh! %s failed.**\n", name);
+	return retVal;
+}
+
+int main(int argc, char** argv) {
+	int counter = 0;
+	int benches_ran = 0;
+	char* bench_wanted = NULL;
+	if(argc > 1) {
+		if (argv[1][0] == '\'') { // some shells put quotes around arguments
+			argv[1][strlen(argv[1])-1] = 0;
+			bench_wanted = &(argv[1][1]);
+		}
+		else
+			bench_wanted = argv[1];
+	}
+	int array_length = sizeof(funcs) / sizeof(funcs[0]);
+	int array2_length = sizeof(names) / sizeof(names[0]);
+	if (array_length != array2_length) {
+		printf("Benchmark arrays are not of the same length. Funcs: %d, Names: %d\n", array_length, array2_length);
+	}
+	for (int i = 0; i < array_length; i++) {
+		if (bench_wanted != NULL && strcmp(names[i], bench_wanted) != 0)
+			continue;
+		benches_ran++;
+		counter += benchit(names[i], funcs[i]);
+	}
+
+	if (benches_ran == 0)
+		printf("***** No benchmarks found *****\n");
+	else if (benches_ran - counter > 0)
+		printf("***** There were %d failed benchmark(s) *****\n", benches_ran - counter);
+	libp2p_logger_free();
+	return benches_ran - counter;
+}
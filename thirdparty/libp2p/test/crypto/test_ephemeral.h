@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "libp2p/crypto/ephemeral.h"
+#include "libp2p/crypto/ephemeral_pool.h"
 /**
  * Try to generate an ephemeral private key
  */
@@ -85,3 +87,60 @@ int test_ephemeral_key_sign() {
 		libp2p_crypto_private_key_free(r_private_key);
 	return retVal;
 }
+
+/**
+ * Take keys from a pool filled in the background
+ */
+int test_ephemeral_pool() {
+	int retVal = 0;
+	struct EphemeralPrivateKey* keys[3] = { NULL, NULL, NULL };
+	struct EphemeralPoolStats stats;
+
+	if (!libp2p_crypto_ephemeral_pool_start("P-256", 4, 2))
+		goto exit;
+
+	// wait for the first fill
+	for(int i = 0; i < 10; i++) {
+		libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+		if (stats.available == 4)
+			break;
+		sleep(1);
+	}
+	if (stats.available != 4 || stats.refills != 1)
+		goto exit;
+
+	// these come from the pool
+	for(int i = 0; i < 2; i++) {
+		if (!libp2p_crypto_ephemeral_pool_take("P-256", &keys[i]))
+			goto exit;
+		if (keys[i] == NULL || keys[i]->public_key->bytes_size == 0)
+			goto exit;
+	}
+	libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+	if (stats.hits != 2 || stats.misses != 0)
+		goto exit;
+
+	// this curve is not pooled, so the key is made on the spot
+	if (!libp2p_crypto_ephemeral_pool_take("P-384", &keys[2]) || keys[2] == NULL)
+		goto exit;
+
+	// one more below the mark starts a refill
+	libp2p_crypto_ephemeral_key_free(keys[0]);
+	if (!libp2p_crypto_ephemeral_pool_take("P-256", &keys[0]))
+		goto exit;
+	for(int i = 0; i < 10; i++) {
+		libp2p_crypto_ephemeral_pool_stats("P-256", &stats);
+		if (stats.refills == 2)
+			break;
+		sleep(1);
+	}
+	if (stats.refills != 2 || stats.available != 4 || stats.refill_ns_max == 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_ephemeral_pool_stop();
+	for(int i = 0; i < 3; i++)
+		libp2p_crypto_ephemeral_key_free(keys[i]);
+	return retVal;
+}
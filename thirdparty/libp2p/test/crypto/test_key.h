@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <pthread.h>
 
 #include "libp2p/crypto/key.h"
+#include "libp2p/crypto/key_cache.h"
+#include "libp2p/crypto/rsa.h"
 
 
 int test_protobuf_private_key() {
@@ -67,3 +70,190 @@ int test_protobuf_private_key() {
 		free(final_id);
 	return retVal;
 }
+
+/***
+ * The peer id and the parsed key of a public key come from the key cache
+ * the second time, and a key pushed out of the cache comes back the same
+ */
+int test_crypto_key_cache() {
+	int retVal = 0;
+	struct RsaPrivateKey* private_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct PublicKey public_key;
+	struct RsaPublicKey rsa_public_key;
+	struct KeyCacheStats stats;
+	char* first_id = NULL;
+	char* second_id = NULL;
+	char* other_id = NULL;
+	unsigned char* signature = NULL;
+	size_t signature_size = 0;
+	unsigned char other_data[32];
+
+	libp2p_crypto_key_cache_clear();
+	if (private_key == NULL || !libp2p_crypto_rsa_generate_keypair(private_key, 1024))
+		goto exit;
+	public_key.type = KEYTYPE_RSA;
+	public_key.data = (unsigned char*)private_key->public_key_der;
+	public_key.data_size = private_key->public_key_length;
+
+	if (!libp2p_crypto_public_key_to_peer_id(&public_key, &first_id))
+		goto exit;
+	if (!libp2p_crypto_public_key_to_peer_id(&public_key, &second_id))
+		goto exit;
+	if (strcmp(first_id, second_id) != 0)
+		goto exit;
+	libp2p_crypto_key_cache_stats(&stats);
+	if (stats.misses != 1 || stats.hits != 1 || stats.entries != 1)
+		goto exit;
+
+	// verifying uses the key parsed the first time
+	if (!libp2p_crypto_rsa_sign(private_key, "a message", 9, &signature, &signature_size))
+		goto exit;
+	rsa_public_key.der = private_key->public_key_der;
+	rsa_public_key.der_length = private_key->public_key_length;
+	if (!libp2p_crypto_rsa_verify(&rsa_public_key, (unsigned char*)"a message", 9, signature))
+		goto exit;
+	if (libp2p_crypto_rsa_verify(&rsa_public_key, (unsigned char*)"a massage", 9, signature))
+		goto exit;
+	libp2p_crypto_key_cache_stats(&stats);
+	if (stats.misses != 1 || stats.hits != 3)
+		goto exit;
+
+	// fill the cache with other keys, the RSA key is the oldest and goes
+	memset(other_data, 0, 32);
+	for(int i = 0; i < KEY_CACHE_SIZE; i++) {
+		struct PublicKey other_key;
+		other_key.type = KEYTYPE_ED25519;
+		other_key.data = other_data;
+		other_key.data_size = 32;
+		memcpy(other_data, &i, sizeof(int));
+		if (!libp2p_crypto_public_key_to_peer_id(&other_key, &other_id))
+			goto exit;
+		free(other_id);
+		other_id = NULL;
+	}
+	libp2p_crypto_key_cache_stats(&stats);
+	if (stats.evictions != 1 || stats.entries != KEY_CACHE_SIZE)
+		goto exit;
+	free(second_id);
+	second_id = NULL;
+	if (!libp2p_crypto_public_key_to_peer_id(&public_key, &second_id))
+		goto exit;
+	if (strcmp(first_id, second_id) != 0)
+		goto exit;
+	libp2p_crypto_key_cache_stats(&stats);
+	if (stats.misses != 2 + KEY_CACHE_SIZE)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_key_cache_clear();
+	if (first_id != NULL)
+		free(first_id);
+	if (second_id != NULL)
+		free(second_id);
+	if (other_id != NULL)
+		free(other_id);
+	if (signature != NULL)
+		free(signature);
+	libp2p_crypto_rsa_rsa_private_key_free(private_key);
+	return retVal;
+}
+
+#define TEST_KEY_CACHE_THREADS 4
+#define TEST_KEY_CACHE_ROUNDS 200
+
+struct TestKeyCacheThread {
+	struct RsaPublicKey* keys[2];
+	unsigned char* signatures[2];
+	// the other keys this thread puts in the cache, to push entries out
+	int first_other;
+	int ok;
+};
+
+/***
+ * Verify good and bad signatures of two keys, while filling the cache with
+ * other keys so that entries are pushed out as they are verified with
+ */
+void* test_crypto_key_cache_thread(void* arg) {
+	struct TestKeyCacheThread* thread = (struct TestKeyCacheThread*)arg;
+	unsigned char other_data[32];
+	char* other_id = NULL;
+
+	thread->ok = 1;
+	memset(other_data, 0, 32);
+	for(int i = 0; i < TEST_KEY_CACHE_ROUNDS; i++) {
+		int k = i & 1;
+		if (!libp2p_crypto_rsa_verify(thread->keys[k], (unsigned char*)"a message", 9, thread->signatures[k])
+				|| libp2p_crypto_rsa_verify(thread->keys[k], (unsigned char*)"a message", 9, thread->signatures[!k]))
+			thread->ok = 0;
+		struct PublicKey other_key;
+		other_key.type = KEYTYPE_ED25519;
+		other_key.data = other_data;
+		other_key.data_size = 32;
+		int other = thread->first_other + i;
+		memcpy(other_data, &other, sizeof(int));
+		if (!libp2p_crypto_public_key_to_peer_id(&other_key, &other_id))
+			thread->ok = 0;
+		free(other_id);
+		other_id = NULL;
+	}
+	return NULL;
+}
+
+/***
+ * Threads verify with the key cache at once, while its entries are pushed out
+ */
+int test_crypto_key_cache_threads() {
+	int retVal = 0;
+	struct RsaPrivateKey* private_keys[2] = { NULL, NULL };
+	struct RsaPublicKey public_keys[2];
+	unsigned char* signatures[2] = { NULL, NULL };
+	size_t signature_size = 0;
+	struct TestKeyCacheThread threads[TEST_KEY_CACHE_THREADS];
+	pthread_t ids[TEST_KEY_CACHE_THREADS];
+	int started = 0;
+	struct KeyCacheStats stats;
+
+	libp2p_crypto_key_cache_clear();
+	for(int k = 0; k < 2; k++) {
+		private_keys[k] = libp2p_crypto_rsa_rsa_private_key_new();
+		if (private_keys[k] == NULL || !libp2p_crypto_rsa_generate_keypair(private_keys[k], 1024))
+			goto exit;
+		if (!libp2p_crypto_rsa_sign(private_keys[k], "a message", 9, &signatures[k], &signature_size))
+			goto exit;
+		public_keys[k].der = private_keys[k]->public_key_der;
+		public_keys[k].der_length = private_keys[k]->public_key_length;
+	}
+
+	for(; started < TEST_KEY_CACHE_THREADS; started++) {
+		threads[started].keys[0] = &public_keys[0];
+		threads[started].keys[1] = &public_keys[1];
+		threads[started].signatures[0] = signatures[0];
+		threads[started].signatures[1] = signatures[1];
+		threads[started].first_other = started * TEST_KEY_CACHE_ROUNDS;
+		threads[started].ok = 0;
+		if (pthread_create(&ids[started], NULL, test_crypto_key_cache_thread, &threads[started]) != 0)
+			break;
+	}
+	int ok = started == TEST_KEY_CACHE_THREADS;
+	for(int i = 0; i < started; i++) {
+		pthread_join(ids[i], NULL);
+		ok = ok && threads[i].ok;
+	}
+	if (!ok)
+		goto exit;
+	// there were more keys than entries, so some were pushed out
+	libp2p_crypto_key_cache_stats(&stats);
+	if (stats.evictions == 0 || stats.entries != KEY_CACHE_SIZE)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_key_cache_clear();
+	for(int k = 0; k < 2; k++) {
+		if (signatures[k] != NULL)
+			free(signatures[k]);
+		libp2p_crypto_rsa_rsa_private_key_free(private_keys[k]);
+	}
+	return retVal;
+}
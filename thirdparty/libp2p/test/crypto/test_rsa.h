@@ -263,3 +263,58 @@ int test_crypto_rsa_signing() {
 
 	return 1;
 }
+
+/***
+ * A signer gives the same (deterministic PKCS#1 v1.5) signatures as signing
+ * with the DER each time, alone and in a batch
+ */
+int test_crypto_rsa_signer() {
+	int retVal = 0;
+	struct RsaPrivateKey* private_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct RsaSigner* signer = NULL;
+	unsigned char* expected[2] = { NULL, NULL };
+	size_t expected_size[2] = { 0, 0 };
+	unsigned char* results[2] = { NULL, NULL };
+	size_t result_sizes[2] = { 0, 0 };
+	const char* messages[2] = { "first message", "second message" };
+	size_t message_lengths[2] = { 13, 14 };
+
+	if (private_key == NULL || !libp2p_crypto_rsa_generate_keypair(private_key, 2048))
+		goto exit;
+	for(int i = 0; i < 2; i++) {
+		if (!libp2p_crypto_rsa_sign(private_key, messages[i], message_lengths[i], &expected[i], &expected_size[i]))
+			goto exit;
+	}
+
+	signer = libp2p_crypto_rsa_signer_new(private_key);
+	if (signer == NULL)
+		goto exit;
+	if (!libp2p_crypto_rsa_signer_sign_batch(signer, 2, messages, message_lengths, results, result_sizes))
+		goto exit;
+	for(int i = 0; i < 2; i++) {
+		if (result_sizes[i] != expected_size[i] || memcmp(results[i], expected[i], expected_size[i]) != 0)
+			goto exit;
+		free(results[i]);
+		results[i] = NULL;
+	}
+
+	// and through libp2p_crypto_rsa_sign once the key has a signer
+	private_key->signer = signer;
+	signer = NULL;
+	if (!libp2p_crypto_rsa_sign(private_key, messages[1], message_lengths[1], &results[1], &result_sizes[1]))
+		goto exit;
+	if (result_sizes[1] != expected_size[1] || memcmp(results[1], expected[1], expected_size[1]) != 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	for(int i = 0; i < 2; i++) {
+		if (expected[i] != NULL)
+			free(expected[i]);
+		if (results[i] != NULL)
+			free(results[i]);
+	}
+	libp2p_crypto_rsa_signer_free(signer);
+	libp2p_crypto_rsa_rsa_private_key_free(private_key);
+	return retVal;
+}
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bench_dht.h"
+
+/***
+ * Fuzz target for the KRPC parser of dht.c. Build it against libFuzzer with
+ *   make fuzz_dht CC=clang FUZZ_FLAGS="-fsanitize=fuzzer,address -DLIBFUZZER"
+ * Without libFuzzer, main mutates the messages of bench_dht_messages at random.
+ */
+
+static int fuzz_dht_inside(const unsigned char* p, int len, const unsigned char* buf, size_t size) {
+	if (len == 0)
+		return 1;
+	return p >= buf && p + len <= buf + size;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	unsigned char values[2048];
+	struct message m;
+	/* an exact-size copy, so that reading past the end is caught by ASan */
+	unsigned char* buf = malloc(size == 0 ? 1 : size);
+
+	if (buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	if (parse_message(buf, size, &m) >= 0) {
+		if (!fuzz_dht_inside(m.tid, m.tid_len, buf, size)
+				|| !fuzz_dht_inside(m.token, m.token_len, buf, size)
+				|| !fuzz_dht_inside(m.nodes, m.nodes_len, buf, size)
+				|| !fuzz_dht_inside(m.nodes6, m.nodes6_len, buf, size)
+				|| !fuzz_dht_inside(m.values, m.values_len, buf, size))
+			abort();
+		if (m.id != zeroes && !fuzz_dht_inside(m.id, 20, buf, size))
+			abort();
+		if (message_values(&m, 4, values, sizeof(values)) % 6 != 0
+				|| message_values(&m, 16, values, sizeof(values)) % 18 != 0)
+			abort();
+	}
+	free(buf);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+
+static const unsigned char fuzz_dht_tokens[] = "0123456789:deil";
+
+int main(int argc, char** argv) {
+	unsigned char bufs[BENCH_DHT_MESSAGES][BENCH_DHT_MESSAGE_SIZE];
+	unsigned char input[BENCH_DHT_MESSAGE_SIZE];
+	int lens[BENCH_DHT_MESSAGES];
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+	srandom(argc > 2 ? atol(argv[2]) : 1);
+	bench_dht_messages(bufs, lens);
+
+	for(long n = 0; n < iterations; n++) {
+		int k = random() % BENCH_DHT_MESSAGES;
+		int len = lens[k];
+		memcpy(input, bufs[k], len);
+		int mutations = 1 + random() % 4;
+		for(int i = 0; i < mutations && len > 0; i++) {
+			int pos = random() % len;
+			switch (random() % 4) {
+				case 0: /* flip a byte */
+					input[pos] = random() & 0xFF;
+					break;
+				case 1: /* put bencode syntax where it does not belong */
+					input[pos] = fuzz_dht_tokens[random() % (sizeof(fuzz_dht_tokens) - 1)];
+					break;
+				case 2: /* truncate */
+					len = pos;
+					break;
+				default: /* duplicate a run of bytes */
+					if (len < BENCH_DHT_MESSAGE_SIZE / 2) {
+						int run = 1 + random() % (len - pos);
+						memmove(&input[pos + run], &input[pos], len - pos);
+						len += run;
+					}
+					break;
+			}
+		}
+		LLVMFuzzerTestOneInput(input, len);
+	}
+	printf("fuzz_dht: %ld inputs\n", iterations);
+	return 0;
+}
+
+#endif
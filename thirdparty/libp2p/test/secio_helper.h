@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libp2p/secio/secio.h"
+#include "libp2p/crypto/ephemeral.h"
+#include "libp2p/net/multistream.h"
+
+/***
+ * What the secio tests and benchmarks share
+ */
+
+/***
+ * Free what a handshake left in a session, and close its socket
+ * @param session the session, which is zeroed
+ */
+void secio_helper_session_clear(struct SessionContext* session) {
+	libp2p_secio_stop_ciphers(session);
+	if (session->insecure_stream != NULL)
+		libp2p_net_multistream_stream_free(session->insecure_stream);
+	if (session->local_stretched_key != NULL)
+		libp2p_crypto_ephemeral_stretched_key_free(session->local_stretched_key);
+	if (session->remote_stretched_key != NULL)
+		libp2p_crypto_ephemeral_stretched_key_free(session->remote_stretched_key);
+	if (session->ephemeral_private_key != NULL)
+		libp2p_crypto_ephemeral_key_free(session->ephemeral_private_key);
+	if (session->remote_ephemeral_public_key != NULL)
+		free(session->remote_ephemeral_public_key);
+	if (session->chosen_cipher != NULL)
+		free(session->chosen_cipher);
+	if (session->chosen_curve != NULL)
+		free(session->chosen_curve);
+	if (session->chosen_hash != NULL)
+		free(session->chosen_hash);
+	if (session->shared_key != NULL)
+		free(session->shared_key);
+	memset(session, 0, sizeof(struct SessionContext));
+}
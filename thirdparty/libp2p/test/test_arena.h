@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "libp2p/utils/arena.h"
+#include "libp2p/utils/linked_list.h"
+#include "libp2p/peer/peer.h"
+#include "multiaddr/multiaddr.h"
+
+/***
+ * Allocations are aligned, counted, spill into new blocks, and a reset
+ * keeps only the first block
+ */
+int test_arena() {
+	struct Libp2pArena arena;
+	int retVal = 0;
+
+	libp2p_utils_arena_init(&arena, 256);
+	for(int i = 0; i < 100; i++) {
+		unsigned char* p = libp2p_utils_arena_alloc(&arena, 1 + i % 40);
+		if (p == NULL || (uintptr_t)p % ARENA_ALIGNMENT != 0)
+			goto exit;
+		memset(p, i, 1 + i % 40);
+	}
+	if (arena.allocations != 100 || arena.mallocs < 2 || arena.high_water != arena.used)
+		goto exit;
+	// bigger than a block gets a block of its own
+	unsigned char* big = libp2p_utils_arena_alloc(&arena, 1000);
+	if (big == NULL)
+		goto exit;
+	memset(big, 0, 1000);
+	size_t high_water = arena.high_water;
+
+	libp2p_utils_arena_reset(&arena);
+	if (arena.used != 0 || arena.allocations != 0 || arena.mallocs != 0 || arena.high_water != high_water)
+		goto exit;
+	// the first block is used again
+	if (libp2p_utils_arena_alloc(&arena, 100) == NULL || arena.mallocs != 0)
+		goto exit;
+
+	// without an arena, it is malloc
+	void* p = libp2p_utils_arena_alloc(NULL, 10);
+	if (p == NULL)
+		goto exit;
+	free(p);
+
+	retVal = 1;
+	exit:
+	libp2p_utils_arena_clear(&arena);
+	return retVal;
+}
+
+/***
+ * A peer copied into an arena matches one copied with malloc
+ */
+int test_arena_peer_copy() {
+	struct Libp2pArena* arena = libp2p_utils_arena_new(0);
+	struct Libp2pPeer* peer = libp2p_peer_new();
+	struct Libp2pPeer* copy = NULL;
+	struct Libp2pPeer* arena_copy = NULL;
+	unsigned char buffer[512], arena_buffer[512];
+	size_t size = 0, arena_size = 0;
+	int retVal = 0;
+
+	if (arena == NULL || peer == NULL)
+		goto exit;
+	peer->id = malloc(7);
+	memcpy(peer->id, "QmPeer1", 7);
+	peer->id_size = 7;
+	peer->addr_head = libp2p_utils_linked_list_new();
+	peer->addr_head->item = multiaddress_new_from_string("/ip4/127.0.0.1/tcp/4001/");
+	peer->addr_head->next = libp2p_utils_linked_list_new();
+	peer->addr_head->next->item = multiaddress_new_from_string("/ip4/10.0.0.1/tcp/4002/");
+
+	copy = libp2p_peer_copy(peer);
+	arena_copy = libp2p_peer_copy_in(arena, peer);
+	if (copy == NULL || arena_copy == NULL)
+		goto exit;
+	if (!libp2p_peer_protobuf_encode(copy, buffer, sizeof(buffer), &size))
+		goto exit;
+	if (!libp2p_peer_protobuf_encode(arena_copy, arena_buffer, sizeof(arena_buffer), &arena_size))
+		goto exit;
+	if (size != arena_size || memcmp(buffer, arena_buffer, size) != 0)
+		goto exit;
+	struct MultiAddress* ma = (struct MultiAddress*)arena_copy->addr_head->next->item;
+	if (strcmp(multiaddress_to_string(ma), "/ip4/10.0.0.1/tcp/4002/") != 0)
+		goto exit;
+	// a peer, 2 list items and 2 multiaddresses with their bytes and strings, and the id
+	if (arena->allocations != 10 || arena->mallocs != 1)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_peer_free(peer);
+	libp2p_peer_free(copy);
+	libp2p_utils_arena_free(arena);
+	return retVal;
+}
@@ -1,7 +1,9 @@
 #include <stdlib.h>
+#include <arpa/inet.h>
 
 #include "libp2p/conn/dialer.h"
 #include "libp2p/net/stream.h"
+#include "libp2p/net/p2pnet.h"
 #include "test_helper.h"
 
 int test_dialer_new() {
@@ -20,6 +22,64 @@ int test_dialer_new() {
 	return retVal;
 }
 
+/***
+ * Dial a port on this machine that is listening, and one that is not: the
+ * second gives no connection
+ */
+int test_dialer_dial_local() {
+	int retVal = 0;
+	char* peer_id = "QmQSDGgxSVTkHmtT25rTzQtc5C1Yg8SpGK3BTws8YsJ4x3";
+	struct PrivateKey* private_key = libp2p_crypto_private_key_new();
+	struct Dialer* dialer = libp2p_conn_dialer_new(peer_id, private_key);
+	struct MultiAddress* address = NULL;
+	struct Connection* conn = NULL;
+	uint32_t ip = htonl(INADDR_LOOPBACK);
+	uint16_t listening_port = 0;
+	uint16_t closed_port = 0;
+	int listening = -1;
+	int closed = -1;
+	char address_string[64];
+
+	if (dialer == NULL)
+		goto exit;
+	listening = socket_listen(socket_open4(), &ip, &listening_port);
+	if (listening < 0)
+		goto exit;
+	// bound but not listening, so a connect is refused
+	closed = socket_open4();
+	if (closed < 0 || socket_bind4(closed, ip, 0) != 0 || socket_local4(closed, &ip, &closed_port) != 0)
+		goto exit;
+
+	sprintf(address_string, "/ip4/127.0.0.1/tcp/%d", listening_port);
+	address = multiaddress_new_from_string(address_string);
+	conn = libp2p_conn_dialer_get_connection(dialer, address);
+	if (conn == NULL)
+		goto exit;
+	close(conn->socket_handle);
+	libp2p_conn_connection_free(conn);
+	multiaddress_free(address);
+
+	sprintf(address_string, "/ip4/127.0.0.1/tcp/%d", closed_port);
+	address = multiaddress_new_from_string(address_string);
+	conn = libp2p_conn_dialer_get_connection(dialer, address);
+	if (conn != NULL) {
+		close(conn->socket_handle);
+		libp2p_conn_connection_free(conn);
+		goto exit;
+	}
+
+	retVal = 1;
+	exit:
+	if (listening >= 0)
+		close(listening);
+	if (closed >= 0)
+		close(closed);
+	multiaddress_free(address);
+	libp2p_conn_dialer_free(dialer);
+	libp2p_crypto_private_key_free(private_key);
+	return retVal;
+}
+
 int test_dialer_dial() {
 	int retVal = 0;
 	char* config_dir = "/home/parallels/.ipfs/config";
@@ -0,0 +1,596 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/***
+ * The routing table and storage of the DHT are internal to dht.c, so the
+ * tests build against the source itself, as the benchmarks do. dht.o from
+ * libp2p.a is then never pulled in by the linker, and DHT_TESTING gives
+ * them dht_testing.
+ */
+#define DHT_TESTING
+#include "../routing/dht.c"
+
+/***
+ * Start a DHT whose socket can not reach anything, so that the pings sent
+ * while filling the table fail locally instead of leaving the machine.
+ * @param id the id of the node
+ * @returns the socket, or -1 on error
+ */
+int test_dht_start(const unsigned char* id) {
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+	if (dht_init(fd, -1, id, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void test_dht_stop(int fd) {
+	dht_uninit();
+	close(fd);
+}
+
+/***
+ * Make an id that shares exactly bits leading bits with myid
+ * @param id where to put the id
+ * @param bits the common prefix length, below 160
+ * @param seed fills the bits after the prefix
+ */
+void test_dht_id(unsigned char* id, int bits, int seed) {
+	memcpy(id, myid, 20);
+	id[bits / 8] ^= 0x80 >> (bits % 8);
+	for(int i = bits + 1; i < 160; i++) {
+		if ((seed >> (i % 31)) & 1)
+			id[i / 8] ^= 0x80 >> (i % 8);
+	}
+}
+
+/***
+ * A routable address, 10.0.0.0/8 is not martian
+ */
+void test_dht_addr(struct sockaddr_in* sin, int i) {
+	memset(sin, 0, sizeof(struct sockaddr_in));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0A000000 | (i + 1));
+	sin->sin_port = htons(1024 + i);
+}
+
+struct node* test_dht_insert(const unsigned char* id, int i, int confirm) {
+	struct sockaddr_in sin;
+	test_dht_addr(&sin, i);
+	return new_node(id, (struct sockaddr*)&sin, sizeof(sin), confirm);
+}
+
+/***
+ * Every bucket holds the nodes that share exactly its depth in bits with
+ * myid, but for the last one, which holds all the closer ones
+ */
+int test_dht_table_valid(struct routing_table* t) {
+	for(int i = 0; i < t->numbuckets; i++) {
+		struct bucket* b = &t->buckets[i];
+		if (b->depth != i || b->count > BUCKET_SIZE || is_mybucket(b) != (i == t->numbuckets - 1))
+			return 0;
+		for(int j = 0; j < b->count; j++) {
+			int bits = common_bits(b->nodes[j].id, myid);
+			if (is_mybucket(b) ? bits < i : bits != i)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/***
+ * Insert into our own bucket until it splits, then fill the table with
+ * ids at every distance and find each one back
+ */
+int test_dht_routing_table() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char ids[2000][20];
+	int inserted = 0, found = 0;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = 0x5A;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+
+	// 8 good nodes fill the only bucket
+	for(int i = 0; i < BUCKET_SIZE; i++) {
+		test_dht_id(id, 0, i);
+		if (test_dht_insert(id, i, 2) == NULL || find_node(id, AF_INET) == NULL)
+			goto exit;
+	}
+	if (buckets->numbuckets != 1 || buckets->buckets[0].count != BUCKET_SIZE)
+		goto exit;
+	// a closer one splits it, and goes in the new bucket
+	test_dht_id(id, 3, 0);
+	if (test_dht_insert(id, BUCKET_SIZE, 2) == NULL)
+		goto exit;
+	if (buckets->numbuckets != 2 || buckets->buckets[0].count != BUCKET_SIZE || buckets->buckets[1].count != 1)
+		goto exit;
+	if (find_bucket(id, AF_INET) != &buckets->buckets[1] || find_node(id, AF_INET) == NULL)
+		goto exit;
+	// a farther one has no room, and is cached by its full bucket
+	test_dht_id(id, 0, BUCKET_SIZE);
+	if (test_dht_insert(id, BUCKET_SIZE + 1, 2) != NULL || find_node(id, AF_INET) != NULL)
+		goto exit;
+	if (buckets->buckets[0].cached.ss_family != AF_INET)
+		goto exit;
+	// a known node is not inserted twice
+	test_dht_id(id, 0, 0);
+	if (test_dht_insert(id, 0, 2) != &buckets->buckets[0].nodes[0] || buckets->buckets[0].count != BUCKET_SIZE)
+		goto exit;
+	// nor is ourselves
+	if (test_dht_insert(myid, 0, 2) != NULL)
+		goto exit;
+
+	// ids close to us keep splitting the table, each one lands in the bucket of its prefix length
+	for(int i = 0; i < 2000; i++) {
+		test_dht_id(ids[i], i % 40, i);
+		if (test_dht_insert(ids[i], 100 + i, 2) != NULL)
+			inserted++;
+	}
+	if (!test_dht_table_valid(buckets) || buckets->numbuckets < 30)
+		goto exit;
+	for(int i = 0; i < 2000; i++) {
+		struct node* n = find_node(ids[i], AF_INET);
+		if (n == NULL)
+			continue;
+		if (find_bucket(ids[i], AF_INET)->depth != MIN(i % 40, buckets->numbuckets - 1))
+			goto exit;
+		found++;
+	}
+	if (found != inserted || found == 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
+
+/***
+ * The nodes sent back for an id are the closest good ones, in order
+ */
+int test_dht_closest_nodes() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char target[20];
+	unsigned char nodes[8 * 26];
+	int numnodes = 0;
+	struct bucket* b;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	for(int i = 0; i < 1000; i++) {
+		test_dht_id(id, i % 20, random());
+		test_dht_insert(id, i, 2);
+	}
+	if (!test_dht_table_valid(buckets))
+		goto exit;
+
+	// next to a node we know, that node is the closest
+	b = &buckets->buckets[buckets->numbuckets / 2];
+	if (b->count == 0)
+		goto exit;
+	memcpy(target, b->nodes[0].id, 20);
+	target[19] ^= 1;
+
+	// as send_closest_nodes walks them
+	b = find_bucket(target, AF_INET);
+	numnodes = buffer_closest_nodes(nodes, numnodes, target, b);
+	if (next_bucket(b))
+		numnodes = buffer_closest_nodes(nodes, numnodes, target, next_bucket(b));
+	if (previous_bucket(b))
+		numnodes = buffer_closest_nodes(nodes, numnodes, target, previous_bucket(b));
+	if (numnodes != 8)
+		goto exit;
+	if (memcmp(nodes, b->nodes[0].id, 20) != 0)
+		goto exit;
+	for(int i = 1; i < numnodes; i++) {
+		if (xorcmp(nodes + 26 * (i - 1), nodes + 26 * i, target) >= 0)
+			goto exit;
+	}
+	// with the address of each node after its id
+	for(int i = 0; i < numnodes; i++) {
+		struct node* n = find_node(nodes + 26 * i, AF_INET);
+		if (n == NULL)
+			goto exit;
+		struct sockaddr_in* sin = (struct sockaddr_in*)&n->ss;
+		if (memcmp(nodes + 26 * i + 20, &sin->sin_addr, 4) != 0 || memcmp(nodes + 26 * i + 24, &sin->sin_port, 2) != 0)
+			goto exit;
+	}
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
+
+/***
+ * A node that stopped answering makes room for a new one, and is
+ * removed altogether once it failed 4 pings
+ */
+int test_dht_eviction() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char gone[20];
+	struct bucket* b;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	for(int i = 0; i < BUCKET_SIZE; i++) {
+		test_dht_id(id, 0, i);
+		if (test_dht_insert(id, i, 2) == NULL)
+			goto exit;
+	}
+	b = &buckets->buckets[0];
+
+	// pinged 3 times, but just now, it is given some time to answer
+	memcpy(gone, b->nodes[3].id, 20);
+	b->nodes[3].pinged = 3;
+	b->nodes[3].pinged_time = now.tv_sec;
+	test_dht_id(id, 0, 100);
+	if (test_dht_insert(id, 100, 0) == &b->nodes[3] || find_node(gone, AF_INET) == NULL)
+		goto exit;
+	// and then replaced
+	b->nodes[3].pinged_time = now.tv_sec - 20;
+	test_dht_id(id, 0, 101);
+	if (test_dht_insert(id, 101, 2) != &b->nodes[3] || find_node(gone, AF_INET) != NULL)
+		goto exit;
+	if (find_node(id, AF_INET) == NULL || b->nodes[3].pinged != 0 || b->count != BUCKET_SIZE)
+		goto exit;
+
+	// one more failed ping and expire_buckets drops it
+	memcpy(gone, b->nodes[5].id, 20);
+	b->nodes[5].pinged = 4;
+	expire_buckets(buckets);
+	if (find_node(gone, AF_INET) != NULL || b->count != BUCKET_SIZE - 1)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
+
+/***
+ * dht_nodes counts good and dubious nodes, the ones last heard from
+ * without a reply, and the buckets with a cached node
+ */
+int test_dht_nodes_counts() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	int good = -1, dubious = -1, cached = -1, incoming = -1;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	if (dht_nodes(AF_INET, &good, &dubious, &cached, &incoming) != 0 || good != 0 || dubious != 0 || cached != 0 || incoming != 0)
+		goto exit;
+	if (dht_nodes(AF_INET6, &good, &dubious, &cached, &incoming) != 0)
+		goto exit;
+
+	// 5 replied, 2 only heard of, 1 sent a query but never replied
+	for(int i = 0; i < 5; i++) {
+		test_dht_id(id, 0, i);
+		test_dht_insert(id, i, 2);
+	}
+	for(int i = 5; i < 7; i++) {
+		test_dht_id(id, 0, i);
+		test_dht_insert(id, i, 0);
+	}
+	test_dht_id(id, 0, 7);
+	test_dht_insert(id, 7, 1);
+	// 2 of the good ones are heard from again later, without a reply
+	now.tv_sec += 10;
+	for(int i = 0; i < 2; i++) {
+		test_dht_id(id, 0, i);
+		test_dht_insert(id, i, 1);
+	}
+	if (dht_nodes(AF_INET, &good, &dubious, &cached, &incoming) != 8 || good != 5 || dubious != 3 || cached != 0 || incoming != 2)
+		goto exit;
+
+	// the farthest bucket is full of good nodes once split, so one more is cached
+	test_dht_id(id, 5, 0);
+	test_dht_insert(id, 8, 2);
+	for(int i = 5; i < 8; i++) {
+		test_dht_id(id, 0, i);
+		test_dht_insert(id, i, 2);
+	}
+	test_dht_id(id, 0, 8);
+	test_dht_insert(id, 9, 2);
+	if (dht_nodes(AF_INET, &good, &dubious, &cached, &incoming) != 9 || good != 9 || dubious != 0 || cached != 1)
+		goto exit;
+	// the counts may be left out
+	if (dht_nodes(AF_INET, NULL, NULL, NULL, NULL) != 9)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
+
+static void test_dht_hex(char* out, const unsigned char* id) {
+	for(int i = 0; i < 20; i++)
+		sprintf(out + 2 * i, "%02x", id[i]);
+}
+
+/***
+ * dht_dump_tables writes the buckets in the order of their first id, in
+ * the format it always had
+ */
+int test_dht_dump_tables() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char ids[BUCKET_SIZE + 1][20];
+	char hex[41];
+	char* expected = NULL;
+	char* written = NULL;
+	size_t pos = 0;
+	FILE* f = NULL;
+	long size;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = 0x5A;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	for(int i = 0; i <= BUCKET_SIZE; i++) {
+		test_dht_id(ids[i], i < BUCKET_SIZE ? 0 : 4, i);
+		if (test_dht_insert(ids[i], i, 2) == NULL)
+			goto exit;
+	}
+	if (buckets->numbuckets != 2)
+		goto exit;
+	buckets->buckets[0].nodes[1].pinged = 1;
+	buckets->buckets[0].nodes[2].time = now.tv_sec - 5;
+
+	expected = malloc(4096);
+	if (expected == NULL)
+		goto exit;
+	pos += sprintf(expected + pos, "My id 5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a5a\n");
+	// ours is first, its prefix is 0 where myid starts with 0
+	pos += sprintf(expected + pos, "Bucket 0000000000000000000000000000000000000000 count 1 age 0 (mine):\n");
+	test_dht_hex(hex, ids[BUCKET_SIZE]);
+	pos += sprintf(expected + pos, "    Node %s 10.0.0.%d:%d age 0 (good)\n", hex, BUCKET_SIZE + 1, 1024 + BUCKET_SIZE);
+	pos += sprintf(expected + pos, "Bucket 8000000000000000000000000000000000000000 count %d age 0:\n", BUCKET_SIZE);
+	for(int i = 0; i < BUCKET_SIZE; i++) {
+		test_dht_hex(hex, ids[i]);
+		pos += sprintf(expected + pos, "    Node %s 10.0.0.%d:%d %s%s (good)\n", hex, i + 1, 1024 + i,
+				i == 2 ? "age 5, 0" : "age 0", i == 1 ? " (1)" : "");
+	}
+	pos += sprintf(expected + pos, "\n\n\n");
+
+	f = tmpfile();
+	if (f == NULL)
+		goto exit;
+	dht_dump_tables(f);
+	size = ftell(f);
+	if (size != (long)pos)
+		goto exit;
+	written = malloc(size);
+	rewind(f);
+	if (written == NULL || fread(written, 1, size, f) != (size_t)size)
+		goto exit;
+	if (memcmp(written, expected, size) != 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	if (f != NULL)
+		fclose(f);
+	free(expected);
+	free(written);
+	return retVal;
+}
+
+/***
+ * Announce a peer for a hash
+ * @returns what storage_store returns, 1 for a new peer, 0 for a refreshed one
+ */
+int test_dht_announce(const unsigned char* hash, int ip, unsigned short port) {
+	struct sockaddr_in sin;
+	test_dht_addr(&sin, ip);
+	return storage_store(hash, (struct sockaddr*)&sin, port);
+}
+
+/***
+ * A peer announced again is refreshed rather than added, whether or not
+ * the peers of its hash were reindexed in between
+ */
+int test_dht_storage_announce() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char hash[20];
+	struct storage* st;
+
+	for(int i = 0; i < 20; i++) {
+		id[i] = random() & 0xFF;
+		hash[i] = random() & 0xFF;
+	}
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	if (find_storage(hash) != NULL)
+		goto exit;
+
+	for(int i = 0; i < 3; i++) {
+		if (test_dht_announce(hash, i, 6881) != 1)
+			goto exit;
+	}
+	st = find_storage(hash);
+	if (st == NULL || memcmp(st->id, hash, 20) != 0 || st->numpeers != 3 || numstorage != 1)
+		goto exit;
+
+	// the same (ip, port) later on only moves it to the newest end
+	now.tv_sec += 60;
+	if (test_dht_announce(hash, 0, 6881) != 0 || st->numpeers != 3)
+		goto exit;
+	if (st->peers[st->newest].time != now.tv_sec || st->peers[st->newest].ip[3] != 1 || st->peers[st->oldest].ip[3] != 2)
+		goto exit;
+	// another port is another peer
+	if (test_dht_announce(hash, 0, 6882) != 1 || st->numpeers != 4)
+		goto exit;
+
+	// many more, reindexed as the array grows, are still found
+	for(int i = 3; i < 300; i++) {
+		if (test_dht_announce(hash, i, 6881) != 1)
+			goto exit;
+	}
+	for(int i = 0; i < 300; i++) {
+		if (test_dht_announce(hash, i, 6881) != 0)
+			goto exit;
+	}
+	if (st->numpeers != 301 || st->maxpeers < 301 || find_storage(hash) != st)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
+
+/***
+ * Lookups keep working while the table of hashes grows past its first size
+ */
+int test_dht_storage_grow() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char (*hashes)[20] = malloc(1000 * 20);
+
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	if (hashes == NULL)
+		goto exit;
+	for(int i = 0; i < 1000; i++)
+		for(int j = 0; j < 20; j++)
+			hashes[i][j] = random() & 0xFF;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+
+	for(int i = 0; i < 1000; i++) {
+		if (test_dht_announce(hashes[i], i, 6881) != 1)
+			goto exit;
+		// everything announced so far, at every size of the table
+		if (i % 97 == 0) {
+			for(int j = 0; j <= i; j++) {
+				struct storage* st = find_storage(hashes[j]);
+				if (st == NULL || memcmp(st->id, hashes[j], 20) != 0)
+					goto exit;
+			}
+		}
+	}
+	if (numstorage != 1000 || storage_size < 2000)
+		goto exit;
+	for(int i = 0; i < 1000; i++) {
+		struct storage* st = find_storage(hashes[i]);
+		if (st == NULL || memcmp(st->id, hashes[i], 20) != 0 || st->numpeers != 1)
+			goto exit;
+	}
+	hashes[0][19] ^= 1;
+	if (find_storage(hashes[0]) != NULL)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	free(hashes);
+	return retVal;
+}
+
+/***
+ * Run expire_storage once a minute: peers go DHT_PEER_EXPIRE_TIME after
+ * their last announce, and their hash with the last of them
+ */
+int test_dht_storage_expire() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char a[20], b[20], c[20];
+	time_t start;
+
+	for(int i = 0; i < 20; i++) {
+		id[i] = random() & 0xFF;
+		a[i] = random() & 0xFF;
+		b[i] = random() & 0xFF;
+		c[i] = random() & 0xFF;
+	}
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	start = now.tv_sec;
+	expire_storage();
+
+	test_dht_announce(a, 0, 6881);
+	test_dht_announce(a, 1, 6881);
+	test_dht_announce(b, 2, 6881);
+	for(int minute = 1; minute <= 43; minute++) {
+		now.tv_sec = start + minute * 60;
+		// one peer of a is announced again 10 minutes in
+		if (minute == 10)
+			test_dht_announce(a, 1, 6881);
+		expire_storage();
+		struct storage* sa = find_storage(a);
+		struct storage* sb = find_storage(b);
+		if (minute < 33) {
+			if (numstorage != 2 || sa == NULL || sa->numpeers != 2 || sb == NULL)
+				goto exit;
+		} else if (minute < 43) {
+			// the peers from the start are gone, and b with them
+			if (numstorage != 1 || sa == NULL || sa->numpeers != 1 || sb != NULL)
+				goto exit;
+			if (sa->peers[0].ip[3] != 2)
+				goto exit;
+		} else {
+			if (numstorage != 0 || sa != NULL)
+				goto exit;
+		}
+	}
+
+	// not having run for longer than the wheel still expires everything
+	test_dht_announce(c, 3, 6881);
+	now.tv_sec += 3 * 60 * 60;
+	expire_storage();
+	if (numstorage != 0 || find_storage(c) != NULL)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	return retVal;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libp2p/hashmap/hashmap.h"
+
+#define TEST_HASHMAP_ENTRIES 5000
+
+static int test_hashmap_count(any_t item, any_t data) {
+	(*(int*)item)++;
+	return MAP_OK;
+}
+
+/***
+ * String keys: put, replace, get, remove half, then iterate what is left
+ */
+int test_hashmap() {
+	map_t map = libp2p_hashmap_new();
+	char (*keys)[16] = malloc(TEST_HASHMAP_ENTRIES * sizeof(*keys));
+	any_t value = NULL;
+	int retVal = 0;
+	int count = 0;
+
+	if (map == NULL || keys == NULL)
+		goto exit;
+
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i++) {
+		sprintf(keys[i], "Key%d", i);
+		if (libp2p_hashmap_put(map, keys[i], &keys[i]) != MAP_OK)
+			goto exit;
+	}
+	// replacing a key does not add to the length
+	if (libp2p_hashmap_put(map, keys[0], keys[1]) != MAP_OK || libp2p_hashmap_length(map) != TEST_HASHMAP_ENTRIES)
+		goto exit;
+	if (libp2p_hashmap_get(map, "Key0", &value) != MAP_OK || value != keys[1])
+		goto exit;
+	if (libp2p_hashmap_get(map, "Key", &value) != MAP_MISSING || value != NULL)
+		goto exit;
+
+	// removing must not hide the keys that probed past it
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i += 2) {
+		if (libp2p_hashmap_remove(map, keys[i]) != MAP_OK)
+			goto exit;
+	}
+	if (libp2p_hashmap_remove(map, keys[0]) != MAP_MISSING)
+		goto exit;
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i++) {
+		int status = libp2p_hashmap_get(map, keys[i], &value);
+		if (i % 2 == 0 && status != MAP_MISSING)
+			goto exit;
+		if (i % 2 == 1 && (status != MAP_OK || value != &keys[i]))
+			goto exit;
+	}
+	if (libp2p_hashmap_iterate(map, test_hashmap_count, &count) != MAP_OK || count != TEST_HASHMAP_ENTRIES / 2)
+		goto exit;
+
+	// empty it one at a time
+	while (libp2p_hashmap_get_one(map, &value, 1) == MAP_OK)
+		count--;
+	if (count != 0 || libp2p_hashmap_length(map) != 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_hashmap_free(map);
+	free(keys);
+	return retVal;
+}
+
+/***
+ * Binary ids, which may hold zeros, are copied into the map
+ */
+int test_hashmap_id() {
+	map_t map = libp2p_hashmap_new_id(32);
+	unsigned char id[32];
+	any_t value = NULL;
+	int retVal = 0;
+
+	if (map == NULL || libp2p_hashmap_new_id(MAP_MAX_ID_SIZE + 1) != NULL)
+		goto exit;
+
+	memset(id, 0, sizeof(id));
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i++) {
+		memcpy(id, &i, sizeof(int));
+		if (libp2p_hashmap_put_id(map, id, (any_t)(size_t)(i + 1)) != MAP_OK)
+			goto exit;
+	}
+	// the map has its own copy
+	memset(id, 0xff, sizeof(id));
+	if (libp2p_hashmap_length(map) != TEST_HASHMAP_ENTRIES || libp2p_hashmap_get_id(map, id, &value) != MAP_MISSING)
+		goto exit;
+
+	memset(id, 0, sizeof(id));
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i += 3) {
+		memcpy(id, &i, sizeof(int));
+		if (libp2p_hashmap_remove_id(map, id) != MAP_OK)
+			goto exit;
+	}
+	for(int i = 0; i < TEST_HASHMAP_ENTRIES; i++) {
+		memcpy(id, &i, sizeof(int));
+		int status = libp2p_hashmap_get_id(map, id, &value);
+		if (i % 3 == 0 && status != MAP_MISSING)
+			goto exit;
+		if (i % 3 != 0 && (status != MAP_OK || value != (any_t)(size_t)(i + 1)))
+			goto exit;
+	}
+
+	retVal = 1;
+	exit:
+	libp2p_hashmap_free(map);
+	return retVal;
+}
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "test_dht.h"
+/***
+ * The search lists are internal to kademlia.c, built in here for the same
+ * reason as dht.c is
+ */
+#include "../routing/kademlia.c"
+#include "libp2p/utils/vector.h"
+
+#define TEST_KADEMLIA_SEARCHES 8
+
+/***
+ * A fake DHT node on the loopback interface, answered by a thread of its own
+ */
+struct test_kademlia_peer {
+	int fd;
+	unsigned char id[20];
+	struct sockaddr_in addr;
+	volatile int answered;
+	volatile int stop;
+	pthread_t thread;
+};
+
+/***
+ * Answer every query until told to stop: pings get a pong, and get_peers
+ * gets one value, 10.h0.h1.h2:4001 for the info hash h
+ */
+void* test_kademlia_answer(void* arg) {
+	struct test_kademlia_peer* peer = (struct test_kademlia_peer*)arg;
+	unsigned char buf[4096], reply[512];
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	int rc;
+
+	while (!peer->stop) {
+		struct pollfd pfd = { peer->fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 10) <= 0)
+			continue;
+		from_len = sizeof(from);
+		while ((rc = recvfrom(peer->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len)) > 0) {
+			unsigned char* tid = memmem(buf, rc, "1:t4:", 5);
+			unsigned char* hash = memmem(buf, rc, "9:info_hash20:", 14);
+			int pos = 0;
+			from_len = sizeof(from);
+			if (tid == NULL || tid + 9 > buf + rc)
+				continue;
+			memcpy(&reply[pos], "d1:rd2:id20:", 12); pos += 12;
+			memcpy(&reply[pos], peer->id, 20); pos += 20;
+			if (hash != NULL && hash + 34 <= buf + rc) {
+				memcpy(&reply[pos], "5:token4:tktk6:valuesl6:", 24); pos += 24;
+				reply[pos++] = 10;
+				memcpy(&reply[pos], hash + 14, 3); pos += 3;
+				reply[pos++] = 0x0F;
+				reply[pos++] = 0xA1;
+				reply[pos++] = 'e';
+			}
+			memcpy(&reply[pos], "e1:t4:", 6); pos += 6;
+			memcpy(&reply[pos], tid + 5, 4); pos += 4;
+			memcpy(&reply[pos], "1:y1:re", 7); pos += 7;
+			sendto(peer->fd, reply, pos, 0, (struct sockaddr*)&from, sizeof(struct sockaddr_in));
+			peer->answered++;
+		}
+	}
+	return NULL;
+}
+
+/***
+ * Start a kademlia node on the loopback interface
+ * @param name what its id is hashed from
+ * @returns true(1) on success
+ */
+int test_kademlia_start(const char* name) {
+	struct sockaddr_in addr;
+	struct Libp2pVector* bootstrap = libp2p_utils_vector_new(1);
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int retVal = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bootstrap == NULL || fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		if (fd >= 0)
+			close(fd);
+		goto exit;
+	}
+	dht_testing = 1;
+	if (start_kademlia(fd, AF_INET, (char*)name, 1, bootstrap) != 0) {
+		close(fd);
+		dht_testing = 0;
+		goto exit;
+	}
+	dht_debug = NULL;
+	retVal = 1;
+	exit:
+	if (bootstrap != NULL)
+		libp2p_utils_vector_free(bootstrap);
+	return retVal;
+}
+
+void test_kademlia_stop() {
+	stop_kademlia();
+	dht_testing = 0;
+}
+
+/***
+ * Open a fake peer and have the running kademlia node ping it into its
+ * routing table
+ * @returns true(1) on success
+ */
+int test_kademlia_peer_start(struct test_kademlia_peer* peer) {
+	socklen_t len = sizeof(struct sockaddr_in);
+	char ip[INET_ADDRSTRLEN];
+
+	memset(peer, 0, sizeof(struct test_kademlia_peer));
+	peer->addr.sin_family = AF_INET;
+	peer->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	peer->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (peer->fd < 0)
+		return 0;
+	if (bind(peer->fd, (struct sockaddr*)&peer->addr, len) != 0 || getsockname(peer->fd, (struct sockaddr*)&peer->addr, &len) != 0
+			|| pthread_create(&peer->thread, NULL, test_kademlia_answer, peer) != 0) {
+		close(peer->fd);
+		peer->fd = -1;
+		return 0;
+	}
+	for(int i = 0; i < 20; i++)
+		peer->id[i] = random() & 0xFF;
+
+	inet_ntop(AF_INET, &peer->addr.sin_addr, ip, sizeof(ip));
+	ping_kademlia(ip, ntohs(peer->addr.sin_port));
+	for(int i = 0; i < 100 && peer->answered == 0; i++)
+		usleep(10000);
+	// give the pong the time to be handled
+	usleep(100000);
+	return peer->answered > 0;
+}
+
+void test_kademlia_peer_stop(struct test_kademlia_peer* peer) {
+	if (peer->fd < 0)
+		return;
+	if (!peer->stop) {
+		peer->stop = 1;
+		pthread_join(peer->thread, NULL);
+	}
+	close(peer->fd);
+	peer->fd = -1;
+}
+
+/***
+ * Whether the results of a search are the single value the fake peer gives for hash
+ */
+int test_kademlia_results_match(struct kademlia_search* search, const unsigned char* hash) {
+	struct MultiAddress** results = search_kademlia_results(search);
+	char expected[64];
+	int retVal = 0;
+
+	if (results == NULL)
+		return 0;
+	sprintf(expected, "/ip4/10.%d.%d.%d/tcp/4001", hash[0], hash[1], hash[2]);
+	retVal = results[0] != NULL && results[1] == NULL && strcmp(results[0]->string, expected) == 0;
+	for(int i = 0; results[i] != NULL; i++)
+		multiaddress_free(results[i]);
+	free(results);
+	return retVal;
+}
+
+/***
+ * Run several searches at once, and wait for each of them on its own handle
+ */
+int test_kademlia_concurrent_search() {
+	int retVal = 0;
+	int started = 0;
+	struct test_kademlia_peer peer;
+	struct kademlia_search* searches[TEST_KADEMLIA_SEARCHES];
+	unsigned char hashes[TEST_KADEMLIA_SEARCHES][20];
+
+	peer.fd = -1;
+	memset(searches, 0, sizeof(searches));
+	if (!test_kademlia_start("QmTestKademliaSearchNode"))
+		goto exit;
+	started = 1;
+	if (!test_kademlia_peer_start(&peer))
+		goto exit;
+
+	for(int i = 0; i < TEST_KADEMLIA_SEARCHES; i++) {
+		for(int j = 0; j < 20; j++)
+			hashes[i][j] = random() & 0xFF;
+		searches[i] = search_kademlia_start(hashes[i], 0);
+		if (searches[i] == NULL)
+			goto exit;
+	}
+
+	// wait for them in the reverse order they were started in
+	for(int i = TEST_KADEMLIA_SEARCHES - 1; i >= 0; i--) {
+		if (!search_kademlia_wait(searches[i], 5000))
+			goto exit;
+		if (!test_kademlia_results_match(searches[i], hashes[i]))
+			goto exit;
+	}
+
+	// once done, kademlia_thread let go of each of them, only the caller holds them
+	pthread_mutex_lock(&search_mutex);
+	int released = search_running == NULL && search_pending == NULL;
+	for(int i = 0; i < TEST_KADEMLIA_SEARCHES; i++)
+		if (!searches[i]->done || searches[i]->refs != 1)
+			released = 0;
+	pthread_mutex_unlock(&search_mutex);
+	if (!released)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	for(int i = 0; i < TEST_KADEMLIA_SEARCHES; i++)
+		search_kademlia_free(searches[i]);
+	test_kademlia_peer_stop(&peer);
+	if (started)
+		test_kademlia_stop();
+	return retVal;
+}
+
+/***
+ * Whether a search for hash is still queued or running
+ */
+int test_kademlia_searching(const unsigned char* hash) {
+	int searching = 0;
+	pthread_mutex_lock(&search_mutex);
+	for(struct kademlia_search* s = search_pending; s != NULL; s = s->next)
+		if (memcmp(s->hash, hash, 20) == 0)
+			searching = 1;
+	for(struct kademlia_search* s = search_running; s != NULL; s = s->next)
+		if (memcmp(s->hash, hash, 20) == 0)
+			searching = 1;
+	pthread_mutex_unlock(&search_mutex);
+	return searching;
+}
+
+/***
+ * A search let go before it completes is let go by kademlia_thread once
+ * it does, and one that can not complete times out
+ */
+int test_kademlia_search_release() {
+	int retVal = 0;
+	int started = 0;
+	struct test_kademlia_peer peer;
+	struct kademlia_search* search = NULL;
+	unsigned char hash[20];
+
+	peer.fd = -1;
+	if (!test_kademlia_start("QmTestKademliaReleaseNode"))
+		goto exit;
+	started = 1;
+	if (!test_kademlia_peer_start(&peer))
+		goto exit;
+
+	for(int j = 0; j < 20; j++)
+		hash[j] = random() & 0xFF;
+	search_kademlia_free(search_kademlia_start(hash, 0));
+	for(int i = 0; i < 500 && test_kademlia_searching(hash); i++)
+		usleep(10000);
+	if (test_kademlia_searching(hash))
+		goto exit;
+
+	// the peer stops answering, so the next search is still waiting for it
+	peer.stop = 1;
+	pthread_join(peer.thread, NULL);
+	for(int j = 0; j < 20; j++)
+		hash[j] = random() & 0xFF;
+	search = search_kademlia_start(hash, 0);
+	if (search == NULL || search_kademlia_wait(search, 200) || search_kademlia_results(search) != NULL)
+		goto exit;
+	if (!test_kademlia_searching(hash))
+		goto exit;
+
+	retVal = 1;
+	exit:
+	search_kademlia_free(search);
+	test_kademlia_peer_stop(&peer);
+	if (started)
+		test_kademlia_stop();
+	return retVal;
+}
+
+/***
+ * Write len bytes of buf to path
+ * @returns true(1) on success
+ */
+int test_kademlia_write_file(const char* path, const unsigned char* buf, size_t len) {
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+		return 0;
+	size_t written = fwrite(buf, 1, len, f);
+	return fclose(f) == 0 && written == len;
+}
+
+/***
+ * Load the snapshot into a fresh table
+ * @param fd the socket of the DHT, replaced by the one of the fresh table
+ * @param id the id of the node
+ * @returns the number of nodes loaded, or -1 if the table did not start
+ */
+int test_kademlia_reload(int* fd, const unsigned char* id) {
+	test_dht_stop(*fd);
+	*fd = test_dht_start(id);
+	if (*fd < 0)
+		return -1;
+	snapshot_retry_count = 0;
+	return kademlia_load_snapshot(AF_INET);
+}
+
+/***
+ * Save the routing table, load it into a fresh one and find the same
+ * nodes there, then make sure that a snapshot cut short or damaged in any
+ * way loads nothing
+ */
+int test_kademlia_snapshot() {
+	int retVal = 0;
+	int fd = -1;
+	unsigned char id[20];
+	unsigned char ids[16 * 20];
+	struct sockaddr_storage ss[16];
+	unsigned char* saved = NULL;
+	int num = 16;
+	size_t len = 0;
+	char path[64];
+	FILE* f = NULL;
+
+	snprintf(path, sizeof(path), "/tmp/test_kademlia_%d.snapshot", (int)getpid());
+	unlink(path);
+	if (!kademlia_snapshot_file(path))
+		goto exit;
+	net_family = AF_INET;
+
+	for(int i = 0; i < 20; i++)
+		id[i] = random() & 0xFF;
+	fd = test_dht_start(id);
+	if (fd < 0)
+		goto exit;
+	// a full bucket, and three closer nodes in ours once it split
+	for(int i = 0; i < BUCKET_SIZE; i++) {
+		test_dht_id(ids, 0, i);
+		test_dht_insert(ids, i, 2);
+	}
+	for(int i = 0; i < 3; i++) {
+		test_dht_id(ids, 2 + i, i);
+		test_dht_insert(ids, BUCKET_SIZE + i, 2);
+	}
+	if (buckets->numbuckets != 2 || kademlia_save_snapshot() != BUCKET_SIZE + 3)
+		goto exit;
+	dht_get_node_ids(AF_INET, ids, ss, &num);
+	if (num != BUCKET_SIZE + 3)
+		goto exit;
+
+	// the same nodes, at the same addresses
+	if (test_kademlia_reload(&fd, id) != num || snapshot_retry_count != 0 || dht_nodes(AF_INET, NULL, NULL, NULL, NULL) != num)
+		goto exit;
+	for(int i = 0; i < num; i++) {
+		struct node* n = find_node(ids + 20 * i, AF_INET);
+		if (n == NULL || n->sslen != sizeof(struct sockaddr_in) || memcmp(&n->ss, &ss[i], sizeof(struct sockaddr_in)) != 0)
+			goto exit;
+	}
+
+	f = fopen(path, "rb");
+	saved = malloc(SNAPSHOT_MAX_SIZE);
+	if (f == NULL || saved == NULL)
+		goto exit;
+	len = fread(saved, 1, SNAPSHOT_MAX_SIZE, f);
+	fclose(f);
+	if (len != sizeof SNAPSHOT_MAGIC - 1 + num * SNAPSHOT_RECORD + SNAPSHOT_CHECKSUM)
+		goto exit;
+
+	// cut in the middle of a record, then on a record boundary
+	size_t cuts[] = { len - 5, len - SNAPSHOT_RECORD, sizeof SNAPSHOT_MAGIC - 1 };
+	for(int i = 0; i < 3; i++) {
+		if (!test_kademlia_write_file(path, saved, cuts[i]))
+			goto exit;
+		if (test_kademlia_reload(&fd, id) != 0 || dht_nodes(AF_INET, NULL, NULL, NULL, NULL) != 0)
+			goto exit;
+	}
+	// a bit flipped in a record, in the checksum, or in the magic string
+	size_t flips[] = { sizeof SNAPSHOT_MAGIC - 1 + 3 * SNAPSHOT_RECORD + 21, len - 1, 5 };
+	for(int i = 0; i < 3; i++) {
+		saved[flips[i]] ^= 0x04;
+		if (!test_kademlia_write_file(path, saved, len))
+			goto exit;
+		saved[flips[i]] ^= 0x04;
+		if (test_kademlia_reload(&fd, id) != 0 || dht_nodes(AF_INET, NULL, NULL, NULL, NULL) != 0)
+			goto exit;
+	}
+	// and the untouched one still loads
+	if (!test_kademlia_write_file(path, saved, len) || test_kademlia_reload(&fd, id) != num)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (fd >= 0)
+		test_dht_stop(fd);
+	kademlia_snapshot_file(NULL);
+	net_family = 0;
+	unlink(path);
+	free(saved);
+	return retVal;
+}
@@ -5,6 +5,8 @@
 #include <netdb.h>
 
 #include "libp2p/net/multistream.h"
+#include "libp2p/conn/session.h"
+#include "libp2p/net/read_buffer.h"
 
 int test_multistream_connect() {
 	int retVal = 0;
@@ -71,3 +73,179 @@ int test_multistream_get_list() {
 
 	return retVal > 0;
 }
+
+int libp2p_secio_unencrypted_write(struct SessionContext* session, unsigned char* bytes, size_t data_length);
+int libp2p_secio_unencrypted_read(struct SessionContext* session, unsigned char** results, size_t* results_size, int timeout_secs);
+
+/***
+ * Frames sent back to back, a frame that arrives in two parts, and a frame
+ * bigger than the buffer come out of the read buffer of a stream whole, and
+ * a frame over the limit is refused
+ */
+int test_multistream_read_buffered() {
+	int retVal = 0;
+	int fds[2] = { -1, -1 };
+	struct Stream* writer = NULL;
+	struct Stream* reader = NULL;
+	struct SessionContext write_session = {0};
+	struct SessionContext read_session = {0};
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+	unsigned char big[1000];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		goto exit;
+	writer = libp2p_net_multistream_stream_new(fds[0], "127.0.0.1", 0);
+	reader = libp2p_net_multistream_stream_new(fds[1], "127.0.0.1", 0);
+	if (writer == NULL || reader == NULL)
+		goto exit;
+	fds[0] = fds[1] = -1;
+	write_session.insecure_stream = writer;
+	read_session.insecure_stream = reader;
+	for(int i = 0; i < sizeof(big); i++)
+		big[i] = i;
+
+	// a multistream frame followed by two secio frames, all in the socket at once
+	if (libp2p_net_multistream_write(&write_session, (unsigned char*)"/secio/1.0.0\n", 13) <= 0
+			|| libp2p_secio_unencrypted_write(&write_session, (unsigned char*)"hello", 5) != 5
+			|| libp2p_secio_unencrypted_write(&write_session, big, sizeof(big)) != sizeof(big))
+		goto exit;
+
+	if (libp2p_net_multistream_read(&read_session, &results, &results_size, 1) != 13
+			|| memcmp(results, "/secio/1.0.0\n", 13) != 0)
+		goto exit;
+	free(results);
+	results = NULL;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 5
+			|| memcmp(results, "hello", 5) != 0)
+		goto exit;
+	free(results);
+	results = NULL;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != sizeof(big)
+			|| memcmp(results, big, sizeof(big)) != 0)
+		goto exit;
+	free(results);
+	results = NULL;
+
+	// half a frame times out, and is kept for when the rest comes
+	unsigned char prefix[4] = { 0, 0, 0, 5 };
+	if (write(*((int*)writer->socket_descriptor), prefix, 4) != 4
+			|| write(*((int*)writer->socket_descriptor), "wor", 3) != 3)
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 0)
+		goto exit;
+	if (write(*((int*)writer->socket_descriptor), "ld", 2) != 2)
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 5
+			|| memcmp(results, "world", 5) != 0)
+		goto exit;
+
+	free(results);
+	results = NULL;
+
+	// a frame bigger than the read buffer, then one bigger than allowed
+	size_t huge_size = 100000;
+	unsigned char* huge = malloc(huge_size);
+	if (huge == NULL)
+		goto exit;
+	memset(huge, 'x', huge_size);
+	int written = libp2p_secio_unencrypted_write(&write_session, huge, huge_size);
+	free(huge);
+	if (written != huge_size)
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != huge_size
+			|| results[0] != 'x' || results[huge_size - 1] != 'x')
+		goto exit;
+	free(results);
+	results = NULL;
+	libp2p_net_read_buffer_set_max_frame_size(reader->read_buffer, sizeof(big) - 1);
+	if (libp2p_secio_unencrypted_write(&write_session, big, sizeof(big)) != sizeof(big))
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (results != NULL)
+		free(results);
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	libp2p_net_multistream_stream_free(writer);
+	libp2p_net_multistream_stream_free(reader);
+	return retVal;
+}
+
+/***
+ * An empty frame and a frame over the limit are dropped from the stream,
+ * prefix and all, so the frame after them is still read. Both the varint
+ * (multistream) and 4 byte (secio) prefixes are tried, and the payload of
+ * the refused frame is made to arrive after its prefix was read.
+ */
+int test_multistream_read_refused_frames() {
+	int retVal = 0;
+	int fds[2] = { -1, -1 };
+	struct Stream* writer = NULL;
+	struct Stream* reader = NULL;
+	struct SessionContext write_session = {0};
+	struct SessionContext read_session = {0};
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+	unsigned char big[100];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		goto exit;
+	writer = libp2p_net_multistream_stream_new(fds[0], "127.0.0.1", 0);
+	reader = libp2p_net_multistream_stream_new(fds[1], "127.0.0.1", 0);
+	if (writer == NULL || reader == NULL)
+		goto exit;
+	fds[0] = fds[1] = -1;
+	write_session.insecure_stream = writer;
+	read_session.insecure_stream = reader;
+	memset(big, 'x', sizeof(big));
+	libp2p_net_read_buffer_set_max_frame_size(reader->read_buffer, sizeof(big) - 1);
+	int socket_fd = *((int*)writer->socket_descriptor);
+
+	// varint: empty, too big, then good
+	unsigned char empty_varint[1] = { 0 };
+	if (write(socket_fd, empty_varint, 1) != 1
+			|| libp2p_net_multistream_write(&write_session, big, sizeof(big)) <= 0
+			|| libp2p_net_multistream_write(&write_session, (unsigned char*)"ok\n", 3) <= 0)
+		goto exit;
+	if (libp2p_net_multistream_read(&read_session, &results, &results_size, 1) != 0
+			|| libp2p_net_multistream_read(&read_session, &results, &results_size, 1) != 0)
+		goto exit;
+	if (libp2p_net_multistream_read(&read_session, &results, &results_size, 1) != 3
+			|| memcmp(results, "ok\n", 3) != 0)
+		goto exit;
+	free(results);
+	results = NULL;
+
+	// 4 bytes: empty, too big with its payload still to come, then good
+	unsigned char empty_uint32[4] = { 0, 0, 0, 0 };
+	unsigned char big_uint32[4] = { 0, 0, 0, sizeof(big) };
+	if (write(socket_fd, empty_uint32, 4) != 4 || write(socket_fd, big_uint32, 4) != 4)
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 0
+			|| libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 0)
+		goto exit;
+	if (write(socket_fd, big, sizeof(big)) != sizeof(big)
+			|| libp2p_secio_unencrypted_write(&write_session, (unsigned char*)"hello", 5) != 5)
+		goto exit;
+	if (libp2p_secio_unencrypted_read(&read_session, &results, &results_size, 1) != 5
+			|| memcmp(results, "hello", 5) != 0)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	if (results != NULL)
+		free(results);
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	libp2p_net_multistream_stream_free(writer);
+	libp2p_net_multistream_stream_free(reader);
+	return retVal;
+}
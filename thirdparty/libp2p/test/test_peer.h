@@ -3,9 +3,11 @@
 #include <stdlib.h>
 #include "libp2p/peer/peer.h"
 #include "libp2p/peer/peerstore.h"
+#include "libp2p/peer/providerstore.h"
+#include "libp2p/utils/logger.h"
 
 /***
- * Includes Libp2pPeer, PeerEntry, Peerstore
+ * Includes Libp2pPeer, PeerEntry, Peerstore, ProviderStore
  */
 
 /**
@@ -60,6 +62,172 @@ int test_peerstore() {
 	return retVal;
 }
 
+/**
+ * Test the peerstore index as it grows: one copy per id, and the pointers
+ * handed out before the growth still good after it
+ */
+int test_peerstore_index() {
+	struct Peerstore* peerstore = libp2p_peerstore_new("Qmabcdefg");
+	struct Libp2pPeer* peer = libp2p_peer_new();
+	struct Libp2pPeer* first = NULL;
+	int retVal = 0;
+	int count = PEERSTORE_INITIAL_CAPACITY * 8;
+	char id[16];
+
+	if (peerstore == NULL || peer == NULL)
+		goto exit;
+
+	peer->id = id;
+	for(int i = 0; i < count; i++) {
+		peer->id_size = sprintf(id, "Peer%d", i);
+		struct Libp2pPeer* stored = libp2p_peerstore_get_or_add_peer(peerstore, peer);
+		if (stored == NULL || stored == peer || stored->id_size != peer->id_size)
+			goto exit;
+		if (i == 0)
+			first = stored;
+	}
+	// the local peer, and each one added
+	if (peerstore->index.count != count + 1 || peerstore->index.capacity <= PEERSTORE_INITIAL_CAPACITY)
+		goto exit;
+
+	// adding again finds the same peers
+	for(int i = 0; i < count; i++) {
+		peer->id_size = sprintf(id, "Peer%d", i);
+		if (!libp2p_peerstore_add_peer(peerstore, peer))
+			goto exit;
+		struct Libp2pPeer* stored = libp2p_peerstore_get_peer(peerstore, (unsigned char*)id, peer->id_size);
+		if (stored == NULL || memcmp(stored->id, id, peer->id_size) != 0)
+			goto exit;
+		if (i == 0 && stored != first)
+			goto exit;
+	}
+	if (peerstore->index.count != count + 1)
+		goto exit;
+
+	// an id that differs only in length is another peer
+	if (libp2p_peerstore_get_peer(peerstore, (unsigned char*)"Peer1", 4) != NULL
+			|| libp2p_peerstore_get_peer(peerstore, (unsigned char*)"Qmabcdefg", 9) == NULL)
+		goto exit;
+
+	retVal = 1;
+
+	exit:
+	if (peer != NULL) {
+		peer->id = NULL;
+		libp2p_peer_free(peer);
+	}
+	libp2p_peerstore_free(peerstore);
+	return retVal;
+}
+
+/**
+ * Test that adding and freeing peers does not build the strings of their
+ * addresses when nobody is watching the log
+ */
+int test_peerstore_quiet_logging() {
+	struct Peerstore* peerstore = libp2p_peerstore_new("Qmabcdefg");
+	struct Libp2pPeer* peer = libp2p_peer_new();
+	struct MultiAddress* parsed = multiaddress_new_from_string("/ip4/127.0.0.1/tcp/4001");
+	struct MultiAddress* address = NULL;
+	int retVal = 0;
+
+	if (peerstore == NULL || peer == NULL || parsed == NULL)
+		goto exit;
+	if (libp2p_logger_watching_class("peer") || libp2p_logger_watching_class("peerstore"))
+		goto exit;
+
+	// an address made from bytes has no string until it is asked for
+	address = multiaddress_new_from_bytes(parsed->bytes, parsed->bsize);
+	if (address == NULL || address->string != NULL)
+		goto exit;
+	peer->id = malloc(6);
+	memcpy(peer->id, "ABC123", 6);
+	peer->id_size = 6;
+	peer->addr_head = libp2p_utils_linked_list_new();
+	peer->addr_head->item = address;
+
+	if (!libp2p_peerstore_add_peer(peerstore, peer))
+		goto exit;
+	struct Libp2pPeer* stored = libp2p_peerstore_get_peer(peerstore, (unsigned char*)"ABC123", 6);
+	if (stored == NULL || address->string != NULL || ((struct MultiAddress*)stored->addr_head->item)->string != NULL)
+		goto exit;
+
+	retVal = 1;
+
+	exit:
+	multiaddress_free(parsed);
+	libp2p_peer_free(peer);
+	libp2p_peerstore_free(peerstore);
+	return retVal;
+}
+
+/**
+ * Test the providerstore: many providers per hash, no duplicates, a bound
+ * on how many are kept, and expiry
+ */
+int test_providerstore() {
+	struct ProviderStore* store = libp2p_providerstore_new();
+	struct ProviderRecord* providers[PROVIDERSTORE_MAX_PROVIDERS + 1];
+	unsigned char* peer_id = NULL;
+	int peer_id_size = 0;
+	int retVal = 0;
+	char hash[16];
+	char id[16];
+
+	if (store == NULL)
+		goto exit;
+
+	// enough hashes to grow the index
+	for(int i = 0; i < PROVIDERSTORE_INITIAL_CAPACITY * 2; i++) {
+		int hash_size = sprintf(hash, "Hash%d", i);
+		for(int j = 0; j < 3; j++) {
+			int id_size = sprintf(id, "Peer%d", j);
+			// twice, which must not make a duplicate
+			if (!libp2p_providerstore_add(store, (unsigned char*)hash, hash_size, (unsigned char*)id, id_size)
+					|| !libp2p_providerstore_add(store, (unsigned char*)hash, hash_size, (unsigned char*)id, id_size))
+				goto exit;
+		}
+	}
+	if (store->index.count != PROVIDERSTORE_INITIAL_CAPACITY * 2)
+		goto exit;
+	for(int i = 0; i < PROVIDERSTORE_INITIAL_CAPACITY * 2; i++) {
+		int hash_size = sprintf(hash, "Hash%d", i);
+		if (libp2p_providerstore_get_providers(store, (unsigned char*)hash, hash_size, providers, PROVIDERSTORE_MAX_PROVIDERS) != 3)
+			goto exit;
+	}
+	if (libp2p_providerstore_get_providers(store, (unsigned char*)"Hash", 4, providers, PROVIDERSTORE_MAX_PROVIDERS) != 0)
+		goto exit;
+
+	// no more than PROVIDERSTORE_MAX_PROVIDERS are kept, and asking for fewer gets fewer
+	for(int j = 0; j < PROVIDERSTORE_MAX_PROVIDERS * 2; j++) {
+		int id_size = sprintf(id, "Peer%d", j);
+		if (!libp2p_providerstore_add(store, (unsigned char*)"Hash0", 5, (unsigned char*)id, id_size))
+			goto exit;
+	}
+	if (libp2p_providerstore_get_providers(store, (unsigned char*)"Hash0", 5, providers, PROVIDERSTORE_MAX_PROVIDERS + 1) != PROVIDERSTORE_MAX_PROVIDERS
+			|| libp2p_providerstore_get_providers(store, (unsigned char*)"Hash0", 5, providers, 2) != 2)
+		goto exit;
+
+	if (!libp2p_providerstore_get(store, (unsigned char*)"Hash1", 5, &peer_id, &peer_id_size)
+			|| peer_id_size != 5 || memcmp(peer_id, "Peer", 4) != 0)
+		goto exit;
+
+	// once the ttl is over, every record and hash is gone
+	libp2p_providerstore_expire(store, time(NULL) + PROVIDERSTORE_TTL + PROVIDERSTORE_WHEEL_TICK * 2);
+	if (store->index.count != 0)
+		goto exit;
+	for(int i = 0; i < PROVIDERSTORE_WHEEL_SLOTS; i++) {
+		if (store->wheel[i] != NULL)
+			goto exit;
+	}
+
+	retVal = 1;
+	exit:
+	free(peer_id);
+	libp2p_providerstore_free(store);
+	return retVal;
+}
+
 int test_peer_protobuf() {
 	int retVal = 0;
 	struct Libp2pPeer *peer = NULL, *peer_result = NULL;
@@ -83,8 +251,8 @@ int test_peer_protobuf() {
 	libp2p_peer_protobuf_decode(protobuf, protobuf_size, &peer_result);
 	ma_result = peer_result->addr_head->item;
 
-	if (strcmp(ma->string, ma_result->string) != 0) {
-		fprintf(stderr, "Results to not match: %s vs %s\n", ma->string, ma_result->string);
+	if (strcmp(multiaddress_to_string(ma), multiaddress_to_string(ma_result)) != 0) {
+		fprintf(stderr, "Results to not match: %s vs %s\n", multiaddress_to_string(ma), multiaddress_to_string(ma_result));
 		goto exit;
 	}
 
@@ -2,6 +2,7 @@
 
 #include "libp2p/record/record.h"
 #include "libp2p/record/message.h"
+#include "libp2p/record/message_view.h"
 #include "libp2p/peer/peer.h"
 #include "multiaddr/multiaddr.h"
 
@@ -249,7 +250,7 @@ int test_record_message_protobuf() {
 
 	ma_result = ((struct Libp2pPeer*)result->closer_peer_head->item)->addr_head->item;
 
-	if (strcmp(ma_result->string, ((struct MultiAddress*)closer_peer->addr_head->item)->string) != 0) {
+	if (strcmp(multiaddress_to_string(ma_result), multiaddress_to_string((struct MultiAddress*)closer_peer->addr_head->item)) != 0) {
 		fprintf(stderr, "MultiAddress strings do not match\n");
 		goto exit;
 	}
@@ -265,3 +266,177 @@ int test_record_message_protobuf() {
 		libp2p_message_free(result);
 	return retVal;
 }
+
+/***
+ * A FIND_NODE message with a record and closer peers, each with 2 addresses
+ */
+struct Libp2pMessage* test_record_message_create(int peer_count) {
+	struct Libp2pMessage* message = libp2p_message_new();
+	struct Libp2pLinkedList* last = NULL;
+	char str[128];
+
+	if (message == NULL)
+		return NULL;
+	message->message_type = MESSAGE_TYPE_FIND_NODE;
+	setval(&message->key, &message->key_size, "QmW8CYQuoJhgfxTeNVFWktGFnTRzdUAimerSsHaE4rUXk8");
+	message->record = test_record_create();
+	message->cluster_level_raw = 300;
+	for(int i = 0; i < peer_count; i++) {
+		struct Libp2pPeer* peer = libp2p_peer_new();
+		sprintf(str, "QmPeer%d", i);
+		setval(&peer->id, &peer->id_size, str);
+		peer->connection_type = CONNECTION_TYPE_CAN_CONNECT;
+		peer->addr_head = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/10.0.0.%d/tcp/4001", i);
+		peer->addr_head->item = multiaddress_new_from_string(str);
+		peer->addr_head->next = libp2p_utils_linked_list_new();
+		sprintf(str, "/ip4/127.0.0.1/tcp/%d", 4001 + i);
+		peer->addr_head->next->item = multiaddress_new_from_string(str);
+		struct Libp2pLinkedList* item = libp2p_utils_linked_list_new();
+		item->item = peer;
+		if (last == NULL)
+			message->closer_peer_head = item;
+		else
+			last->next = item;
+		last = item;
+	}
+	return message;
+}
+
+/***
+ * A FIND_NODE reply with 20 closer peers is sized exactly, and needs no
+ * more room than that
+ */
+int test_record_message_protobuf_exact() {
+	int retVal = 0;
+	struct Libp2pMessage* message = test_record_message_create(20);
+	struct Libp2pMessage* result = NULL;
+	unsigned char* buffer = NULL;
+	size_t buffer_len = 0;
+	size_t bytes_written = 0;
+	char str[128];
+
+	if (message == NULL)
+		goto exit;
+
+	buffer_len = libp2p_message_protobuf_encode_size(message);
+	buffer = malloc(buffer_len);
+	if (buffer == NULL)
+		goto exit;
+	// one byte short must fail rather than overrun
+	if (libp2p_message_protobuf_encode(message, buffer, buffer_len - 1, &bytes_written))
+		goto exit;
+	if (!libp2p_message_protobuf_encode(message, buffer, buffer_len, &bytes_written) || bytes_written != buffer_len) {
+		fprintf(stderr, "Expected %lu bytes but wrote %lu\n", (unsigned long)buffer_len, (unsigned long)bytes_written);
+		goto exit;
+	}
+
+	if (!libp2p_message_protobuf_decode(buffer, bytes_written, &result))
+		goto exit;
+	if (result->message_type != MESSAGE_TYPE_FIND_NODE || result->cluster_level_raw != 300 || result->record == NULL)
+		goto exit;
+	if (result->record->key_size != 3 || strncmp(result->record->key, "Key", 3) != 0)
+		goto exit;
+	int count = 0;
+	struct Libp2pLinkedList* current = result->closer_peer_head;
+	while (current != NULL) {
+		struct Libp2pPeer* peer = (struct Libp2pPeer*)current->item;
+		sprintf(str, "QmPeer%d", count);
+		if (peer->id_size != strlen(str) || strncmp(peer->id, str, peer->id_size) != 0)
+			goto exit;
+		if (peer->addr_head == NULL || peer->addr_head->next == NULL)
+			goto exit;
+		count++;
+		current = current->next;
+	}
+	if (count != 20)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_message_free(message);
+	libp2p_message_free(result);
+	free(buffer);
+	return retVal;
+}
+
+/***
+ * The view of a FIND_NODE reply points into the buffer, matches what was
+ * encoded, and refuses truncated buffers
+ */
+int test_record_message_view() {
+	int retVal = 0;
+	struct Libp2pMessage* message = test_record_message_create(20);
+	struct Libp2pMessageView view;
+	struct Libp2pPeerView peer_view;
+	struct Libp2pPeer* peer = NULL;
+	unsigned char* buffer = NULL;
+	size_t buffer_len = 0;
+	size_t pos = 0;
+	char str[128];
+
+	if (message == NULL || !libp2p_message_protobuf_allocate_and_encode(message, &buffer, &buffer_len))
+		goto exit;
+
+	if (!libp2p_message_view_decode(buffer, buffer_len, &view))
+		goto exit;
+	if (view.message_type != MESSAGE_TYPE_FIND_NODE || view.cluster_level_raw != 300)
+		goto exit;
+	if (view.closer_peer_count != 20 || view.provider_peer_count != 0)
+		goto exit;
+	// the key and record point into the buffer
+	if (view.key < buffer || view.key >= buffer + buffer_len)
+		goto exit;
+	if (view.key_size != message->key_size || memcmp(view.key, message->key, view.key_size) != 0)
+		goto exit;
+	if (!view.has_record || view.record.key_size != 3 || memcmp(view.record.key, "Key", 3) != 0)
+		goto exit;
+	if (view.record.value_size != message->record->value_size || memcmp(view.record.value, message->record->value, view.record.value_size) != 0)
+		goto exit;
+
+	int count = 0;
+	struct Libp2pLinkedList* current = message->closer_peer_head;
+	while (libp2p_message_view_next_peer(&view, MESSAGE_VIEW_CLOSER_PEERS, &pos, &peer_view)) {
+		if (current == NULL)
+			goto exit;
+		struct Libp2pPeer* original = (struct Libp2pPeer*)current->item;
+		sprintf(str, "QmPeer%d", count);
+		if (peer_view.id_size != strlen(str) || memcmp(peer_view.id, str, peer_view.id_size) != 0)
+			goto exit;
+		if (peer_view.address_count != 2 || peer_view.connection_type != CONNECTION_TYPE_CAN_CONNECT)
+			goto exit;
+		peer = libp2p_peer_view_to_peer(&peer_view);
+		if (peer == NULL || peer->addr_head == NULL || peer->addr_head->next == NULL)
+			goto exit;
+		struct MultiAddress* expected = (struct MultiAddress*)original->addr_head->next->item;
+		struct MultiAddress* actual = (struct MultiAddress*)peer->addr_head->next->item;
+		if (actual == NULL || actual->bsize != expected->bsize || memcmp(actual->bytes, expected->bytes, actual->bsize) != 0)
+			goto exit;
+		current = current->next;
+		libp2p_peer_free(peer);
+		peer = NULL;
+		count++;
+	}
+	if (count != 20)
+		goto exit;
+	pos = 0;
+	if (libp2p_message_view_next_peer(&view, MESSAGE_VIEW_PROVIDER_PEERS, &pos, &peer_view))
+		goto exit;
+
+	// a truncated buffer is refused unless it ends between two fields
+	int accepted = 0;
+	for(size_t i = 1; i < buffer_len; i++) {
+		if (libp2p_message_view_decode(buffer, i, &view))
+			accepted++;
+	}
+	// type, key, record and the 20 peers
+	if (accepted != 23)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	libp2p_peer_free(peer);
+	libp2p_message_free(message);
+	free(buffer);
+	return retVal;
+}
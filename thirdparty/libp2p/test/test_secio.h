@@ -1,10 +1,15 @@
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
 #include "libp2p/secio/secio.h"
 #include "libp2p/secio/exchange.h"
+#include "libp2p/crypto/ephemeral.h"
 #include "libp2p/net/multistream.h"
 #include "libp2p/net/p2pnet.h"
 #include "libp2p/utils/logger.h"
+#include "secio_helper.h"
 
 int test_secio_handshake() {
 	int retVal = 0;
@@ -65,6 +70,7 @@ int test_secio_handshake() {
 	exit:
 	if (secure_session.insecure_stream != NULL)
 		libp2p_net_multistream_stream_free(secure_session.insecure_stream);
+	libp2p_secio_stop_ciphers(&secure_session);
 	if (secure_session.local_stretched_key != NULL)
 		libp2p_crypto_ephemeral_stretched_key_free(secure_session.local_stretched_key);
 	if (secure_session.remote_stretched_key != NULL)
@@ -100,7 +106,7 @@ int test_secio_encrypt_decrypt() {
 	size_t encrypted_size = 0;
 	unsigned char* results = NULL;
 	size_t results_size = 0;
-	struct SessionContext secure_session;
+	struct SessionContext secure_session = {0};
 	struct StretchedKey stretched_key;
 
 	secure_session.local_stretched_key = &stretched_key;
@@ -114,24 +120,39 @@ int test_secio_encrypt_decrypt() {
 	secure_session.local_stretched_key->iv = "abcdefghijklmnop";
 	secure_session.mac_function = NULL;
 
-	if (!libp2p_secio_encrypt(&secure_session, original, strlen((char*)original), &encrypted, &encrypted_size)) {
-		fprintf(stderr, "Unable to encrypt\n");
+	if (!libp2p_secio_start_ciphers(&secure_session)) {
+		fprintf(stderr, "Unable to start ciphers\n");
 		goto exit;
 	}
 
-	if (!libp2p_secio_decrypt(&secure_session, encrypted, encrypted_size, &results, &results_size)) {
-		fprintf(stderr, "Unable to decrypt\n");
-		goto exit;
-	}
+	// the cipher streams carry on from one message to the next
+	for(int i = 0; i < 2; i++) {
+		if (results != NULL)
+			free(results);
+		if (encrypted != NULL)
+			free(encrypted);
+		results = NULL;
+		encrypted = NULL;
 
-	if (results_size != strlen((char*)original)) {
-		fprintf(stderr, "Results size are different. Results size = %lu and original is %lu\n", results_size, strlen((char*)original));
-		goto exit;
-	}
+		if (!libp2p_secio_encrypt(&secure_session, original, strlen((char*)original), &encrypted, &encrypted_size)) {
+			fprintf(stderr, "Unable to encrypt\n");
+			goto exit;
+		}
 
-	if (strncmp(original, results, strlen( (char*) original)) != 0) {
-		fprintf(stderr, "String comparison did not match\n");
-		goto exit;
+		if (!libp2p_secio_decrypt(&secure_session, encrypted, encrypted_size, &results, &results_size)) {
+			fprintf(stderr, "Unable to decrypt\n");
+			goto exit;
+		}
+
+		if (results_size != strlen((char*)original)) {
+			fprintf(stderr, "Results size are different. Results size = %lu and original is %lu\n", results_size, strlen((char*)original));
+			goto exit;
+		}
+
+		if (strncmp(original, results, strlen( (char*) original)) != 0) {
+			fprintf(stderr, "String comparison did not match\n");
+			goto exit;
+		}
 	}
 
 	retVal = 1;
@@ -140,6 +161,7 @@ int test_secio_encrypt_decrypt() {
 		free(results);
 	if (encrypted != NULL)
 		free(encrypted);
+	libp2p_secio_stop_ciphers(&secure_session);
 	return retVal;
 }
 
@@ -174,3 +196,110 @@ int test_secio_exchange_protobuf_encode() {
 	libp2p_secio_exchange_free(exch);
 	return retVal;
 }
+
+struct TestSecioPeer {
+	struct SessionContext session;
+	struct RsaPrivateKey* private_key;
+	int optimistic;
+	int ok;
+};
+
+/***
+ * The listening side: take the protocol id, handshake, say hello and wait for ping
+ */
+void* test_secio_handshake_listener(void* arg) {
+	struct TestSecioPeer* peer = (struct TestSecioPeer*)arg;
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+
+	if (libp2p_net_multistream_read(&peer->session, &results, &results_size, 5) <= 0)
+		return NULL;
+	free(results);
+	results = NULL;
+	if (peer->optimistic) {
+		if (!libp2p_secio_handshake_optimistic(&peer->session, peer->private_key, 1))
+			return NULL;
+	} else if (!libp2p_secio_handshake(&peer->session, peer->private_key, 1)) {
+		return NULL;
+	}
+	if (peer->session.default_stream->write(&peer->session, (unsigned char*)"hello", 5) <= 0)
+		return NULL;
+	if (peer->session.default_stream->read(&peer->session, &results, &results_size, 5) == 4
+			&& memcmp(results, "ping", 4) == 0)
+		peer->ok = 1;
+	if (results != NULL)
+		free(results);
+	return NULL;
+}
+
+/***
+ * Handshake over a socket pair with each side lock-step or optimistic, and
+ * talk both ways, so that the nonce checks left to the first reads are done
+ */
+int test_secio_handshake_optimistic() {
+	int retVal = 0;
+	struct RsaPrivateKey* listener_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct RsaPrivateKey* dialer_key = libp2p_crypto_rsa_rsa_private_key_new();
+	struct TestSecioPeer listener;
+	struct TestSecioPeer dialer;
+	unsigned char* results = NULL;
+	size_t results_size = 0;
+	// dialer, listener: optimistic or not
+	int modes[3][2] = { { 1, 0 }, { 0, 1 }, { 1, 1 } };
+
+	memset(&listener, 0, sizeof(struct TestSecioPeer));
+	memset(&dialer, 0, sizeof(struct TestSecioPeer));
+	if (listener_key == NULL || dialer_key == NULL
+			|| !libp2p_crypto_rsa_generate_keypair(listener_key, 1024)
+			|| !libp2p_crypto_rsa_generate_keypair(dialer_key, 1024))
+		goto exit;
+
+	for(int i = 0; i < 3; i++) {
+		int fds[2];
+		pthread_t thread;
+		int ok = 0;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			goto exit;
+		dialer.session.insecure_stream = libp2p_net_multistream_stream_new(fds[0], "127.0.0.1", 0);
+		listener.session.insecure_stream = libp2p_net_multistream_stream_new(fds[1], "127.0.0.1", 0);
+		dialer.private_key = dialer_key;
+		listener.private_key = listener_key;
+		dialer.optimistic = modes[i][0];
+		listener.optimistic = modes[i][1];
+		listener.ok = 0;
+		if (dialer.session.insecure_stream == NULL || listener.session.insecure_stream == NULL
+				|| pthread_create(&thread, NULL, test_secio_handshake_listener, &listener) != 0) {
+			secio_helper_session_clear(&dialer.session);
+			secio_helper_session_clear(&listener.session);
+			goto exit;
+		}
+		if (dialer.optimistic)
+			ok = libp2p_secio_handshake_optimistic(&dialer.session, dialer_key, 0);
+		else
+			ok = libp2p_secio_handshake(&dialer.session, dialer_key, 0);
+		if (ok)
+			ok = dialer.session.default_stream->read(&dialer.session, &results, &results_size, 5) == 5
+					&& memcmp(results, "hello", 5) == 0
+					&& dialer.session.default_stream->write(&dialer.session, (unsigned char*)"ping", 4) > 0;
+		if (results != NULL) {
+			free(results);
+			results = NULL;
+		}
+		// a failed dialer closes its end, which lets the listener give up
+		if (!ok)
+			shutdown(fds[0], SHUT_RDWR);
+		pthread_join(thread, NULL);
+		secio_helper_session_clear(&dialer.session);
+		secio_helper_session_clear(&listener.session);
+		if (!ok || !listener.ok) {
+			fprintf(stderr, "test_secio_handshake_optimistic: failed with dialer %d and listener %d\n", modes[i][0], modes[i][1]);
+			goto exit;
+		}
+	}
+
+	retVal = 1;
+	exit:
+	libp2p_crypto_rsa_rsa_private_key_free(listener_key);
+	libp2p_crypto_rsa_rsa_private_key_free(dialer_key);
+	return retVal;
+}
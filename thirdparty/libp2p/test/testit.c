@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 
 #include "crypto/test_aes.h"
@@ -13,6 +15,10 @@
 #include "test_conn.h"
 #include "test_record.h"
 #include "test_peer.h"
+#include "test_hashmap.h"
+#include "test_arena.h"
+#include "test_dht.h"
+#include "test_kademlia.h"
 #include "libp2p/utils/logger.h"
 
 const char* names[] = {
@@ -21,6 +27,7 @@ const char* names[] = {
 		"test_mbedtls_varint_128_string",
 		"test_crypto_rsa_private_key_der",
 		"test_crypto_rsa_signing",
+		"test_crypto_rsa_signer",
 		"test_crypto_rsa_public_key_to_peer_id",
 		"test_crypto_x509_der_to_private2",
 		"test_crypto_x509_der_to_private",
@@ -38,24 +45,51 @@ const char* names[] = {
 		//"test_crypto_rsa_sign",
 		"test_crypto_encoding_base32_encode",
 		"test_protobuf_private_key",
+		"test_crypto_key_cache",
+		"test_crypto_key_cache_threads",
 		"test_secio_handshake",
 		"test_secio_encrypt_decrypt",
+		"test_secio_handshake_optimistic",
 		"test_secio_exchange_protobuf_encode",
 		"test_multistream_connect",
 		"test_multistream_get_list",
+		"test_multistream_read_buffered",
+		"test_multistream_read_refused_frames",
 		"test_ephemeral_key_generate",
 		"test_ephemeral_key_sign",
+		"test_ephemeral_pool",
 		"test_dialer_new",
+		"test_dialer_dial_local",
 		"test_dialer_dial",
 		"test_dialer_dial_multistream",
 		"test_record_protobuf",
 		"test_record_make_put_record",
 		"test_record_peer_protobuf",
 		"test_record_message_protobuf",
+		"test_record_message_protobuf_exact",
+		"test_record_message_view",
 		"test_peer",
 		"test_peer_protobuf",
 		"test_peerstore",
-		"test_aes"
+		"test_peerstore_index",
+		"test_peerstore_quiet_logging",
+		"test_providerstore",
+		"test_hashmap",
+		"test_hashmap_id",
+		"test_arena",
+		"test_arena_peer_copy",
+		"test_aes",
+		"test_dht_routing_table",
+		"test_dht_closest_nodes",
+		"test_dht_eviction",
+		"test_dht_nodes_counts",
+		"test_dht_dump_tables",
+		"test_dht_storage_announce",
+		"test_dht_storage_grow",
+		"test_dht_storage_expire",
+		"test_kademlia_concurrent_search",
+		"test_kademlia_search_release",
+		"test_kademlia_snapshot"
 };
 
 int (*funcs[])(void) = {
@@ -64,6 +98,7 @@ int (*funcs[])(void) = {
 		test_mbedtls_varint_128_string,
 		test_crypto_rsa_private_key_der,
 		test_crypto_rsa_signing,
+		test_crypto_rsa_signer,
 		test_crypto_rsa_public_key_to_peer_id,
 		test_crypto_x509_der_to_private2,
 		test_crypto_x509_der_to_private,
@@ -81,24 +116,51 @@ int (*funcs[])(void) = {
 		//test_crypto_rsa_sign,
 		test_crypto_encoding_base32_encode,
 		test_protobuf_private_key,
+		test_crypto_key_cache,
+		test_crypto_key_cache_threads,
 		test_secio_handshake,
 		test_secio_encrypt_decrypt,
+		test_secio_handshake_optimistic,
 		test_secio_exchange_protobuf_encode,
 		test_multistream_connect,
 		test_multistream_get_list,
+		test_multistream_read_buffered,
+		test_multistream_read_refused_frames,
 		test_ephemeral_key_generate,
 		test_ephemeral_key_sign,
+		test_ephemeral_pool,
 		test_dialer_new,
+		test_dialer_dial_local,
 		test_dialer_dial,
 		test_dialer_dial_multistream,
 		test_record_protobuf,
 		test_record_make_put_record,
 		test_record_peer_protobuf,
 		test_record_message_protobuf,
+		test_record_message_protobuf_exact,
+		test_record_message_view,
 		test_peer,
 		test_peer_protobuf,
 		test_peerstore,
-		test_aes
+		test_peerstore_index,
+		test_peerstore_quiet_logging,
+		test_providerstore,
+		test_hashmap,
+		test_hashmap_id,
+		test_arena,
+		test_arena_peer_copy,
+		test_aes,
+		test_dht_routing_table,
+		test_dht_closest_nodes,
+		test_dht_eviction,
+		test_dht_nodes_counts,
+		test_dht_dump_tables,
+		test_dht_storage_announce,
+		test_dht_storage_grow,
+		test_dht_storage_expire,
+		test_kademlia_concurrent_search,
+		test_kademlia_search_release,
+		test_kademlia_snapshot
 };
 
 int testit(const char* name, int (*func)(void)) {
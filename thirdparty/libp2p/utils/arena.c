@@ -0,0 +1,105 @@
+#include <stdlib.h>
+
+#include "libp2p/utils/arena.h"
+
+struct Libp2pArenaBlock {
+	struct Libp2pArenaBlock* next;
+	size_t size;
+	size_t used;
+};
+
+/* the block header, rounded up so that what follows it is aligned */
+#define ARENA_HEADER_SIZE ((sizeof(struct Libp2pArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static unsigned char* libp2p_utils_arena_block_data(struct Libp2pArenaBlock* block) {
+	return (unsigned char*)block + ARENA_HEADER_SIZE;
+}
+
+void libp2p_utils_arena_init(struct Libp2pArena* arena, size_t block_size) {
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->block_size = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+	arena->used = 0;
+	arena->allocations = 0;
+	arena->mallocs = 0;
+	arena->high_water = 0;
+}
+
+struct Libp2pArena* libp2p_utils_arena_new(size_t block_size) {
+	struct Libp2pArena* out = (struct Libp2pArena*)malloc(sizeof(struct Libp2pArena));
+	if (out != NULL)
+		libp2p_utils_arena_init(out, block_size);
+	return out;
+}
+
+void* libp2p_utils_arena_alloc(struct Libp2pArena* arena, size_t size) {
+	if (arena == NULL)
+		return malloc(size);
+
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	// the current block is always the last one
+	struct Libp2pArenaBlock* block = arena->current;
+	if (block == NULL || block->size - block->used < size) {
+		size_t block_size = size > arena->block_size ? size : arena->block_size;
+		block = (struct Libp2pArenaBlock*)malloc(ARENA_HEADER_SIZE + block_size);
+		if (block == NULL)
+			return NULL;
+		block->next = NULL;
+		block->size = block_size;
+		block->used = 0;
+		if (arena->current == NULL)
+			arena->first = block;
+		else
+			arena->current->next = block;
+		arena->mallocs++;
+	}
+	arena->current = block;
+
+	void* out = libp2p_utils_arena_block_data(block) + block->used;
+	block->used += size;
+	arena->used += size;
+	arena->allocations++;
+	if (arena->used > arena->high_water)
+		arena->high_water = arena->used;
+	return out;
+}
+
+static void libp2p_utils_arena_free_blocks(struct Libp2pArenaBlock* block) {
+	while (block != NULL) {
+		struct Libp2pArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+void libp2p_utils_arena_reset(struct Libp2pArena* arena) {
+	if (arena == NULL)
+		return;
+	if (arena->first != NULL) {
+		libp2p_utils_arena_free_blocks(arena->first->next);
+		arena->first->next = NULL;
+		arena->first->used = 0;
+	}
+	arena->current = arena->first;
+	arena->used = 0;
+	arena->allocations = 0;
+	arena->mallocs = 0;
+}
+
+void libp2p_utils_arena_clear(struct Libp2pArena* arena) {
+	if (arena == NULL)
+		return;
+	libp2p_utils_arena_free_blocks(arena->first);
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->used = 0;
+	arena->allocations = 0;
+	arena->mallocs = 0;
+}
+
+void libp2p_utils_arena_free(struct Libp2pArena* arena) {
+	if (arena == NULL)
+		return;
+	libp2p_utils_arena_clear(arena);
+	free(arena);
+}
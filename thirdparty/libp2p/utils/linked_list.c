@@ -3,7 +3,11 @@
 #include "libp2p/utils/linked_list.h"
 
 struct Libp2pLinkedList* libp2p_utils_linked_list_new() {
-	struct Libp2pLinkedList* out = (struct Libp2pLinkedList*)malloc(sizeof(struct Libp2pLinkedList));
+	return libp2p_utils_linked_list_new_in(NULL);
+}
+
+struct Libp2pLinkedList* libp2p_utils_linked_list_new_in(struct Libp2pArena* arena) {
+	struct Libp2pLinkedList* out = (struct Libp2pLinkedList*)libp2p_utils_arena_alloc(arena, sizeof(struct Libp2pLinkedList));
 	if (out != NULL) {
 		out->item = NULL;
 		out->next = NULL;
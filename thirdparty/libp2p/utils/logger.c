@@ -55,6 +55,22 @@ void libp2p_logger_add_class(const char* str) {
 	libp2p_utils_vector_add(logger_classes, ptr);
 }
 
+/***
+ * Checks to see if messages from a class are printed, so that what is
+ * costly to put in a message can be skipped when it is not
+ * @param area the class name
+ * @returns true(1) if the class is watched
+ */
+int libp2p_logger_watching_class(const char* area) {
+	if (!libp2p_logger_initialized())
+		return 0;
+	for (int i = 0; i < logger_classes->total; i++) {
+		if (strcmp(libp2p_utils_vector_get(logger_classes, i), area) == 0)
+			return 1;
+	}
+	return 0;
+}
+
 /**
  * Log a message to the console
  * @param area the class it is coming from
@@ -66,14 +82,7 @@ void libp2p_logger_log(const char* area, int log_level, const char* format, ...)
 	if (!libp2p_logger_initialized())
 		libp2p_logger_init();
 	if (log_level <= CURRENT_LOGLEVEL) {
-		int found = 0;
-		for (int i = 0; i < logger_classes->total; i++) {
-			if (strcmp(libp2p_utils_vector_get(logger_classes, i), area) == 0) {
-				found = 1;
-				break;
-			}
-		}
-		if (found) {
+		if (libp2p_logger_watching_class(area)) {
 			va_list argptr;
 			va_start(argptr, format);
 			vfprintf(stderr, format, argptr);
@@ -98,14 +107,8 @@ void libp2p_logger_vlog(const char* area, int log_level, const char* format, va_
 		// error should always be printed for now. We need to think about this more...
 		if (log_level <= LOGLEVEL_ERROR )
 			found = 1;
-		else {
-			for (int i = 0; i < logger_classes->total; i++) {
-				if (strcmp(libp2p_utils_vector_get(logger_classes, i), area) == 0) {
-					found = 1;
-					break;
-				}
-			}
-		}
+		else
+			found = libp2p_logger_watching_class(area);
 		if (found) {
 			vfprintf(stderr, format, argptr);
 		}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+
+#include "libp2p/utils/slot_index.h"
+
+uint64_t libp2p_utils_slot_index_hash(const unsigned char* key, size_t key_size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < key_size; i++) {
+		hash ^= key[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+int libp2p_utils_slot_index_init(struct Libp2pSlotIndex* index, size_t capacity) {
+	index->slots = (struct Libp2pSlot*)calloc(capacity, sizeof(struct Libp2pSlot));
+	if (index->slots == NULL)
+		return 0;
+	index->capacity = capacity;
+	index->count = 0;
+	return 1;
+}
+
+void libp2p_utils_slot_index_release(struct Libp2pSlotIndex* index) {
+	free(index->slots);
+	index->slots = NULL;
+	index->capacity = 0;
+	index->count = 0;
+}
+
+struct Libp2pSlot* libp2p_utils_slot_index_find(struct Libp2pSlotIndex* index, const unsigned char* key, size_t key_size, uint64_t hash, libp2p_utils_slot_index_match match) {
+	size_t mask = index->capacity - 1;
+	size_t pos = hash & mask;
+	while (1) {
+		struct Libp2pSlot* slot = &index->slots[pos];
+		if (slot->item == NULL)
+			return slot;
+		if (slot->hash == hash && match(slot->item, key, key_size))
+			return slot;
+		pos = (pos + 1) & mask;
+	}
+}
+
+int libp2p_utils_slot_index_reserve(struct Libp2pSlotIndex* index) {
+	// keep it no more than 3/4 full, so probes stay short
+	if ((index->count + 1) * 4 <= index->capacity * 3)
+		return 1;
+	size_t capacity = index->capacity * 2;
+	struct Libp2pSlot* slots = (struct Libp2pSlot*)calloc(capacity, sizeof(struct Libp2pSlot));
+	if (slots == NULL)
+		return 0;
+	// the items themselves do not move
+	for(size_t i = 0; i < index->capacity; i++) {
+		struct Libp2pSlot* old = &index->slots[i];
+		if (old->item == NULL)
+			continue;
+		size_t pos = old->hash & (capacity - 1);
+		while (slots[pos].item != NULL)
+			pos = (pos + 1) & (capacity - 1);
+		slots[pos] = *old;
+	}
+	free(index->slots);
+	index->slots = slots;
+	index->capacity = capacity;
+	return 1;
+}
+
+void libp2p_utils_slot_index_fill(struct Libp2pSlotIndex* index, struct Libp2pSlot* slot, uint64_t hash, void* item) {
+	slot->hash = hash;
+	slot->item = item;
+	index->count++;
+}
+
+void libp2p_utils_slot_index_remove(struct Libp2pSlotIndex* index, struct Libp2pSlot* slot) {
+	size_t mask = index->capacity - 1;
+	size_t pos = slot - index->slots;
+	size_t next = pos;
+	index->slots[pos].item = NULL;
+	index->count--;
+	while (1) {
+		next = (next + 1) & mask;
+		struct Libp2pSlot* moved = &index->slots[next];
+		if (moved->item == NULL)
+			return;
+		size_t home = moved->hash & mask;
+		// move it back unless its home lies cyclically in (pos, next]
+		int stays = pos <= next ? (home > pos && home <= next) : (home > pos || home <= next);
+		if (!stays) {
+			index->slots[pos] = *moved;
+			moved->item = NULL;
+			pos = next;
+		}
+	}
+}
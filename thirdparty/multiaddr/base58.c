@@ -157,7 +157,7 @@ int multiaddr_encoding_base58_encode(const unsigned char* data, size_t binsz, un
 	}
 	
 	if (zcount) {
-		memset(b58, '1', zcount);
+		memset(*b58, '1', zcount);
 	}
 	for (i = zcount; j < (ssize_t)size; ++i, ++j) {
 		(*b58)[i] = b58digits_ordered[buf[j]];
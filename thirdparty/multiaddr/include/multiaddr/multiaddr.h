@@ -1,6 +1,8 @@
 #ifndef MULTIADDR
 #define MULTIADDR
 #include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #include "varhexutils.h"
 #include "varint.h"
@@ -31,15 +33,26 @@
 
 struct MultiAddress
 {
-	// A MultiAddress represented as a string
+	// A MultiAddress represented as a string. Built when first asked for,
+	// so read it with multiaddress_to_string
 	char* string;
 	// A MultiAddress represented as an array of bytes
 	//<varint proto><n byte addr><1 byte protocol code><4 byte ipv4 address or 16 byte ipv6 address><1 byte tcp/udp code><2 byte port>
 	uint8_t* bytes;
 	size_t bsize;
+	// the bytes, parsed once whenever they are set
+	int component_count;
+	struct MultiAddressComponent components[MULTIADDRESS_MAX_COMPONENTS];
+	// an ip4 or ip6 address followed by tcp or udp, decoded. The family is 0 if
+	// there is none, and the port -1
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} sockaddr;
+	int port;
 };
 
-
 int strpos(char *haystack, char *needle);
 
 struct MultiAddress* multiaddress_new_from_bytes(const uint8_t* byteaddress, int size); //Construct new address from bytes
@@ -50,6 +63,35 @@ void multiaddress_free(struct MultiAddress* in);
 
 struct MultiAddress* multiaddress_copy(const struct MultiAddress* source);
 
+/**
+ * Copy a multiaddress, taking the memory from allocate(context, size) rather than malloc.
+ * The copy is released as the allocator requires, never with multiaddress_free
+ */
+struct MultiAddress* multiaddress_copy_with(const struct MultiAddress* source, void* (*allocate)(void* context, size_t size), void* context);
+
+/**
+ * The string form of a MultiAddress, built from its bytes the first time it is asked for
+ * @param in the MultiAddress
+ * @returns the string, owned by the MultiAddress, or NULL on error
+ */
+const char* multiaddress_to_string(const struct MultiAddress* in);
+
+/**
+ * Find the first component with a protocol code
+ * @param in the MultiAddress
+ * @param code the protocol code
+ * @returns the component, or NULL if there is none
+ */
+const struct MultiAddressComponent* multiaddress_find_component(const struct MultiAddress* in, int code);
+
+/**
+ * The decoded ip address and port, ready for connect() or bind()
+ * @param in the MultiAddress
+ * @param size where to put the size of the address
+ * @returns the address, or NULL if there is no ip address with a tcp or udp port
+ */
+const struct sockaddr* multiaddress_get_sockaddr(const struct MultiAddress* in, socklen_t* size);
+
 // helpers to parse the MultiAddress struct
 
 int multiaddress_encapsulate(struct MultiAddress * result, char * string);
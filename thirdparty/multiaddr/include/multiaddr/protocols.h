@@ -16,25 +16,24 @@ struct Protocol
 	char name[30];
 };
 
-struct ProtocolListItem {
-	struct Protocol* current;
-	struct ProtocolListItem* next;
-};
-
-int protocol_REMOVE_id(struct ProtocolListItem* head, int remid); //Function to remove & shift back all data, sort of like c++ vectors.
-
-void unload_protocols(struct ProtocolListItem* head);
-
 /**
- * load the available protocols into the global protocol_P
- * @returns True(1) on success, otherwise 0
+ * The protocols are a static table, so lookups allocate nothing and the
+ * results must not be freed
  */
-int load_protocols(struct ProtocolListItem** head);
-
-struct Protocol * proto_with_name(const struct ProtocolListItem* head, const char* proto_w_name); //Search for protocol with inputted name
 
-struct Protocol * proto_with_deccode(const struct ProtocolListItem* head, int proto_w_deccode); //Search for protocol with inputted deccode
+/**
+ * Find a protocol by its code
+ * @param code the code
+ * @returns the protocol, or NULL if there is none with that code
+ */
+const struct Protocol* proto_with_code(int code);
 
-void protocols_with_string(const struct ProtocolListItem* head, char * meee, int sizi); // NOT FINISHED, DO NOT USE!
+/**
+ * Find a protocol by its name
+ * @param name the name, which need not be NULL terminated
+ * @param length the length of the name
+ * @returns the protocol, or NULL if there is none with that name
+ */
+const struct Protocol* proto_with_name(const char* name, size_t length);
 
 #endif
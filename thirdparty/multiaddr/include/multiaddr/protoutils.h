@@ -1,6 +1,33 @@
 #ifndef PROTOUTILS
 #define PROTOUTILS
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocols.h"
+
+/**
+ * The most components a MultiAddress may have
+ */
+#define MULTIADDRESS_MAX_COMPONENTS 8
+
+/**
+ * The longest the bytes of a MultiAddress may be
+ */
+#define MULTIADDRESS_MAX_BYTES 512
+
+/**
+ * One /protocol/value pair of a MultiAddress, as found in its bytes
+ */
+struct MultiAddressComponent
+{
+	// the protocol code
+	uint16_t code;
+	// where the value starts in bytes, and how long it is
+	uint16_t offset;
+	uint16_t size;
+};
+
 //////////////////////////////////////////////////////////
 char ASCII2bits(char ch);
 
@@ -31,25 +58,57 @@ uint64_t ip2int(const char * ipconvertint);
 
 char * int2ip(int inputintip);
 
+/**
+ * Split the bytes of a MultiAddress into its components. Each is a varint
+ * protocol code, followed by a value of the size the protocol has. Values of
+ * variable size, such as ipfs, are prefixed by their length as a varint.
+ * @param bytes the bytes
+ * @param bytes_size the length of the bytes
+ * @param components where to put the components, MULTIADDRESS_MAX_COMPONENTS of them
+ * @param component_count where to put how many there are
+ * @returns true(1) on success, 0 if the bytes are not a MultiAddress we understand
+ */
+int multiaddr_bytes_parse(const uint8_t* bytes, size_t bytes_size, struct MultiAddressComponent* components, int* component_count);
+
+/**
+ * Build the string form of parsed bytes
+ * @param bytes the bytes
+ * @param components the components found by multiaddr_bytes_parse
+ * @param component_count how many there are
+ * @returns the string, which the caller frees, or NULL on error
+ */
+char* multiaddr_components_format(const uint8_t* bytes, const struct MultiAddressComponent* components, int component_count);
+
 /**
  * Unserialize the bytes into a string
  * @param results where to put the resultant string
  * @param bytes the bytes to unserialize
  * @param bytes_size the length of the bytes array
+ * @returns true(1) on success, otherwise 0
  */
 int bytes_to_string(char** results, const uint8_t* bytes, int bytes_size);
 
 /**
- * Convert an address string to a byte representation
+ * Convert the value of one component from its string form to bytes
  * @param protocol the protocol to use
- * @param incoming the byte array
- * @param incoming_size the size of the byte array
- * @param results the results
- * @param results_size the size of the results
- * @returns the results array
+ * @param incoming the value, which need not be NULL terminated
+ * @param incoming_size the length of the value
+ * @param results where to write the bytes
+ * @param results_max how many bytes there is room for
+ * @param results_size where to put how many bytes were written
+ * @returns true(1) on success, otherwise 0
  */
-char * address_string_to_bytes(struct Protocol *protocol, const char *incoming, size_t incoming_size, char** results, int *results_size);
+int address_string_to_bytes(const struct Protocol* protocol, const char* incoming, size_t incoming_size, uint8_t* results, size_t results_max, size_t* results_size);
 
+/**
+ * Convert a MultiAddress string to its bytes, in one pass and without a
+ * scratch copy of the string
+ * @param finalbytes where to put the bytes, which the caller frees
+ * @param realbbsize where to put the length of the bytes
+ * @param strx the string
+ * @param strsize the most characters to read. The string may end sooner with a NULL
+ * @returns true(1) on success, otherwise 0
+ */
 int string_to_bytes(uint8_t** finalbytes,size_t* realbbsize, const char * strx, size_t strsize);
 
 #endif
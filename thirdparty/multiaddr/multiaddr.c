@@ -1,11 +1,16 @@
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "multiaddr/varhexutils.h"
 #include "multiaddr/varint.h"
 #include "multiaddr/protocols.h"
 #include "multiaddr/protoutils.h"
 #include "multiaddr/multiaddr.h"
+#include "multiaddr/base58.h"
 
 int strpos(char *haystack, char *needle)
 {
@@ -20,6 +25,41 @@ int strpos(char *haystack, char *needle)
 	}
 }
 
+/**
+ * Parse the bytes into components, and decode the ip address and port
+ * @param in the MultiAddress, with its bytes set
+ * @returns true(1) on success, otherwise 0
+ */
+static int multiaddress_parse(struct MultiAddress* in)
+{
+	memset(&in->sockaddr, 0, sizeof(in->sockaddr));
+	in->port = -1;
+	if (!multiaddr_bytes_parse(in->bytes, in->bsize, in->components, &in->component_count))
+		return 0;
+
+	// the port, and the address it is on
+	for(int i = 0; i < in->component_count; i++) {
+		const struct MultiAddressComponent* component = &in->components[i];
+		if (component->code == 6 || component->code == 17) {
+			in->port = (in->bytes[component->offset] << 8) | in->bytes[component->offset + 1];
+			break;
+		}
+	}
+	if (in->port >= 0) {
+		const struct MultiAddressComponent* ip = &in->components[0];
+		if (ip->code == 4) {
+			in->sockaddr.in4.sin_family = AF_INET;
+			memcpy(&in->sockaddr.in4.sin_addr, &in->bytes[ip->offset], 4);
+			in->sockaddr.in4.sin_port = htons(in->port);
+		} else if (ip->code == 41) {
+			in->sockaddr.in6.sin6_family = AF_INET6;
+			memcpy(&in->sockaddr.in6.sin6_addr, &in->bytes[ip->offset], 16);
+			in->sockaddr.in6.sin6_port = htons(in->port);
+		}
+	}
+	return 1;
+}
+
 /**
  * Construct a new MultiAddress struct
  * @returns an empty MultiAddress struct
@@ -27,38 +67,32 @@ int strpos(char *haystack, char *needle)
 struct MultiAddress* multiaddress_new() {
 	struct MultiAddress* out = (struct MultiAddress*)malloc(sizeof(struct MultiAddress));
 	if (out != NULL) {
-		out->bsize = 0;
-		out->bytes = NULL;
-		out->string = NULL;
+		memset(out, 0, sizeof(struct MultiAddress));
+		out->port = -1;
 	}
 	return out;
 }
 
 /**
- * construct a new MultiAddress from bytes
+ * construct a new MultiAddress from bytes. The string is only built if it is asked for.
  * @param byteaddress the byte array
  * @param size the size of the byte array
  * @returns a new MultiAddress struct filled in, or NULL on error
  */
 struct MultiAddress* multiaddress_new_from_bytes(const uint8_t* byteaddress, int size)//Construct new address from bytes
 {
+	if (byteaddress == NULL || size < 0)
+		return NULL;
 	struct MultiAddress* out = multiaddress_new();
 	if (out != NULL) {
-		if(byteaddress!=NULL)
-		{
-			out->bytes = malloc(size);
-			if (out->bytes == NULL) {
-				multiaddress_free(out);
-				return NULL;
-			}
-			out->bsize = size;
-			memcpy(out->bytes, byteaddress, size);
-			if(!bytes_to_string(&out->string,byteaddress,size)==1)
-			{
-				multiaddress_free(out);
-				return NULL;
-			}
-		} else {
+		out->bytes = malloc(size > 0 ? size : 1);
+		if (out->bytes == NULL) {
+			multiaddress_free(out);
+			return NULL;
+		}
+		out->bsize = size;
+		memcpy(out->bytes, byteaddress, size);
+		if (!multiaddress_parse(out)) {
 			multiaddress_free(out);
 			return NULL;
 		}
@@ -77,7 +111,7 @@ struct MultiAddress* multiaddress_new_from_string(const char* straddress)//Const
 		}
 		strcpy(out->string, straddress);
 
-		if (string_to_bytes(&(out->bytes), &out->bsize, out->string, strlen(out->string)) == 0 )
+		if (string_to_bytes(&(out->bytes), &out->bsize, out->string, strlen(out->string)) == 0 || !multiaddress_parse(out))
 		{
 			multiaddress_free(out);
 			return NULL;
@@ -86,28 +120,52 @@ struct MultiAddress* multiaddress_new_from_string(const char* straddress)//Const
 	return out;
 }
 
-int multiaddress_is_ip(const struct MultiAddress* in) {
-	if (in->bytes > 0) {
-		int byte = in->bytes[0];
+const char* multiaddress_to_string(const struct MultiAddress* in) {
+	if (in == NULL)
+		return NULL;
+	// the string is a cache of the bytes, so filling it in does not change the address
+	if (in->string == NULL)
+		((struct MultiAddress*)in)->string = multiaddr_components_format(in->bytes, in->components, in->component_count);
+	return in->string;
+}
 
-		if (byte == 4 || byte == 41)
-			return 1;
+const struct MultiAddressComponent* multiaddress_find_component(const struct MultiAddress* in, int code) {
+	for(int i = 0; i < in->component_count; i++) {
+		if (in->components[i].code == code)
+			return &in->components[i];
 	}
-	return 0;
+	return NULL;
 }
+
+const struct sockaddr* multiaddress_get_sockaddr(const struct MultiAddress* in, socklen_t* size) {
+	if (in->sockaddr.sa.sa_family == AF_INET) {
+		*size = sizeof(struct sockaddr_in);
+		return &in->sockaddr.sa;
+	}
+	if (in->sockaddr.sa.sa_family == AF_INET6) {
+		*size = sizeof(struct sockaddr_in6);
+		return &in->sockaddr.sa;
+	}
+	return NULL;
+}
+
+int multiaddress_is_ip(const struct MultiAddress* in) {
+	return multiaddress_is_ip4(in) || multiaddress_is_ip6(in);
+}
+
 int multiaddress_is_ip4(const struct MultiAddress* in) {
-	return in->bytes[0] == 4;
+	return in->component_count > 0 && in->components[0].code == 4;
 }
 
 int multiaddress_is_ip6(const struct MultiAddress* in) {
-	return in->bytes[0] == 41;
+	return in->component_count > 0 && in->components[0].code == 41;
 }
 
 
 int multiaddress_get_ip_family(const struct MultiAddress* in) {
-	if (in->bytes[0] == 4)
+	if (multiaddress_is_ip4(in))
 		return AF_INET;
-	if (in->bytes[0] == 41)
+	if (multiaddress_is_ip6(in))
 		return AF_INET6;
 	return 0;
 }
@@ -119,21 +177,23 @@ int multiaddress_get_ip_family(const struct MultiAddress* in) {
  * @returns true(1) on success, otherwise 0
  */
 int multiaddress_get_ip_address(const struct MultiAddress* in, char** ip) {
-	// the incoming address is not what was expected
-	if (strncmp(in->string, "/ip4/", 5) != 0 && strncmp(in->string, "/ip6/", 5) != 0)
+	char buffer[INET6_ADDRSTRLEN];
+	const void* address = NULL;
+
+	*ip = NULL;
+	// an ip address with a tcp or udp port
+	if (in->sockaddr.sa.sa_family == AF_INET)
+		address = &in->sockaddr.in4.sin_addr;
+	else if (in->sockaddr.sa.sa_family == AF_INET6)
+		address = &in->sockaddr.in6.sin6_addr;
+	else
 		return 0;
-	if (strstr(in->string, "/tcp/") == NULL && strstr(in->string, "/udp/") == NULL)
+	if (inet_ntop(in->sockaddr.sa.sa_family, address, buffer, sizeof(buffer)) == NULL)
 		return 0;
-	// ip
-	char* str = malloc(strlen(in->string));
-	if (str == NULL)
+	*ip = malloc(strlen(buffer) + 1);
+	if (*ip == NULL)
 		return 0;
-	strcpy(str, &in->string[5]); // gets rid of /ip4/
-	char* pos = strchr(str, '/');
-	pos[0] = 0;
-	*ip = malloc(strlen(str) + 1);
-	strcpy(*ip, str);
-	free(str);
+	strcpy(*ip, buffer);
 	return 1;
 }
 
@@ -144,45 +204,22 @@ int multiaddress_get_ip_address(const struct MultiAddress* in, char** ip) {
  * @returns the port, or a negative number for an error
  */
 int multiaddress_get_ip_port(const struct MultiAddress* in) {
-	char* ptr = strstr(in->string, "/tcp/");
-	if (ptr == NULL)
-		ptr = strstr(in->string, "/udp/");
-	if (ptr == NULL)
-		return -1;
-	ptr += 5;
-	char* end_ptr = strstr(ptr, "/");
-	if (end_ptr == NULL) {
-		return atoi(ptr);
-	}
-	char str[end_ptr - ptr + 1];
-	memcpy(str, ptr, end_ptr - ptr);
-	str[end_ptr-ptr] = '\0';
-	return atoi(str);
+	return in->port;
 }
 
 char* multiaddress_get_peer_id(const struct MultiAddress* in) {
-	char* result = NULL;
-	int str_len = 0;
-	char* slash = NULL;
-	char* ptr = NULL;
-
-	ptr = strstr(in->string, "/ipfs/");
-	if (ptr != NULL && ptr[6] != 0) {
-		ptr += 6;
-		str_len = strlen(ptr);
-		slash = strchr(ptr, '/');
-		if (slash != NULL) {
-			str_len = slash - ptr;
-		}
-		if (str_len > 0) {
-			result = malloc(str_len + 1);
-			if (result != NULL) {
-				memset(result, 0, str_len + 1);
-				memcpy(result, ptr, str_len);
-			}
-		}
+	const struct MultiAddressComponent* component = multiaddress_find_component(in, 42);
+	if (component == NULL || component->size == 0)
+		return NULL;
+	size_t result_size = component->size * 138 / 100 + 2;
+	unsigned char* result = malloc(result_size);
+	if (result == NULL)
+		return NULL;
+	if (!multiaddr_encoding_base58_encode(&in->bytes[component->offset], component->size, &result, &result_size)) {
+		free(result);
+		return NULL;
 	}
-	return result;
+	return (char*)result;
 }
 
 void multiaddress_free(struct MultiAddress* in) {
@@ -206,21 +243,22 @@ struct MultiAddress* multiaddress_copy(const struct MultiAddress* in) {
 	if (in != NULL) {
 		out = (struct MultiAddress*)malloc(sizeof(struct MultiAddress));
 		if (out != NULL) {
+			// the components are offsets into the bytes, so they copy as they are
+			*out = *in;
+			out->bytes = NULL;
+			out->string = NULL;
 			if (in->bsize > 0) {
 				out->bytes = malloc(in->bsize);
 				if (out->bytes == NULL) {
 					free(out);
 					return NULL;
 				}
-				out->bsize = in->bsize;
 				memcpy(out->bytes, in->bytes, out->bsize);
 			} // bytes need to be copied
 			if (in->string != NULL) {
 				out->string = malloc(strlen(in->string) + 1);
 				if (out->string == NULL) {
-					if (out->bsize > 0)
-						free(out->bytes);
-					free(out);
+					multiaddress_free(out);
 					return NULL;
 				}
 				strcpy(out->string, in->string);
@@ -230,6 +268,41 @@ struct MultiAddress* multiaddress_copy(const struct MultiAddress* in) {
 	return out;
 }
 
+/**
+ * Copy a multiaddress, taking the memory from an allocator rather than malloc
+ * @param in the source
+ * @param allocate returns size bytes taken from context, or NULL if there are none
+ * @param context passed to allocate
+ * @returns the new struct MultiAddress or NULL if there was a problem. It is released
+ * as the allocator requires, never with multiaddress_free
+ */
+struct MultiAddress* multiaddress_copy_with(const struct MultiAddress* in, void* (*allocate)(void* context, size_t size), void* context) {
+	if (in == NULL)
+		return NULL;
+	// build the string on the source, so the copy never has to malloc it
+	const char* string = multiaddress_to_string(in);
+	if (string == NULL)
+		return NULL;
+	struct MultiAddress* out = (struct MultiAddress*)allocate(context, sizeof(struct MultiAddress));
+	if (out == NULL)
+		return NULL;
+	*out = *in;
+	out->bytes = NULL;
+	out->string = NULL;
+	if (in->bsize > 0) {
+		out->bytes = allocate(context, in->bsize);
+		if (out->bytes == NULL)
+			return NULL;
+		memcpy(out->bytes, in->bytes, out->bsize);
+	}
+	size_t length = strlen(string) + 1;
+	out->string = allocate(context, length);
+	if (out->string == NULL)
+		return NULL;
+	memcpy(out->string, string, length);
+	return out;
+}
+
 /**
  * Put a string into the MultiAddress and recalculate the bytes
  * @param result the struct
@@ -237,7 +310,7 @@ struct MultiAddress* multiaddress_copy(const struct MultiAddress* in) {
  */
 int multiaddress_encapsulate(struct MultiAddress* result, char* string)
 {
-	if(result != NULL && string != NULL)
+	if(result != NULL && string != NULL && multiaddress_to_string(result) != NULL)
 	{
 		// remove the old values
 		if (result->bytes != NULL)
@@ -271,7 +344,7 @@ int multiaddress_encapsulate(struct MultiAddress* result, char* string)
 		{
 			strcat(result->string, string);
 		}
-		if(string_to_bytes(&result->bytes, &result->bsize, result->string, strlen(result->string)+1) == 0)
+		if(string_to_bytes(&result->bytes, &result->bsize, result->string, strlen(result->string)+1) == 0 || !multiaddress_parse(result))
 		{
 			multiaddress_free(result);
 			return 0;
@@ -290,7 +363,7 @@ int multiaddress_encapsulate(struct MultiAddress* result, char* string)
  */
 int multiaddress_decapsulate(struct MultiAddress * result, char * srci)
 {
-	if(result!=NULL && srci!=NULL)
+	if(result!=NULL && srci!=NULL && multiaddress_to_string(result) != NULL)
 	{
 		char * procstr = NULL;
 		procstr = result->string;
@@ -328,7 +401,7 @@ int multiaddress_decapsulate(struct MultiAddress * result, char * srci)
 				free(result->bytes);
 			result->bytes = NULL;
 			result->bsize = 0;
-			if(string_to_bytes(&result->bytes, &result->bsize, result->string, strlen(result->string)+1) == 0)
+			if(string_to_bytes(&result->bytes, &result->bsize, result->string, strlen(result->string)+1) == 0 || !multiaddress_parse(result))
 			{
 				multiaddress_free(result);
 				return 0;
@@ -1,230 +1,86 @@
-#include <stdio.h>
-#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <strings.h>
-#include <ctype.h>
-#include <errno.h>
 
 #include "multiaddr/protocols.h"
-#include "multiaddr/varhexutils.h"
 
-/*
-int protocol_REMOVE_id(struct ProtocolListItem* protocol_P, int remid)//Function to remove & shift back all data, sort of like c++ vectors.
-{
+/**
+ * The protocols we know of, as (code, size, name). The table and both of
+ * its lookups are built from this one list.
+ */
+#define PROTOCOL_LIST(X) \
+	X(4, 32, "ip4") \
+	X(41, 128, "ip6") \
+	X(6, 16, "tcp") \
+	X(17, 16, "udp") \
+	X(33, 16, "dccp") \
+	X(132, 16, "sctp") \
+	X(301, 0, "udt") \
+	X(302, 0, "utp") \
+	X(42, -1, "ipfs") \
+	X(480, 0, "http") \
+	X(443, 0, "https") \
+	X(477, 0, "ws") \
+	X(444, 10, "onion") \
+	X(275, 0, "libp2p-webrtc-star")
 
-	if(remid < CNT_PROTOCOLNUM && remid >= 0&&CNT_PROTOCOLNUM!=0) //Checking to see if remid actually exists.
-	{
-		for(int i=remid; i<CNT_PROTOCOLNUM-1; ++i) //While i < num of registered protocols //Needs to be tested that -1 is for valgrind debugging
-		{
-			//strcpy((protocol_P+i)->hexcode, (protocol_P+i+1)->hexcode); //shift memory to the user we want to remove.
-			(protocol_P+i)->deccode = (protocol_P+i+1)->deccode;       	//Same as above
-			(protocol_P+i)->size = (protocol_P+i+1)->size; 				//Same as above
-			strcpy((protocol_P+i)->name, (protocol_P+i+1)->name);		//Same as above
-		}//Overwriting user done. Time to get rid of that extra memory.
-		protocol_P = (struct Protocol*) realloc(protocol_P, (CNT_PROTOCOLNUM-1) * sizeof(struct Protocol));
-		//Memory erased,
-		CNT_PROTOCOLNUM--; //Since the record no longer exists, we should decrease the ammount of users.
-		return 1; //Purely for error checking, in case someone ever wants it/
-	}	//1 = Success
-	else
-	{
-		if(CNT_PROTOCOLNUM == 0)
-		{
-			perror("ERROR: 0 PROTOCOLS... Did you load protocols?");
-		}
-		else
-		{
-			perror("ERROR: No such protocol!");
-		}
-		return 0;
-	}
-}
-*/
+/**
+ * Where each protocol is in protocol_table, named by its code. A code that
+ * is listed twice will not compile.
+ */
+enum ProtocolPosition {
+#define PROTOCOL_POSITION(code, size, name) PROTOCOL_POSITION_##code,
+	PROTOCOL_LIST(PROTOCOL_POSITION)
+#undef PROTOCOL_POSITION
+	PROTOCOL_COUNT
+};
 
-void unload_protocols(struct ProtocolListItem* head)
-{
-	struct ProtocolListItem* current = head;
-	while (current != NULL) {
-		struct ProtocolListItem* next = current->next;
-		free(current->current);
-		free(current);
-		current = next;
-	}
-}
+static const struct Protocol protocol_table[PROTOCOL_COUNT] = {
+#define PROTOCOL_ENTRY(code, size, name) { code, size, name },
+	PROTOCOL_LIST(PROTOCOL_ENTRY)
+#undef PROTOCOL_ENTRY
+};
 
 /**
- * load the available protocols into the global protocol_P
- * @returns True(1) on success, otherwise 0
+ * The highest code in PROTOCOL_LIST. A code above it will not compile.
  */
-int load_protocols(struct ProtocolListItem** head)
-{
-	unload_protocols(*head);
-	int num_protocols = 14;
-	int dec_code[] = {4, 41, 6, 17, 33, 132, 301, 302, 42, 480, 443, 477, 444, 275};
-	int size[] = {32, 128, 16, 16, 16, 16, 0, 0, -1, 0, 0, 0, 10, 0 };
-	char* name[] = { "ip4", "ip6", "tcp", "udp", "dccp", "sctp", "udt", "utp", "ipfs", "http", "https", "ws", "onion", "libp2p-webrtc-star" };
-	struct ProtocolListItem* last = NULL;
-	for(int i = 0; i < num_protocols; i++) {
-		struct ProtocolListItem* current_item = (struct ProtocolListItem*)malloc(sizeof(struct ProtocolListItem));
-		current_item->current = (struct Protocol*)malloc(sizeof(struct Protocol));
-		current_item->next = NULL;
-		current_item->current->deccode = dec_code[i];
-		strcpy(current_item->current->name, name[i]);
-		current_item->current->size = size[i];
-		if (*head == NULL) {
-			*head = current_item;
-		} else {
-			last->next = current_item;
-		}
-		last = current_item;
-	}
-	return 1;
-}
+#define PROTOCOL_MAX_CODE 480
 
-/*
-void load_protocols_from_file(struct Protocol** in)
-{
-	struct Protocol* protocol_P = *in;
-	FILE *FPROC_POINT; //File pointer.
-	FPROC_POINT = fopen("proto-dat", "r");//Opening proto-dat Or protocols.csv, I just formatted it to my liking.
-	if(FPROC_POINT != NULL) //While pointer is not null.
-	{
-		char W_BUFF[20] = "\0";//Char array to parse file.
-		for(int i=0; fscanf(FPROC_POINT, "%s", W_BUFF) != EOF; i++) // Scanning file and incrementing for processing.
-		{
-			switch(i)
-			{
-				case 0: //First word - HEXCODE
-				{
-					//ADD MEMORY FOR NEW PROTOCOL
-					if(CNT_PROTOCOLNUM==0) //If there are no registered protocols yet, allocate memory to pointer.
-					{
-						protocol_P = (struct Protocol*) malloc (sizeof(struct Protocol));
-					}
-					else //Reallocate memory to fit one more Protocol
-					{
-						protocol_P = (struct Protocol*) realloc(protocol_P, (CNT_PROTOCOLNUM+1) * sizeof(struct protocol));
-					}
-					//strcpy((protocol_P+CNT_PROTOCOLNUM)->hexcode, W_BUFF);	//Copy word to structure at hexcode A hexcode is a string so we keep it as such
-					break;
-				}
-				case 1://Second word - DECCODE
-				{
-					(protocol_P+CNT_PROTOCOLNUM)->deccode= atoi(W_BUFF);	//Copy word to structure at deccode after converting it to int.
-					break;
-				}
-				case 2://Third word - SIZE
-				{
-					(protocol_P+CNT_PROTOCOLNUM)->size= atoi(W_BUFF);		//Copy word to structure at size after converting it to int.
-					break;
-				}
-				case 3://Fourth word - NAME
-				{
-					strcpy((protocol_P+CNT_PROTOCOLNUM)->name, W_BUFF); 	//Copy word to structure at name // String
-					i=-1;
-					CNT_PROTOCOLNUM++;
-					break;
-				}
-				default:
-				{
-					printf("HOUSTON WE HAVE A BIG PROBLEM!!!!\nPROTOCOLS.H-REACHED DEFAULT CASE IN READING FILE!\nREPORT TO SYSTEMS ADMIN!\n");
-					break;
-				}
-			}
-		}
-		fclose(FPROC_POINT);
-		protocol_REMOVE_id(protocol_P, 0);
-	}
-	else
-	{
-		perror("Fatal Error:");
-	}
-}
-*/
+/**
+ * Where each code is in protocol_table, plus one, so that 0 is an unknown code
+ */
+static const uint8_t protocol_index_by_code[PROTOCOL_MAX_CODE + 1] = {
+#define PROTOCOL_INDEX(code, size, name) [code] = PROTOCOL_POSITION_##code + 1,
+	PROTOCOL_LIST(PROTOCOL_INDEX)
+#undef PROTOCOL_INDEX
+};
 
-struct Protocol* proto_with_name(const struct ProtocolListItem* head, const char* proto_w_name) //Search for Protocol with inputted name
+/**
+ * Find a protocol by its code
+ * @param code the code
+ * @returns the protocol, or NULL if there is none with that code
+ */
+const struct Protocol* proto_with_code(int code)
 {
-	const struct ProtocolListItem* current = head;
-	while(current != NULL)
-	{
-		if (strcmp(proto_w_name, current->current->name) == 0) {
-			return current->current;
-		}
-		current = current->next;
-	}
-	return NULL;
+	if (code < 0 || code > PROTOCOL_MAX_CODE || protocol_index_by_code[code] == 0)
+		return NULL;
+	return &protocol_table[protocol_index_by_code[code] - 1];
 }
 
-struct Protocol* proto_with_deccode(const struct ProtocolListItem* head, int proto_w_deccode) //Search for Protocol with inputted deccode
+/**
+ * Find a protocol by its name
+ * @param name the name, which need not be NULL terminated
+ * @param length the length of the name
+ * @returns the protocol, or NULL if there is none with that name
+ */
+const struct Protocol* proto_with_name(const char* name, size_t length)
 {
-	const struct ProtocolListItem* current = head;
-	while(current != NULL)
-	{
-		if (current->current->deccode == proto_w_deccode) {
-			return current->current;
-		}
-		current = current->next;
-	}
+	if (length == 0)
+		return NULL;
+	// the lengths and first letters are constants, so most names are passed over without a memcmp
+#define PROTOCOL_MATCH(code, size, protocol_name) \
+	if (length == sizeof(protocol_name) - 1 && name[0] == protocol_name[0] && memcmp(name, protocol_name, length) == 0) \
+		return &protocol_table[PROTOCOL_POSITION_##code];
+	PROTOCOL_LIST(PROTOCOL_MATCH)
+#undef PROTOCOL_MATCH
 	return NULL;
 }
-
-void protocols_with_string(const struct ProtocolListItem* head, char* meee, int sizi) // NOT FINISHED, DO NOT USE!
-{
-	int finalsize = 0;
-
-	if(!isalnum(meee[sizi-1]) && !isalnum(meee[sizi-1]))
-	{
-		//Everything is alright, it's nul terminated!;
-		finalsize = sizi;
-	}
-	else
-	{
-		//Well houston we have a problem.
-		finalsize = sizi+2;
-	}
-	char mestring[finalsize];
-	strcpy(mestring, meee);
-	if(sizi!=finalsize)
-	{
-		strcpy(mestring,"\0");
-	}
-
-	char * words[50] = { NULL };
-	int atword = 0;
-	int mem = 0;
-	for(int i=0; i<sizeof(mestring)-2; i++)
-	{
-		if(mestring[i] == '/')
-		{
-			printf("NEW WORD!\n");
-			atword++;
-			int currentsize = 0;
-			for(int j = i+1; mestring[j] != '/' && j < sizeof(mestring)-2; j++)
-			{
-				currentsize++;
-			}
-			char haay[20];
-			int lesbo = 0;
-			for(int x = i+1; x<sizeof(mestring)-2; x++)
-			{
-				if(mestring[x] == '/')
-				{
-					break;
-				}
-				haay[lesbo] = mestring[x];
-				lesbo++;
-			}
-			words[atword-1] = (char *) malloc(currentsize+2);
-			strcpy(words[atword-1], haay);
-			bzero(haay,20);
-		}
-	}
-	printf("Result:%s\n", words[0]);
-	for(int mm=0; mm < 50; mm++)
-	{
-		if(words[mm])
-		{
-			free(words[mm]);
-		}
-	}
-}
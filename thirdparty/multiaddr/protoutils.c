@@ -5,13 +5,14 @@
 #include <math.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "multiaddr/base58.h"
 #include "multiaddr/varhexutils.h"
 #include "multiaddr/protocols.h"
 #include "multiaddr/protoutils.h"
 
-extern char *strtok_r(char *, const char *, char **);
-
 //////////////////////////////////////////////////////////
 char ASCII2bits(char ch) {
    if (ch >= '0' && ch <= '9') {
@@ -295,422 +296,292 @@ char * int2ip(int inputintip)
 }
 
 /**
- * Unserialize the bytes into a string
- * @param results where to put the resultant string
- * @param in_bytes the bytes to unserialize
- * @param in_bytes_size the length of the bytes array
+ * Write a varint
+ * @param value the value
+ * @param out where to write it, with room for 5 bytes
+ * @returns the number of bytes written
  */
-int bytes_to_string(char** buffer, const uint8_t* in_bytes, int in_bytes_size)
+static size_t multiaddr_varint_write(uint32_t value, uint8_t* out)
 {
-	uint8_t * bytes = NULL;
-	char *results = NULL;
-	int size = in_bytes_size;
-	struct ProtocolListItem* head = NULL;
-	char hex[(in_bytes_size*2)+1];
-	//Positioning for memory jump:
-	int lastpos = 0;
-	char pid[3];
-
-	// set up variables
-	load_protocols(&head);
-	memset(hex, 0, (in_bytes_size * 2) + 1);
-	char* tmp = Var_To_Hex(in_bytes, size);
-	memcpy(hex, tmp, in_bytes_size * 2);
-	free(tmp);
-	pid[2] = 0;
-
-	// allocate memory for results
-	*buffer = malloc(800);
-	results = *buffer;
-	memset(results, 0, 800);
-
-
-	//Process Hex String
-	NAX:
-	//Stage 1 ID:
-	pid[0] = hex[lastpos];
-	pid[1] = hex[lastpos+1];
-
-	int protocol_int = Hex_To_Int(pid);
-	struct Protocol* protocol = proto_with_deccode(head, protocol_int);
-	if(protocol != NULL)
-	{
-		//////////Stage 2: Address
-		if(strcmp(protocol->name,"ipfs")!=0)
-		{
-			lastpos = lastpos+2;
-			char address[(protocol->size/4)+1];
-			memset(address, 0, (protocol->size / 4) + 1);
-			memcpy(address, &hex[lastpos], protocol->size / 4);
-			//////////Stage 3 Process it back to string
-			lastpos= lastpos+(protocol->size/4);
-
-			//////////Address:
-			//Keeping Valgrind happy
-			char name[30];
-			bzero(name,30);
-			strcpy(name, protocol->name);
-			//
-			strcat(results, "/");
-			strcat(results, name);
-			strcat(results, "/");
-			if(strcmp(name, "ip4")==0)
-			{
-				strcat(results,int2ip(Hex_To_Int(address)));
-			}
-			else if(strcmp(name, "tcp")==0)
-			{
-				char a[5];
-					sprintf(a,"%lu",Hex_To_Int(address));
-					strcat(results,a);
-			}
-			else if(strcmp(name, "udp")==0)
-			{
-				char a[5];
-				sprintf(a,"%lu",Hex_To_Int(address));
-				strcat(results,a);
-			}
-			/////////////Done processing this, move to next if there is more.
-			if(lastpos<size*2)
-			{
-				goto NAX;
-			}
-		}
-		else//IPFS CASE
-		{
-			lastpos = lastpos + 4;
-			//fetch the size of the address based on the varint prefix
-			char prefixedvarint[3];
-			memset(prefixedvarint, 0, 3);
-			memcpy(prefixedvarint, &hex[lastpos-2], 2);
-			int addrsize = HexVar_To_Num_32(prefixedvarint);
-
-			// get the ipfs address as hex values
-			unsigned char IPFS_ADDR[addrsize+1];
-			memset(IPFS_ADDR, 0, addrsize + 1);
-			memcpy(IPFS_ADDR, &hex[lastpos], addrsize);
-			// convert the address from hex values to a binary array
-			size_t num_bytes = 0;
-			unsigned char* addrbuf = Hex_To_Var(IPFS_ADDR, &num_bytes);
-			size_t b58_size = strlen(IPFS_ADDR);
-			unsigned char b58[b58_size];
-			memset(b58, 0, b58_size);
-			unsigned char *ptr_b58 = b58;
-			int returnstatus = multiaddr_encoding_base58_encode(addrbuf, num_bytes, &ptr_b58, &b58_size);
-			free(addrbuf);
-			if(returnstatus == 0)
-			{
-				fprintf(stderr, "Unable to base58 encode MultiAddress %s\n", IPFS_ADDR);
-				unload_protocols(head);
+	size_t size = 0;
+	do {
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		if (value > 0)
+			byte |= 0x80;
+		out[size++] = byte;
+	} while (value > 0);
+	return size;
+}
+
+/**
+ * Read a varint
+ * @param bytes the bytes
+ * @param bytes_size the length of the bytes
+ * @param pos where to read from, moved past the varint
+ * @param value where to put the value
+ * @returns true(1) on success, 0 if the varint is cut short or too long
+ */
+static int multiaddr_varint_read(const uint8_t* bytes, size_t bytes_size, size_t* pos, uint32_t* value)
+{
+	uint8_t byte = 0;
+	int shift = 0;
+
+	*value = 0;
+	do {
+		if (*pos >= bytes_size || shift > 28)
+			return 0;
+		byte = bytes[(*pos)++];
+		*value |= (uint32_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return 1;
+}
+
+int multiaddr_bytes_parse(const uint8_t* bytes, size_t bytes_size, struct MultiAddressComponent* components, int* component_count)
+{
+	size_t pos = 0;
+
+	*component_count = 0;
+	if (bytes_size > MULTIADDRESS_MAX_BYTES)
+		return 0;
+	while (pos < bytes_size) {
+		uint32_t code = 0;
+		if (*component_count == MULTIADDRESS_MAX_COMPONENTS || !multiaddr_varint_read(bytes, bytes_size, &pos, &code))
+			return 0;
+		const struct Protocol* protocol = proto_with_code(code);
+		if (protocol == NULL)
+			return 0;
+		uint32_t size = 0;
+		if (protocol->size > 0) {
+			size = protocol->size / 8;
+		} else if (protocol->size < 0) {
+			if (!multiaddr_varint_read(bytes, bytes_size, &pos, &size))
 				return 0;
-			}
-			strcat(results, "/");
-			strcat(results, protocol->name);
-			strcat(results, "/");
-			strcat(results, b58);
 		}
+		if (size > bytes_size - pos)
+			return 0;
+		struct MultiAddressComponent* component = &components[(*component_count)++];
+		component->code = protocol->deccode;
+		component->offset = pos;
+		component->size = size;
+		pos += size;
 	}
-	strcat(results, "/");
-	unload_protocols(head);
 	return 1;
 }
-//
+
+char* multiaddr_components_format(const uint8_t* bytes, const struct MultiAddressComponent* components, int component_count)
+{
+	// each component is its name, and a value no longer than an ip6 address or twice its bytes
+	size_t max = 2;
+	for(int i = 0; i < component_count; i++)
+		max += sizeof(((struct Protocol*)0)->name) + 2 + INET6_ADDRSTRLEN + 2 * components[i].size;
+	char* out = malloc(max);
+	if (out == NULL)
+		return NULL;
+
+	size_t pos = 0;
+	for(int i = 0; i < component_count; i++) {
+		const struct MultiAddressComponent* component = &components[i];
+		const uint8_t* value = &bytes[component->offset];
+		const struct Protocol* protocol = proto_with_code(component->code);
+		pos += sprintf(&out[pos], "/%s", protocol->name);
+		if (component->size == 0)
+			continue;
+		out[pos++] = '/';
+		switch (component->code) {
+			case 4: // ip4
+				pos += sprintf(&out[pos], "%u.%u.%u.%u", value[0], value[1], value[2], value[3]);
+				break;
+			case 41: // ip6
+				if (inet_ntop(AF_INET6, value, &out[pos], INET6_ADDRSTRLEN) == NULL) {
+					free(out);
+					return NULL;
+				}
+				pos += strlen(&out[pos]);
+				break;
+			case 6: // tcp
+			case 17: // udp
+			case 33: // dccp
+			case 132: // sctp
+				pos += sprintf(&out[pos], "%u", (value[0] << 8) | value[1]);
+				break;
+			case 42: { // ipfs
+				unsigned char* b58 = (unsigned char*)&out[pos];
+				size_t b58_size = max - pos;
+				if (!multiaddr_encoding_base58_encode(value, component->size, &b58, &b58_size)) {
+					free(out);
+					return NULL;
+				}
+				pos += b58_size - 1;
+				break;
+			}
+			default:
+				for(int j = 0; j < component->size; j++)
+					pos += sprintf(&out[pos], "%02x", value[j]);
+				break;
+		}
+	}
+	out[pos++] = '/';
+	out[pos] = 0;
+	return out;
+}
 
 /**
- * Convert an address string to a byte representation
- * @param protocol the protocol to use
- * @param incoming the byte array
- * @param incoming_size the size of the byte array
- * @param results the results
- * @param results_size the size of the results
- * @returns the results array
+ * Unserialize the bytes into a string
+ * @param buffer where to put the resultant string
+ * @param in_bytes the bytes to unserialize
+ * @param in_bytes_size the length of the bytes array
+ * @returns true(1) on success, otherwise 0
  */
-char* address_string_to_bytes(struct Protocol * protocol, const char *incoming, size_t incoming_size, char** results, int* results_size)
+int bytes_to_string(char** buffer, const uint8_t* in_bytes, int in_bytes_size)
 {
-	static char astb__stringy[800] = "\0";
-	memset(astb__stringy, 0, 800);
+	struct MultiAddressComponent components[MULTIADDRESS_MAX_COMPONENTS];
+	int component_count = 0;
+
+	*buffer = NULL;
+	if (in_bytes_size < 0 || !multiaddr_bytes_parse(in_bytes, in_bytes_size, components, &component_count))
+		return 0;
+	*buffer = multiaddr_components_format(in_bytes, components, component_count);
+	return *buffer != NULL;
+}
 
-	int code = 0;
-	code = protocol->deccode;
+/**
+ * Convert the value of one component from its string form to bytes
+ * @param protocol the protocol to use
+ * @param incoming the value, which need not be NULL terminated
+ * @param incoming_size the length of the value
+ * @param results where to write the bytes
+ * @param results_max how many bytes there is room for
+ * @param results_size where to put how many bytes were written
+ * @returns true(1) on success, otherwise 0
+ */
+int address_string_to_bytes(const struct Protocol* protocol, const char* incoming, size_t incoming_size, uint8_t* results, size_t results_max, size_t* results_size)
+{
+	*results_size = 0;
+	if (protocol->size > 0 && (size_t)protocol->size / 8 > results_max)
+		return 0;
 
-	switch(code)
+	switch(protocol->deccode)
 	{
 		case 4://IPv4
+		case 41://IPv6
 		{
-			char testip[16] = "\0";
-			bzero(testip,16);
-			strcpy(testip,incoming);
-			if(is_valid_ipv4(testip)==1)
-			{
-				uint64_t iip = ip2int(incoming);
-				strcpy(astb__stringy,Int_To_Hex(iip));
-				protocol = NULL;
-				*results = malloc(strlen(astb__stringy));
-				memcpy(*results, astb__stringy, strlen(astb__stringy));
-				*results_size = strlen(astb__stringy);
-				return *results;
-			}
-			else
-			{
-				return "ERR";
-			}
-			break;
-		}
-		case 41://IPv6 Must be done
-		{
-			return "ERR";
-			break;
-		}
-		case 6: //Tcp
-		{
-			if(atoi(incoming)<65536&&atoi(incoming)>0)
-			{
-				static char himm_woot[5] = "\0";
-				bzero(himm_woot, 5);
-				strcpy(himm_woot, Int_To_Hex(atoi(incoming)));
-				if(himm_woot[2] == '\0')
-				{//manual switch
-					char swap0='0';
-					char swap1='0';
-					char swap2=himm_woot[0];
-					char swap3=himm_woot[1];
-					himm_woot[0] = swap0;
-					himm_woot[1] = swap1;
-					himm_woot[2] = swap2;
-					himm_woot[3] = swap3;
-				}
-				else if(himm_woot[3] == '\0')
-				{
-					char swap0='0';
-					char swap1=himm_woot[0];
-					char swap2=himm_woot[1];
-					char swap3=himm_woot[2];
-					himm_woot[0] = swap0;
-					himm_woot[1] = swap1;
-					himm_woot[2] = swap2;
-					himm_woot[3] = swap3;
-				}
-				himm_woot[4]='\0';
-				*results = malloc(5);
-				*results_size = 5;
-				memcpy(*results, himm_woot, 5);
-				return *results;
-			}
-			else
-			{
-				return "ERR";
-			}
-			break;
-		}
-		case 17: //Udp
-		{
-			if(atoi(incoming)<65536&&atoi(incoming)>0)
-			{
-				static char himm_woot2[5] = "\0";
-				bzero(himm_woot2, 5);
-				strcpy(himm_woot2, Int_To_Hex(atoi(incoming)));
-				if(himm_woot2[2] == '\0')
-				{//Manual Switch2be
-					char swap0='0';
-					char swap1='0';
-					char swap2=himm_woot2[0];
-					char swap3=himm_woot2[1];
-					himm_woot2[0] = swap0;
-					himm_woot2[1] = swap1;
-					himm_woot2[2] = swap2;
-					himm_woot2[3] = swap3;
-				}
-				else if(himm_woot2[3] == '\0')
-				{//Manual switch
-					char swap0='0';
-					char swap1=himm_woot2[0];
-					char swap2=himm_woot2[1];
-					char swap3=himm_woot2[2];
-					himm_woot2[0] = swap0;
-					himm_woot2[1] = swap1;
-					himm_woot2[2] = swap2;
-					himm_woot2[3] = swap3;
-				}
-				himm_woot2[4]='\0';
-				*results = malloc(5);
-				*results_size = 5;
-				memcpy(*results, himm_woot2, 5);
-				return *results;
-			}
-			else
-			{
-				return "ERR";
-			}
-			break;
+			char address[INET6_ADDRSTRLEN];
+			if (incoming_size >= sizeof(address))
+				return 0;
+			memcpy(address, incoming, incoming_size);
+			address[incoming_size] = 0;
+			if (inet_pton(protocol->deccode == 4 ? AF_INET : AF_INET6, address, results) != 1)
+				return 0;
+			*results_size = protocol->size / 8;
+			return 1;
 		}
+		case 6://tcp
+		case 17://udp
 		case 33://dccp
-		{
-			return "ERR";
-		}
 		case 132://sctp
 		{
-			return "ERR";
-		}
-		case 301://udt
-		{
-			return "ERR";
-		}
-		case 302://utp
-		{
-			return "ERR";
-		}
-		case 42://IPFS - !!!
-		{
-			// decode the base58 to bytes
-			char * incoming_copy = NULL;
-			incoming_copy = (char*)incoming;
-			size_t incoming_copy_size = strlen(incoming_copy);
-			size_t result_buffer_length = multiaddr_encoding_base58_decode_max_size((unsigned char*)incoming_copy);
-			unsigned char result_buffer[result_buffer_length];
-			unsigned char* ptr_to_result = result_buffer;
-			memset(result_buffer, 0, result_buffer_length);
-			// now get the decoded address
-			int return_value = multiaddr_encoding_base58_decode(incoming_copy, incoming_copy_size, &ptr_to_result, &result_buffer_length);
-			if (return_value == 0)
-			{
-				return "ERR";
-			}
-
-			// throw everything in a hex string so we can debug the results
-			char addr_encoded[300];
-			memset(addr_encoded, 0, 300);
-			int ilen = 0;
-			for(int i = 0; i < result_buffer_length; i++)
+			uint32_t port = 0;
+			if (incoming_size == 0 || incoming_size > 5)
+				return 0;
+			for(size_t i = 0; i < incoming_size; i++)
 			{
-				// get the char so we can see it in the debugger
-				char miu[3];
-				sprintf(miu,"%02x", ptr_to_result[i]);
-				strcat(addr_encoded, miu);
+				if (incoming[i] < '0' || incoming[i] > '9')
+					return 0;
+				port = port * 10 + (incoming[i] - '0');
 			}
-			ilen = strlen(addr_encoded);
-			char prefixed[3];
-			memset(prefixed, 0, 3);
-			strcpy(prefixed,Num_To_HexVar_32(ilen));
-			*results_size = ilen + 3;
-			*results = malloc(*results_size);
-			memset(*results, 0, *results_size);
-			strcat(*results, prefixed); // 2 bytes
-			strcat(*results, addr_encoded); // ilen bytes + null terminator
-			return *results;
-		}
-		case 480://http
-		{
-			return "ERR";
-		}
-		case 443://https
-		{
-			return "ERR";
-		}
-		case 477://ws
-		{
-			return "ERR";
-		}
-		case 444://onion
-		{
-			return "ERR";
+			if (port > 65535)
+				return 0;
+			// big endian
+			results[0] = port >> 8;
+			results[1] = port & 0xff;
+			*results_size = 2;
+			return 1;
 		}
-		case 275://libp2p-webrtc-star
+		case 42://IPFS
 		{
-			return "ERR";
+			// a base58 string never decodes to more bytes than it has characters
+			if (incoming_size == 0 || incoming_size > MULTIADDRESS_MAX_BYTES)
+				return 0;
+			char b58[incoming_size + 1];
+			memcpy(b58, incoming, incoming_size);
+			b58[incoming_size] = 0;
+			unsigned char decoded[incoming_size];
+			unsigned char* ptr_to_decoded = decoded;
+			size_t decoded_size = incoming_size;
+			if (!multiaddr_encoding_base58_decode(b58, incoming_size, &ptr_to_decoded, &decoded_size))
+				return 0;
+			// prefixed by its length in bytes. The decoder leaves the bytes at the end of its buffer
+			uint8_t prefix[5];
+			size_t prefix_size = multiaddr_varint_write(decoded_size, prefix);
+			if (prefix_size + decoded_size > results_max)
+				return 0;
+			memcpy(results, prefix, prefix_size);
+			memcpy(&results[prefix_size], &decoded[incoming_size - decoded_size], decoded_size);
+			*results_size = prefix_size + decoded_size;
+			return 1;
 		}
 		default:
-		{
-			printf("NO SUCH PROTOCOL!\n");
-			return "ERR";
-		}
+			return 0;
 	}
 }
 
 /**
- * convert a string address into bytes
- * @param finalbytes the destination
- * @param realbbsize the ultimate size of the destination
- * @param strx the incoming string
- * @param strsize the string length
+ * Convert a MultiAddress string to its bytes. The string is walked once, a
+ * word at a time, without copying it; the bytes are built on the stack and
+ * copied out at their exact size.
+ * @param finalbytes where to put the bytes, which the caller frees
+ * @param realbbsize where to put the length of the bytes
+ * @param strx the string
+ * @param strsize the most characters to read. The string may end sooner with a NULL
+ * @returns true(1) on success, otherwise 0
  */
 int string_to_bytes(uint8_t** finalbytes, size_t* realbbsize, const char* strx, size_t strsize)
 {
-	if(strx[0] != '/')
-	{
-		printf("Error, must start with '/'\n");
+	uint8_t buffer[MULTIADDRESS_MAX_BYTES];
+	size_t written = 0;
+	size_t pos = 0;
+	int component_count = 0;
+
+	if(strsize == 0 || strx[0] != '/')
 		return 0;
-	}
 
-	//Initializing variables to store our processed HEX in:
-	int malf=0; //In case something goes wrong this will be 1.
-	char processed[800];//HEX CONTAINER
-	bzero(processed,800);
-
-	//Now Setting up variables for calculating which is the first
-	//and second word:
-	int firstorsecond = 1; //1=Protocol && 2 = Address
-
-	// copy input so as to not harm it
-	char pstring[strsize + 1];
-	strcpy(pstring,strx);
-
-	// load up the list of protocols
-	struct ProtocolListItem* head = NULL;
-	load_protocols(&head);
-
-	//Starting to extract words and process them:
-	char * wp;
-	char * end;
-	wp=strtok_r(pstring,"/",&end);
-	struct Protocol * protx;
-	while(wp)
+	while (pos < strsize && strx[pos] != 0)
 	{
-		if(firstorsecond==1)//This is the Protocol
-		{
-			protx = proto_with_name(head, wp);
-			if(protx != NULL)
-			{
-				strcat(processed, Int_To_Hex(protx->deccode));
-				firstorsecond=2;//Since the next word will be an address
-			}
-			else
-			{
-				printf("\nNo such protocol!\n\n");
-				malf=1;
-				break;
-			}
-		}
-		else//This is the address
+		// like strtok, any number of slashes separate the words
+		if (strx[pos] == '/')
 		{
-			char* s_to_b = NULL;
-			int s_to_b_size = 0;
-			if(address_string_to_bytes(protx, wp,strlen(wp), &s_to_b, &s_to_b_size) == "ERR")
-			{
-				malf = 1;
-			}
-			else
-			{
-				int temp_size = strlen(processed);
-				strncat(processed, s_to_b, s_to_b_size);
-				processed[temp_size + s_to_b_size] = 0;
-				free(s_to_b);
-			}
-			protx=NULL;//Since right now it doesn't need that assignment anymore.
-			firstorsecond=1;//Since the next word will be an protocol
+			pos++;
+			continue;
 		}
-		wp=strtok_r(NULL,"/",&end);
+		// the protocol
+		size_t start = pos;
+		while (pos < strsize && strx[pos] != 0 && strx[pos] != '/')
+			pos++;
+		const struct Protocol* protocol = proto_with_name(&strx[start], pos - start);
+		if (protocol == NULL || component_count == MULTIADDRESS_MAX_COMPONENTS || sizeof(buffer) - written < 5)
+			return 0;
+		written += multiaddr_varint_write(protocol->deccode, &buffer[written]);
+		component_count++;
+		if (protocol->size == 0)
+			continue;
+		// and its value
+		while (pos < strsize && strx[pos] == '/')
+			pos++;
+		start = pos;
+		while (pos < strsize && strx[pos] != 0 && strx[pos] != '/')
+			pos++;
+		size_t value_size = 0;
+		if (pos == start || !address_string_to_bytes(protocol, &strx[start], pos - start, &buffer[written], sizeof(buffer) - written, &value_size))
+			return 0;
+		written += value_size;
 	}
-	protx=NULL;
-	unload_protocols(head);
 
-	if(malf==1)
-	{
+	*finalbytes = malloc(written > 0 ? written : 1);
+	if (*finalbytes == NULL)
 		return 0;
-	}
-	else
-	{
-		*finalbytes = Hex_To_Var(processed, realbbsize);
-		return 1;
-	}
+	memcpy(*finalbytes, buffer, written);
+	*realbbsize = written;
+	return 1;
 }
-
@@ -26,21 +26,21 @@ int test_full() {
 
 	//Remember, Decapsulation happens from right to left, never in reverse!
 
-	printf("A STRING:%s\n",a->string);
+	printf("A STRING:%s\n",multiaddress_to_string(a));
 	multiaddress_encapsulate(a,"/udp/3333/");
-	printf("A STRING ENCAPSULATED:%s\n",a->string);
+	printf("A STRING ENCAPSULATED:%s\n",multiaddress_to_string(a));
 	tmp = Var_To_Hex(a->bytes, a->bsize);
 	printf("TEST BYTES: %s\n", tmp);
 	free(tmp);
 	multiaddress_decapsulate(a,"udp");
-	printf("A STRING DECAPSULATED UDP:%s\n",a->string);
+	printf("A STRING DECAPSULATED UDP:%s\n",multiaddress_to_string(a));
 	tmp = Var_To_Hex(a->bytes, a->bsize);
 	printf("TEST BYTES: %s\n", tmp);
 	free(tmp);
 	multiaddress_encapsulate(a,"/udp/3333/");
-	printf("A STRING ENCAPSULATED UDP: %s\n",a->string);
+	printf("A STRING ENCAPSULATED UDP: %s\n",multiaddress_to_string(a));
 	multiaddress_encapsulate(a,"/ipfs/QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbdG");
-	printf("A STRING ENCAPSULATED IPFS:%s\n",a->string);
+	printf("A STRING ENCAPSULATED IPFS:%s\n",multiaddress_to_string(a));
 	tmp = Var_To_Hex(a->bytes, a->bsize);
 	printf("TEST BYTES: %s\n", tmp);
 	free(tmp);
@@ -48,7 +48,7 @@ int test_full() {
 
 	struct MultiAddress* beta;
 	beta = multiaddress_new_from_bytes(a->bytes,a->bsize);
-	printf("B STRING: %s\n",beta->string);
+	printf("B STRING: %s\n",multiaddress_to_string(beta));
 
 	multiaddress_free(a);
 	multiaddress_free(beta);
@@ -151,8 +151,8 @@ int test_multiaddr_peer_id() {
 	free(result);
 	result = NULL;
 
-	if (strcmp(full_string, addr2->string) != 0) {
-		fprintf(stderr, "Original string was %s but new string is %s\n", full_string, addr2->string);
+	if (strcmp(full_string, multiaddress_to_string(addr2)) != 0) {
+		fprintf(stderr, "Original string was %s but new string is %s\n", full_string, multiaddress_to_string(addr2));
 		goto exit;
 	}
 
@@ -219,8 +219,8 @@ int test_multiaddr_bytes() {
 
 	result = multiaddress_new_from_bytes(orig->bytes, orig->bsize);
 
-	if (strcmp(orig_address, result->string) != 0) {
-		fprintf(stderr, "%s does not equal %s\n", orig_address, result->string);
+	if (strcmp(orig_address, multiaddress_to_string(result)) != 0) {
+		fprintf(stderr, "%s does not equal %s\n", orig_address, multiaddress_to_string(result));
 		goto exit;
 	}
 
@@ -234,3 +234,132 @@ int test_multiaddr_bytes() {
 
 }
 
+
+int test_multiaddr_components() {
+	int retVal = 0;
+	const char* peer_id = "QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbdG";
+	char full_string[255];
+	struct MultiAddress *orig = NULL, *result = NULL, *copy = NULL, *bad = NULL;
+	char* ip = NULL;
+	char* id = NULL;
+	socklen_t size = 0;
+
+	// an address whose first byte is below 16 used to lose a hex digit
+	sprintf(full_string, "/ip4/10.1.2.3/tcp/4001/ipfs/%s/", peer_id);
+	orig = multiaddress_new_from_string(full_string);
+	if (orig == NULL)
+		goto exit;
+	result = multiaddress_new_from_bytes(orig->bytes, orig->bsize);
+	if (result == NULL)
+		goto exit;
+	// nothing is formatted until it is asked for
+	if (result->string != NULL)
+		goto exit;
+	if (result->component_count != 3 || result->components[0].code != 4 || result->components[1].code != 6 || result->components[2].code != 42)
+		goto exit;
+	if (multiaddress_find_component(result, 42)->size != 34 || multiaddress_find_component(result, 17) != NULL)
+		goto exit;
+	if (multiaddress_get_ip_port(result) != 4001)
+		goto exit;
+	const struct sockaddr_in* in4 = (const struct sockaddr_in*)multiaddress_get_sockaddr(result, &size);
+	if (in4 == NULL || size != sizeof(struct sockaddr_in) || in4->sin_family != AF_INET)
+		goto exit;
+	if (ntohs(in4->sin_port) != 4001 || ntohl(in4->sin_addr.s_addr) != 0x0a010203)
+		goto exit;
+	if (!multiaddress_get_ip_address(result, &ip) || strcmp(ip, "10.1.2.3") != 0)
+		goto exit;
+	id = multiaddress_get_peer_id(result);
+	if (id == NULL || strcmp(id, peer_id) != 0)
+		goto exit;
+	if (strcmp(multiaddress_to_string(result), full_string) != 0) {
+		fprintf(stderr, "%s does not equal %s\n", full_string, multiaddress_to_string(result));
+		goto exit;
+	}
+
+	// a copy keeps the components
+	copy = multiaddress_copy(result);
+	if (copy == NULL || multiaddress_get_ip_port(copy) != 4001 || strcmp(multiaddress_to_string(copy), full_string) != 0)
+		goto exit;
+	multiaddress_free(copy);
+
+	// ip6 comes in as bytes
+	uint8_t ip6[] = { 0x29, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0x06, 0x0f, 0xa1 };
+	copy = multiaddress_new_from_bytes(ip6, sizeof(ip6));
+	if (copy == NULL || !multiaddress_is_ip6(copy) || multiaddress_get_ip_port(copy) != 4001)
+		goto exit;
+	if (multiaddress_get_sockaddr(copy, &size) == NULL || size != sizeof(struct sockaddr_in6))
+		goto exit;
+	if (strcmp(multiaddress_to_string(copy), "/ip6/::1/tcp/4001/") != 0)
+		goto exit;
+
+	// truncated values and unknown protocols are refused
+	uint8_t truncated[] = { 0x04, 10, 1 };
+	bad = multiaddress_new_from_bytes(truncated, sizeof(truncated));
+	if (bad != NULL)
+		goto exit;
+	uint8_t unknown[] = { 0x07, 0, 0 };
+	bad = multiaddress_new_from_bytes(unknown, sizeof(unknown));
+	if (bad != NULL)
+		goto exit;
+
+	retVal = 1;
+	exit:
+	multiaddress_free(orig);
+	multiaddress_free(result);
+	multiaddress_free(copy);
+	multiaddress_free(bad);
+	free(ip);
+	free(id);
+	return retVal;
+}
+
+int test_multiaddr_protocols() {
+	int retVal = 0;
+	const char* names[] = { "ip4", "ip6", "tcp", "udp", "dccp", "sctp", "udt", "utp", "ipfs", "http", "https", "ws", "onion", "libp2p-webrtc-star" };
+	int codes[] = { 4, 41, 6, 17, 33, 132, 301, 302, 42, 480, 443, 477, 444, 275 };
+	uint8_t* bytes = NULL;
+	size_t bytes_size = 0;
+	char* string = NULL;
+
+	// every protocol is found both ways
+	for(int i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+		const struct Protocol* by_name = proto_with_name(names[i], strlen(names[i]));
+		if (by_name == NULL || by_name != proto_with_code(codes[i]) || by_name->deccode != codes[i]) {
+			fprintf(stderr, "Protocol %s not found\n", names[i]);
+			goto exit;
+		}
+	}
+	// and nothing else is
+	if (proto_with_name("tc", 2) != NULL || proto_with_name("tcpx", 4) != NULL || proto_with_name("", 0) != NULL)
+		goto exit;
+	if (proto_with_code(0) != NULL || proto_with_code(-1) != NULL || proto_with_code(481) != NULL || proto_with_code(100000) != NULL)
+		goto exit;
+	// names need not end where the string does
+	if (proto_with_name("tcp/4001", 3) != proto_with_code(6))
+		goto exit;
+
+	// codes of 128 and over are varints
+	if (!string_to_bytes(&bytes, &bytes_size, "/ip6/::1/sctp/5000/", 19))
+		goto exit;
+	if (bytes_size != 21 || bytes[17] != 0x84 || bytes[18] != 0x01)
+		goto exit;
+	if (!bytes_to_string(&string, bytes, bytes_size) || strcmp(string, "/ip6/::1/sctp/5000/") != 0)
+		goto exit;
+	free(bytes);
+	bytes = NULL;
+
+	// bad values are refused
+	if (string_to_bytes(&bytes, &bytes_size, "/ip4/1.2.3/", 11)
+			|| string_to_bytes(&bytes, &bytes_size, "/ip4/1.2.3.4/tcp/65536/", 23)
+			|| string_to_bytes(&bytes, &bytes_size, "/ip4/1.2.3.4/tcp/", 17)
+			|| string_to_bytes(&bytes, &bytes_size, "/ip4/1.2.3.4/xyz/1/", 19)
+			|| string_to_bytes(&bytes, &bytes_size, "/ipfs/0OIl/", 11)
+			|| string_to_bytes(&bytes, &bytes_size, "ip4/1.2.3.4/", 12))
+		goto exit;
+
+	retVal = 1;
+	exit:
+	free(bytes);
+	free(string);
+	return retVal;
+}
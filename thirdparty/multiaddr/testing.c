@@ -1,6 +1,10 @@
 #include <stdio.h>
+#include <time.h>
 
 #include "test_multiaddr.h"
+#include "multiaddr/protoutils.h"
+
+#define BENCH_ROUNDS 100000
 
 const char* names[] = {
 		"test_new_from_string",
@@ -10,7 +14,9 @@ const char* names[] = {
 		"test_multiaddr_utils",
 		"test_multiaddr_peer_id",
 		"test_multiaddr_get_peer_id",
-		"test_multiaddr_bytes"
+		"test_multiaddr_bytes",
+		"test_multiaddr_components",
+		"test_multiaddr_protocols"
 };
 
 int (*funcs[])(void) = {
@@ -21,7 +27,9 @@ int (*funcs[])(void) = {
 		test_multiaddr_utils,
 		test_multiaddr_peer_id,
 		test_multiaddr_get_peer_id,
-		test_multiaddr_bytes
+		test_multiaddr_bytes,
+		test_multiaddr_components,
+		test_multiaddr_protocols
 };
 
 int testit(const char* name, int (*func)(void)) {
@@ -34,11 +42,87 @@ int testit(const char* name, int (*func)(void)) {
 	return retVal;
 }
 
+static void bench_report(const char* what, clock_t start) {
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-28s %10.0f per second\n", what, BENCH_ROUNDS / seconds);
+}
+
+/***
+ * How fast a MultiAddress is parsed and formatted. Run it with "bench",
+ * as its output is numbers rather than pass/fail.
+ */
+int bench_multiaddr() {
+	const char* address = "/ip4/10.1.2.3/tcp/4001/ipfs/QmYwAPJzv5CZsnA625s3Xf2nemtYgPpHdWEz79ojWnPbdG/";
+	struct MultiAddress* orig = multiaddress_new_from_string(address);
+	if (orig == NULL)
+		return 0;
+	clock_t start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++)
+		multiaddress_free(multiaddress_new_from_string(address));
+	bench_report("parse string", start);
+
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++)
+		multiaddress_free(multiaddress_new_from_bytes(orig->bytes, orig->bsize));
+	bench_report("parse bytes", start);
+
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++) {
+		struct MultiAddress* ma = multiaddress_new_from_bytes(orig->bytes, orig->bsize);
+		multiaddress_to_string(ma);
+		multiaddress_free(ma);
+	}
+	bench_report("parse bytes and format", start);
+
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++) {
+		char* string = NULL;
+		bytes_to_string(&string, orig->bytes, orig->bsize);
+		free(string);
+	}
+	bench_report("bytes to string", start);
+
+	// without the base58 of the peer id, which is most of the cost above
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++) {
+		uint8_t* bytes = NULL;
+		size_t bytes_size = 0;
+		string_to_bytes(&bytes, &bytes_size, "/ip4/10.1.2.3/tcp/4001/", 24);
+		free(bytes);
+	}
+	bench_report("string to bytes, no peer id", start);
+
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++) {
+		if (proto_with_name("tcp", 3) == NULL || proto_with_code(42) == NULL)
+			i = BENCH_ROUNDS;
+	}
+	bench_report("protocol by name and code", start);
+
+	// what a dial asks for
+	start = clock();
+	for(int i = 0; i < BENCH_ROUNDS; i++) {
+		char* ip = NULL;
+		multiaddress_get_ip_address(orig, &ip);
+		char* id = multiaddress_get_peer_id(orig);
+		if (multiaddress_get_ip_port(orig) != 4001)
+			i = BENCH_ROUNDS;
+		free(ip);
+		free(id);
+	}
+	bench_report("ip, port and peer id", start);
+
+	multiaddress_free(orig);
+	return 1;
+}
+
 int main(int argc, char** argv) {
 	int counter = 0;
 	int tests_ran = 0;
 	char* test_wanted;
 	int only_one = 0;
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return !bench_multiaddr();
 	if(argc > 1) {
 		only_one = 1;
 		if (argv[1][0] == '\'') { // some shells put quotes around arguments
@@ -9,23 +9,36 @@
 
 int protobuf_encode_length_delimited(int field_number, enum WireType field_type, const char* incoming, size_t incoming_length,
 		unsigned char* buffer, size_t max_buffer_length, size_t* bytes_written)
+{
+	// field type & number, then field size
+	if (!protobuf_encode_length_delimited_header(field_number, field_type, incoming_length, buffer, max_buffer_length, bytes_written))
+		return 0;
+	// field value
+	if (incoming_length > max_buffer_length - *bytes_written)
+		return 0;
+	if (incoming_length > 0) {
+		memcpy(&buffer[*bytes_written], incoming, incoming_length);
+		*bytes_written += incoming_length;
+	}
+	return 1;
+}
+
+int protobuf_encode_length_delimited_header(int field_number, enum WireType field_type, size_t incoming_length,
+		unsigned char* buffer, size_t max_buffer_length, size_t* bytes_written)
 {
 	// push the field number and wire type together
 	unsigned int field_no = field_number << 3;
 	unsigned long long field = field_no | field_type;
 	size_t bytes_processed = 0;
 	*bytes_written = 0;
+	if (protobuf_varint_size(field) + protobuf_varint_size(incoming_length) > max_buffer_length)
+		return 0;
 	// field type & number
 	varint_encode(field, buffer, max_buffer_length, &bytes_processed);
 	*bytes_written += bytes_processed;
 	// field size
 	varint_encode(incoming_length, &buffer[*bytes_written], max_buffer_length - *bytes_written, &bytes_processed);
 	*bytes_written += bytes_processed;
-	// field value
-	if (incoming_length > 0) {
-		memcpy(&buffer[*bytes_written], incoming, incoming_length);
-		*bytes_written += incoming_length;
-	}
 	return 1;
 }
 
@@ -87,6 +100,8 @@ int protobuf_encode_varint(int field_number, enum WireType field_type, unsigned
 	unsigned int field_no = field_number << 3;
 	unsigned long long field = field_no | field_type;
 	size_t bytes_processed;
+	if (protobuf_varint_size(field) + protobuf_varint_size(incoming) > max_buffer_length)
+		return 0;
 	// field type & number
 	varint_encode(field, buffer, max_buffer_length, &bytes_processed);
 	*bytes_written += bytes_processed;
@@ -20,6 +20,41 @@ enum WireType {
 	WIRETYPE_32BIT
 };
 
+/***
+ * The number of bytes a value takes as a varint. The size functions are
+ * inline, as encoders call them for every field of every nested message.
+ * @param incoming the value
+ * @returns the number of bytes
+ */
+static inline size_t protobuf_varint_size(unsigned long long incoming) {
+	size_t size = 1;
+	while (incoming >= 0x80) {
+		incoming >>= 7;
+		size++;
+	}
+	return size;
+}
+
+/***
+ * The exact number of bytes protobuf_encode_length_delimited will write
+ * @param field_number the field number
+ * @param incoming_length the length of the value
+ * @returns the number of bytes
+ */
+static inline size_t protobuf_encode_length_delimited_size(int field_number, size_t incoming_length) {
+	return protobuf_varint_size((field_number << 3) | WIRETYPE_LENGTH_DELIMITED) + protobuf_varint_size(incoming_length) + incoming_length;
+}
+
+/***
+ * The exact number of bytes protobuf_encode_varint will write
+ * @param field_number the field number
+ * @param incoming the value
+ * @returns the number of bytes
+ */
+static inline size_t protobuf_encode_varint_size(int field_number, unsigned long long incoming) {
+	return protobuf_varint_size((field_number << 3) | WIRETYPE_VARINT) + protobuf_varint_size(incoming);
+}
+
 /***
  * Encode a length delimited field into the buffer
  * @param field_number the field number
@@ -29,11 +64,26 @@ enum WireType {
  * @param buffer the pointer to where to place the encoded value
  * @param max_buffer_length the buffer length remaining
  * @param bytes_written the number of bytes written
- * @returns true(1) on success
+ * @returns true(1) on success, false(0) if the buffer is too small
  */
 int protobuf_encode_length_delimited(int field_number, enum WireType wire_type, const char* incoming, size_t incoming_length,
 		unsigned char* buffer, size_t max_buffer_size, size_t* bytes_written);
 
+/***
+ * Encode the field number, wire type and length of a length delimited field,
+ * but not its value. The caller writes the value right after, which lets a
+ * nested message be encoded in place.
+ * @param field_number the field number
+ * @param wire_type the wire type
+ * @param incoming_length the length of the value that will follow
+ * @param buffer the pointer to where to place the encoded value
+ * @param max_buffer_length the buffer length remaining
+ * @param bytes_written the number of bytes written
+ * @returns true(1) on success, false(0) if the buffer is too small
+ */
+int protobuf_encode_length_delimited_header(int field_number, enum WireType wire_type, size_t incoming_length,
+		unsigned char* buffer, size_t max_buffer_length, size_t* bytes_written);
+
 int protobuf_decode_length_delimited(const unsigned char* buffer, size_t buffer_length, char** results, size_t *results_length, size_t* bytes_read);
 
 /***